@@ -0,0 +1,292 @@
+/*
+ * Bit timing harness with a virtual Timer1.
+ *
+ * Drives both bit timing engines of the Deadline 5 firmware with the same
+ * bus edges and compares the sample and writing points they produce:
+ *   - the TQ-stepped engine, where incrementTq() runs bitTimingStateMachine()
+ *     on every time quantum;
+ *   - the event-driven engine, where Timer1's compare only fires at the next
+ *     sample or writing point and flagSync() moves those deadlines.
+ * The bus is driven by a remote node whose clock is off by the given drift,
+ * with jitter on every edge. Dominant edges after 11 recessive bits hard
+ * sync, the others resynchronise.
+ *
+ * The TQ-stepped engine is the firmware's, from can_bit_timing.h. The
+ * event-driven one below is copied from CANController1.ino, with TCNT1 and
+ * OCR1A as plain variables.
+ *
+ * Build: gcc -O2 -o BitTimingHarness BitTimingHarness.c
+ * Usage: BitTimingHarness [bits] [drift ppm] [seed]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "can_bit_timing.h"
+
+// Bit length (time quanta) of bitTiming's power-up timing.
+#define BIT_LEN (SYNC_SEG_LEN + 1 + 7 + 7)
+#define BAUD_RATE 1
+#define TQ 1000000.0/(BAUD_RATE*BIT_LEN)
+
+#define F_CPU 16000000L
+#define TIMER1_PRESCALER 1024
+#define TQ_TICKS ((uint16_t)((TQ) * (F_CPU / TIMER1_PRESCALER) / 1000000.0 + 0.5))
+
+#define SAMPLE_POINT_EVENT  0
+#define WRITING_POINT_EVENT 1
+
+#define DEFAULT_BIT_COUNT 100000
+#define DEFAULT_DRIFT_PPM 3000
+#define JITTER_TICKS      (TQ_TICKS / 4)
+#define MAX_EVENTS        (4 * DEFAULT_BIT_COUNT)
+
+// Sample ('S') or writing ('W') point on a TQ tick.
+struct TimingEvent {
+    char type;
+    uint32_t tq;
+};
+
+struct Edge {
+    uint64_t time;  // Timer ticks.
+    bool hard;
+};
+
+/******** Event-driven engine state ********/
+volatile uint32_t lastEventTq = 0;
+volatile uint32_t ps1StartTq  = 0;
+volatile uint32_t sampleTq    = 0;
+volatile uint32_t writeTq     = 0;
+volatile unsigned char nextEvent = SAMPLE_POINT_EVENT;
+
+uint16_t TCNT1, OCR1A;
+
+void resetFirmwareState() {
+    resetBitTiming();
+    lastEventTq = ps1StartTq = sampleTq = writeTq = 0;
+    nextEvent = SAMPLE_POINT_EVENT;
+    TCNT1 = OCR1A = 0;
+}
+
+/******** Event-driven engine ********/
+void scheduleBitTimingEvent(unsigned char event, uint32_t tq) {
+    nextEvent = event;
+    OCR1A = (uint16_t)(tq * TQ_TICKS);
+}
+
+uint32_t edgeTq() {
+    uint16_t elapsed = TCNT1 - (uint16_t)(lastEventTq * TQ_TICKS);
+    return lastEventTq + elapsed / TQ_TICKS + 1;
+}
+
+void startBitTimer() {
+    TCNT1 = 0;
+    lastEventTq = 0;
+    ps1StartTq  = bitTiming.propSeg;
+    sampleTq    = ps1StartTq + phaseSeg1Len;
+    currentSegment = PROP_SEG;
+    scheduleBitTimingEvent(SAMPLE_POINT_EVENT, sampleTq);
+}
+
+void bitTimingEvent() {
+    restoreSegsDefaultLen();
+    tqSegCnt = 0;
+    if (nextEvent == SAMPLE_POINT_EVENT) {
+        lastEventTq = sampleTq;
+        samplePoint  = true;
+        writingPoint = false;
+        currentSegment = PHASE_SEG2;
+        writeTq = sampleTq + phaseSeg2Len;
+        scheduleBitTimingEvent(WRITING_POINT_EVENT, writeTq);
+    } else {
+        lastEventTq = writeTq;
+        samplePoint  = false;
+        writingPoint = true;
+        currentSegment = SYNC_SEG;
+        ps1StartTq = writeTq + SYNC_SEG_LEN + bitTiming.propSeg;
+        sampleTq = ps1StartTq + phaseSeg1Len;
+        scheduleBitTimingEvent(SAMPLE_POINT_EVENT, sampleTq);
+    }
+    advanceStateMachine = true;
+}
+
+void bitTimingEdge(bool hard, uint32_t t) {
+    uint32_t cnt;
+    if (hard) {
+        writingPoint = false;
+        currentSegment = PROP_SEG;
+        ps1StartTq = t + bitTiming.propSeg;
+        sampleTq = ps1StartTq + phaseSeg1Len;
+        scheduleBitTimingEvent(SAMPLE_POINT_EVENT, sampleTq);
+    } else if (nextEvent == SAMPLE_POINT_EVENT) {
+        if ((int32_t)(t - (ps1StartTq - bitTiming.propSeg)) <= 0) return;
+        if ((int32_t)(t - ps1StartTq) <= 0) {
+            // In PROP_SEG.
+            cnt = t - (ps1StartTq - bitTiming.propSeg);
+            phaseError = min(cnt + SYNC_SEG_LEN, bitTiming.propSeg);
+        } else {
+            cnt = t - ps1StartTq;
+            phaseError = cnt + bitTiming.propSeg + SYNC_SEG_LEN;
+        }
+        phaseSeg1Len = bitTiming.phaseSeg1 + ((phaseError <= bitTiming.sjw) ? phaseError : bitTiming.sjw);
+        sampleTq = ps1StartTq + phaseSeg1Len;
+        scheduleBitTimingEvent(SAMPLE_POINT_EVENT, sampleTq);
+    } else {
+        phaseError = bitTiming.phaseSeg2 - (t - sampleTq);
+        phaseSeg2Len = bitTiming.phaseSeg2 - ((phaseError <= bitTiming.sjw) ? phaseError : bitTiming.sjw);
+        writeTq = sampleTq + phaseSeg2Len;
+        scheduleBitTimingEvent(WRITING_POINT_EVENT, writeTq);
+    }
+}
+
+/******** Bus stimulus ********/
+// Dominant edges of a remote transmitter running at (1 + drift) times the
+// nominal bit time: frames of random, stuffed bits between idle gaps.
+int generateEdges(struct Edge *edges, int maxEdges, unsigned long bits, long driftPpm, uint64_t *end) {
+    double bitTicks = (double)BIT_LEN * TQ_TICKS * (1.0 + driftPpm / 1e6);
+    double t = 3.5 * bitTicks; // Start bus idle, off the TQ grid.
+    unsigned long n;
+    int count = 0, recessiveRun = 11, sameRun = 0, frameLeft = 0;
+    unsigned char level = 1, previous = 1;
+    uint64_t time;
+
+    for (n = 0; n < bits; n++) {
+        if (frameLeft == 0) {
+            // Idle gap, then a frame of 40..130 bits.
+            level = 1;
+            if (rand() % 4 == 0 || recessiveRun < 11) frameLeft = -(11 + rand() % 20);
+            else frameLeft = 40 + rand() % 90;
+        }
+        if (frameLeft < 0) {
+            level = 1;
+            frameLeft++;
+        } else {
+            if (recessiveRun >= 11) level = 0; // SOF.
+            else if (sameRun == 5) level = !previous; // Stuff bit.
+            else level = rand() & 1;
+            frameLeft--;
+        }
+        if (level == 0 && previous == 1) {
+            time = (uint64_t)(t + (rand() % (2 * JITTER_TICKS + 1)) - JITTER_TICKS);
+            if (time % TQ_TICKS == 0) time++; // Keep edges off the TQ ticks.
+            if (count < maxEdges && (count == 0 || time > edges[count - 1].time)) {
+                edges[count].time = time;
+                edges[count].hard = recessiveRun >= 11;
+                count++;
+            }
+        }
+        sameRun = level == previous ? sameRun + 1 : 1;
+        recessiveRun = level ? recessiveRun + 1 : 0;
+        previous = level;
+        t += bitTicks;
+    }
+    *end = (uint64_t)t;
+    return count;
+}
+
+void recordEvent(struct TimingEvent *events, int *count, char type, uint32_t tq) {
+    if (*count < MAX_EVENTS) {
+        events[*count].type = type;
+        events[*count].tq = tq;
+    }
+    (*count)++;
+}
+
+// One timer interrupt per TQ; flagSync() only raises the flags.
+int runSteppedEngine(const struct Edge *edges, int edgeCnt, uint64_t end, struct TimingEvent *events, unsigned long *interrupts) {
+    uint64_t tick;
+    int e = 0, count = 0;
+
+    resetFirmwareState();
+    *interrupts = 0;
+    for (tick = 1; tick * TQ_TICKS < end; tick++) {
+        for (; e < edgeCnt && edges[e].time < tick * TQ_TICKS; e++) {
+            if (edges[e].hard) hardSyncBool = true;
+            else resyncBool = true;
+        }
+        incrementTq();
+        (*interrupts)++;
+        if (samplePoint && currentSegment == PHASE_SEG2 && tqSegCnt == 0) recordEvent(events, &count, 'S', (uint32_t)tick);
+        if (writingPoint && currentSegment == SYNC_SEG && tqSegCnt == 0) recordEvent(events, &count, 'W', (uint32_t)tick);
+    }
+    return count;
+}
+
+// Compare interrupts at the programmed deadlines, edge interrupts in between.
+int runEventEngine(const struct Edge *edges, int edgeCnt, uint64_t end, struct TimingEvent *events, unsigned long *interrupts) {
+    uint64_t now = 0, compare;
+    uint16_t delta;
+    int e = 0, count = 0;
+
+    resetFirmwareState();
+    *interrupts = 0;
+    startBitTimer();
+    for (;;) {
+        delta = (uint16_t)(OCR1A - (uint16_t)now);
+        compare = now + (delta ? delta : 65536);
+        if (e < edgeCnt && edges[e].time < compare) {
+            now = edges[e].time;
+            TCNT1 = (uint16_t)now;
+            bitTimingEdge(edges[e].hard, edgeTq());
+            e++;
+        } else {
+            if (compare >= end) break;
+            now = compare;
+            TCNT1 = (uint16_t)now;
+            bitTimingEvent();
+            (*interrupts)++;
+            recordEvent(events, &count, samplePoint ? 'S' : 'W', (uint32_t)(now / TQ_TICKS));
+        }
+    }
+    return count;
+}
+
+int main(int argc, char *argv[]) {
+    unsigned long bits = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_BIT_COUNT;
+    long driftPpm = argc > 2 ? atol(argv[2]) : DEFAULT_DRIFT_PPM;
+    unsigned int seed = argc > 3 ? (unsigned int)atoi(argv[3]) : 1;
+    struct TimingEvent *stepped, *evented;
+    struct Edge *edges;
+    unsigned long steppedInterrupts, eventInterrupts;
+    int edgeCnt, hardCnt = 0, steppedCnt, eventCnt, i, mismatches = 0;
+    uint64_t end;
+
+    if (bits > DEFAULT_BIT_COUNT) bits = DEFAULT_BIT_COUNT;
+    edges = malloc(bits * sizeof(*edges));
+    stepped = malloc(MAX_EVENTS * sizeof(*stepped));
+    evented = malloc(MAX_EVENTS * sizeof(*evented));
+    if (edges == NULL || stepped == NULL || evented == NULL) {
+        printf("Out of memory.\n");
+        return 1;
+    }
+    srand(seed);
+    edgeCnt = generateEdges(edges, (int)bits, bits, driftPpm, &end);
+    for (i = 0; i < edgeCnt; i++) hardCnt += edges[i].hard;
+
+    steppedCnt = runSteppedEngine(edges, edgeCnt, end, stepped, &steppedInterrupts);
+    eventCnt = runEventEngine(edges, edgeCnt, end, evented, &eventInterrupts);
+
+    for (i = 0; i < steppedCnt && i < eventCnt && i < MAX_EVENTS; i++) {
+        if (stepped[i].type != evented[i].type || stepped[i].tq != evented[i].tq) {
+            if (mismatches == 0) {
+                printf("First mismatch at event %d: TQ-stepped %c@%lu, event-driven %c@%lu\n", i,
+                       stepped[i].type, (unsigned long)stepped[i].tq, evented[i].type, (unsigned long)evented[i].tq);
+            }
+            mismatches++;
+        }
+    }
+    mismatches += abs(steppedCnt - eventCnt);
+
+    printf("Bus: %lu bits, %d edges (%d hard sync), drift %ld ppm, TQ = %u timer ticks\n",
+           bits, edgeCnt, hardCnt, driftPpm, (unsigned)TQ_TICKS);
+    printf("%-14s %10s %12s %14s\n", "Engine", "Events", "Timer IRQs", "IRQs per bit");
+    printf("%-14s %10d %12lu %14.2f\n", "TQ-stepped", steppedCnt, steppedInterrupts, (double)steppedInterrupts / bits);
+    printf("%-14s %10d %12lu %14.2f\n", "Event-driven", eventCnt, eventInterrupts, (double)eventInterrupts / bits);
+    printf("Mismatching sample/writing points: %d\n", mismatches);
+
+    free(edges);
+    free(stepped);
+    free(evented);
+    return mismatches != 0;
+}
@@ -0,0 +1,575 @@
+/*
+ * Multi-node CAN bus simulator.
+ *
+ * Runs N controllers on one simulated wired-AND bus (a dominant 0 from any
+ * node wins), one bus bit per step and as fast as the CPU allows. Every node
+ * shifts out a pre-stuffed TxStream (can_frame.h), compares each bit it
+ * writes with the bus level for arbitration and bit errors, destuffs and
+ * checks what it receives, drives the ACK slot and signals errors with
+ * active error frames (6 dominant flag bits, 8 recessive delimiter bits).
+ * A transmitter that loses arbitration or hits an error retries its frame.
+ *
+ * Nodes are scripted with the Deadline 7 LED ring: a node reacts to frames
+ * from its predecessor and from any generator node (node X). If its LED is
+ * on it sends 01 (LED off) to the next node, otherwise 02 (LED on), and then
+ * applies the received command to its own LED.
+ *
+ * Script lines (default: the Deadline 7 message map):
+ *   name id[r] predecessor on|off [period data]
+ * The optional period makes the node a generator that sends data every
+ * period bit-times (0 = once, at the start of the simulation). An id ending
+ * in r makes the node send remote frames instead of data frames.
+ *
+ * -c srr and -c ide run an extended frame against a standard one with the
+ * same base identifier, both sent at bit 0: the extended frame loses at its
+ * SRR bit to a standard data frame, or at its IDE bit to a standard remote
+ * frame. Both frames must be received without errors.
+ *
+ * Build: gcc -O2 -o BusSimulator BusSimulator.c
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "can_frame.h"
+#include "can_record.h"
+
+/********** Node states ***********/
+#define NODE_IDLE             0
+#define NODE_FRAME            1 // SOF up to the end of the CRC (stuffed).
+#define NODE_FRAME_TAIL       2 // CRC delimiter, ACK and EOF.
+#define NODE_ERROR_FLAG       3
+#define NODE_ERROR_DELIMITER  4
+#define NODE_INTERMISSION     5
+/**********************************/
+
+/******** Frame layout ************/
+#define FRAME_TAIL_BITS       10 // CRC delimiter, ACK slot, ACK delimiter, 7 EOF bits.
+#define ERROR_FLAG_BITS       6
+#define ERROR_DELIMITER_BITS  8
+#define INTERMISSION_BITS     3
+/**********************************/
+
+/********* LED commands ***********/
+#define LED_OFF               0x01
+#define LED_ON                0x02
+/**********************************/
+
+#define MAX_NODES             16
+#define TX_QUEUE_DEPTH        4
+#define DEFAULT_BIT_COUNT     10000000ULL
+
+struct Node {
+    char name[16];
+    uint32_t id;
+    unsigned char extended;
+    unsigned char remote;
+    int predecessor;             // Node index, -1 for none.
+    unsigned char led;
+    unsigned char isGenerator;
+    unsigned long period;        // Generator: bit-times between frames, 0 = once.
+    uint8_t generatorData;
+
+    // Transmit queue; frames are compiled when queued.
+    struct Frame queue[TX_QUEUE_DEPTH];
+    struct TxStream txStream[TX_QUEUE_DEPTH];
+    unsigned long long queuedAt[TX_QUEUE_DEPTH];
+    unsigned char queueHead;
+    unsigned char queueCount;
+    unsigned char isTransmitter;
+    unsigned char txIndex;
+    unsigned long long txStartBitTime;
+    unsigned char writingBit;
+
+    // Receiver.
+    unsigned char state;
+    unsigned char previousBit;
+    unsigned char samePolarityBitCnt;
+    uint8_t rxBits[(FRAME_CRC_FIELD_MAX_BITS + 15 + 7) / 8]; // Destuffed SOF..CRC.
+    unsigned char rxLen;
+    unsigned char rxExpected;
+    unsigned char stateBitCnt;
+    unsigned char crcOk;
+
+    // Statistics.
+    unsigned long sent;
+    unsigned long received;
+    unsigned long dropped;
+    unsigned long arbitrationLost;
+    unsigned long errors[ERROR_TYPE_ACK + 1];
+    unsigned long long latencySum;
+    unsigned long long latencyMax;
+};
+
+const char *defaultScript[] = {
+    "A 0x301      D off",
+    "B 0x10000000 A off",
+    "C 0x302      B off",
+    "D 0x10000001 C off",
+    "X 0x10000003 - off 0 02",
+};
+
+// Lost at the SRR bit: 0x123 sends a dominant RTR there.
+const char *srrCaseScript[] = {
+    "S 0x123     - off 0 02",
+    "E 0x48C0155 - off 0 02",
+};
+
+// Lost at the IDE bit: 0x123 is a remote frame, its recessive RTR meets the SRR.
+const char *ideCaseScript[] = {
+    "S 0x123r    - off 0 02",
+    "E 0x48C0155 - off 0 02",
+};
+
+struct Node nodes[MAX_NODES];
+int nodeCnt = 0;
+
+unsigned long long bitTime = 0;
+unsigned long long busyBits = 0;
+unsigned long long framesOnBus = 0;
+double noiseProbability = 0;
+uint64_t rngState = 1;
+unsigned long bitrate = 500000;
+unsigned char verbose = 0;
+
+const char *errorTypeNames[] = {"none", "bit", "stuff", "crc", "form", "ack"};
+
+uint64_t nextRandom() {
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 7;
+    rngState ^= rngState << 17;
+    return rngState;
+}
+
+double wallClockSeconds() {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/********** Script **********/
+int findNode(const char *name) {
+    int i;
+    for (i = 0; i < nodeCnt; i++) {
+        if (strcmp(nodes[i].name, name) == 0) return i;
+    }
+    return -1;
+}
+
+// Parse one script line into a new node. Returns 0 on success, 1 for blank
+// lines and comments, -1 on errors.
+int parseScriptLine(const char *line, char predecessors[][16]) {
+    struct Node *n;
+    char name[16], led[8], idText[16], *end;
+    unsigned long id, period, data;
+    int fields;
+
+    while (*line == ' ' || *line == '\t') line++;
+    if (*line == '#' || *line == '\n' || *line == '\r' || *line == '\0') return 1;
+    if (nodeCnt == MAX_NODES) {
+        printf("Script error: more than %d nodes.\n", MAX_NODES);
+        return -1;
+    }
+
+    n = &nodes[nodeCnt];
+    memset(n, 0, sizeof(*n));
+    fields = sscanf(line, "%15s %15s %15s %7s %lu %lx", name, idText, predecessors[nodeCnt], led, &period, &data);
+    id = strtoul(idText, &end, 0);
+    if ((fields != 4 && fields != 6) || end == idText || (*end != '\0' && strcmp(end, "r") != 0)) {
+        printf("Script error: invalid line \"%s\".\n", line);
+        return -1;
+    }
+    strcpy(n->name, name);
+    n->id = (uint32_t)id & FRAME_ID_MASK;
+    n->extended = id > 0x7FF;
+    n->remote = *end == 'r';
+    n->led = strcmp(led, "on") == 0;
+    n->isGenerator = fields == 6;
+    n->period = n->isGenerator ? period : 0;
+    n->generatorData = n->isGenerator ? (uint8_t)data : 0;
+    n->state = NODE_IDLE;
+    nodeCnt++;
+    return 0;
+}
+
+// Load the script file at path, or the built-in script when path is NULL.
+int loadScript(const char *path, const char **script, int lineCnt) {
+    char line[256];
+    char predecessors[MAX_NODES][16];
+    FILE *fp;
+    int i;
+
+    if (path == NULL) {
+        for (i = 0; i < lineCnt; i++) {
+            if (parseScriptLine(script[i], predecessors) < 0) return -1;
+        }
+    } else {
+        fp = fopen(path, "r");
+        if (fp == NULL) {
+            printf("Error while opening the script.\n");
+            return -1;
+        }
+        while (fgets(line, sizeof(line), fp) != NULL) {
+            if (parseScriptLine(line, predecessors) < 0) {
+                fclose(fp);
+                return -1;
+            }
+        }
+        fclose(fp);
+    }
+
+    for (i = 0; i < nodeCnt; i++) {
+        nodes[i].predecessor = strcmp(predecessors[i], "-") == 0 ? -1 : findNode(predecessors[i]);
+        if (strcmp(predecessors[i], "-") != 0 && nodes[i].predecessor < 0) {
+            printf("Script error: unknown predecessor \"%s\".\n", predecessors[i]);
+            return -1;
+        }
+    }
+    if (nodeCnt < 2) {
+        printf("Script error: at least two nodes are needed.\n");
+        return -1;
+    }
+    return 0;
+}
+/****************************/
+
+/******* Application ********/
+void queueFrame(struct Node *n, uint8_t data) {
+    unsigned char slot;
+    struct Frame *f;
+
+    if (n->queueCount == TX_QUEUE_DEPTH) {
+        n->dropped++;
+        return;
+    }
+    slot = (n->queueHead + n->queueCount) % TX_QUEUE_DEPTH;
+    f = &n->queue[slot];
+    memset(f, 0, sizeof(*f));
+    f->id = n->id;
+    f->flags = n->extended ? FRAME_FLAG_IDE | FRAME_FLAG_SRR : 0;
+    frameSetFlag(f, FRAME_FLAG_RTR, n->remote);
+    f->dlc = 1;
+    if (!n->remote) f->data[0] = data;
+    frameCompile(f, &n->txStream[slot]);
+    n->queuedAt[slot] = bitTime;
+    n->queueCount++;
+}
+
+unsigned char isSender(const struct Node *sender, const struct Frame *f) {
+    return sender->id == f->id && sender->extended == frameIsExtended(f);
+}
+
+// LED ring logic: react to the predecessor and to the generators.
+void applicationReceive(struct Node *n, const struct Frame *f) {
+    int i;
+    unsigned char accepted = n->predecessor >= 0 && isSender(&nodes[n->predecessor], f);
+
+    for (i = 0; i < nodeCnt && !accepted; i++) {
+        accepted = nodes[i].isGenerator && &nodes[i] != n && isSender(&nodes[i], f);
+    }
+    if (!accepted || frameDataLength(f) < 1) return;
+    if (f->data[0] != LED_OFF && f->data[0] != LED_ON) return;
+
+    if (!n->isGenerator) queueFrame(n, n->led ? LED_OFF : LED_ON);
+    n->led = f->data[0] == LED_ON;
+}
+
+void applicationTick(struct Node *n) {
+    if (!n->isGenerator) return;
+    if (bitTime == 0 || (n->period > 0 && bitTime % n->period == 0)) queueFrame(n, n->generatorData);
+}
+/****************************/
+
+/********* Controller *******/
+static inline unsigned char rxBit(const struct Node *n, unsigned char i) {
+    return (n->rxBits[i >> 3] >> (7 - (i & 7))) & 1;
+}
+
+unsigned char rxField(const struct Node *n, unsigned char first, unsigned char len) {
+    unsigned char i, value = 0;
+    for (i = 0; i < len; i++) value = (value << 1) | rxBit(n, first + i);
+    return value;
+}
+
+// Rebuild the received frame from the destuffed bits.
+void rxToFrame(const struct Node *n, struct Frame *f) {
+    unsigned char i, dataStart;
+    memset(f, 0, sizeof(*f));
+    for (i = 1; i <= 11; i++) f->id = (f->id << 1) | rxBit(n, i);
+    if (rxBit(n, 13)) {
+        for (i = 14; i < 32; i++) f->id = (f->id << 1) | rxBit(n, i);
+        f->flags = FRAME_FLAG_IDE | FRAME_FLAG_SRR;
+        frameSetFlag(f, FRAME_FLAG_RTR, rxBit(n, 32));
+        f->dlc = rxField(n, 35, 4);
+        dataStart = 39;
+    } else {
+        frameSetFlag(f, FRAME_FLAG_RTR, rxBit(n, 12));
+        f->dlc = rxField(n, 15, 4);
+        dataStart = 19;
+    }
+    for (i = 0; i < frameDataLength(f); i++) f->data[i] = rxField(n, dataStart + 8 * i, 8);
+}
+
+void signalError(struct Node *n, unsigned char errorType) {
+    n->errors[errorType]++;
+    n->isTransmitter = 0; // The frame stays queued and is retransmitted.
+    n->state = NODE_ERROR_FLAG;
+    n->stateBitCnt = 0;
+}
+
+void startFrame(struct Node *n) {
+    n->state = NODE_FRAME;
+    n->rxLen = 0;
+    n->rxExpected = 0;
+    packBit(n->rxBits, n->rxLen++, 0);
+    n->previousBit = 0;
+    n->samePolarityBitCnt = 1;
+}
+
+void endFrame(struct Node *n) {
+    struct Frame f;
+    struct FrameRecord rec;
+    unsigned long long latency;
+
+    if (n->isTransmitter) {
+        latency = bitTime + 1 - n->queuedAt[n->queueHead];
+        n->latencySum += latency;
+        if (latency > n->latencyMax) n->latencyMax = latency;
+        n->sent++;
+        framesOnBus++;
+        if (verbose) {
+            recordFromFrame(&rec, &n->queue[n->queueHead], n->txStartBitTime, 1, ERROR_TYPE_NONE);
+            recordWriteCandump(stdout, &rec, bitrate, "vcan0");
+        }
+        n->queueHead = (n->queueHead + 1) % TX_QUEUE_DEPTH;
+        n->queueCount--;
+        n->isTransmitter = 0;
+    } else {
+        n->received++;
+        rxToFrame(n, &f);
+        applicationReceive(n, &f);
+    }
+    n->state = NODE_INTERMISSION;
+    n->stateBitCnt = 0;
+}
+
+// Bit the node drives at the writing point.
+unsigned char nodeWriteBit(struct Node *n) {
+    if (n->state == NODE_IDLE && !n->isTransmitter && n->queueCount > 0) {
+        n->isTransmitter = 1;
+        n->txIndex = 0;
+        n->txStartBitTime = bitTime;
+    }
+
+    if (n->state == NODE_ERROR_FLAG) n->writingBit = 0;
+    else if (n->isTransmitter) n->writingBit = txStreamBit(&n->txStream[n->queueHead], n->txIndex);
+    else if (n->state == NODE_FRAME_TAIL && n->stateBitCnt == 1 && n->crcOk) n->writingBit = 0; // ACK.
+    else n->writingBit = 1;
+    return n->writingBit;
+}
+
+// Transmitter checks: arbitration, bit monitoring and the ACK slot.
+// Returns 0 when an error was signalled.
+int monitorBit(struct Node *n, unsigned char bus) {
+    const struct TxStream *tx = &n->txStream[n->queueHead];
+
+    if (n->txIndex == tx->ackSlot) {
+        if (bus) {
+            signalError(n, ERROR_TYPE_ACK);
+            return 0;
+        }
+    } else if (bus != n->writingBit) {
+        if (n->writingBit && n->txIndex > 0 && n->txIndex < tx->arbitrationEnd) {
+            n->arbitrationLost++;
+            n->isTransmitter = 0;
+            return 1;
+        }
+        signalError(n, ERROR_TYPE_BIT);
+        return 0;
+    }
+    n->txIndex++;
+    return 1;
+}
+
+// Bit the node reads at the sample point.
+void nodeSampleBit(struct Node *n, unsigned char bus) {
+    unsigned char rtr, dlc, len;
+    uint16_t crc;
+
+    if (n->isTransmitter && !monitorBit(n, bus)) return;
+
+    switch (n->state) {
+        case NODE_IDLE:
+            if (bus == 0) startFrame(n);
+            break;
+        case NODE_FRAME:
+            if (n->samePolarityBitCnt == 5) {
+                if (bus == n->previousBit) {
+                    signalError(n, ERROR_TYPE_STUFF);
+                    break;
+                }
+                n->previousBit = bus;
+                n->samePolarityBitCnt = 1;
+            } else {
+                n->samePolarityBitCnt = bus == n->previousBit ? n->samePolarityBitCnt + 1 : 1;
+                n->previousBit = bus;
+                packBit(n->rxBits, n->rxLen++, bus);
+
+                if (n->rxLen == 19 && !rxBit(n, 13)) {
+                    rtr = rxBit(n, 12);
+                    dlc = rxField(n, 15, 4);
+                    len = rtr ? 0 : (dlc < FRAME_MAX_DLC ? dlc : FRAME_MAX_DLC);
+                    n->rxExpected = 19 + 8 * len + 15;
+                } else if (n->rxLen == 39 && rxBit(n, 13)) {
+                    rtr = rxBit(n, 32);
+                    dlc = rxField(n, 35, 4);
+                    len = rtr ? 0 : (dlc < FRAME_MAX_DLC ? dlc : FRAME_MAX_DLC);
+                    n->rxExpected = 39 + 8 * len + 15;
+                }
+                if (n->samePolarityBitCnt == 5) break; // A stuff bit follows.
+            }
+            if (n->rxLen == n->rxExpected) {
+                crc = crc15UpdateBits(0, n->rxBits, n->rxLen - 15);
+                n->crcOk = crc == ((uint16_t)rxField(n, n->rxLen - 15, 7) << 8 | rxField(n, n->rxLen - 8, 8));
+                n->state = NODE_FRAME_TAIL;
+                n->stateBitCnt = 0;
+            }
+            break;
+        case NODE_FRAME_TAIL:
+            if (n->stateBitCnt != 1 && bus == 0) {
+                signalError(n, ERROR_TYPE_FORM);
+                break;
+            }
+            if (n->stateBitCnt == 2 && !n->crcOk) {
+                signalError(n, ERROR_TYPE_CRC);
+                break;
+            }
+            if (++n->stateBitCnt == FRAME_TAIL_BITS) endFrame(n);
+            break;
+        case NODE_ERROR_FLAG:
+            if (++n->stateBitCnt == ERROR_FLAG_BITS) {
+                n->state = NODE_ERROR_DELIMITER;
+                n->stateBitCnt = 0;
+            }
+            break;
+        case NODE_ERROR_DELIMITER:
+            // Wait for the other nodes' flags to end, then 8 recessive bits.
+            n->stateBitCnt = bus ? n->stateBitCnt + 1 : 0;
+            if (n->stateBitCnt == ERROR_DELIMITER_BITS) {
+                n->state = NODE_INTERMISSION;
+                n->stateBitCnt = 0;
+            }
+            break;
+        case NODE_INTERMISSION:
+            if (bus == 0) {
+                // A dominant third bit is a SOF.
+                if (n->stateBitCnt == INTERMISSION_BITS - 1) startFrame(n);
+                else signalError(n, ERROR_TYPE_FORM);
+                break;
+            }
+            if (++n->stateBitCnt == INTERMISSION_BITS) n->state = NODE_IDLE;
+            break;
+    }
+}
+
+void simulateBit() {
+    int i;
+    unsigned char bus = 1, busy = 0;
+
+    for (i = 0; i < nodeCnt; i++) {
+        applicationTick(&nodes[i]);
+        bus &= nodeWriteBit(&nodes[i]);
+        busy |= nodes[i].state != NODE_IDLE;
+    }
+    if (noiseProbability > 0 && (nextRandom() >> 11) * (1.0 / 9007199254740992.0) < noiseProbability) bus ^= 1;
+    busyBits += busy || bus == 0;
+
+    for (i = 0; i < nodeCnt; i++) nodeSampleBit(&nodes[i], bus);
+    bitTime++;
+}
+/****************************/
+
+void printReport(double elapsed) {
+    int i, j;
+    struct Node *n;
+    unsigned long errors;
+
+    printf("\n%-6s %-10s %-4s %9s %9s %8s %8s %8s %12s %12s\n",
+           "Node", "ID", "LED", "Sent", "Received", "ArbLost", "Errors", "Dropped", "Latency avg", "Latency max");
+    for (i = 0; i < nodeCnt; i++) {
+        n = &nodes[i];
+        errors = 0;
+        for (j = ERROR_TYPE_BIT; j <= ERROR_TYPE_ACK; j++) errors += n->errors[j];
+        printf("%-6s %-10X %-4s %9lu %9lu %8lu %8lu %8lu %12.1f %12llu\n",
+               n->name, n->id, n->led ? "on" : "off", n->sent, n->received, n->arbitrationLost, errors,
+               n->dropped, n->sent ? (double)n->latencySum / n->sent : 0.0, n->latencyMax);
+    }
+    printf("\nErrors by type:");
+    for (j = ERROR_TYPE_BIT; j <= ERROR_TYPE_ACK; j++) {
+        errors = 0;
+        for (i = 0; i < nodeCnt; i++) errors += nodes[i].errors[j];
+        printf(" %s %lu", errorTypeNames[j], errors);
+    }
+    printf("\nLatency in bit-times (queued to end of EOF); x %.3f us at %lu bit/s.\n", 1e6 / bitrate, bitrate);
+    printf("Frames: %llu, bus utilisation: %.2f%%\n", framesOnBus, bitTime ? 100.0 * busyBits / bitTime : 0.0);
+    printf("Simulated %llu bits in %.3f s (%.2f Mbit/s)\n", bitTime, elapsed, elapsed > 0 ? bitTime / elapsed / 1e6 : 0.0);
+}
+
+void printUsage(const char *program) {
+    printf("Usage: %s [options]\n", program);
+    printf("  -n bits     Bus bit-times to simulate (default: %llu).\n", DEFAULT_BIT_COUNT);
+    printf("  -s script   Node script (default: the Deadline 7 message map).\n");
+    printf("  -c srr|ide  Built-in case: an extended frame loses arbitration at SRR or IDE.\n");
+    printf("  -p prob     Probability of flipping each bus bit (default: 0).\n");
+    printf("  -r seed     Noise seed (default: 1).\n");
+    printf("  -b bitrate  Bit rate used for timestamps and latencies (default: 500000).\n");
+    printf("  -v          Print every transmitted frame as a candump -L line.\n");
+}
+
+int main(int argc, char *argv[]) {
+    int i;
+    const char *scriptPath = NULL;
+    const char **script = defaultScript;
+    int scriptLineCnt = (int)(sizeof(defaultScript) / sizeof(defaultScript[0]));
+    unsigned long long bitCount = DEFAULT_BIT_COUNT;
+    double start, elapsed;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            bitCount = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            scriptPath = argv[++i];
+        } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc && strcmp(argv[i + 1], "srr") == 0) {
+            script = srrCaseScript;
+            scriptLineCnt = (int)(sizeof(srrCaseScript) / sizeof(srrCaseScript[0]));
+            i++;
+        } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc && strcmp(argv[i + 1], "ide") == 0) {
+            script = ideCaseScript;
+            scriptLineCnt = (int)(sizeof(ideCaseScript) / sizeof(ideCaseScript[0]));
+            i++;
+        } else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+            noiseProbability = atof(argv[++i]);
+        } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            rngState = strtoull(argv[++i], NULL, 10);
+            if (rngState == 0) rngState = 1;
+        } else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            bitrate = strtoul(argv[++i], NULL, 10);
+            if (bitrate == 0) bitrate = 1;
+        } else if (strcmp(argv[i], "-v") == 0) {
+            verbose = 1;
+        } else {
+            printUsage(argv[0]);
+            return strcmp(argv[i], "-h") != 0;
+        }
+    }
+
+    if (loadScript(scriptPath, script, scriptLineCnt) != 0) return 1;
+
+    start = wallClockSeconds();
+    while (bitTime < bitCount) simulateBit();
+    elapsed = wallClockSeconds() - start;
+
+    printReport(elapsed);
+    return 0;
+}
@@ -0,0 +1,510 @@
+/*
+ * Decoder/encoder benchmark on synthetic CAN traffic.
+ *
+ * Generates a reproducible bus trace from a seed: standard and extended
+ * identifiers, DLC 0..8, remote frames, idle time for the requested bus
+ * load, and a share of frames hit by a stuff, CRC, form or ACK error (each
+ * followed by the 6-bit error flag and the error delimiter) or followed by
+ * an overload frame. The trace is then run through the bit-by-bit decoder,
+ * the word-at-a-time decoder (can_fastpath.h) and the encoder, and a
+ * profiling pass times every sampled bit against the decoder state it was
+ * handled in.
+ *
+ * Results are printed as a table and, with -o, written as JSON so runs can
+ * be compared over time. The decoded frame and error counts are checked
+ * against what was generated.
+ *
+ * Build: gcc -O2 -o CanBenchmark CanBenchmark.c -lm
+ * Usage: CanBenchmark [-n bits] [-s seed] [-l load] [-e errors] [-O overloads]
+ *                     [-r runs] [-o results.json] [-t trace.txt]
+ */
+#ifndef LOG_LEVEL
+#define LOG_LEVEL 0
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "can_controller.h"
+#include "can_fastpath.h"
+
+#define DEFAULT_TRACE_BITS 4000000
+#define DEFAULT_RUNS       3
+#define INTERMISSION_BITS  3
+#define FLAG_BITS          6
+#define DELIMITER_BITS     8
+// A frame, an error or overload frame and the intermission.
+#define MAX_FRAME_GROUP_BITS (MAX_STUFFED_FRAME_SIZE + FLAG_BITS + DELIMITER_BITS + INTERMISSION_BITS)
+
+static const char *stateNames[DECODER_STATE_CNT] = {
+    [INTERFRAME_SPACE_INTERMISSION] = "INTERMISSION",
+    [INTERFRAME_SPACE_BUS_IDLE]     = "BUS_IDLE",
+    [START_OF_FRAME]                = "START_OF_FRAME",
+    [ARBITRATION_IDENTIFIER_11_BIT] = "IDENTIFIER_11_BIT",
+    [ARBITRATION_RTR]               = "RTR",
+    [ARBITRATION_SRR]               = "SRR",
+    [ARBITRATION_IDE]               = "IDE",
+    [ARBITRATION_IDENTIFIER_18_BIT] = "IDENTIFIER_18_BIT",
+    [CONTROL_IDE]                   = "CONTROL_IDE",
+    [CONTROL_r0]                    = "r0",
+    [CONTROL_DLC]                   = "DLC",
+    [CONTROL_r1]                    = "r1",
+    [DATA]                          = "DATA",
+    [CRC_SEQUENCE]                  = "CRC_SEQUENCE",
+    [CRC_DELIMITER]                 = "CRC_DELIMITER",
+    [ACK_SLOT]                      = "ACK_SLOT",
+    [ACK_DELIMITER]                 = "ACK_DELIMITER",
+    [END_OF_FRAME]                  = "END_OF_FRAME",
+    [BIT_STUFFING]                  = "BIT_STUFFING",
+    [ERROR_FLAG]                    = "ERROR_FLAG",
+    [ERROR_DELIMITER]               = "ERROR_DELIMITER",
+    [OVERLOAD_FLAG]                 = "OVERLOAD_FLAG",
+    [OVERLOAD_DELIMITER]            = "OVERLOAD_DELIMITER",
+    [PASSIVE_ERROR_FLAG]            = "PASSIVE_ERROR_FLAG",
+    [BUS_OFF]                       = "BUS_OFF",
+};
+
+struct Settings {
+    unsigned long long bits;
+    uint64_t seed;
+    int load;             // Percent of the bus time taken by frames.
+    int errorPercent;     // Frames hit by an error.
+    int overloadPercent;  // Frames followed by an overload frame.
+    int runs;
+};
+
+// Generated trace and what the decoder has to find in it.
+struct Traffic {
+    unsigned char *bits;  // One 0/1 bus level per byte.
+    unsigned long long len;
+    struct Frame *frames; // Every frame put on the bus, for the encoder run.
+    unsigned long frameCnt;
+    unsigned long standardCnt, extendedCnt, remoteCnt;
+    unsigned long validCnt;
+    unsigned long errorCnt[ERROR_TYPE_ACK + 1];
+    unsigned long overloadCnt;
+};
+
+struct Result {
+    double seconds;        // Best of the runs.
+    unsigned long long bits;
+    unsigned long frames;
+};
+
+struct StateProfile {
+    unsigned long long bits[DECODER_STATE_CNT];
+    double ns[DECODER_STATE_CNT];
+};
+
+double wallClockSeconds() {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Cheap timestamp for the per-bit profile: the TSC where there is one.
+static inline uint64_t readTicks() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+#endif
+}
+
+/********** Generator **********/
+// xorshift64*: the same trace for the same seed on every platform.
+static uint32_t nextRandom(uint64_t *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return (uint32_t)((*state * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+static void randomFrame(struct Frame *f, uint64_t *rng) {
+    int i;
+    memset(f, 0, sizeof(*f));
+    if (nextRandom(rng) & 1) {
+        f->id = nextRandom(rng) & FRAME_ID_MASK;
+        f->flags = FRAME_FLAG_IDE | FRAME_FLAG_SRR;
+    } else {
+        f->id = nextRandom(rng) & 0x7FF;
+    }
+    if ((nextRandom(rng) & 7) == 0) f->flags |= FRAME_FLAG_RTR;
+    f->dlc = nextRandom(rng) % (FRAME_MAX_DLC + 1);
+    for (i = 0; i < FRAME_MAX_DLC; i++) f->data[i] = nextRandom(rng);
+}
+
+// Index of a random stuff bit of tx, or -1 when it has none.
+static int randomStuffBit(const struct TxStream *tx, uint64_t *rng) {
+    int positions[MAX_STUFFED_FRAME_SIZE];
+    int i, cnt = 0, end = tx->len - 10; // Stuffing ends with the CRC.
+    unsigned char bit, previous = 2, run = 0;
+    for (i = 0; i < end; i++) {
+        bit = txStreamBit(tx, i);
+        if (run == 5) {
+            positions[cnt++] = i;
+            run = 1;
+        } else {
+            run = bit == previous ? run + 1 : 1;
+        }
+        previous = bit;
+    }
+    return cnt ? positions[nextRandom(rng) % cnt] : -1;
+}
+
+static void putBits(struct Traffic *t, unsigned char bit, int n) {
+    while (n-- > 0) t->bits[t->len++] = bit;
+}
+
+// Put one frame on the bus, possibly hit by an error or followed by an
+// overload frame, then the intermission. Returns the error type.
+static int generateFrame(struct Traffic *t, const struct Settings *s, uint64_t *rng) {
+    uint8_t bits[(FRAME_CRC_FIELD_MAX_BITS + 15 + 7) / 8] = {0};
+    struct Frame f;
+    struct TxStream tx;
+    unsigned int n, i, end;
+    uint16_t crc;
+    int errorType = ERROR_TYPE_NONE, at;
+
+    randomFrame(&f, rng);
+    if ((int)(nextRandom(rng) % 100) < s->errorPercent) errorType = ERROR_TYPE_STUFF + nextRandom(rng) % 4;
+
+    n = framePackBits(&f, bits);
+    f.crc = crc15UpdateBits(0, bits, n);
+    // A CRC error: one flipped bit in the transmitted CRC.
+    crc = errorType == ERROR_TYPE_CRC ? f.crc ^ 1u << (nextRandom(rng) % 15) : f.crc;
+    for (i = 0; i < 15; i++) packBit(bits, n++, (crc >> (14 - i)) & 1);
+    frameStuff(bits, n, frameIsExtended(&f), &tx);
+    t->frames[t->frameCnt++] = f;
+    if (frameIsExtended(&f)) t->extendedCnt++;
+    else t->standardCnt++;
+    if (frameIsRemote(&f)) t->remoteCnt++;
+
+    // end: the bit the error is detected on, the last one sent.
+    end = tx.len - 1;
+    at = -1;
+    if (errorType == ERROR_TYPE_STUFF && (at = randomStuffBit(&tx, rng)) < 0) errorType = ERROR_TYPE_FORM;
+    switch (errorType) {
+        case ERROR_TYPE_STUFF:
+            end = at; // Same level as the five bits before it.
+            break;
+        case ERROR_TYPE_CRC:
+            end = tx.ackSlot + 1; // Reported at the ACK delimiter.
+            break;
+        case ERROR_TYPE_FORM:
+            // Dominant CRC delimiter, ACK delimiter or one of the first six
+            // EOF bits.
+            at = nextRandom(rng) % 8;
+            end = at == 0 ? tx.ackSlot - 1 : tx.ackSlot + at;
+            break;
+        case ERROR_TYPE_ACK:
+            end = tx.ackSlot; // Nobody drives the ACK slot.
+            break;
+    }
+    for (i = 0; i <= end; i++) {
+        if (i == tx.ackSlot) t->bits[t->len++] = errorType == ERROR_TYPE_ACK;
+        else if (i == end && errorType == ERROR_TYPE_STUFF) t->bits[t->len++] = !txStreamBit(&tx, i);
+        else if (i == end && errorType == ERROR_TYPE_FORM) t->bits[t->len++] = 0;
+        else t->bits[t->len++] = txStreamBit(&tx, i);
+    }
+
+    if (errorType != ERROR_TYPE_NONE) {
+        putBits(t, 0, FLAG_BITS);
+        putBits(t, 1, DELIMITER_BITS);
+        t->errorCnt[errorType]++;
+    } else {
+        t->validCnt++;
+        if ((int)(nextRandom(rng) % 100) < s->overloadPercent) {
+            putBits(t, 0, FLAG_BITS);
+            putBits(t, 1, DELIMITER_BITS);
+            t->overloadCnt++;
+        }
+    }
+    putBits(t, 1, INTERMISSION_BITS);
+    return errorType;
+}
+
+int generateTraffic(struct Traffic *t, const struct Settings *s) {
+    uint64_t rng = s->seed ? s->seed : 1;
+    unsigned long long sent, idle = 0, idleBits;
+    unsigned long maxFrames = s->bits / 40 + 1;
+
+    memset(t, 0, sizeof(*t));
+    t->bits = malloc(s->bits + MAX_FRAME_GROUP_BITS);
+    t->frames = malloc(maxFrames * sizeof(*t->frames));
+    if (t->bits == NULL || t->frames == NULL) return -1;
+    while (t->len < s->bits && t->frameCnt < maxFrames) {
+        sent = t->len;
+        generateFrame(t, s, &rng);
+        // Idle bus time in proportion to the bits just sent.
+        idle += (t->len - sent) * (100 - s->load);
+        idleBits = idle / s->load;
+        idle -= idleBits * s->load;
+        if (t->len + idleBits > s->bits) idleBits = t->len < s->bits ? s->bits - t->len : 0;
+        putBits(t, 1, (int)idleBits);
+    }
+    return 0;
+}
+
+int writeTrace(const struct Traffic *t, const char *path) {
+    FILE *fp = fopen(path, "w");
+    unsigned long long i;
+    if (fp == NULL) return -1;
+    for (i = 0; i < t->len; i++) {
+        fputc('0' + t->bits[i], fp);
+        if ((i & 127) == 127) fputc('\n', fp);
+    }
+    fputc('\n', fp);
+    fclose(fp);
+    return 0;
+}
+
+/********** Runs **********/
+static void keepBest(struct Result *r, double seconds) {
+    if (r->seconds == 0 || seconds < r->seconds) r->seconds = seconds;
+}
+
+void runDecoder(const struct Traffic *t, struct Controller *c, struct Result *r) {
+    unsigned long long i;
+    double start;
+    controllerInit(c);
+    start = wallClockSeconds();
+    for (i = 0; i < t->len; i++) controllerSampleBit(c, t->bits[i]);
+    keepBest(r, wallClockSeconds() - start);
+    r->bits = t->len;
+    r->frames = c->frameCnt;
+}
+
+void runFastPath(const struct Traffic *t, const uint64_t *words, struct Controller *c, struct Result *r) {
+    double start;
+    controllerInit(c);
+    start = wallClockSeconds();
+    fastDecode(c, words, t->len);
+    keepBest(r, wallClockSeconds() - start);
+    r->bits = t->len;
+    r->frames = c->frameCnt;
+}
+
+void runEncoder(const struct Traffic *t, struct Result *r) {
+    struct Controller c;
+    unsigned long k;
+    int i;
+    double start;
+    controllerInit(&c);
+    start = wallClockSeconds();
+    for (k = 0; k < t->frameCnt; k++) {
+        c.frame = t->frames[k];
+        c.isTransmitter = 1;
+        c.state = START_OF_FRAME;
+        controllerTransmitBits(&c, NULL);
+        for (i = 0; i < INTERMISSION_BITS; i++) controllerSampleBit(&c, 1);
+    }
+    keepBest(r, wallClockSeconds() - start);
+    r->bits = c.bitTime;
+    r->frames = t->frameCnt;
+}
+
+// Time every sampled bit and charge it to the state it was decoded in. The
+// cost of reading the timer is measured first and taken off.
+void profileStates(const struct Traffic *t, struct StateProfile *p) {
+    struct Controller c;
+    uint64_t ticks[DECODER_STATE_CNT] = {0};
+    uint64_t t0, t1, first, overhead;
+    unsigned long long i;
+    unsigned char state;
+    double start, nsPerTick;
+    int k;
+
+    memset(p, 0, sizeof(*p));
+    t0 = readTicks();
+    for (k = 0; k < 1000; k++) readTicks();
+    overhead = (readTicks() - t0) / 1001;
+
+    controllerInit(&c);
+    start = wallClockSeconds();
+    first = readTicks();
+    for (i = 0; i < t->len; i++) {
+        state = c.state;
+        t0 = readTicks();
+        controllerSampleBit(&c, t->bits[i]);
+        t1 = readTicks();
+        ticks[state] += t1 - t0 > overhead ? t1 - t0 - overhead : 0;
+        p->bits[state]++;
+    }
+    // Ticks to ns over the whole pass rather than from a nominal TSC rate.
+    nsPerTick = 1e9 * (wallClockSeconds() - start) / (double)(readTicks() - first + 1);
+    for (k = 0; k < DECODER_STATE_CNT; k++) {
+        if (p->bits[k]) p->ns[k] = ticks[k] * nsPerTick / p->bits[k];
+    }
+}
+
+/********** Report **********/
+static void printResult(const char *name, const struct Result *r) {
+    printf("%-10s %14.2f %14.0f %10.2f %10.3f\n", name, r->bits / r->seconds / 1e6, r->frames / r->seconds,
+           1e9 * r->seconds / r->bits, r->seconds);
+}
+
+static void writeResultJson(FILE *fp, const char *name, const struct Result *r, int last) {
+    fprintf(fp, "  \"%s\": {\"seconds\": %.6f, \"bits\": %llu, \"frames\": %lu, \"bitsPerSecond\": %.0f, "
+                "\"framesPerSecond\": %.0f, \"nsPerBit\": %.3f}%s\n",
+            name, r->seconds, r->bits, r->frames, r->bits / r->seconds, r->frames / r->seconds,
+            1e9 * r->seconds / r->bits, last ? "" : ",");
+}
+
+int writeJson(const char *path, const struct Settings *s, const struct Traffic *t, const struct Result *decoder,
+              const struct Result *fast, const struct Result *encoder, const struct StateProfile *p,
+              long peakKb, int checked) {
+    FILE *fp = strcmp(path, "-") == 0 ? stdout : fopen(path, "w");
+    int k, first = 1;
+    if (fp == NULL) return -1;
+    fprintf(fp, "{\n");
+    fprintf(fp, "  \"config\": {\"bits\": %llu, \"seed\": %llu, \"load\": %d, \"errorPercent\": %d, "
+                "\"overloadPercent\": %d, \"runs\": %d, \"logLevel\": %d},\n",
+            s->bits, (unsigned long long)s->seed, s->load, s->errorPercent, s->overloadPercent, s->runs, LOG_LEVEL);
+    fprintf(fp, "  \"traffic\": {\"bits\": %llu, \"frames\": %lu, \"standard\": %lu, \"extended\": %lu, "
+                "\"remote\": %lu, \"valid\": %lu, \"stuffErrors\": %lu, \"crcErrors\": %lu, \"formErrors\": %lu, "
+                "\"ackErrors\": %lu, \"overloads\": %lu},\n",
+            t->len, t->frameCnt, t->standardCnt, t->extendedCnt, t->remoteCnt, t->validCnt,
+            t->errorCnt[ERROR_TYPE_STUFF], t->errorCnt[ERROR_TYPE_CRC], t->errorCnt[ERROR_TYPE_FORM],
+            t->errorCnt[ERROR_TYPE_ACK], t->overloadCnt);
+    writeResultJson(fp, "decoder", decoder, 0);
+    writeResultJson(fp, "fastPath", fast, 0);
+    writeResultJson(fp, "encoder", encoder, 0);
+    fprintf(fp, "  \"states\": {");
+    for (k = 0; k < DECODER_STATE_CNT; k++) {
+        if (p->bits[k] == 0) continue;
+        fprintf(fp, "%s\n    \"%s\": {\"bits\": %llu, \"nsPerBit\": %.3f}", first ? "" : ",", stateNames[k],
+                p->bits[k], p->ns[k]);
+        first = 0;
+    }
+    fprintf(fp, "\n  },\n");
+    fprintf(fp, "  \"peakMemoryKb\": %ld,\n", peakKb);
+    fprintf(fp, "  \"countsMatch\": %s\n", checked ? "true" : "false");
+    fprintf(fp, "}\n");
+    if (fp != stdout) fclose(fp);
+    return 0;
+}
+
+// The decoder has to report every generated frame and error, the fast path
+// the same.
+int checkCounts(const struct Traffic *t, const struct Controller *slow, const struct Controller *fast) {
+    int k, ok = slow->frameCnt == t->validCnt && fast->frameCnt == t->validCnt;
+    for (k = ERROR_TYPE_STUFF; k <= ERROR_TYPE_ACK; k++) {
+        ok = ok && slow->errorCnt[k] == t->errorCnt[k] && fast->errorCnt[k] == t->errorCnt[k];
+    }
+    return ok;
+}
+
+void printUsage(const char *program) {
+    printf("Usage: %s [options]\n", program);
+    printf("  -n bits       Trace length (default %d).\n", DEFAULT_TRACE_BITS);
+    printf("  -s seed       Generator seed (default 1).\n");
+    printf("  -l load       Bus load in percent, 1..100 (default 100).\n");
+    printf("  -e percent    Frames hit by a stuff, CRC, form or ACK error (default 5).\n");
+    printf("  -O percent    Frames followed by an overload frame (default 2).\n");
+    printf("  -r runs       Timed runs, the best one is reported (default %d).\n", DEFAULT_RUNS);
+    printf("  -o file       Write the results as JSON (\"-\" for stdout).\n");
+    printf("  -t file       Write the generated trace as '0'/'1' text.\n");
+}
+
+int main(int argc, char *argv[]) {
+    struct Settings s = {DEFAULT_TRACE_BITS, 1, 100, 5, 2, DEFAULT_RUNS};
+    struct Traffic t;
+    struct Result decoder = {0}, fast = {0}, encoder = {0};
+    struct Controller slowC, fastC;
+    struct StateProfile profile;
+    struct rusage usage;
+    const char *jsonPath = NULL, *tracePath = NULL;
+    uint64_t *words;
+    unsigned long long i;
+    int k, checked;
+
+    for (k = 1; k < argc; k++) {
+        if (strcmp(argv[k], "-n") == 0 && k + 1 < argc) {
+            s.bits = strtoull(argv[++k], NULL, 10);
+        } else if (strcmp(argv[k], "-s") == 0 && k + 1 < argc) {
+            s.seed = strtoull(argv[++k], NULL, 10);
+        } else if (strcmp(argv[k], "-l") == 0 && k + 1 < argc) {
+            s.load = atoi(argv[++k]);
+        } else if (strcmp(argv[k], "-e") == 0 && k + 1 < argc) {
+            s.errorPercent = atoi(argv[++k]);
+        } else if (strcmp(argv[k], "-O") == 0 && k + 1 < argc) {
+            s.overloadPercent = atoi(argv[++k]);
+        } else if (strcmp(argv[k], "-r") == 0 && k + 1 < argc) {
+            s.runs = atoi(argv[++k]);
+        } else if (strcmp(argv[k], "-o") == 0 && k + 1 < argc) {
+            jsonPath = argv[++k];
+        } else if (strcmp(argv[k], "-t") == 0 && k + 1 < argc) {
+            tracePath = argv[++k];
+        } else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (s.bits == 0 || s.load < 1 || s.load > 100 || s.errorPercent < 0 || s.errorPercent > 100 ||
+        s.overloadPercent < 0 || s.overloadPercent > 100 || s.runs < 1) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    if (generateTraffic(&t, &s) != 0) {
+        printf("Out of memory.\n");
+        return 1;
+    }
+    if (tracePath != NULL && writeTrace(&t, tracePath) != 0) {
+        printf("Error while opening the file.\n");
+        return 1;
+    }
+    // Packed MSB-first with two zero words of padding, as tracePack() does.
+    words = calloc(t.len / 64 + 3, sizeof(*words));
+    if (words == NULL) {
+        printf("Out of memory.\n");
+        return 1;
+    }
+    for (i = 0; i < t.len; i++) words[i >> 6] |= (uint64_t)t.bits[i] << (63 - (i & 63));
+
+    for (k = 0; k < s.runs; k++) {
+        runDecoder(&t, &slowC, &decoder);
+        runFastPath(&t, words, &fastC, &fast);
+        runEncoder(&t, &encoder);
+    }
+    profileStates(&t, &profile);
+    checked = checkCounts(&t, &slowC, &fastC);
+    getrusage(RUSAGE_SELF, &usage);
+
+    printf("Trace: %llu bits, seed %llu, load %d%%: %lu frames (%lu standard, %lu extended, %lu remote)\n", t.len,
+           (unsigned long long)s.seed, s.load, t.frameCnt, t.standardCnt, t.extendedCnt, t.remoteCnt);
+    printf("Errors: %lu stuff, %lu CRC, %lu form, %lu ACK; %lu overload frames\n", t.errorCnt[ERROR_TYPE_STUFF],
+           t.errorCnt[ERROR_TYPE_CRC], t.errorCnt[ERROR_TYPE_FORM], t.errorCnt[ERROR_TYPE_ACK], t.overloadCnt);
+    printf("\n%-10s %14s %14s %10s %10s\n", "Path", "Mbit/s", "Frames/s", "ns/bit", "Seconds");
+    printResult("decoder", &decoder);
+    printResult("fastpath", &fast);
+    printResult("encoder", &encoder);
+    printf("\n%-20s %12s %10s\n", "Decoder state", "Bits", "ns/bit");
+    for (k = 0; k < DECODER_STATE_CNT; k++) {
+        if (profile.bits[k]) printf("%-20s %12llu %10.2f\n", stateNames[k], profile.bits[k], profile.ns[k]);
+    }
+    printf("\nPeak memory: %ld KB\n", usage.ru_maxrss);
+    if (!checked) {
+        printf("Benchmark error: decoded frame/error counts do not match the generated traffic "
+               "(decoder %lu, fast path %lu, expected %lu frames).\n", slowC.frameCnt, fastC.frameCnt, t.validCnt);
+    }
+    if (jsonPath != NULL && writeJson(jsonPath, &s, &t, &decoder, &fast, &encoder, &profile, usage.ru_maxrss,
+                                      checked) != 0) {
+        printf("Error while opening the file.\n");
+        return 1;
+    }
+
+    free(words);
+    free(t.bits);
+    free(t.frames);
+    return checked ? 0 : 1;
+}
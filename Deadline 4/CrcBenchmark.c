@@ -0,0 +1,134 @@
+/*
+ * CRC-15 micro-benchmark.
+ *
+ * Compares the original ASCII shift-register CRC (one '0'/'1' char per bit)
+ * with the uint16_t engine from can_crc.h, both bit-at-a-time and through
+ * the byte table. Results are reported in ns per bit.
+ *
+ * Build: gcc -O2 -o CrcBenchmark CrcBenchmark.c
+ * Usage: CrcBenchmark [number of bits]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include "can_crc.h"
+
+#define DEFAULT_BIT_COUNT 8000000
+#define FRAME_BITS        103   // SOF..DATA of a standard frame with 8 data bytes.
+
+unsigned char crc[15] = "000000000000000";
+const unsigned char generatorPolynomial[15] = "100010110011001"; // 0x4599
+
+// Original Deadline 4 implementation, kept here as the baseline.
+void computeCrcSequence(unsigned char sampledBit) {
+    int j;
+    unsigned char nxtBit, crcNxt;
+
+    nxtBit = sampledBit;
+    crcNxt = nxtBit ^ crc[0];
+
+    // Shift left by one position.
+    for (j = 0; j < 14; j++) {
+        crc[j] = crc[j+1];
+    }
+    crc[14] = '0';
+
+    if (crcNxt) {
+        for (j = 0; j < 15; j++) {
+          crc[j] = crc[j] ^ generatorPolynomial[j] ? '1' : '0';
+        }
+    }
+}
+
+double elapsedNs(struct timespec start, struct timespec end) {
+    return (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+}
+
+int main(int argc, char *argv[]) {
+    unsigned long i, f;
+    unsigned long bitCount = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_BIT_COUNT;
+    unsigned long frameCount;
+    unsigned char *asciiBits;
+    uint8_t *packedBits;
+    uint16_t bitCrc = 0, tableCrc = 0, asciiCrc = 0;
+    uint16_t checksum = 0;
+    struct timespec start, end;
+    double asciiNs, bitNs, tableNs;
+    int j, mismatches = 0;
+
+    frameCount = bitCount / FRAME_BITS;
+    bitCount = frameCount * FRAME_BITS;
+    if (frameCount == 0) {
+        printf("Bit count must be at least %d.\n", FRAME_BITS);
+        return 1;
+    }
+
+    asciiBits  = malloc(bitCount);
+    packedBits = calloc(frameCount, (FRAME_BITS + 7) / 8);
+    if (asciiBits == NULL || packedBits == NULL) {
+        printf("Out of memory.\n");
+        return 1;
+    }
+
+    srand(1);
+    for (i = 0; i < bitCount; i++) {
+        asciiBits[i] = (rand() & 1) + '0';
+        packBit(packedBits + (i / FRAME_BITS) * ((FRAME_BITS + 7) / 8), i % FRAME_BITS, asciiBits[i] - '0');
+    }
+
+    // ASCII shift register, one char per bit.
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (f = 0; f < frameCount; f++) {
+        for (j = 0; j < 15; j++) crc[j] = '0';
+        for (i = 0; i < FRAME_BITS; i++) computeCrcSequence(asciiBits[f * FRAME_BITS + i]);
+        asciiCrc = 0;
+        for (j = 0; j < 15; j++) asciiCrc = (asciiCrc << 1) | (crc[j] - '0');
+        checksum ^= asciiCrc;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    asciiNs = elapsedNs(start, end) / bitCount;
+
+    // uint16_t register, one call per bit (decoder sample point path).
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (f = 0; f < frameCount; f++) {
+        bitCrc = 0;
+        for (i = 0; i < FRAME_BITS; i++) bitCrc = crc15UpdateBit(bitCrc, asciiBits[f * FRAME_BITS + i] - '0');
+        checksum ^= bitCrc;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    bitNs = elapsedNs(start, end) / bitCount;
+
+    // uint16_t register, byte table over packed bits (encoder/offline path).
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (f = 0; f < frameCount; f++) {
+        tableCrc = crc15UpdateBits(0, packedBits + f * ((FRAME_BITS + 7) / 8), FRAME_BITS);
+        checksum ^= tableCrc;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    tableNs = elapsedNs(start, end) / bitCount;
+
+    // The three implementations must agree on every frame.
+    for (f = 0; f < frameCount; f++) {
+        for (j = 0; j < 15; j++) crc[j] = '0';
+        bitCrc = 0;
+        for (i = 0; i < FRAME_BITS; i++) {
+            computeCrcSequence(asciiBits[f * FRAME_BITS + i]);
+            bitCrc = crc15UpdateBit(bitCrc, asciiBits[f * FRAME_BITS + i] - '0');
+        }
+        asciiCrc = 0;
+        for (j = 0; j < 15; j++) asciiCrc = (asciiCrc << 1) | (crc[j] - '0');
+        tableCrc = crc15UpdateBits(0, packedBits + f * ((FRAME_BITS + 7) / 8), FRAME_BITS);
+        mismatches += asciiCrc != bitCrc || bitCrc != tableCrc;
+    }
+
+    printf("Frames: %lu x %d bits (%lu bits)\n", frameCount, FRAME_BITS, bitCount);
+    printf("ASCII shift register: %8.3f ns/bit\n", asciiNs);
+    printf("uint16_t bitwise:     %8.3f ns/bit (%.1fx)\n", bitNs, asciiNs / bitNs);
+    printf("uint16_t byte table:  %8.3f ns/bit (%.1fx)\n", tableNs, asciiNs / tableNs);
+    printf("Mismatches: %d (checksum %04X)\n", mismatches, checksum);
+
+    free(asciiBits);
+    free(packedBits);
+    return mismatches != 0;
+}
@@ -1,755 +1,744 @@
+/*
+ * Deadline 4 CAN decoder/encoder.
+ *
+ * Decodes a '0'/'1' bus trace into frames (text, binary records or candump
+ * logs) and encodes recorded frames back into a bitstream. -h lists the
+ * options.
+ *
+ * Build: gcc -O2 -pthread -o DecoderEncoder DecoderEncoder.c -lm
+ */
+#define _GNU_SOURCE // open_memstream(), madvise() under -std=c11.
 #include <stdio.h>
-#include <math.h>
-
-/********** Interframe Space ***********/
-#define INTERFRAME_SPACE                0
-#define INTERFRAME_SPACE_INTERMISSION   1
-#define INTERFRAME_SPACE_BUS_IDLE       2
-/***************************************/
-
-/**** Start of Frame ***/
-#define START_OF_FRAME  3
-/***********************/
-
-/************* Arbitration *************/
-#define ARBITRATION                     4
-/*** Standard/Extended format fields ***/
-#define ARBITRATION_IDENTIFIER_11_BIT   5
-#define ARBITRATION_RTR                 6
-/**** Extended format extra fields *****/
-#define ARBITRATION_SRR                 7
-#define ARBITRATION_IDE                 8
-#define ARBITRATION_IDENTIFIER_18_BIT   9
-/***************************************/
-
-/************* Control *************/
-#define CONTROL     10
-/* Standard/Extended format fields */
-#define CONTROL_IDE 11
-#define CONTROL_r0  12
-#define CONTROL_DLC 13
-/*** Extended format extra fields **/
-#define CONTROL_r1  14
-/***********************************/
-
-/*** Data ****/
-#define DATA 15
-/*************/
-
-/******* CRC check ******/
-#define CRC             16
-#define CRC_SEQUENCE    17
-#define CRC_DELIMITER   18
-/************************/
-
-/********** ACK *********/
-#define ACK             19
-#define ACK_SLOT        20
-#define ACK_DELIMITER   21
-/************************/
-
-/****** End of Frame ****/
-#define END_OF_FRAME    22
-/************************/
-
-/****** Bit Stuffing ****/
-#define BIT_STUFFING    23
-/************************/
-
-/****** Error frame *****/
-#define ERROR           24
-#define ERROR_FLAG      25
-#define ERROR_DELIMITER 26
-/************************/
-
-/***** Overload frame ******/
-#define OVERLOAD           27
-#define OVERLOAD_FLAG      28
-#define OVERLOAD_DELIMITER 29
-/***************************/
-
-#define MAX_FRAME_SIZE 127
-
-unsigned char currentFrameField    = INTERFRAME_SPACE;
-unsigned char currentFrameSubField = INTERFRAME_SPACE_BUS_IDLE;
-unsigned char prevFrameField;
-
-unsigned char frameBuf[MAX_FRAME_SIZE];
-unsigned char sampledBit;
-unsigned char writingBit;
-unsigned char previousBit;
-unsigned char bitIndex = 0;
-unsigned char bitCnt   = 0;
-unsigned char hasError = 0;
-unsigned char crcError = 0;
-unsigned char isTransmitter      = 0;
-unsigned char bitFieldIndex      = 0;
-unsigned char overloadFrameCnt   = 0;
-unsigned char samePolarityBitCnt = 1;
-
-unsigned char dlc;
-unsigned char crc[15] = "000000000000000";
-const unsigned char generatorPolynomial[15] = "100010110011001"; // 0x4599
-
-struct Frame {
-    unsigned char idA[11];
-    unsigned char rtr;
-    unsigned char srr;
-    unsigned char ide;
-    unsigned char idB[18];
-    unsigned char r1;
-    unsigned char r0;
-    unsigned char dlc[4];
-    unsigned char data[64];
-    unsigned char crc[15];
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "can_controller.h"
+#include "can_trace.h"
+#include "can_fastpath.h"
+
+#define MAX_WORKERS 64
+
+#define BUS_IDLE_BITS     11 // EOF plus intermission: the next dominant bit is a SOF.
+#define CHUNKS_PER_WORKER 4
+
+// One trace file of a batch run and its decoding results.
+struct BatchFile {
+    char *path;
+    long long size;
+    int status; // 0 when decoded, -1 when the trace or its output could not be opened.
+    unsigned long long bits;
+    unsigned long frameCnt;
+    unsigned long crcFailCnt;
+    unsigned long errorCnt[ERROR_TYPE_ACK + 1];
+    double seconds;
 };
 
-struct Frame frame;
-struct Frame receivedframe;
+// Per-worker deque of file indices: the owner takes from the front, idle
+// workers steal from the back.
+struct WorkQueue {
+    pthread_mutex_t lock;
+    int *items;
+    int head;
+    int tail;
+};
 
-const unsigned char errorOverloadFrame[14] = "00000011111111";
+struct Batch {
+    struct BatchFile *files;
+    int fileCnt;
+    int fileCap;
+    struct WorkQueue queues[MAX_WORKERS];
+    int workerCnt;
+    const char *outputDir; // NULL: next to each trace.
+    int fast;              // Decode with the word-at-a-time fast path.
+    struct Controller settings; // Output format, bitrate, interface and loopback for every file.
+};
 
-void decoderStateMachine();
+struct Worker {
+    pthread_t thread;
+    struct Batch *batch;
+    int index;
+};
 
-void printFrameInfo(struct Frame frame) {
-    int i;
-    printf("\n------- FRAME INFO -------\n");
-    printf("ID (11-bit): ");
-    for (i = 0; i < 11; i++) {
-        printf("%c", frame.idA[i]);
-    }
-    printf("\n");
+// Piece of one trace decoded on its own, from a SOF that follows at least
+// BUS_IDLE_BITS recessive bits.
+struct Chunk {
+    const unsigned char *begin;
+    const unsigned char *end;
+    unsigned long long bits;
+    unsigned long long invalid;
+    struct Controller c;         // Decoder state at the end of the chunk.
+    struct ChunkLog records;     // Frame records and fault confinement steps.
+    char *log;                   // Buffered logFile contents.
+    size_t logLen;
+    int done;
+};
 
-    printf("RTR: %c\n", frame.rtr);
+struct Split {
+    struct Chunk *chunks;
+    int chunkCnt;
+    int next;
+    pthread_mutex_t lock;
+    pthread_cond_t chunkDone;
+    const struct Controller *settings;
+};
 
-    printf("IDE: %c\n", frame.ide);
+struct Controller controller;
 
-    if (frame.ide == '1') {
-        printf("SRR: %c\n", frame.srr);
-        printf("ID (18-bit): ");
-        for (i = 0; i < 18; i++) {
-            printf("%c", frame.idB[i]);
-        }
-        printf("\n");
-        printf("r1: %c\n", frame.r1);
-    }
+double wallClockSeconds() {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
 
-    printf("r0: %c\n", frame.r0);
+void printUsage(const char *program) {
+    printf("Usage: %s [options] [trace file | -]\n", program);
+    printf("  -l            Loopback: echo received frames and error flags through the encoder.\n");
+    printf("  -f format     Decoded frame output: text (default), bin or candump.\n");
+    printf("  -o file       Output file for bin/candump records or the encoded bitstream.\n");
+    printf("  -b bitrate    Bit rate used for candump timestamps (default: 500000).\n");
+    printf("  -i interface  Interface name written to candump logs (default: can0).\n");
+    printf("  -e input      Encode the frames of a bin/candump file into a bitstream.\n");
+    printf("  -j threads    Batch mode: decode every trace on a pool of worker threads.\n");
+    printf("  -d dir        Batch mode output directory (default: next to each trace).\n");
+    printf("  -s threads    Split one trace at bus-idle points and decode the pieces in parallel.\n");
+    printf("  -w            Word-at-a-time fast path: decode whole frames at once (same output).\n");
+    printf("  -             Read the trace from stdin (default file: can_bus.txt).\n");
+    printf("Several traces, a directory or @list (one path per line) also select batch mode.\n");
+}
 
-    printf("DLC: ");
-    for (i = 0; i < 4; i++) {
-        printf("%c", frame.dlc[i]);
+// Run the decoder over every bit of the trace. Whitespace between frames is
+// skipped; in loopback mode the encoder drives the bus while transmitting.
+void decodeTrace(struct Controller *c, struct Trace *trace) {
+    const unsigned char *p, *end;
+    while (traceNextBlock(trace, &p, &end)) {
+        for (; p < end; p++) {
+            if (traceIsSpace(*p)) continue;
+            controllerTransmitBits(c, NULL);
+            if (*p != '0' && *p != '1') {
+                trace->invalid++;
+                continue;
+            }
+            trace->bits++;
+            controllerSampleBit(c, *p - '0');
+        }
     }
-    printf("\n");
+    controllerTransmitBits(c, NULL);
+}
 
+// Same as decodeTrace() through the word-at-a-time decoder of
+// can_fastpath.h. Loopback and the field and bit logs go through
+// decodeTrace().
+void decodeTraceFast(struct Controller *c, struct Trace *trace) {
+    uint64_t *words;
+    if (c->loopback || LOG_LEVEL >= LOG_LEVEL_FIELD) {
+        decodeTrace(c, trace);
+        return;
+    }
+    words = tracePack(trace);
+    if (words == NULL) {
+        printf("Out of memory.\n");
+        return;
+    }
+    fastDecode(c, words, trace->bits);
+    free(words);
+}
 
-    if (frame.rtr == '0') {
-        printf("Data: ");
-        for (i = 0; i < 8 * dlc; i++) {
-            printf("%c", frame.data[i]);
+// Encode every frame of a bin/candump file into a bitstream trace, one frame
+// (followed by the 3-bit intermission) per line.
+unsigned long encodeFrames(struct Controller *c, struct RecordReader *reader, FILE *out) {
+    int i;
+    unsigned long count = 0;
+    struct FrameRecord rec;
+    while (recordReaderNext(reader, &rec)) {
+        recordToFrame(&rec, &c->frame);
+        c->isTransmitter = 1;
+        c->state = START_OF_FRAME;
+        controllerTransmitBits(c, out);
+        for (i = 0; i < 3; i++) {
+            fputc('1', out);
+            controllerSampleBit(c, 1);
         }
-        printf("\n");
+        fputc('\n', out);
+        count++;
     }
+    return count;
+}
 
-    printf("CRC: ");
-    for (i = 0; i < 15; i++) {
-        printf("%c", frame.crc[i]);
-    }
-    printf("\n");
+/********** Batch **********/
+const char *batchOutputSuffix(unsigned char format) {
+    if (format == FORMAT_BINARY) return ".bin";
+    if (format == FORMAT_CANDUMP) return ".log";
+    return ".decoded.txt";
+}
 
-    printf("Frame (destuffed): ");
-    for (i = 0; i < bitIndex; i++) {
-        printf("%c", frameBuf[i]);
-    }
+int hasSuffix(const char *name, const char *suffix) {
+    size_t n = strlen(name), m = strlen(suffix);
+    return n >= m && strcmp(name + n - m, suffix) == 0;
+}
 
-    printf("\n\n");
+int addBatchFile(struct Batch *batch, const char *path) {
+    struct stat st;
+    struct BatchFile *files;
+    if (batch->fileCnt == batch->fileCap) {
+        batch->fileCap = batch->fileCap ? 2 * batch->fileCap : 64;
+        files = realloc(batch->files, batch->fileCap * sizeof(*files));
+        if (files == NULL) return -1;
+        batch->files = files;
+    }
+    memset(&batch->files[batch->fileCnt], 0, sizeof(struct BatchFile));
+    batch->files[batch->fileCnt].path = malloc(strlen(path) + 1);
+    if (batch->files[batch->fileCnt].path == NULL) return -1;
+    strcpy(batch->files[batch->fileCnt].path, path);
+    batch->files[batch->fileCnt].size = stat(path, &st) == 0 ? (long long)st.st_size : 0;
+    batch->fileCnt++;
+    return 0;
 }
 
-void checkBitStuffing() {
-    sampledBit == previousBit ? samePolarityBitCnt++ : (samePolarityBitCnt = 1);
-    previousBit = sampledBit;
-    if (samePolarityBitCnt == 5) {
-        printf("Destuffing next bit at index %d.\n", bitIndex);
-        samePolarityBitCnt = 1;
-        prevFrameField = currentFrameField;
-        currentFrameField = BIT_STUFFING;
+// Add a trace, every regular file of a directory (skipping decoder outputs)
+// or every path listed in an @file.
+int addBatchInput(struct Batch *batch, const char *input) {
+    struct stat st;
+    DIR *dir;
+    struct dirent *entry;
+    FILE *list;
+    char path[4096];
+    size_t len;
+
+    if (input[0] == '@') {
+        list = fopen(input + 1, "r");
+        if (list == NULL) return -1;
+        while (fgets(path, sizeof(path), list) != NULL) {
+            len = strcspn(path, "\r\n");
+            path[len] = '\0';
+            if (len > 0 && addBatchFile(batch, path) != 0) {
+                fclose(list);
+                return -1;
+            }
+        }
+        fclose(list);
+        return 0;
+    }
+    if (stat(input, &st) == 0 && S_ISDIR(st.st_mode)) {
+        dir = opendir(input);
+        if (dir == NULL) return -1;
+        while ((entry = readdir(dir)) != NULL) {
+            snprintf(path, sizeof(path), "%s/%s", input, entry->d_name);
+            if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) continue;
+            if (hasSuffix(entry->d_name, batchOutputSuffix(FORMAT_TEXT)) || hasSuffix(entry->d_name, batchOutputSuffix(FORMAT_BINARY))
+                || hasSuffix(entry->d_name, batchOutputSuffix(FORMAT_CANDUMP))) continue;
+            if (addBatchFile(batch, path) != 0) {
+                closedir(dir);
+                return -1;
+            }
+        }
+        closedir(dir);
+        return 0;
     }
+    return addBatchFile(batch, input);
 }
 
-void bitStuffingStateMachine() {
-    if (sampledBit == previousBit) {
-        printf("Bit stuffing error at index %d.\n", bitIndex);
-        hasError = 1;
+// Output path: <dir>/<trace name without extension><suffix>.
+void batchOutputPath(const struct Batch *batch, const char *path, char *out, size_t size) {
+    const char *base = path, *p, *dot;
+    int dirLen;
+    for (p = path; *p; p++) {
+        if (*p == '/' || *p == '\\') base = p + 1;
+    }
+    dot = strrchr(base, '.');
+    if (dot == NULL || dot == base) dot = base + strlen(base);
+    if (batch->outputDir != NULL) {
+        snprintf(out, size, "%s/%.*s%s", batch->outputDir, (int)(dot - base), base, batchOutputSuffix(batch->settings.outputFormat));
     } else {
-        printf("Stuffed bit: %c\n", sampledBit);
-        samePolarityBitCnt = 1;
-        previousBit = sampledBit;
-        currentFrameField = prevFrameField;
+        dirLen = (int)(base - path);
+        snprintf(out, size, "%.*s%.*s%s", dirLen, path, (int)(dot - base), base, batchOutputSuffix(batch->settings.outputFormat));
     }
 }
 
-void computeCrcSequence() {
-    int i, j;
-    unsigned char nxtBit, crcNxt;
-    
-    nxtBit = sampledBit;
-    crcNxt = nxtBit ^ crc[0];
-
-    // Shift left by one position.
-    for (j = 0; j < 14; j++) {
-        crc[j] = crc[j+1];
+void decodeBatchFile(struct Batch *batch, struct BatchFile *file) {
+    struct Controller c;
+    struct Trace trace;
+    char outputPath[4096];
+    double start;
+
+    controllerInit(&c);
+    c.loopback = batch->settings.loopback;
+    c.outputFormat = batch->settings.outputFormat;
+    c.bitrate = batch->settings.bitrate;
+    c.interfaceName = batch->settings.interfaceName;
+
+    batchOutputPath(batch, file->path, outputPath, sizeof(outputPath));
+    if (traceOpen(&trace, file->path) != 0) {
+        file->status = -1;
+        return;
     }
-    crc[14] = '0';
-
-    if (crcNxt) {
-        for (j = 0; j < 15; j++) {
-          crc[j] = crc[j] ^ generatorPolynomial[j] ? '1' : '0';
-        }
+    c.outputFile = fopen(outputPath, c.outputFormat == FORMAT_BINARY ? "wb" : "w");
+    if (c.outputFile == NULL) {
+        traceClose(&trace);
+        file->status = -1;
+        return;
     }
+    c.logFile = c.outputFormat == FORMAT_TEXT ? c.outputFile : NULL;
+    if (c.outputFormat == FORMAT_BINARY) recordWriteHeader(c.outputFile);
+
+    start = wallClockSeconds();
+    if (batch->fast) decodeTraceFast(&c, &trace);
+    else decodeTrace(&c, &trace);
+    file->seconds = wallClockSeconds() - start;
+    traceClose(&trace);
+    fclose(c.outputFile);
+
+    file->bits = trace.bits;
+    file->frameCnt = c.frameCnt;
+    file->crcFailCnt = c.crcFailCnt;
+    memcpy(file->errorCnt, c.errorCnt, sizeof(file->errorCnt));
 }
 
-int validateCrcSequence() {
-    int j;
-    for (j = 0; j < 15 && !crcError; j++) {
-        crcError = crc[j] != receivedframe.crc[j];
+// Next file for worker w: its own queue first, then steal from the others.
+int nextBatchFile(struct Batch *batch, int w) {
+    struct WorkQueue *q;
+    int k, item = -1;
+
+    for (k = 0; k < batch->workerCnt && item < 0; k++) {
+        q = &batch->queues[(w + k) % batch->workerCnt];
+        pthread_mutex_lock(&q->lock);
+        if (q->head < q->tail) item = k == 0 ? q->items[q->head++] : q->items[--q->tail];
+        pthread_mutex_unlock(&q->lock);
     }
+    return item;
 }
 
-void interframeSpaceStateMachine() {
-    printf("Interframe space\n");
-    switch(currentFrameSubField) {
-        case INTERFRAME_SPACE_INTERMISSION:
-            if (sampledBit == '0') {
-                if (bitCnt == 2) {
-                    /***
-                    /* If a CAN node has a message waiting for transmission and it samples a
-                    /* dominant bit at the third bit of INTERMISSION, it will interpret this as
-                    /* a START OF FRAME bit, and, with the next bit, start transmitting its message
-                    /* with the first bit of its IDENTIFIER without first transmitting a START OF FRAME bit
-                    /* and without becoming receiver.
-                    /***/
-                    currentFrameField = START_OF_FRAME;
-                    decoderStateMachine();
-                } else {
-                    overloadFrameCnt++;
-                    if (overloadFrameCnt <= 2) {
-                        // Overload frame.
-                        currentFrameField = OVERLOAD;
-                        currentFrameSubField = OVERLOAD_FLAG;
-                        if (bitCnt == 0) {
-                            bitCnt = 6; // Overload flag length.
-                            decoderStateMachine();
-                        } else {
-                            bitCnt = 6; // Overload flag length.
-                        }
-                    } else {
-                        printf("Overload error: ");
-                        printf("Maximum of 2 Overload frames allowed to delay Data/Remote frame.\n");
-                        hasError = 1;
-                    }
-                }
-            } else if (sampledBit == '1') {
-                bitCnt++;
-                if (bitCnt == 3) {
-                    bitCnt = 0;
-                    // TODO: Create logic to decide wheter or not to transmit a frame after receiving one.
-                    if ((isTransmitter = 1)) { // Forcing transmission after receiving a frame.
-                        currentFrameField = START_OF_FRAME;
-                        frame = receivedframe;  // Send back the received frame.
-                    } else {
-                        currentFrameField = INTERFRAME_SPACE;
-                        currentFrameSubField = INTERFRAME_SPACE_BUS_IDLE;
-                    }
-                }
-            } else {
-                printf("Interframe space error: ");
-                printf("Expecting 3 recessive bits during Intermission.\n");
-                hasError = 1;
-            }
-            break;
-        case INTERFRAME_SPACE_BUS_IDLE:
-            if (sampledBit == '0') {
-                currentFrameField = START_OF_FRAME;
-                decoderStateMachine();
-            }
-            break;
-        default:
-            printf("Interframe space error: invalid sub-frame field.\n");
-            return;
+void *batchWorker(void *arg) {
+    struct Worker *worker = arg;
+    int item;
+    while ((item = nextBatchFile(worker->batch, worker->index)) >= 0) {
+        decodeBatchFile(worker->batch, &worker->batch->files[item]);
     }
-};
+    return NULL;
+}
 
-void startOfFrameStateMachine() {
-    printf("Start of Frame\n");
-    // TODO: Enable hard synchronisation.
-    int j;
-    dlc      = 0;
-    bitCnt   = 0;
-    bitIndex = 0;
-    crcError = 0;
-    hasError = 0;
-    receivedframe.ide ?: 0;  // Assuming Standard format when in Receiver mode.
-    bitFieldIndex     = 0;
-    overloadFrameCnt   = 0;
-    samePolarityBitCnt = 1;
-    previousBit = sampledBit;
-    frameBuf[bitIndex++] = sampledBit;
-    currentFrameField = ARBITRATION;
-    currentFrameSubField = ARBITRATION_IDENTIFIER_11_BIT;
-    // Reset CRC sequence.
-    for (j = 0; j < 15; j++) {
-        crc[j] = '0';
-    }
-    computeCrcSequence();
-};
+int compareFileSize(const void *a, const void *b) {
+    const struct BatchFile *x = a, *y = b;
+    return (x->size < y->size) - (x->size > y->size);
+}
 
-void arbitrationStateMachine() {
-    printf("Arbitration\n");
-    int skipState = 0;
-    switch (currentFrameSubField) {
-        case ARBITRATION_IDENTIFIER_11_BIT:
-            frameBuf[bitIndex++] = sampledBit;
-            receivedframe.idA[bitFieldIndex++] = sampledBit;
-            if (bitFieldIndex == 11) {
-                bitFieldIndex = 0;
-                if (isTransmitter) {
-                    currentFrameSubField = (receivedframe.ide == '0') ? ARBITRATION_RTR : ARBITRATION_SRR;
-                } else {
-                    currentFrameSubField = ARBITRATION_RTR; // Assuming Standard format.
-                }
-            }
-            break;
-        case ARBITRATION_RTR:
-            receivedframe.rtr = sampledBit;
-            frameBuf[bitIndex++] = sampledBit;
-            currentFrameField = CONTROL;
-            if (receivedframe.ide == '1') currentFrameSubField = CONTROL_r1;  // Extended format.
-            else currentFrameSubField = CONTROL_IDE;    // Standard format.
-            break;
-        case ARBITRATION_SRR: // Empty transition to IDE bit field.
-            currentFrameSubField = ARBITRATION_IDE;
-            if (isTransmitter) {
-                receivedframe.srr = sampledBit;
-            } else {
-                receivedframe.srr = receivedframe.rtr;
-                skipState = 1; // Prevent from doing further evaluation without having sampled a new bit.
-                arbitrationStateMachine();
-            }
-            break;
-        case ARBITRATION_IDE: // Empty transition to 18 bit identifier.
-            bitFieldIndex = 0;
-            currentFrameSubField = ARBITRATION_IDENTIFIER_18_BIT;
-            break;
-        case ARBITRATION_IDENTIFIER_18_BIT:
-            frameBuf[bitIndex++] = sampledBit;
-            receivedframe.idB[bitFieldIndex++] = sampledBit;
-            if (bitFieldIndex == 18) currentFrameSubField = ARBITRATION_RTR; // Assuming Standard format.
-            break;
-        default:
-            printf("Arbitration error: invalid sub-frame field.\n");
-            return;
-    }
-    // Compute CRC sequence and check bit stuffing.
-    if (!hasError && !skipState) {
-        computeCrcSequence();
-        checkBitStuffing();
+void printBatchSummary(const struct Batch *batch, double elapsed) {
+    int i, j;
+    const struct BatchFile *f;
+    unsigned long long bits = 0;
+    unsigned long frames = 0, crcFails = 0, errors[ERROR_TYPE_ACK + 1] = {0};
+    int failed = 0;
+
+    printf("%-40s %12s %9s %8s %6s %6s %6s %6s %6s %9s\n",
+           "File", "Bits", "Frames", "CRC fail", "Bit", "Stuff", "CRC", "Form", "ACK", "Mbit/s");
+    for (i = 0; i < batch->fileCnt; i++) {
+        f = &batch->files[i];
+        if (f->status != 0) {
+            printf("%-40s Error while opening the file.\n", f->path);
+            failed++;
+            continue;
+        }
+        printf("%-40s %12llu %9lu %8lu %6lu %6lu %6lu %6lu %6lu %9.2f\n", f->path, f->bits, f->frameCnt, f->crcFailCnt,
+               f->errorCnt[ERROR_TYPE_BIT], f->errorCnt[ERROR_TYPE_STUFF], f->errorCnt[ERROR_TYPE_CRC],
+               f->errorCnt[ERROR_TYPE_FORM], f->errorCnt[ERROR_TYPE_ACK], f->seconds > 0 ? f->bits / f->seconds / 1e6 : 0.0);
+        bits += f->bits;
+        frames += f->frameCnt;
+        crcFails += f->crcFailCnt;
+        for (j = 0; j <= ERROR_TYPE_ACK; j++) errors[j] += f->errorCnt[j];
     }
+    printf("%-40s %12llu %9lu %8lu %6lu %6lu %6lu %6lu %6lu\n", "Total", bits, frames, crcFails,
+           errors[ERROR_TYPE_BIT], errors[ERROR_TYPE_STUFF], errors[ERROR_TYPE_CRC], errors[ERROR_TYPE_FORM], errors[ERROR_TYPE_ACK]);
+    printf("Decoded %d files (%d failed) on %d threads: %llu bits in %.3f s (%.2f Mbit/s aggregate)\n",
+           batch->fileCnt - failed, failed, batch->workerCnt, bits, elapsed, elapsed > 0 ? bits / elapsed / 1e6 : 0.0);
 }
 
-void controlStateMachine() {
-    printf("Control\n");
-    int skipState = 0;
-    switch (currentFrameSubField) {
-        case CONTROL_IDE:
-            receivedframe.ide = sampledBit;
-            frameBuf[bitIndex++] = sampledBit;
-            if (receivedframe.ide == '0') { // Standard format.
-                currentFrameSubField = CONTROL_r0;
-            } else { // Extended format.
-                currentFrameField = ARBITRATION;
-                currentFrameSubField = ARBITRATION_SRR;
-                skipState = 1; // Prevent from doing further evaluation without having sampled a new bit.
-                arbitrationStateMachine();
-            }
-            break;
-        case CONTROL_r1:
-            receivedframe.r1 = sampledBit;
-            frameBuf[bitIndex++] = sampledBit;
-            currentFrameSubField = CONTROL_r0;
-            break;
-        case CONTROL_r0:
-            receivedframe.r0 = sampledBit;
-            frameBuf[bitIndex++] = sampledBit;
-            currentFrameSubField = CONTROL_DLC;
-            bitFieldIndex = 0;
-            bitCnt = 4;
-            break;
-        case CONTROL_DLC:
-            frameBuf[bitIndex++] = sampledBit;
-            receivedframe.dlc[bitFieldIndex++] = sampledBit;
-            bitCnt--;
-            dlc += ((sampledBit - '0') << bitCnt);
-            if (bitCnt == 0) {
-                dlc = fmin(dlc, 8); // Maximum number of data bytes: 8.
-                printf("%d\n", dlc);
-                bitFieldIndex = 0;
-                if (receivedframe.rtr == '0' && dlc != 0) currentFrameField = DATA; // Data frame.
-                else {
-                    // Remote frame. Transitioning to CRC sequence. 
-                    bitCnt = 15;
-                    currentFrameField = CRC;
-                    currentFrameSubField = CRC_SEQUENCE;
-                }
-            }
-            break;
-        default:
-            printf("Control error: invalid sub-frame field.\n");
-            return;
+// Decode every file of the batch on workerCnt threads. Files are dealt
+// largest first, round-robin, to the worker queues.
+int runBatch(struct Batch *batch, int workerCnt) {
+    struct Worker workers[MAX_WORKERS];
+    double start, elapsed;
+    int i, w, failed = 0;
+
+    if (workerCnt < 1) workerCnt = 1;
+    if (workerCnt > MAX_WORKERS) workerCnt = MAX_WORKERS;
+    batch->workerCnt = workerCnt;
+    qsort(batch->files, batch->fileCnt, sizeof(*batch->files), compareFileSize);
+    for (w = 0; w < workerCnt; w++) {
+        pthread_mutex_init(&batch->queues[w].lock, NULL);
+        batch->queues[w].items = malloc((batch->fileCnt / workerCnt + 1) * sizeof(int));
+        batch->queues[w].head = batch->queues[w].tail = 0;
+        if (batch->queues[w].items == NULL) {
+            printf("Out of memory.\n");
+            return 1;
+        }
     }
-    // Compute CRC sequence and check bit stuffing.
-    if (!hasError && !skipState) {
-        computeCrcSequence();
-        checkBitStuffing();
+    for (i = 0; i < batch->fileCnt; i++) {
+        w = i % workerCnt;
+        batch->queues[w].items[batch->queues[w].tail++] = i;
     }
-}
 
-void dataStateMachine() {
-    printf("Data\n");
-    frameBuf[bitIndex++] = sampledBit;
-    receivedframe.data[bitFieldIndex++] = sampledBit;
-    bitCnt++;
-    if (bitCnt == 8 * dlc) {
-        bitCnt = 15;
-        bitFieldIndex = 0;
-        currentFrameField = CRC;
-        currentFrameSubField = CRC_SEQUENCE;
-    }
-    // Compute CRC sequence and check bit stuffing.
-    if (!hasError) {
-        computeCrcSequence();
-        checkBitStuffing();
+    start = wallClockSeconds();
+    for (w = 0; w < workerCnt; w++) {
+        workers[w].batch = batch;
+        workers[w].index = w;
+        pthread_create(&workers[w].thread, NULL, batchWorker, &workers[w]);
     }
-}
+    for (w = 0; w < workerCnt; w++) pthread_join(workers[w].thread, NULL);
+    elapsed = wallClockSeconds() - start;
 
-void crcStateMachine() {
-    printf("CRC\n");
-    switch (currentFrameSubField) {
-        case CRC_SEQUENCE:
-            frameBuf[bitIndex++] = sampledBit;
-            receivedframe.crc[bitFieldIndex++] = sampledBit;
-            bitCnt--;
-            if (bitCnt == 0) {
-                validateCrcSequence();
-                currentFrameSubField = CRC_DELIMITER;
-            }
-            // Check bit stuffing.
-            if (!hasError)
-                checkBitStuffing();
-            break;
-        case CRC_DELIMITER:
-            if (sampledBit != '1') {
-                printf("CRC delimiter error: ");
-                printf("Must be a recessive bit.\n");
-                hasError = 1;
-            } else {
-                frameBuf[bitIndex++] = sampledBit;
-                currentFrameField = ACK;
-                currentFrameSubField = ACK_SLOT;
-            }
-            break;
-        default:
-            printf("CRC error: invalid sub-frame field.\n");
-            return;
+    printBatchSummary(batch, elapsed);
+    for (w = 0; w < workerCnt; w++) {
+        pthread_mutex_destroy(&batch->queues[w].lock);
+        free(batch->queues[w].items);
     }
+    for (i = 0; i < batch->fileCnt; i++) {
+        failed |= batch->files[i].status != 0;
+        free(batch->files[i].path);
+    }
+    free(batch->files);
+    return failed;
+}
+/****************************/
+
+/********** Split **********/
+// First dominant bit at or after p that follows BUS_IDLE_BITS recessive bits,
+// or end. Whitespace and invalid characters do not break the run, as the
+// decoder never samples them.
+const unsigned char *findBusIdleStart(const unsigned char *p, const unsigned char *end) {
+    int run = 0;
+    for (; p < end; p++) {
+        if (*p == '1') run++;
+        else if (*p == '0' && run >= BUS_IDLE_BITS) return p;
+        else if (*p == '0') run = 0;
+    }
+    return end;
 }
 
-void ackStateMachine() {
-    printf("ACK\n");
-    switch (currentFrameSubField) {
-        case ACK_SLOT:
-            if (sampledBit == '1') { // None of the stations has acknowledged the message.
-                printf("Acknowledgment error: ");
-                printf("Failed to validade the message correctly.\n");
-                hasError = 1;
-            } else {
-                frameBuf[bitIndex++] = sampledBit;
-                currentFrameSubField = ACK_DELIMITER;
-            }
-            break;
-        case ACK_DELIMITER:
-            if (crcError) {
-                printf("CRC error: ");
-                printf("The calculated result is not the same as that received in the CRC sequence.\n");
-                hasError = 1;
-            } else if (sampledBit != '1') {
-                printf("Acknowledgment delimiter error: ");
-                printf("Must be a recessive bit.\n");
-                hasError = 1;
-            } else {
-                bitCnt = 0;
-                frameBuf[bitIndex++] = sampledBit;
-                currentFrameField = END_OF_FRAME;
-            }
-            break;
-        default:
-            printf("Ack error: invalid sub-frame field.\n");
-            return;
+// Decode a chunk from a fresh bus-idle context, buffering its log, records
+// and fault confinement steps. Bit-times count from the chunk's first bit.
+int decodeChunk(struct Chunk *chunk, const struct Controller *settings) {
+    struct Trace trace;
+    FILE *log = NULL;
+
+    if (settings->logFile != NULL) {
+        log = open_memstream(&chunk->log, &chunk->logLen);
+        if (log == NULL) return -1;
     }
+    chunk->c = *settings;
+    chunk->c.state = INTERFRAME_SPACE_BUS_IDLE;
+    chunk->c.bitTime = 0;
+    chunk->c.outputFile = NULL;
+    chunk->c.logFile = log;
+    chunk->c.chunkLog = &chunk->records;
+    chunk->c.frameCnt = chunk->c.crcFailCnt = 0;
+    memset(chunk->c.errorCnt, 0, sizeof(chunk->c.errorCnt));
+    chunk->c.tec = chunk->c.rec = 0;
+    chunk->c.errorState = ERROR_ACTIVE;
+
+    memset(&trace, 0, sizeof(trace));
+    trace.buf = (unsigned char *)chunk->begin;
+    trace.size = chunk->end - chunk->begin;
+    trace.mapped = 1;
+    decodeTrace(&chunk->c, &trace);
+    chunk->bits = trace.bits;
+    chunk->invalid = trace.invalid;
+    chunk->c.chunkLog = NULL;
+
+    if (log != NULL) fclose(log);
+    return 0;
 }
 
-void endOfFrameStateMachine() {
-    printf("End of frame\n");
-    if (sampledBit == '1') {
-        frameBuf[bitIndex++] = sampledBit;
-        bitCnt++;
-        if (bitCnt == 7) {
-            bitCnt = 0;
-            printFrameInfo(receivedframe);
-            currentFrameField = INTERFRAME_SPACE;
-            currentFrameSubField = INTERFRAME_SPACE_INTERMISSION;
-            isTransmitter = 0;  // Disabling transmission.
+// Carry the fault confinement counters and mode of prev through the steps
+// of a chunk decoded from a fresh error-active context. The chunk decoded
+// the same as from prev as long as both contexts are in the same mode at
+// every step, and change mode with the same counters (the log prints
+// them). Returns 0, with the chunk's final counters updated, or -1 when the
+// chunk has to be decoded again from prev.
+int carryConfinement(struct Chunk *chunk, const struct Controller *prev) {
+    struct Controller carried, fresh;
+    unsigned char carriedState, freshState;
+    size_t i;
+
+    if (chunk->records.failed) return -1;
+    if (chunk->records.stepCnt == 0) {
+        chunk->c.tec = prev->tec;
+        chunk->c.rec = prev->rec;
+        chunk->c.errorState = prev->errorState;
+        chunk->c.wasTransmitter = prev->wasTransmitter;
+        return 0;
+    }
+    controllerInit(&fresh);
+    fresh.logFile = NULL;
+    carried = fresh;
+    carried.tec = prev->tec;
+    carried.rec = prev->rec;
+    carried.errorState = prev->errorState;
+    if (carried.errorState != fresh.errorState) return -1;
+    for (i = 0; i < chunk->records.stepCnt; i++) {
+        carriedState = carried.errorState;
+        freshState = fresh.errorState;
+        controllerApplyStep(&carried, chunk->records.steps[i]);
+        controllerApplyStep(&fresh, chunk->records.steps[i]);
+        if (carried.errorState != fresh.errorState) return -1;
+        if ((carried.errorState != carriedState || fresh.errorState != freshState)
+            && (carried.tec != fresh.tec || carried.rec != fresh.rec)) {
+            return -1;
         }
-    } else {
-        printf("End of frame error: ");
-        printf("Expecting a flag sequence consisting of 7 recessive bits.\n");
-        hasError = 1;
     }
+    chunk->c.tec = carried.tec;
+    chunk->c.rec = carried.rec;
+    chunk->c.errorState = carried.errorState;
+    return 0;
 }
 
-void errorStateMachine() {
-    printf("Error frame\n");
-    switch(currentFrameSubField) {
-        case ERROR_FLAG:
-            if (sampledBit == '0') {
-                bitCnt++;
-            } else if (sampledBit == '1') {
-                if (bitCnt < 6) {
-                    printf("Error flag error: ");
-                    printf("Expecting at least 6 equal bits during error flag.\n");
-                    hasError = 1;
-                } else if (bitCnt >= 6 && bitCnt <= 12) {
-                    bitCnt = 7;
-                    currentFrameSubField = ERROR_DELIMITER;
-                }
-            }
-            if (bitCnt > 12) {
-                printf("Error flag error: ");
-                printf("Expecting maximum of 12 equal bits during error flag.\n");
-                hasError = 1;
-            }
-            break;
-        case ERROR_DELIMITER:
-            if (sampledBit == '1') {
-                bitCnt--;
-                if (bitCnt == 0) {
-                    currentFrameField = INTERFRAME_SPACE;
-                    currentFrameSubField = INTERFRAME_SPACE_INTERMISSION;
-                }
-            } else {
-                printf("Error delimiter error: ");
-                printf("Expecting 8 recessive bits during error delimiter.\n");
-                hasError = 1;
-            }
-            break;
-        default:
-            printf("Error frame error: invalid sub-frame field.\n");
-            return;
+// Write a chunk's buffered log and records, with the bit-times moved by
+// firstBit. Records go in place in the log when both share one stream.
+void writeChunk(const struct Chunk *chunk, const struct Controller *c, unsigned long long firstBit) {
+    struct FrameRecord rec;
+    long logPos = 0;
+    size_t i;
+
+    for (i = 0; i < chunk->records.recordCnt; i++) {
+        if (c->logFile == c->outputFile && chunk->records.logOffsets[i] > logPos) {
+            fwrite(chunk->log + logPos, 1, chunk->records.logOffsets[i] - logPos, c->logFile);
+            logPos = chunk->records.logOffsets[i];
+        }
+        rec = chunk->records.records[i];
+        rec.timestamp += firstBit;
+        if (c->outputFormat == FORMAT_BINARY) recordWriteBinary(c->outputFile, &rec);
+        else recordWriteCandump(c->outputFile, &rec, c->bitrate, c->interfaceName);
+    }
+    if (c->logFile != NULL && (size_t)logPos < chunk->logLen) {
+        fwrite(chunk->log + logPos, 1, chunk->logLen - logPos, c->logFile);
     }
 }
 
-void overloadStateMachine() {
-    printf("Overload frame\n");
-    switch(currentFrameSubField) {
-        case OVERLOAD_FLAG:
-            if (sampledBit == '0') {
-                bitCnt--;
-                if (bitCnt == 0) {
-                    bitCnt = 8;
-                    currentFrameSubField = OVERLOAD_DELIMITER;
-                }
-            } else if (sampledBit == '1') {
-                printf("Overload flag error: ");
-                printf("Expecting 6 dominant bits during overload flag.\n");
-                hasError = 1;
-            }
-            break;
-        case OVERLOAD_DELIMITER:
-            if (sampledBit == '1') {
-                bitCnt--;
-                if (bitCnt == 0) {
-                    currentFrameField = INTERFRAME_SPACE;
-                    currentFrameSubField = INTERFRAME_SPACE_INTERMISSION;
-                }
-            } else {
-                printf("Overload delimiter error: ");
-                printf("Expecting 8 recessive bits during overload delimiter.\n");
-                hasError = 1;
-            }
-            break;
-        default:
-            printf("Overload frame error: invalid sub-frame field.\n");
-            return;
+void *splitWorker(void *arg) {
+    struct Split *split = arg;
+    struct Chunk *chunk;
+    int k;
+
+    for (;;) {
+        pthread_mutex_lock(&split->lock);
+        k = split->next < split->chunkCnt ? split->next++ : -1;
+        pthread_mutex_unlock(&split->lock);
+        if (k < 0) break;
+        chunk = &split->chunks[k];
+        decodeChunk(chunk, split->settings);
+        pthread_mutex_lock(&split->lock);
+        chunk->done = 1;
+        pthread_cond_broadcast(&split->chunkDone);
+        pthread_mutex_unlock(&split->lock);
     }
+    return NULL;
 }
 
-void decoderStateMachine() {
-    switch(currentFrameField) {
-        case INTERFRAME_SPACE:
-            interframeSpaceStateMachine();
-            break;
-        case START_OF_FRAME:
-            startOfFrameStateMachine();
-            break;
-        case ARBITRATION:
-            arbitrationStateMachine();
-            break;
-        case CONTROL:
-            controlStateMachine();
-            break;
-        case DATA:
-            dataStateMachine();
-            break;
-        case CRC:
-            crcStateMachine();
-            break;
-        case ACK:
-            ackStateMachine();
-            break;
-        case END_OF_FRAME:
-            endOfFrameStateMachine();
-            break;
-        case BIT_STUFFING:
-            bitStuffingStateMachine();
-            break;
-        case ERROR:
-            errorStateMachine();
-            break;
-        case OVERLOAD:
-            overloadStateMachine();
-            break;
-        default:
-            printf("Decoder error: invalid frame field.\n");
-            break;
-    }
-    if (hasError) {
-        printFrameInfo(receivedframe);
-        printf("Start receiving error flag...\n");
-        bitCnt = 0;
-        hasError = 0;
-        isTransmitter = 1;
-        bitFieldIndex = 0;
-        currentFrameField = ERROR;
-        currentFrameSubField = ERROR_FLAG;
+// Decode one memory-mapped trace on workerCnt threads. The trace is cut just
+// before SOFs that follow a bus-idle run, and every chunk is decoded from a
+// fresh bus-idle context, with its bit-times counted from its first bit.
+// Chunks are then written out in order: the bits of the chunks before give
+// the timestamps, and the fault confinement counters of the previous chunk
+// are carried through the chunk's own steps. A chunk is decoded again, in
+// place, from the previous chunk's final state only when that state was not
+// bus idle (e.g. a bus-idle run ended inside an error-passive flag), or when
+// the counters it carries would have changed how the chunk decodes. The
+// output is the same as the serial decoder's. Returns the number of
+// re-decoded chunks.
+int decodeTraceSplit(struct Controller *c, struct Trace *trace, int workerCnt) {
+    struct Split split;
+    struct Trace piece;
+    pthread_t threads[MAX_WORKERS];
+    struct Chunk *chunk;
+    const struct Controller *prev = c;
+    const unsigned char *cut, *end = trace->buf + trace->size;
+    unsigned long long bits = 0;
+    int k, j, w, redone = 0;
+
+    if (workerCnt > MAX_WORKERS) workerCnt = MAX_WORKERS;
+    memset(&split, 0, sizeof(split));
+    split.settings = c;
+    split.chunks = calloc(workerCnt * CHUNKS_PER_WORKER, sizeof(*split.chunks));
+    if (split.chunks == NULL) return -1;
+    cut = trace->buf;
+    for (k = 0; k < workerCnt * CHUNKS_PER_WORKER && cut < end; k++) {
+        split.chunks[k].begin = cut;
+        cut = findBusIdleStart(trace->buf + trace->size / (workerCnt * CHUNKS_PER_WORKER) * (k + 1), end);
+        if (cut < split.chunks[k].begin + 1) cut = findBusIdleStart(split.chunks[k].begin + 1, end);
+        split.chunks[k].end = cut;
+        split.chunkCnt++;
     }
+    pthread_mutex_init(&split.lock, NULL);
+    pthread_cond_init(&split.chunkDone, NULL);
+
+    for (w = 0; w < workerCnt; w++) pthread_create(&threads[w], NULL, splitWorker, &split);
+    for (k = 0; k < split.chunkCnt; k++) {
+        chunk = &split.chunks[k];
+        pthread_mutex_lock(&split.lock);
+        while (!chunk->done) pthread_cond_wait(&split.chunkDone, &split.lock);
+        pthread_mutex_unlock(&split.lock);
+        if (controllerIsBusIdle(prev) && carryConfinement(chunk, prev) == 0) {
+            writeChunk(chunk, c, bits);
+        } else {
+            // Straight to the output, with the real bit-times.
+            chunk->c = *prev;
+            chunk->c.bitTime = bits;
+            chunk->c.outputFile = c->outputFile;
+            chunk->c.logFile = c->logFile;
+            chunk->c.frameCnt = chunk->c.crcFailCnt = 0;
+            memset(chunk->c.errorCnt, 0, sizeof(chunk->c.errorCnt));
+            memset(&piece, 0, sizeof(piece));
+            piece.buf = (unsigned char *)chunk->begin;
+            piece.size = chunk->end - chunk->begin;
+            piece.mapped = 1;
+            decodeTrace(&chunk->c, &piece);
+            redone++;
+        }
+        bits += chunk->bits;
+        trace->bits += chunk->bits;
+        trace->invalid += chunk->invalid;
+        c->frameCnt += chunk->c.frameCnt;
+        c->crcFailCnt += chunk->c.crcFailCnt;
+        for (j = 0; j <= ERROR_TYPE_ACK; j++) c->errorCnt[j] += chunk->c.errorCnt[j];
+        free(chunk->log);
+        chunk->log = NULL;
+        chunkLogFree(&chunk->records);
+        prev = &chunk->c;
+    }
+    for (w = 0; w < workerCnt; w++) pthread_join(threads[w], NULL);
+
+    if (split.chunkCnt > 0) {
+        // Continue from the final decoder state with the caller's output and totals.
+        chunk = &split.chunks[split.chunkCnt - 1];
+        chunk->c.bitTime = bits;
+        chunk->c.outputFile = c->outputFile;
+        chunk->c.logFile = c->logFile;
+        chunk->c.frameCnt = c->frameCnt;
+        chunk->c.crcFailCnt = c->crcFailCnt;
+        memcpy(chunk->c.errorCnt, c->errorCnt, sizeof(c->errorCnt));
+        *c = chunk->c;
+    }
+    pthread_cond_destroy(&split.chunkDone);
+    pthread_mutex_destroy(&split.lock);
+    free(split.chunks);
+    return redone;
 }
+/****************************/
 
-void encoderStateMachine() {
-    switch (currentFrameField) {
-        case START_OF_FRAME:
-            printFrameInfo(frame);
-            writingBit = '0';
-            break;
-        case ARBITRATION:
-            switch (currentFrameSubField) {
-                case ARBITRATION_IDENTIFIER_11_BIT:
-                    writingBit = frame.idA[bitFieldIndex];
-                    break;
-                case ARBITRATION_RTR:
-                    writingBit = frame.rtr;
-                    break;
-                case ARBITRATION_SRR:
-                    writingBit = frame.srr;
-                    break;
-                case ARBITRATION_IDE:
-                    writingBit = frame.ide;
-                    break;
-                case ARBITRATION_IDENTIFIER_18_BIT:
-                    writingBit = frame.idB[bitFieldIndex];
-                    break;
-            }
-            break;
-        case CONTROL:
-            switch (currentFrameSubField) {
-                case CONTROL_IDE:
-                    writingBit = frame.ide;
-                    break;
-                case CONTROL_r1:
-                    writingBit = frame.r1;
-                    break;
-                case CONTROL_r0:
-                    writingBit = frame.r0;
-                    break;
-                case CONTROL_DLC:
-                    writingBit = frame.dlc[bitFieldIndex];
-                    break;
-            }
-            break;
-        case DATA:
-            writingBit = frame.data[bitFieldIndex];
-            break;
-        case CRC:
-            switch (currentFrameSubField) {
-                case CRC_SEQUENCE:
-                    writingBit = frame.crc[bitFieldIndex];
-                    break;
-                case CRC_DELIMITER:
-                    writingBit = '1';
-                    break;
-            }
-            break;
-        case ACK:
-            switch (currentFrameSubField) {
-                case ACK_SLOT:
-                    // Forcing ACK for the sake of testing.
-                    // This value should be set to '1' by the encoder.
-                    writingBit = '0';
-                    break;
-                case ACK_DELIMITER:
-                    writingBit = '1';
-                    break;
+int main(int argc, char *argv[]) {
+    int i;
+    const char *path = "can_bus.txt";
+    const char *outputPath = NULL;
+    const char *encodePath = NULL;
+    struct Controller *c = &controller;
+    struct Trace trace;
+    struct RecordReader reader;
+    struct Batch batch;
+    struct stat st;
+    double start, elapsed;
+    unsigned long encoded;
+    int workerCnt = 0, inputCnt = 0, splitCnt = 0, redone = 0;
+
+    controllerInit(c);
+    memset(&batch, 0, sizeof(batch));
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-l") == 0) {
+            c->loopback = 1;
+        } else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "bin") == 0) c->outputFormat = FORMAT_BINARY;
+            else if (strcmp(argv[i], "candump") == 0) c->outputFormat = FORMAT_CANDUMP;
+            else if (strcmp(argv[i], "text") == 0) c->outputFormat = FORMAT_TEXT;
+            else {
+                printUsage(argv[0]);
+                return 1;
             }
-            break;
-        case END_OF_FRAME:
-            writingBit = '1';
-            break;
-        case BIT_STUFFING:
-            writingBit = (!(previousBit - '0')) + '0'; // The opposite polarity from the previous bit.
-            break;
-        case ERROR:
-        case OVERLOAD:
-            writingBit = errorOverloadFrame[bitFieldIndex++];
-            if (bitFieldIndex == 14) {
-                bitFieldIndex = 0;
-                isTransmitter = 0;
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            outputPath = argv[++i];
+        } else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            c->bitrate = strtoul(argv[++i], NULL, 10);
+            if (c->bitrate == 0) c->bitrate = 1;
+        } else if (strcmp(argv[i], "-i") == 0 && i + 1 < argc) {
+            c->interfaceName = argv[++i];
+        } else if (strcmp(argv[i], "-e") == 0 && i + 1 < argc) {
+            encodePath = argv[++i];
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            workerCnt = atoi(argv[++i]);
+            if (workerCnt < 1) workerCnt = 1;
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            splitCnt = atoi(argv[++i]);
+            if (splitCnt < 1) splitCnt = 1;
+        } else if (strcmp(argv[i], "-w") == 0) {
+            batch.fast = 1;
+        } else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            batch.outputDir = argv[++i];
+        } else if (strcmp(argv[i], "-h") == 0) {
+            printUsage(argv[0]);
+            return 0;
+        } else if (argv[i][0] == '-' && argv[i][1] != '\0') {
+            // Unknown option, or one missing its argument.
+            printUsage(argv[0]);
+            return 1;
+        } else {
+            path = argv[i];
+            if (addBatchInput(&batch, path) != 0) {
+                printf("Error while opening %s.\n", path);
+                return 1;
             }
-            break;
-        default:
-            printf("Encoder error: invalid frame field %d.\n", currentFrameField);
-            break;
+            inputCnt++;
+        }
     }
-}
 
-int main() {
-    int i;
-    FILE *fp;
-
-    fp = fopen("can_bus.txt", "r");
-    
-    if (fp == NULL) {
-        printf("Error while opening the file.\n");
-        return 1;
+    if (encodePath == NULL && (workerCnt > 0 || inputCnt > 1 || path[0] == '@'
+                               || (stat(path, &st) == 0 && S_ISDIR(st.st_mode)))) {
+        batch.settings = *c;
+        return runBatch(&batch, workerCnt > 0 ? workerCnt : 1);
+    }
+    for (i = 0; i < batch.fileCnt; i++) free(batch.files[i].path);
+    free(batch.files);
+
+    if (outputPath != NULL && strcmp(outputPath, "-") != 0) {
+        c->outputFile = fopen(outputPath, c->outputFormat == FORMAT_BINARY && encodePath == NULL ? "wb" : "w");
+        if (c->outputFile == NULL) {
+            printf("Error while opening the output file.\n");
+            return 1;
+        }
+        // Text output is the decoder's log, as in batch mode.
+        if (c->outputFormat == FORMAT_TEXT && encodePath == NULL) c->logFile = c->outputFile;
     }
 
-    do {
-        if (isTransmitter) {
-            encoderStateMachine();
-            sampledBit = writingBit;
-        } else {
-            sampledBit = fgetc(fp);
+    if (encodePath != NULL) {
+        if (recordReaderOpen(&reader, encodePath, c->bitrate) != 0) {
+            printf("Error while opening the file.\n");
+            return 1;
         }
-        decoderStateMachine();
-    } while (feof(fp) == 0 || isTransmitter);
+        encoded = encodeFrames(c, &reader, c->outputFile);
+        recordReaderClose(&reader);
+        if (c->outputFile != stdout) fclose(c->outputFile);
+        fprintf(stderr, "Encoded %lu frames.\n", encoded);
+        return 0;
+    }
 
-    fclose(fp);
+    if (traceOpen(&trace, path) != 0) {
+        printf("Error while opening the file.\n");
+        return 1;
+    }
+    if (c->outputFormat == FORMAT_BINARY) recordWriteHeader(c->outputFile);
+
+    start = wallClockSeconds();
+    // Loopback echoes frames across the cut points, so it always runs serially.
+    // The fast path only runs when the split did not decode the trace already.
+    if (splitCnt > 1 && trace.mapped && !c->loopback) redone = decodeTraceSplit(c, &trace, splitCnt);
+    else redone = -1;
+    if (redone < 0 && batch.fast) decodeTraceFast(c, &trace);
+    else if (redone < 0) decodeTrace(c, &trace);
+    elapsed = wallClockSeconds() - start;
+    traceClose(&trace);
+    if (c->outputFile != stdout) fclose(c->outputFile);
+
+    if (trace.invalid) fprintf(stderr, "Ignored %llu invalid trace characters.\n", trace.invalid);
+    fprintf(stderr, "Decoded %llu bits in %.3f s (%.2f Mbit/s)\n",
+            trace.bits, elapsed, elapsed > 0 ? trace.bits / elapsed / 1e6 : 0.0);
+    if (redone > 0) fprintf(stderr, "Re-decoded %d chunks from the state the previous one ended in.\n", redone);
     return 0;
-}
\ No newline at end of file
+}
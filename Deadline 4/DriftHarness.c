@@ -0,0 +1,375 @@
+/*
+ * Oscillator drift and propagation delay harness for resync().
+ *
+ * Runs the TQ-stepped bit timing state machine of the Deadline 5 firmware
+ * against the bus as seen by a receiving node, one local TQ per step:
+ *   - the remote transmitter's bit time is off by the given drift (ppm);
+ *   - every bus edge moves by up to +/- the given jitter (TQ);
+ *   - the receiver hard syncs on the SOF it sends itself (all nodes start a
+ *     frame together), then sees the winner's bits one loop delay (twice the
+ *     propagation delay) late.
+ * Each sample point inside a frame is checked against the bit the receiver
+ * should be sampling. The report gives the sample point position in the
+ * remote bit, how many resynchronisations hit the SJW limit and the bit
+ * error rate.
+ *
+ * The sweep mode tries every segment split and SJW within the CAN limits
+ * for one bit length and finds, for each, the largest drift both ways that
+ * still samples every bit correctly.
+ *
+ * The engine is the firmware's, from can_bit_timing.h.
+ *
+ * Build: gcc -O2 -o DriftHarness DriftHarness.c
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include "can_bit_timing.h"
+
+#define max(a, b) ((a) > (b) ? (a) : (b))
+
+/********* Bit timing limits (CAN 2.0) *********/
+#define MIN_BIT_LEN        8
+#define MAX_BIT_LEN        25
+#define MAX_PROP_SEG_LEN   8
+#define MAX_PHASE_SEG1_LEN 8
+#define MIN_PHASE_SEG2_LEN 2
+#define MAX_PHASE_SEG2_LEN 8
+#define MAX_SJW            4
+/***********************************************/
+
+#define DEFAULT_BIT_COUNT   1000000
+#define DEFAULT_SWEEP_BITS  20000
+#define HISTOGRAM_BINS      20      // 5% of the bit time each.
+#define BIT_HISTORY         16      // Remote bits kept to check slipped sample points.
+#define MAX_SWEEP_DRIFT_PPM 50000
+#define SWEEP_STEP_PPM      100
+
+/******** Bus stimulus ********/
+struct BusParams {
+    long driftPpm;
+    double jitter;      // Max. edge displacement (TQ).
+    double propDelay;   // One-way propagation delay (TQ).
+};
+
+struct Bus {
+    double bitTime;     // Remote bit time in local TQ.
+    double loopDelay;
+    double jitter;
+    unsigned long index;        // Current bit.
+    unsigned long frameEnd;     // First bit after the current frame.
+    unsigned char level;
+    bool hard;                  // Current bit started with a hard sync edge.
+    unsigned char levels[BIT_HISTORY];
+    double starts[BIT_HISTORY]; // Nominal start of the last bits.
+    // Next bit, generated one ahead so its edge time is known.
+    unsigned char nextLevel;
+    double nextNominal, nextStart;
+    unsigned long sof, end;     // SOF and end of the last generated frame.
+    int recessiveRun, sameRun, frameLeft;
+};
+
+struct Result {
+    unsigned long long bits, samples, bitErrors, slips, resyncs, sjwSaturations, frames, framesWithErrors;
+    unsigned long long histogram[HISTOGRAM_BINS + 2]; // Below 0%, 0..100% in bins, 100% and above.
+    double positionSum, positionMin, positionMax;
+};
+
+uint64_t rngState = 1;
+
+uint64_t nextRandom() {
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 7;
+    rngState ^= rngState << 17;
+    return rngState;
+}
+
+double randomUniform() {
+    return (nextRandom() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// Generate bit index + 1: random stuffed frames of 40..130 bits between
+// idle gaps.
+void busGenerate(struct Bus *bus) {
+    unsigned long next = bus->index + 1;
+    unsigned char level, previous = bus->nextLevel;
+
+    if (bus->frameLeft == 0) {
+        if (nextRandom() % 4 == 0 || bus->recessiveRun < 11) bus->frameLeft = -(int)(11 + nextRandom() % 20);
+        else bus->frameLeft = 40 + nextRandom() % 90;
+    }
+    if (bus->frameLeft < 0) {
+        level = 1;
+        bus->frameLeft++;
+    } else {
+        if (bus->recessiveRun >= 11) { // SOF.
+            level = 0;
+            bus->sof = next;
+            bus->end = next + bus->frameLeft;
+        } else if (bus->sameRun == 5) {
+            level = !previous; // Stuff bit.
+        } else {
+            level = nextRandom() & 1;
+        }
+        bus->frameLeft--;
+    }
+    bus->sameRun = level == previous ? bus->sameRun + 1 : 1;
+    bus->recessiveRun = level ? bus->recessiveRun + 1 : 0;
+
+    // The receiver sends the SOF itself: the frame's other bits, up to the
+    // recessive edge after the last one, come from the winner.
+    bus->nextLevel = level;
+    bus->nextNominal = (next + 3.3) * bus->bitTime + (next > bus->sof && next <= bus->end ? bus->loopDelay : 0);
+    bus->nextStart = bus->nextNominal;
+    if (level != previous) bus->nextStart += (randomUniform() * 2 - 1) * bus->jitter;
+}
+
+void busInit(struct Bus *bus, const struct BusParams *p) {
+    memset(bus, 0, sizeof(*bus));
+    bus->bitTime = (SYNC_SEG_LEN + bitTiming.propSeg + bitTiming.phaseSeg1 + bitTiming.phaseSeg2) * (1.0 + p->driftPpm / 1e6);
+    bus->loopDelay = 2 * p->propDelay;
+    bus->jitter = p->jitter;
+    bus->level = bus->levels[0] = 1;
+    bus->nextLevel = 1;
+    bus->recessiveRun = 11;
+    busGenerate(bus);
+}
+
+// Move to the next bit. Returns 1 on a recessive to dominant edge.
+int busAdvance(struct Bus *bus) {
+    int edge = bus->nextLevel == 0 && bus->level == 1;
+
+    bus->index++;
+    bus->hard = edge && bus->index == bus->sof;
+    if (bus->hard) bus->frameEnd = bus->end;
+    bus->level = bus->nextLevel;
+    bus->levels[bus->index % BIT_HISTORY] = bus->level;
+    bus->starts[bus->index % BIT_HISTORY] = bus->nextNominal;
+    busGenerate(bus);
+    return edge;
+}
+
+// Sample point at local time tick for the bit the receiver expects.
+void checkSample(struct Result *r, const struct Bus *bus, unsigned long expected, double tick) {
+    double position;
+    int bin;
+
+    r->samples++;
+    if (expected + BIT_HISTORY <= bus->index || expected > bus->index) {
+        r->slips++;
+        r->bitErrors++;
+        return;
+    }
+    position = (tick - bus->starts[expected % BIT_HISTORY]) / bus->bitTime;
+    if (expected != bus->index) r->slips++;
+    if (bus->levels[expected % BIT_HISTORY] != bus->level) r->bitErrors++;
+
+    bin = position < 0 ? 0 : position >= 1 ? HISTOGRAM_BINS + 1 : 1 + (int)(position * HISTOGRAM_BINS);
+    r->histogram[bin]++;
+    r->positionSum += position;
+    if (position < r->positionMin) r->positionMin = position;
+    if (position > r->positionMax) r->positionMax = position;
+}
+
+// One timer tick per TQ, flagSync() raising the flags for the edges of the
+// last TQ, until bits remote bits went by.
+void run(const struct BusParams *p, unsigned long bits, uint64_t seed, struct Result *r) {
+    struct Bus bus;
+    unsigned long long tick;
+    unsigned long expected = 0;
+    unsigned long long errorsBefore = 0;
+    bool inFrame = false;
+    unsigned char segment;
+
+    memset(r, 0, sizeof(*r));
+    r->positionMin = 1e9;
+    r->positionMax = -1e9;
+    rngState = seed;
+    resetBitTiming();
+    busInit(&bus, p);
+
+    for (tick = 1; bus.index < bits; tick++) {
+        while (bus.nextStart <= tick) {
+            if (busAdvance(&bus)) {
+                if (bus.hard) {
+                    hardSyncBool = true;
+                    if (inFrame && r->bitErrors != errorsBefore) r->framesWithErrors++;
+                    inFrame = true;
+                    expected = bus.index;
+                    errorsBefore = r->bitErrors;
+                    r->frames++;
+                } else {
+                    resyncBool = true;
+                }
+            }
+        }
+        segment = currentSegment;
+        if (resyncBool && !hardSyncBool && segment != SYNC_SEG) {
+            incrementTq();
+            r->resyncs++;
+            if (phaseError > bitTiming.sjw) r->sjwSaturations++;
+        } else {
+            incrementTq();
+        }
+        if (samplePoint && currentSegment == PHASE_SEG2 && tqSegCnt == 0 && inFrame) {
+            checkSample(r, &bus, expected, (double)tick);
+            if (++expected == bus.frameEnd) {
+                inFrame = false;
+                if (r->bitErrors != errorsBefore) r->framesWithErrors++;
+            }
+        }
+    }
+    r->bits = bus.index;
+}
+
+/******** Reports ********/
+void printResult(const struct BusParams *p, const struct Result *r, double elapsed) {
+    unsigned char n = SYNC_SEG_LEN + bitTiming.propSeg + bitTiming.phaseSeg1 + bitTiming.phaseSeg2;
+    unsigned long long peak = 1;
+    int i, width;
+
+    printf("Bit timing: %u TQ (1/%u/%u/%u), SJW %u, nominal sample point %.2f%%\n", n, bitTiming.propSeg,
+           bitTiming.phaseSeg1, bitTiming.phaseSeg2, bitTiming.sjw, 100.0 * (n - bitTiming.phaseSeg2) / n);
+    printf("Bus: %llu bits, %llu frames, drift %ld ppm, jitter %.2f TQ, propagation delay %.2f TQ\n",
+           r->bits, r->frames, p->driftPpm, p->jitter, p->propDelay);
+    printf("Simulated %.2f Mbit/s\n", r->bits / elapsed / 1e6);
+    printf("Sample points: %llu, bit errors: %llu (BER %.3g), slipped: %llu, frames with errors: %llu\n",
+           r->samples, r->bitErrors, r->samples ? (double)r->bitErrors / r->samples : 0.0, r->slips, r->framesWithErrors);
+    printf("Resynchronisations: %llu, SJW saturated: %llu (%.2f%%)\n", r->resyncs, r->sjwSaturations,
+           r->resyncs ? 100.0 * r->sjwSaturations / r->resyncs : 0.0);
+    if (r->samples == 0) return;
+    printf("Sample point position: mean %.2f%%, min %.2f%%, max %.2f%%\n",
+           100.0 * r->positionSum / r->samples, 100.0 * r->positionMin, 100.0 * r->positionMax);
+
+    for (i = 0; i < HISTOGRAM_BINS + 2; i++) peak = max(peak, r->histogram[i]);
+    for (i = 0; i < HISTOGRAM_BINS + 2; i++) {
+        if (i == 0) printf("%9s ", "< 0%");
+        else if (i == HISTOGRAM_BINS + 1) printf("%9s ", ">= 100%");
+        else printf("%3d-%3d%% ", (i - 1) * 100 / HISTOGRAM_BINS, i * 100 / HISTOGRAM_BINS);
+        width = (int)(50 * r->histogram[i] / peak);
+        printf("%12llu %.*s\n", r->histogram[i], width, "##################################################");
+    }
+}
+
+// Largest drift in the direction of sign (in SWEEP_STEP_PPM steps) with no
+// bit errors.
+long findDriftLimit(struct BusParams p, int sign, unsigned long bits, uint64_t seed) {
+    struct Result r;
+    long low = 0, high = MAX_SWEEP_DRIFT_PPM / SWEEP_STEP_PPM, mid;
+
+    p.driftPpm = 0;
+    run(&p, bits, seed, &r);
+    if (r.bitErrors != 0) return -1;
+    while (low < high) {
+        mid = (low + high + 1) / 2;
+        p.driftPpm = sign * mid * SWEEP_STEP_PPM;
+        run(&p, bits, seed, &r);
+        if (r.bitErrors == 0) low = mid;
+        else high = mid - 1;
+    }
+    return low * SWEEP_STEP_PPM;
+}
+
+void sweep(const struct BusParams *p, unsigned char n, unsigned long bits, uint64_t seed) {
+    unsigned char prop, ps1, ps2, sjw, tseg1;
+    long faster, slower, limit, best = -1;
+
+    printf("Bit length %u TQ, jitter %.2f TQ, propagation delay %.2f TQ, %lu bits per run\n",
+           n, p->jitter, p->propDelay, bits);
+    printf("%4s %4s %4s %4s %8s %12s %12s %12s\n", "PROP", "PS1", "PS2", "SJW", "SP %", "-drift ppm", "+drift ppm", "Tolerance");
+    for (ps2 = MIN_PHASE_SEG2_LEN; ps2 <= MAX_PHASE_SEG2_LEN; ps2++) {
+        tseg1 = n - SYNC_SEG_LEN - ps2;
+        for (prop = 1; prop <= MAX_PROP_SEG_LEN; prop++) {
+            if (tseg1 <= prop || tseg1 - prop > MAX_PHASE_SEG1_LEN) continue;
+            ps1 = tseg1 - prop;
+            for (sjw = 1; sjw <= min(MAX_SJW, min(ps1, ps2)); sjw++) {
+                bitTiming.propSeg = prop;
+                bitTiming.phaseSeg1 = ps1;
+                bitTiming.phaseSeg2 = ps2;
+                bitTiming.sjw = sjw;
+                faster = findDriftLimit(*p, -1, bits, seed);
+                slower = findDriftLimit(*p, 1, bits, seed);
+                limit = min(faster, slower);
+                printf("%4u %4u %4u %4u %8.2f ", prop, ps1, ps2, sjw, 100.0 * (n - ps2) / n);
+                if (limit < 0) printf("%12s %12s %12s\n", "-", "-", "fails");
+                else printf("%12ld %12ld %12ld\n", faster, slower, limit);
+                best = max(best, limit);
+            }
+        }
+    }
+    printf("Best tolerance: %ld ppm\n", best);
+}
+
+double wallClockSeconds() {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void printUsage(const char *program) {
+    printf("Usage: %s [options]\n", program);
+    printf("  -n bits       Remote bits to simulate (default: %d, %d with -w).\n", DEFAULT_BIT_COUNT, DEFAULT_SWEEP_BITS);
+    printf("  -d ppm        Remote clock drift, positive when slower (default: 0).\n");
+    printf("  -j tq         Max. edge jitter in TQ (default: 0).\n");
+    printf("  -p tq         One-way propagation delay in TQ (default: 0).\n");
+    printf("  -t p,s1,s2,j  PROP_SEG, PHASE_SEG1, PHASE_SEG2 and SJW (default: 1,7,7,5).\n");
+    printf("  -w length     Sweep every segment split and SJW for a bit length in TQ.\n");
+    printf("  -r seed       Stimulus seed (default: 1).\n");
+}
+
+int main(int argc, char *argv[]) {
+    struct BusParams p = {0, 0, 0};
+    struct Result r;
+    unsigned long bits = 0;
+    unsigned int prop, ps1, ps2, sjw;
+    int i, sweepLength = 0;
+    uint64_t seed = 1;
+    double start;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            bits = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            p.driftPpm = atol(argv[++i]);
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            p.jitter = atof(argv[++i]);
+        } else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+            p.propDelay = atof(argv[++i]);
+        } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            if (sscanf(argv[++i], "%u,%u,%u,%u", &prop, &ps1, &ps2, &sjw) != 4 || prop < 1 || ps1 < 1 || ps2 < 1
+                || prop > MAX_PROP_SEG_LEN || ps1 > MAX_PHASE_SEG1_LEN || ps2 > MAX_PHASE_SEG2_LEN || sjw < 1) {
+                printf("Bit timing error: segments must be 1..8 TQ and SJW at least 1 TQ.\n");
+                return 1;
+            }
+            bitTiming.propSeg = prop;
+            bitTiming.phaseSeg1 = ps1;
+            bitTiming.phaseSeg2 = ps2;
+            bitTiming.sjw = sjw;
+        } else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+            sweepLength = atoi(argv[++i]);
+            if (sweepLength < MIN_BIT_LEN || sweepLength > MAX_BIT_LEN) {
+                printf("Bit timing error: bit length must be %d..%d TQ.\n", MIN_BIT_LEN, MAX_BIT_LEN);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            seed = strtoull(argv[++i], NULL, 10);
+            if (seed == 0) seed = 1;
+        } else {
+            printUsage(argv[0]);
+            return strcmp(argv[i], "-h") != 0;
+        }
+    }
+
+    if (sweepLength) {
+        sweep(&p, (unsigned char)sweepLength, bits ? bits : DEFAULT_SWEEP_BITS, seed);
+        return 0;
+    }
+
+    start = wallClockSeconds();
+    run(&p, bits ? bits : DEFAULT_BIT_COUNT, seed, &r);
+    printResult(&p, &r, wallClockSeconds() - start);
+    return r.bitErrors != 0;
+}
@@ -0,0 +1,537 @@
+/*
+ * Edge timestamp replay harness for the event-driven bit timing engine.
+ *
+ * Feeds a file of recessive to dominant edge timestamps, in Timer1 ticks,
+ * to the event-driven engine of the Deadline 5 firmware and checks where
+ * its sample points fall. The file has one edge per line, "<tick> [h]",
+ * with h marking the edges that hard sync (the SOFs); "#" starts a comment.
+ * A firmware capture gives one through LOG_EDGES and "SerialLog -e", and
+ * -g generates one from a remote node with drift and edge jitter.
+ *
+ * Every file is replayed three times, the edge interrupt being handled up
+ * to -l ticks after the edge:
+ *   - TQ:      the edge is rounded down to the TQ it is handled in, the
+ *              resolution of the engine before the edges were timestamped;
+ *   - TCNT1:   flagSync() timestamps the edge when it is handled;
+ *   - capture: Timer1 input capture timestamps the edge itself.
+ * Generated files carry the remote bit time ("# bit <ticks>") and the
+ * start of remote bit 0 ("# origin <tick>"): each sample point is then
+ * placed in its remote bit and checked for slips. Without them, a sample
+ * point is placed in the nominal bit from the last edge. Either way only
+ * the sample points up to 10 bits after an edge are checked.
+ *
+ * The engine code below is copied from CANController1.ino.
+ *
+ * Build: gcc -O2 -o EdgeReplayHarness EdgeReplayHarness.c
+ * Usage: EdgeReplayHarness [options] [edge file]
+ *        EdgeReplayHarness -g bits [options] > edge file
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+
+// Defining segments.
+#define SYNC_SEG 0
+#define PROP_SEG 1
+#define PHASE_SEG1 2
+#define PHASE_SEG2 3
+
+#define SYNC_SEG_LEN 1
+
+#define SAMPLE_POINT_EVENT  0
+#define WRITING_POINT_EVENT 1
+
+#define MIN_EVENT_LEAD_TICKS 2
+
+/********* Bit timing limits (CAN 2.0) *********/
+#define MAX_PROP_SEG_LEN   8
+#define MAX_PHASE_SEG1_LEN 8
+#define MAX_PHASE_SEG2_LEN 8
+/***********************************************/
+
+#define DEFAULT_TQ_TICKS    16  // 1 us TQ at 16 MHz.
+#define DEFAULT_LATENCY     48  // Ticks, about what attachInterrupt() takes at 16 MHz.
+#define HISTOGRAM_BINS      20  // 5% of the bit time each.
+#define MAX_FREE_RUN_BITS   10  // Sample points checked after the last edge, without a bit time.
+
+#define MODE_TQ      0
+#define MODE_TCNT1   1
+#define MODE_CAPTURE 2
+#define MODE_COUNT   3
+
+typedef struct {
+    unsigned char propSeg;
+    unsigned char phaseSeg1;
+    unsigned char phaseSeg2;
+    unsigned char sjw;
+    uint16_t tqTicks;
+} BitTiming;
+
+// Firmware power-up timing: 1/7/7 TQ, SJW 5.
+BitTiming bitTiming = {1, 7, 7, 5, DEFAULT_TQ_TICKS};
+
+/******** Timer1 ********/
+#define OCF1A 1
+
+uint16_t TCNT1, OCR1A;
+uint8_t TIFR1;          // Write-only here: a one written clears the flag, see replay().
+bool compareFlag;       // OCF1A: the compare matched, its interrupt is pending.
+
+/******** Firmware state ********/
+// Stands in for the decoder: the edge file says which edges hard sync.
+struct Controller {
+    bool hard;
+} controller;
+
+volatile bool samplePoint  = false;
+volatile bool writingPoint = false;
+volatile bool advanceStateMachine = false;
+volatile unsigned char currentSegment = PROP_SEG;
+volatile unsigned char tqSegCnt       = 0;
+volatile unsigned char phaseError     = 0;
+volatile unsigned char phaseSeg1Len   = 7;
+volatile unsigned char phaseSeg2Len   = 7;
+volatile unsigned char nextEvent      = SAMPLE_POINT_EVENT;
+
+volatile uint32_t lastEventTick = 0;
+volatile uint32_t bitStartTick  = 0;
+volatile uint32_t sampleTick    = 0;
+volatile uint32_t writeTick     = 0;
+
+bool hardSyncEdge(const struct Controller *c) {
+    return c->hard;
+}
+
+void restoreSegsDefaultLen() {
+    phaseSeg1Len = bitTiming.phaseSeg1;
+    phaseSeg2Len = bitTiming.phaseSeg2;
+}
+
+void scheduleBitTimingEvent(unsigned char event, uint32_t tick) {
+    nextEvent = event;
+    OCR1A = (uint16_t)tick;
+}
+
+void startBitTimer() {
+    TCNT1  = 0;
+    lastEventTick = 0;
+    bitStartTick  = 0 - (uint32_t)SYNC_SEG_LEN * bitTiming.tqTicks; // Starts in PROP_SEG.
+    sampleTick    = bitStartTick + (uint32_t)(SYNC_SEG_LEN + bitTiming.propSeg + bitTiming.phaseSeg1) * bitTiming.tqTicks;
+    currentSegment = PROP_SEG;
+    scheduleBitTimingEvent(SAMPLE_POINT_EVENT, sampleTick);
+}
+
+uint32_t timerTick(uint16_t count) {
+    return lastEventTick + (uint16_t)(count - (uint16_t)lastEventTick);
+}
+
+void bitTimingEvent() {
+    restoreSegsDefaultLen();
+    tqSegCnt = 0;
+    if (nextEvent == SAMPLE_POINT_EVENT) {
+        lastEventTick = sampleTick;
+        samplePoint  = true;
+        writingPoint = false;
+        currentSegment = PHASE_SEG2;
+        writeTick = sampleTick + (uint32_t)bitTiming.phaseSeg2 * bitTiming.tqTicks;
+        scheduleBitTimingEvent(WRITING_POINT_EVENT, writeTick);
+    } else {
+        lastEventTick = writeTick;
+        samplePoint  = false;
+        writingPoint = true;
+        currentSegment = SYNC_SEG;
+        bitStartTick = writeTick;
+        sampleTick = bitStartTick + (uint32_t)(SYNC_SEG_LEN + bitTiming.propSeg + bitTiming.phaseSeg1) * bitTiming.tqTicks;
+        scheduleBitTimingEvent(SAMPLE_POINT_EVENT, sampleTick);
+    }
+    advanceStateMachine = true;
+}
+
+void bitTimingEdge(bool hard, uint32_t edge, uint32_t now) {
+    uint32_t tq = bitTiming.tqTicks, sjw = (uint32_t)bitTiming.sjw * tq, error, deadline;
+    unsigned char event = nextEvent;
+
+    // The pending event fell due while the edge waited for this interrupt
+    // and its compare waits behind it: run it first, on time as it was.
+    if ((int32_t)(now - (event == SAMPLE_POINT_EVENT ? sampleTick : writeTick)) >= 0) {
+        bitTimingEvent();
+        TIFR1 = 1 << OCF1A;
+        event = nextEvent;
+    }
+    if (hard) {
+        // The edge starts the bit: SYNC_SEG, then PROP_SEG.
+        writingPoint = false;
+        currentSegment = PROP_SEG;
+        bitStartTick = edge;
+        event = SAMPLE_POINT_EVENT;
+        deadline = sampleTick = edge + (uint32_t)(SYNC_SEG_LEN + bitTiming.propSeg + bitTiming.phaseSeg1) * tq;
+    } else if (event == SAMPLE_POINT_EVENT) {
+        if (edge == bitStartTick) return; // On time: no phase error.
+        if ((int32_t)(edge - bitStartTick) > 0) {
+            // Late edge: lengthen PHASE_SEG1 (max. SJW).
+            error = edge - bitStartTick;
+            deadline = bitStartTick + min(error, sjw);
+        } else {
+            // Early edge handled after the writing point: shorten the
+            // PHASE_SEG2 that has just ended (max. SJW).
+            error = bitStartTick - edge;
+            deadline = bitStartTick -= min(error, sjw);
+        }
+        phaseError = (error + tq - 1) / tq;
+        deadline = sampleTick = deadline + (uint32_t)(SYNC_SEG_LEN + bitTiming.propSeg + bitTiming.phaseSeg1) * tq;
+    } else {
+        // Early edge, in PHASE_SEG2: shorten it (max. SJW).
+        error = sampleTick + (uint32_t)bitTiming.phaseSeg2 * tq - edge;
+        phaseError = (error + tq - 1) / tq;
+        deadline = writeTick = sampleTick + (uint32_t)bitTiming.phaseSeg2 * tq - min(error, sjw);
+    }
+    // Already passed while the edge waited for its interrupt: run it next.
+    if ((int32_t)(deadline - now) < MIN_EVENT_LEAD_TICKS) {
+        deadline = now + MIN_EVENT_LEAD_TICKS;
+        if (event == SAMPLE_POINT_EVENT) sampleTick = deadline;
+        else writeTick = deadline;
+    }
+    scheduleBitTimingEvent(event, deadline);
+    // A compare that matched while the edge waited would run the new event
+    // right away: the deadline above replaces it.
+    TIFR1 = 1 << OCF1A;
+}
+
+void bitTimingCapture(uint16_t stamp) {
+    uint16_t count = TCNT1;
+    uint32_t now = timerTick(count);
+    uint32_t edge = now - (uint16_t)(count - stamp);
+    bool hard = hardSyncEdge(&controller);
+    bitTimingEdge(hard, edge, now);
+}
+
+/******** Edge files ********/
+struct Edge {
+    uint64_t tick;
+    bool hard;
+};
+
+struct EdgeFile {
+    struct Edge *edges;
+    size_t count, cap;
+    double bitTicks;    // Remote bit time, 0 if unknown.
+    double origin;      // Start of remote bit 0.
+};
+
+uint64_t rngState = 1;
+
+uint64_t nextRandom() {
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 7;
+    rngState ^= rngState << 17;
+    return rngState;
+}
+
+double randomUniform() {
+    return (nextRandom() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+int readEdges(FILE *fp, struct EdgeFile *f) {
+    char line[128], flag[8];
+    unsigned long long tick;
+    double value;
+    struct Edge *grown;
+    unsigned long lineNo = 0;
+    int n;
+
+    memset(f, 0, sizeof(*f));
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        lineNo++;
+        if (sscanf(line, "# bit %lf", &value) == 1) {
+            f->bitTicks = value;
+            continue;
+        }
+        if (sscanf(line, "# origin %lf", &value) == 1) {
+            f->origin = value;
+            continue;
+        }
+        if (line[0] == '#' || line[strspn(line, " \t\r\n")] == '\0') continue;
+        n = sscanf(line, "%llu %7s", &tick, flag);
+        if (n < 1 || (n == 2 && strcmp(flag, "h") != 0)) {
+            printf("Edge file error: line %lu is not \"<tick> [h]\".\n", lineNo);
+            return 0;
+        }
+        if (f->count > 0 && tick < f->edges[f->count - 1].tick) {
+            printf("Edge file error: line %lu goes back in time.\n", lineNo);
+            return 0;
+        }
+        if (f->count == f->cap) {
+            f->cap = f->cap ? 2 * f->cap : 1024;
+            grown = realloc(f->edges, f->cap * sizeof(*grown));
+            if (grown == NULL) {
+                printf("Out of memory.\n");
+                return 0;
+            }
+            f->edges = grown;
+        }
+        f->edges[f->count].tick = tick;
+        f->edges[f->count].hard = n == 2;
+        f->count++;
+    }
+    return 1;
+}
+
+// Print the edges of bits remote bits: random stuffed frames of 40..130
+// bits between idle gaps, bit time off by driftPpm, every edge moved by up
+// to +/- jitter ticks.
+void generateEdges(unsigned long bits, long driftPpm, double jitter) {
+    double bitTicks = (SYNC_SEG_LEN + bitTiming.propSeg + bitTiming.phaseSeg1 + bitTiming.phaseSeg2) *
+                      (double)bitTiming.tqTicks * (1.0 + driftPpm / 1e6);
+    double origin = 3.3 * bitTicks, t;
+    unsigned long index;
+    unsigned char level, previous = 1;
+    int recessiveRun = 11, sameRun = 1, frameLeft = 0;
+
+    printf("# Generated: %u TQ of %u ticks, drift %ld ppm, jitter %.2f ticks\n",
+           SYNC_SEG_LEN + bitTiming.propSeg + bitTiming.phaseSeg1 + bitTiming.phaseSeg2, bitTiming.tqTicks, driftPpm, jitter);
+    printf("# bit %.6f\n# origin %.6f\n", bitTicks, origin);
+    for (index = 0; index < bits; index++) {
+        if (frameLeft == 0) {
+            if (nextRandom() % 4 == 0 || recessiveRun < 11) frameLeft = -(int)(11 + nextRandom() % 20);
+            else frameLeft = 40 + nextRandom() % 90;
+        }
+        if (frameLeft < 0) {
+            level = 1;
+            frameLeft++;
+        } else {
+            if (recessiveRun >= 11) level = 0; // SOF.
+            else if (sameRun == 5) level = !previous; // Stuff bit.
+            else level = nextRandom() & 1;
+            frameLeft--;
+        }
+        if (level == 0 && previous == 1) {
+            t = origin + index * bitTicks + (randomUniform() * 2 - 1) * jitter;
+            printf("%llu%s\n", (unsigned long long)llround(t), recessiveRun >= 11 ? " h" : "");
+        }
+        sameRun = level == previous ? sameRun + 1 : 1;
+        recessiveRun = level ? recessiveRun + 1 : 0;
+        previous = level;
+    }
+}
+
+/******** Replay ********/
+struct Result {
+    unsigned long long edges, samples, slips, resyncs, sjwSaturations;
+    unsigned long long histogram[HISTOGRAM_BINS + 2]; // Below 0%, 0..100% in bins, 100% and above.
+    double positionSum, positionMin, positionMax;
+};
+
+// Place the sample point at tick s in a remote bit. Only the sample points
+// up to MAX_FREE_RUN_BITS after the last edge are checked: further on, the
+// bus is idle.
+void checkSample(struct Result *r, const struct EdgeFile *f, uint64_t s, uint64_t lastEdge, long *expected) {
+    double nominal = (double)(SYNC_SEG_LEN + bitTiming.propSeg + bitTiming.phaseSeg1 + bitTiming.phaseSeg2) *
+                     bitTiming.tqTicks;
+    double position, bitTicks = f->bitTicks;
+    long bit;
+    int bin;
+
+    if (s - lastEdge >= MAX_FREE_RUN_BITS * nominal) {
+        *expected = -1;
+        return;
+    }
+    if (bitTicks > 0) {
+        position = (s - f->origin) / bitTicks;
+        bit = (long)floor(position);
+        position -= bit;
+        if (*expected >= 0 && bit != *expected) r->slips++;
+        *expected = bit + 1;
+    } else {
+        position = (s - lastEdge) / nominal;
+        position -= floor(position);
+    }
+    r->samples++;
+    bin = position < 0 ? 0 : position >= 1 ? HISTOGRAM_BINS + 1 : 1 + (int)(position * HISTOGRAM_BINS);
+    r->histogram[bin]++;
+    r->positionSum += position;
+    if (position < r->positionMin) r->positionMin = position;
+    if (position > r->positionMax) r->positionMax = position;
+}
+
+// Compare events and edge interrupts in time order, one tick at a time
+// where something happens. An edge is handled latency ticks after it at
+// most. A compare that matches before the edge runs first; one that
+// matches while the edge waits sets OCF1A and waits in turn, as the edge
+// interrupt has the higher priority, then runs right after it unless the
+// edge handler cleared the flag.
+void replay(const struct EdgeFile *f, int mode, unsigned int latency, uint64_t seed, struct Result *r) {
+    uint64_t now = 0, fire, handled = 0, lastEdge = 0;
+    uint32_t tq = bitTiming.tqTicks, edge;
+    size_t next = 0;
+    long expected = -1;
+    bool synced = false, waiting;
+
+    memset(r, 0, sizeof(*r));
+    r->positionMin = 1e9;
+    r->positionMax = -1e9;
+    rngState = seed;
+    restoreSegsDefaultLen();
+    startBitTimer();
+    if (next < f->count) handled = f->edges[next].tick + (latency ? nextRandom() % (latency + 1) : 0);
+
+    compareFlag = false;
+    while (next < f->count || (synced && now - lastEdge < (uint64_t)MAX_FREE_RUN_BITS * 25 * tq)) {
+        // Timer1 matches OCR1A on the first tick at or after now.
+        fire = compareFlag ? now : now + (uint16_t)(OCR1A - (uint16_t)now);
+        waiting = next < f->count && f->edges[next].tick < fire;
+        if (next < f->count && (handled < fire || (compareFlag && waiting))) {
+            now = handled;
+            TCNT1 = (uint16_t)now;
+            controller.hard = f->edges[next].hard;
+            if (mode == MODE_CAPTURE) edge = (uint32_t)f->edges[next].tick;
+            else if (mode == MODE_TCNT1) edge = (uint32_t)now;
+            else edge = lastEventTick + ((uint32_t)now - lastEventTick) / tq * tq;
+            phaseError = 0;
+            samplePoint = false;
+            TIFR1 = 0;
+            bitTimingCapture((uint16_t)edge);
+            if (TIFR1 & (1 << OCF1A)) compareFlag = false;
+            // A sample point that was due before the edge ran in its handler.
+            if (samplePoint && synced) checkSample(r, f, now - (uint32_t)((uint32_t)now - lastEventTick), lastEdge, &expected);
+            if (phaseError > 0) r->resyncs++;
+            if (phaseError > bitTiming.sjw) r->sjwSaturations++;
+            if (controller.hard) synced = true;
+            lastEdge = f->edges[next].tick;
+            r->edges++;
+            if (++next < f->count) {
+                handled = max(f->edges[next].tick + (latency ? nextRandom() % (latency + 1) : 0), now + 1);
+            }
+        } else if (waiting && !compareFlag) {
+            now = fire;
+            compareFlag = true;
+        } else {
+            now = fire;
+            TCNT1 = (uint16_t)now;
+            compareFlag = false;
+            bitTimingEvent();
+            if (samplePoint && synced) checkSample(r, f, now, lastEdge, &expected);
+        }
+    }
+}
+
+/******** Reports ********/
+void printResult(const char *name, const struct Result *r) {
+    unsigned long long peak = 1;
+    int i, width;
+
+    printf("%s: %llu edges, %llu resynchronisations, SJW saturated: %llu, sample points: %llu, slipped: %llu\n",
+           name, r->edges, r->resyncs, r->sjwSaturations, r->samples, r->slips);
+    if (r->samples == 0) return;
+    printf("Sample point position: mean %.2f%%, min %.2f%%, max %.2f%%\n",
+           100.0 * r->positionSum / r->samples, 100.0 * r->positionMin, 100.0 * r->positionMax);
+
+    for (i = 0; i < HISTOGRAM_BINS + 2; i++) peak = max(peak, r->histogram[i]);
+    for (i = 0; i < HISTOGRAM_BINS + 2; i++) {
+        if (r->histogram[i] == 0) continue;
+        if (i == 0) printf("%9s ", "< 0%");
+        else if (i == HISTOGRAM_BINS + 1) printf("%9s ", ">= 100%");
+        else printf("%3d-%3d%% ", (i - 1) * 100 / HISTOGRAM_BINS, i * 100 / HISTOGRAM_BINS);
+        width = (int)(50 * r->histogram[i] / peak);
+        printf("%12llu %.*s\n", r->histogram[i], width, "##################################################");
+    }
+    printf("\n");
+}
+
+void printUsage(const char *program) {
+    printf("Usage: %s [options] [edge file]\n", program);
+    printf("Replays an edge file (stdin by default), one \"<tick> [h]\" line per edge.\n");
+    printf("  -g bits       Print the edges of a remote node sending bits bits instead.\n");
+    printf("  -d ppm        -g: remote clock drift, positive when slower (default: 0).\n");
+    printf("  -j ticks      -g: max. edge jitter in ticks (default: 0).\n");
+    printf("  -l ticks      Max. edge interrupt latency in ticks (default: %d).\n", DEFAULT_LATENCY);
+    printf("  -q ticks      Timer1 ticks per TQ (default: %d).\n", DEFAULT_TQ_TICKS);
+    printf("  -t p,s1,s2,j  PROP_SEG, PHASE_SEG1, PHASE_SEG2 and SJW (default: 1,7,7,5).\n");
+    printf("  -r seed       Stimulus and latency seed (default: 1).\n");
+}
+
+int main(int argc, char *argv[]) {
+    static const char *modeNames[MODE_COUNT] = {"TQ", "TCNT1", "Capture"};
+    const char *path = NULL;
+    FILE *fp = stdin;
+    struct EdgeFile f;
+    struct Result r;
+    unsigned long generate = 0;
+    unsigned int prop, ps1, ps2, sjw, latency = DEFAULT_LATENCY, n;
+    long driftPpm = 0;
+    double jitter = 0;
+    uint64_t seed = 1;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-g") == 0 && i + 1 < argc) {
+            generate = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            driftPpm = atol(argv[++i]);
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            jitter = atof(argv[++i]);
+        } else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+            latency = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-q") == 0 && i + 1 < argc) {
+            bitTiming.tqTicks = (uint16_t)strtoul(argv[++i], NULL, 10);
+            if (bitTiming.tqTicks == 0) {
+                printf("Bit timing error: a TQ must be at least one tick.\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            if (sscanf(argv[++i], "%u,%u,%u,%u", &prop, &ps1, &ps2, &sjw) != 4 || prop < 1 || ps1 < 1 || ps2 < 1
+                || prop > MAX_PROP_SEG_LEN || ps1 > MAX_PHASE_SEG1_LEN || ps2 > MAX_PHASE_SEG2_LEN || sjw < 1) {
+                printf("Bit timing error: segments must be 1..8 TQ and SJW at least 1 TQ.\n");
+                return 1;
+            }
+            bitTiming.propSeg = prop;
+            bitTiming.phaseSeg1 = ps1;
+            bitTiming.phaseSeg2 = ps2;
+            bitTiming.sjw = sjw;
+        } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            seed = strtoull(argv[++i], NULL, 10);
+            if (seed == 0) seed = 1;
+        } else if (argv[i][0] != '-' && path == NULL) {
+            path = argv[i];
+        } else {
+            printUsage(argv[0]);
+            return strcmp(argv[i], "-h") != 0;
+        }
+    }
+    n = SYNC_SEG_LEN + bitTiming.propSeg + bitTiming.phaseSeg1 + bitTiming.phaseSeg2;
+    if ((uint32_t)(n + bitTiming.sjw) * bitTiming.tqTicks > 65535) {
+        printf("Bit timing error: a bit must be less than 65536 ticks.\n");
+        return 1;
+    }
+
+    if (generate) {
+        rngState = seed;
+        generateEdges(generate, driftPpm, jitter);
+        return 0;
+    }
+
+    if (path != NULL && (fp = fopen(path, "r")) == NULL) {
+        printf("Could not open %s.\n", path);
+        return 1;
+    }
+    if (!readEdges(fp, &f)) return 1;
+    if (fp != stdin) fclose(fp);
+
+    printf("Bit timing: %u TQ (1/%u/%u/%u) of %u ticks, SJW %u, nominal sample point %.2f%%\n", n,
+           bitTiming.propSeg, bitTiming.phaseSeg1, bitTiming.phaseSeg2, bitTiming.tqTicks, bitTiming.sjw,
+           100.0 * (n - bitTiming.phaseSeg2) / n);
+    printf("Edges: %lu, interrupt latency up to %u ticks", (unsigned long)f.count, latency);
+    if (f.bitTicks > 0) printf(", remote bit %.3f ticks (%+.0f ppm)", f.bitTicks, (f.bitTicks / (n * bitTiming.tqTicks) - 1) * 1e6);
+    printf("\n\n");
+    for (i = 0; i < MODE_COUNT; i++) {
+        replay(&f, i, latency, seed, &r);
+        printResult(modeNames[i], &r);
+    }
+    free(f.edges);
+    return 0;
+}
@@ -0,0 +1,148 @@
+/*
+ * Multi-channel decoder scaling benchmark.
+ *
+ * Generates one synthetic bus trace per channel (random standard/extended,
+ * data/remote frames, ACKed, separated by the intermission), then decodes
+ * the channels on 1, 2, 4, ... threads, each thread decoding its channels
+ * through its own struct Controller. As the contexts share no mutable
+ * state, aggregate throughput should grow near-linearly with the cores.
+ *
+ * Build: gcc -O2 -pthread -o ScalingBenchmark ScalingBenchmark.c -lm
+ * Usage: ScalingBenchmark [bits per channel] [max threads]
+ */
+#ifndef LOG_LEVEL
+#define LOG_LEVEL 0
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "can_controller.h"
+
+#define DEFAULT_CHANNEL_BITS 4000000
+#define INTERMISSION_BITS    3
+
+struct Channel {
+    unsigned char *bits; // One 0/1 bus level per byte.
+    unsigned long len;
+};
+
+struct Worker {
+    pthread_t thread;
+    struct Channel *channels;
+    int first;
+    int count;
+};
+
+double wallClockSeconds() {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Fill a channel with ACKed random frames until len bits are reached.
+int generateChannel(struct Channel *ch, unsigned long len, unsigned int seed) {
+    struct Frame f;
+    struct TxStream tx;
+    unsigned long n = 0;
+    int i;
+
+    ch->bits = malloc(len + MAX_STUFFED_FRAME_SIZE + INTERMISSION_BITS);
+    if (ch->bits == NULL) return -1;
+    srand(seed);
+    while (n < len) {
+        memset(&f, 0, sizeof(f));
+        if (rand() & 1) {
+            f.id = ((uint32_t)rand() << 8 ^ rand()) & FRAME_ID_MASK;
+            f.flags = FRAME_FLAG_IDE | FRAME_FLAG_SRR;
+        } else {
+            f.id = rand() & 0x7FF;
+        }
+        if ((rand() & 7) == 0) f.flags |= FRAME_FLAG_RTR;
+        f.dlc = rand() % (FRAME_MAX_DLC + 1);
+        for (i = 0; i < FRAME_MAX_DLC; i++) f.data[i] = rand();
+        frameCompile(&f, &tx);
+        for (i = 0; i < tx.len; i++) ch->bits[n++] = i == tx.ackSlot ? 0 : txStreamBit(&tx, i);
+        for (i = 0; i < INTERMISSION_BITS; i++) ch->bits[n++] = 1;
+    }
+    ch->len = n;
+    return 0;
+}
+
+void *decodeChannels(void *arg) {
+    struct Worker *w = arg;
+    struct Controller controller; // On the worker's stack: no cache lines shared with other threads.
+    struct Channel *ch;
+    unsigned long i;
+    int k;
+
+    for (k = w->first; k < w->first + w->count; k++) {
+        ch = &w->channels[k];
+        controllerInit(&controller);
+        for (i = 0; i < ch->len; i++) controllerSampleBit(&controller, ch->bits[i]);
+    }
+    return NULL;
+}
+
+// Decode every channel on threadCnt threads. Returns the wall time.
+double run(struct Channel *channels, int channelCnt, int threadCnt) {
+    struct Worker workers[64];
+    double start;
+    int t, first = 0;
+
+    start = wallClockSeconds();
+    for (t = 0; t < threadCnt; t++) {
+        workers[t].channels = channels;
+        workers[t].first = first;
+        workers[t].count = channelCnt / threadCnt + (t < channelCnt % threadCnt);
+        first += workers[t].count;
+        pthread_create(&workers[t].thread, NULL, decodeChannels, &workers[t]);
+    }
+    for (t = 0; t < threadCnt; t++) pthread_join(workers[t].thread, NULL);
+    return wallClockSeconds() - start;
+}
+
+int main(int argc, char *argv[]) {
+    unsigned long channelBits = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_CHANNEL_BITS;
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int maxThreads = argc > 2 ? atoi(argv[2]) : (int)cores;
+    int channelCnt, threads, k;
+    unsigned long long totalBits = 0;
+    struct Channel *channels;
+    double elapsed, baseline = 0, rate;
+
+    if (maxThreads < 1) maxThreads = 1;
+    if (maxThreads > 64) maxThreads = 64;
+    channelCnt = maxThreads;
+
+    channels = calloc(channelCnt, sizeof(*channels));
+    if (channels == NULL) {
+        printf("Out of memory.\n");
+        return 1;
+    }
+    for (k = 0; k < channelCnt; k++) {
+        if (generateChannel(&channels[k], channelBits, k + 1) != 0) {
+            printf("Out of memory.\n");
+            return 1;
+        }
+        totalBits += channels[k].len;
+    }
+
+    printf("Channels: %d x %lu bits, %ld online cores\n", channelCnt, channelBits, cores);
+    printf("%8s %12s %10s %10s %10s\n", "Threads", "Seconds", "Mbit/s", "Speedup", "Efficiency");
+    for (threads = 1; ; threads *= 2) {
+        if (threads > maxThreads) threads = maxThreads;
+        elapsed = run(channels, channelCnt, threads);
+        rate = totalBits / elapsed / 1e6;
+        if (threads == 1) baseline = rate;
+        printf("%8d %12.3f %10.2f %9.2fx %9.0f%%\n", threads, elapsed, rate, rate / baseline, 100.0 * rate / baseline / threads);
+        if (threads == maxThreads) break;
+    }
+
+    for (k = 0; k < channelCnt; k++) free(channels[k].bits);
+    free(channels);
+    return 0;
+}
@@ -0,0 +1,339 @@
+/*
+ * Decoder for the deferred log of the Deadline 5 firmware (DEFERRED_LOG).
+ *
+ * Reads a capture of the firmware's serial output and turns the binary
+ * records back into the text the inline build prints: messages, frame info
+ * and, with LOG_PLOT, the plotValues() lines for the Serial Plotter. Field
+ * changes, sample/writing points and edges (LOG_FIELDS, LOG_BITS,
+ * LOG_EDGES) have no inline counterpart and are printed in the decoder's
+ * log format; -e writes the edges alone as an EdgeReplayHarness input.
+ * The bus monitor's capture (LISTEN_ONLY) comes out one line per frame,
+ * error or overload flag, alone with -c.
+ * Bytes outside records (plain Serial prints) are copied as they are.
+ *
+ * The record layout and message numbers are those of CANController1.ino.
+ *
+ * Build: gcc -O2 -o SerialLog SerialLog.c
+ * Usage: SerialLog [options] [capture file]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#define LOG_SYNC           0xA5
+#define LOG_RECORD_MESSAGE 1
+#define LOG_RECORD_FIELD   2
+#define LOG_RECORD_SAMPLE  3
+#define LOG_RECORD_WRITE   4
+#define LOG_RECORD_PLOT    5
+#define LOG_RECORD_FRAME   6
+#define LOG_RECORD_DROPPED 7
+#define LOG_RECORD_EDGE    8
+#define LOG_RECORD_CAPTURE 9
+
+#define CAPTURE_FRAME    1
+#define CAPTURE_ERROR    2
+#define CAPTURE_OVERLOAD 3
+#define CAPTURE_HEADER_LEN 13
+
+#define LOG_PLOT_WRITING_POINT 0x01
+#define LOG_PLOT_SAMPLE_POINT  0x02
+#define LOG_PLOT_HARD_SYNC     0x04
+#define LOG_PLOT_RESYNC        0x08
+
+#define FRAME_FLAG_RTR 0x01
+#define FRAME_FLAG_SRR 0x02
+#define FRAME_FLAG_IDE 0x04
+#define FRAME_FLAG_R1  0x08
+#define FRAME_FLAG_R0  0x10
+#define FRAME_MAX_DLC  8
+#define FRAME_HEADER_LEN 11 // Sync, type, id, flags, dlc, crc and bitIndex.
+
+#define OUTPUT_ALL  0
+#define OUTPUT_TEXT 1 // Everything but the plot lines.
+#define OUTPUT_PLOT 2 // Plot lines only, for the Serial Plotter.
+#define OUTPUT_EDGE 3 // Edge timestamps only, for EdgeReplayHarness.
+#define OUTPUT_CAPTURE 4 // Bus monitor capture only.
+
+// Indexed by MSG_* id, with "%u" for the values, as at the LOG_MESSAGE() call sites.
+static const char *const messages[] = {
+    [1]  = "Lost arbitration. ",
+    [2]  = "Acknowledged!\n",
+    [3]  = "Bit error: Sampled bit level is different from the bit level written by the encoder.\n"
+           "Written bit: %u Sampled bit: %u\n",
+    [4]  = "Bit stuffing error at index %u\n",
+    [5]  = "Retransmitting at the next intermission.\n",
+    [6]  = "Retry limit reached. Dropping frame.\n",
+    [7]  = "Bus-off: TEC %u, REC %u\n",
+    [8]  = "Error-passive: TEC %u, REC %u\n",
+    [9]  = "Error-active: TEC %u, REC %u\n",
+    [10] = "Bus-off recovery: error-active.\n",
+    [11] = "Overload error: Maximum of 2 Overload frames allowed to delay Data/Remote frame.\n",
+    [12] = "Interframe space error: Expecting 3 recessive bits during Intermission.\n",
+    [13] = "CRC delimiter error: Must be a recessive bit.\n",
+    [14] = "Acknowledgment error: Failed to validade the message correctly.\n",
+    [15] = "CRC error: The calculated result is not the same as that received in the CRC sequence.\n",
+    [16] = "Acknowledgment delimiter error: Must be a recessive bit.\n",
+    [17] = "End of frame error: Expecting a flag sequence consisting of 7 recessive bits.\n",
+    [18] = "Error flag error: Expecting at least 6 equal bits during error flag.\n",
+    [19] = "Error flag error: Expecting maximum of 12 equal bits during error flag.\n",
+    [20] = "Error delimiter error: Expecting 8 recessive bits during error delimiter.\n",
+    [21] = "Overload flag error: Expecting 6 dominant bits during overload flag.\n",
+    [22] = "Overload delimiter error: Expecting 8 recessive bits during overload delimiter.\n",
+    [23] = "Decoder error: invalid frame field.\n",
+    [24] = "Start receiving error flag...\n",
+    [25] = "Unknown segment!\n",
+    [26] = "Worst TX wait: %u bit times, %u attempt(s).\n",
+    [27] = "Receive path busy: overload frame %u of %u.\n",
+};
+
+// Frame fields and sub-fields, indexed by their number in the firmware.
+static const char *const fieldNames[] = {
+    "INTERFRAME_SPACE", "INTERFRAME_SPACE_INTERMISSION", "INTERFRAME_SPACE_BUS_IDLE", "START_OF_FRAME",
+    "ARBITRATION", "ARBITRATION_IDENTIFIER_11_BIT", "ARBITRATION_RTR", "ARBITRATION_SRR", "ARBITRATION_IDE",
+    "ARBITRATION_IDENTIFIER_18_BIT", "CONTROL", "CONTROL_IDE", "CONTROL_r0", "CONTROL_DLC", "CONTROL_r1",
+    "DATA", "CRC", "CRC_SEQUENCE", "CRC_DELIMITER", "ACK", "ACK_SLOT", "ACK_DELIMITER", "END_OF_FRAME",
+    "BIT_STUFFING", "ERROR", "ERROR_FLAG", "ERROR_DELIMITER", "OVERLOAD", "OVERLOAD_FLAG", "OVERLOAD_DELIMITER",
+    "PASSIVE_ERROR_FLAG", "BUS_OFF"
+};
+
+struct Stats {
+    unsigned long records;
+    unsigned long dropped;
+    unsigned long invalid; // Records of an unknown type or message.
+};
+
+static const char *fieldName(unsigned char field) {
+    return field < sizeof(fieldNames) / sizeof(fieldNames[0]) ? fieldNames[field] : "?";
+}
+
+static void printBits(uint32_t value, int len) {
+    int i;
+    for (i = len - 1; i >= 0; i--) putchar('0' + ((value >> i) & 1));
+}
+
+// Same substitution as the firmware's logPrint().
+static void printMessage(const char *format, unsigned int a, unsigned int b) {
+    int first = 1;
+    for (; *format; format++) {
+        if (format[0] == '%' && format[1] == 'u') {
+            printf("%u", first ? a : b);
+            first = 0;
+            format++;
+        } else {
+            putchar(*format);
+        }
+    }
+}
+
+// printFrameInfo() of the inline build. Returns the record length, or 0 if
+// the record is cut short.
+static size_t printFrame(const unsigned char *r, size_t avail, int print) {
+    uint32_t id = r[2] | r[3] << 8 | r[4] << 16 | (uint32_t)r[5] << 24;
+    unsigned char flags = r[6], dlc = r[7], bitIndex = r[10];
+    unsigned int crc = r[8] | r[9] << 8;
+    unsigned int dataLen = flags & FRAME_FLAG_RTR ? 0 : dlc < FRAME_MAX_DLC ? dlc : FRAME_MAX_DLC;
+    size_t len = FRAME_HEADER_LEN + dataLen + (bitIndex + 7) / 8;
+    const unsigned char *data = r + FRAME_HEADER_LEN, *bits = data + dataLen;
+    unsigned int i;
+
+    if (avail < len) return 0;
+    if (!print) return len;
+    printf("\n------- FRAME INFO -------\n");
+    printf("ID (11-bit): ");
+    printBits(flags & FRAME_FLAG_IDE ? id >> 18 : id, 11);
+    printf("\nRTR: %d\n", (flags & FRAME_FLAG_RTR) != 0);
+    printf("IDE: %d\n", (flags & FRAME_FLAG_IDE) != 0);
+    if (flags & FRAME_FLAG_IDE) {
+        printf("SRR: %d\n", (flags & FRAME_FLAG_SRR) != 0);
+        printf("ID (18-bit): ");
+        printBits(id, 18);
+        printf("\nr1: %d\n", (flags & FRAME_FLAG_R1) != 0);
+    }
+    printf("r0: %d\n", (flags & FRAME_FLAG_R0) != 0);
+    printf("DLC: ");
+    printBits(dlc, 4);
+    printf("\n");
+    if (!(flags & FRAME_FLAG_RTR)) {
+        printf("Data: ");
+        for (i = 0; i < dataLen; i++) printBits(data[i], 8);
+        printf("\n");
+    }
+    printf("CRC: ");
+    printBits(crc, 15);
+    printf("\nFrame (destuffed): ");
+    for (i = 0; i < bitIndex; i++) putchar('0' + ((bits[i >> 3] >> (7 - (i & 7))) & 1));
+    printf("\n\n");
+    return len;
+}
+
+// CAPTURE record: "<bit time> <id> [<dlc>] <data>" for a frame, or
+// "<bit time> error in <field>, <sub-field>", "<bit time> overload". Returns
+// the record length, 0 if it is cut short.
+static size_t printCapture(const unsigned char *r, size_t avail, int print) {
+    unsigned long bitTime = r[3] | r[4] << 8 | (unsigned long)r[5] << 16 | (unsigned long)r[6] << 24;
+    unsigned long id = r[7] | r[8] << 8 | (unsigned long)r[9] << 16 | (unsigned long)r[10] << 24;
+    unsigned char flags = r[11], dlc = r[12];
+    size_t len = CAPTURE_HEADER_LEN, i;
+
+    if (r[2] == CAPTURE_FRAME && !(flags & FRAME_FLAG_RTR)) len += dlc < FRAME_MAX_DLC ? dlc : FRAME_MAX_DLC;
+    if (avail < len) return 0;
+    if (!print) return len;
+    printf("%10lu ", bitTime);
+    if (r[2] == CAPTURE_FRAME) {
+        printf(flags & FRAME_FLAG_IDE ? "%08lX" : "     %03lX", id);
+        printf(" [%u]", dlc);
+        if (flags & FRAME_FLAG_RTR) printf(" remote");
+        for (i = CAPTURE_HEADER_LEN; i < len; i++) printf(" %02X", r[i]);
+        printf("\n");
+    } else if (r[2] == CAPTURE_ERROR) {
+        printf("error in %s, %s\n", fieldName(flags), fieldName(dlc));
+    } else {
+        printf("overload\n");
+    }
+    return len;
+}
+
+// plotValues() of the inline build: five copies of the same line.
+static void printPlot(unsigned char tqSegCnt, unsigned char segment, unsigned char flags) {
+    int i;
+    for (i = 0; i < 5; i++) {
+        printf("%d %d %d %d %d %d \n", tqSegCnt + 6, flags & LOG_PLOT_WRITING_POINT ? 1 : 0,
+               flags & LOG_PLOT_SAMPLE_POINT ? -1 : -2, segment + 2, flags & LOG_PLOT_HARD_SYNC ? -3 : -4,
+               flags & LOG_PLOT_RESYNC ? -5 : -6);
+    }
+}
+
+// Decode one record at r. Returns its length, 0 if it is cut short by the
+// end of the capture, or 1 to skip a sync byte that starts no valid record.
+static size_t decodeRecord(const unsigned char *r, size_t avail, int output, struct Stats *s) {
+    int text = output == OUTPUT_ALL || output == OUTPUT_TEXT;
+    size_t len;
+    unsigned long tick;
+
+    if (avail < 2) return 0;
+    switch (r[1]) {
+        case LOG_RECORD_MESSAGE:
+            if (avail < 7) return 0;
+            if (r[2] >= sizeof(messages) / sizeof(messages[0]) || messages[r[2]] == NULL) break;
+            if (text) printMessage(messages[r[2]], r[3] | r[4] << 8, r[5] | r[6] << 8);
+            s->records++;
+            return 7;
+        case LOG_RECORD_FIELD:
+        case LOG_RECORD_SAMPLE:
+        case LOG_RECORD_WRITE:
+            if (avail < 5) return 0;
+            if (text && r[1] == LOG_RECORD_FIELD) printf("Field: %s, %s\n", fieldName(r[3]), fieldName(r[4]));
+            if (text && r[1] == LOG_RECORD_SAMPLE) printf("Sample point: bit %u\n", r[2]);
+            if (text && r[1] == LOG_RECORD_WRITE) printf("Writing point: bit %u\n", r[2]);
+            s->records++;
+            return 5;
+        case LOG_RECORD_PLOT:
+            if (avail < 5) return 0;
+            if (output == OUTPUT_ALL || output == OUTPUT_PLOT) printPlot(r[2], r[3], r[4]);
+            s->records++;
+            return 5;
+        case LOG_RECORD_FRAME:
+            if (avail < FRAME_HEADER_LEN) return 0;
+            len = printFrame(r, avail, text);
+            if (len > 0) s->records++;
+            return len;
+        case LOG_RECORD_DROPPED:
+            if (avail < 4) return 0;
+            if (text || output == OUTPUT_CAPTURE) printf("[%u log records dropped]\n", r[2] | r[3] << 8);
+            s->dropped += r[2] | r[3] << 8;
+            s->records++;
+            return 4;
+        case LOG_RECORD_EDGE:
+            if (avail < 7) return 0;
+            tick = r[3] | r[4] << 8 | (unsigned long)r[5] << 16 | (unsigned long)r[6] << 24;
+            if (text) printf("Edge: tick %lu%s\n", tick, r[2] ? " (hard sync)" : "");
+            if (output == OUTPUT_EDGE) printf("%lu%s\n", tick, r[2] ? " h" : "");
+            s->records++;
+            return 7;
+        case LOG_RECORD_CAPTURE:
+            if (avail < CAPTURE_HEADER_LEN) return 0;
+            if (r[2] < CAPTURE_FRAME || r[2] > CAPTURE_OVERLOAD) break;
+            if (text && printCapture(r, avail, 0) > 0) printf("Capture: ");
+            len = printCapture(r, avail, text || output == OUTPUT_CAPTURE);
+            if (len > 0) s->records++;
+            return len;
+    }
+    s->invalid++;
+    return 1;
+}
+
+static void printUsage(const char *program) {
+    printf("Usage: %s [options] [capture file]\n", program);
+    printf("Decodes the serial output of the firmware's deferred log (stdin by default).\n");
+    printf("  -t  Text only: leave out the plot lines.\n");
+    printf("  -p  Plot lines only, as the Serial Plotter takes them.\n");
+    printf("  -c  Bus monitor capture only, one line per frame, error or overload flag.\n");
+    printf("  -e  Edge timestamps only, one \"<tick> [h]\" line each (EdgeReplayHarness input).\n");
+    printf("  -s  Print the record counts to stderr at the end.\n");
+}
+
+int main(int argc, char *argv[]) {
+    const char *path = NULL;
+    FILE *fp = stdin;
+    unsigned char *buf = NULL, *grown;
+    size_t size = 0, cap = 0, n, pos, len;
+    struct Stats s = {0, 0, 0};
+    int i, output = OUTPUT_ALL, stats = 0;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-t") == 0) {
+            output = OUTPUT_TEXT;
+        } else if (strcmp(argv[i], "-p") == 0) {
+            output = OUTPUT_PLOT;
+        } else if (strcmp(argv[i], "-c") == 0) {
+            output = OUTPUT_CAPTURE;
+        } else if (strcmp(argv[i], "-e") == 0) {
+            output = OUTPUT_EDGE;
+        } else if (strcmp(argv[i], "-s") == 0) {
+            stats = 1;
+        } else if (argv[i][0] != '-' && path == NULL) {
+            path = argv[i];
+        } else {
+            printUsage(argv[0]);
+            return strcmp(argv[i], "-h") != 0;
+        }
+    }
+
+    if (path != NULL && (fp = fopen(path, "rb")) == NULL) {
+        printf("Could not open %s.\n", path);
+        return 1;
+    }
+    do {
+        if (size == cap) {
+            cap = cap ? 2 * cap : 1 << 16;
+            grown = realloc(buf, cap);
+            if (grown == NULL) {
+                printf("Out of memory.\n");
+                free(buf);
+                return 1;
+            }
+            buf = grown;
+        }
+        n = fread(buf + size, 1, cap - size, fp);
+        size += n;
+    } while (n > 0);
+    if (fp != stdin) fclose(fp);
+
+    for (pos = 0; pos < size; pos += len) {
+        if (buf[pos] != LOG_SYNC) {
+            if (output == OUTPUT_ALL || output == OUTPUT_TEXT) putchar(buf[pos]);
+            len = 1;
+            continue;
+        }
+        len = decodeRecord(buf + pos, size - pos, output, &s);
+        if (len == 0) {
+            fprintf(stderr, "SerialLog: capture ends inside a record.\n");
+            break;
+        }
+    }
+    if (stats) fprintf(stderr, "%lu records, %lu dropped, %lu invalid.\n", s.records, s.dropped, s.invalid);
+    free(buf);
+    return 0;
+}
@@ -0,0 +1,139 @@
+/*
+ * TQ-stepped bit timing engine of the Deadline 5 firmware, for the host
+ * harnesses.
+ *
+ * incrementTq() runs bitTimingStateMachine() once per time quantum, as the
+ * firmware's TQ timer interrupt does; an edge raises hardSyncBool or
+ * resyncBool, as flagSync() does, and is handled at the next TQ. The
+ * segment lengths and the SJW come from bitTiming. This is the code of
+ * CANController1.ino without the runtime bit timing changes
+ * (applyPendingBitTiming()) and the log.
+ */
+#ifndef CAN_BIT_TIMING_H
+#define CAN_BIT_TIMING_H
+
+#include <stdbool.h>
+
+#ifndef min
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#endif
+
+// Defining segments.
+#define SYNC_SEG 0
+#define PROP_SEG 1
+#define PHASE_SEG1 2
+#define PHASE_SEG2 3
+
+#define SYNC_SEG_LEN 1
+
+typedef struct {
+    unsigned char propSeg;
+    unsigned char phaseSeg1;
+    unsigned char phaseSeg2;
+    unsigned char sjw;
+} BitTiming;
+
+// Firmware power-up timing: 1/7/7 TQ, SJW 5.
+static BitTiming bitTiming = {1, 7, 7, 5};
+
+/******** Firmware state ********/
+static volatile bool samplePoint  = false;
+static volatile bool writingPoint = false;
+static volatile bool hardSyncBool  = false;
+static volatile bool resyncBool    = false;
+static volatile bool advanceStateMachine = false;
+static volatile unsigned char currentSegment = PROP_SEG;
+static volatile unsigned char tqSegCnt       = 0;
+static volatile unsigned char phaseError     = 0;
+static volatile unsigned char phaseSeg1Len   = 7;
+static volatile unsigned char phaseSeg2Len   = 7;
+
+static inline void restoreSegsDefaultLen(void) {
+    phaseSeg1Len = bitTiming.phaseSeg1;
+    phaseSeg2Len = bitTiming.phaseSeg2;
+}
+
+static inline void resync(void) {
+    switch(currentSegment){
+        case SYNC_SEG:
+            break;
+        case PROP_SEG:
+            resyncBool = true;
+            // Lengthen PHASE_SEG1 to compensate phase error (max. SJW).
+            phaseError = min(tqSegCnt + SYNC_SEG_LEN, bitTiming.propSeg);
+            phaseSeg1Len = bitTiming.phaseSeg1 + ((phaseError <= bitTiming.sjw) ? phaseError : bitTiming.sjw);
+            break;
+        case PHASE_SEG1:
+            resyncBool = true;
+            // Lengthen segment to compensate phase error (max. SJW).
+            phaseError = tqSegCnt + bitTiming.propSeg + SYNC_SEG_LEN;
+            phaseSeg1Len = bitTiming.phaseSeg1 + ((phaseError <= bitTiming.sjw) ? phaseError : bitTiming.sjw);
+            break;
+        case PHASE_SEG2:
+            resyncBool = true;
+            // Shorten segment to compensate phase error (max. SJW).
+            phaseError = min((bitTiming.phaseSeg2 - tqSegCnt), bitTiming.phaseSeg2);
+            phaseSeg2Len = bitTiming.phaseSeg2 - ((phaseError <= bitTiming.sjw) ? phaseError : bitTiming.sjw);
+            break;
+    }
+}
+
+static inline void bitTimingStateMachine(void) {
+    if (hardSyncBool) {
+        writingPoint = false;
+        currentSegment = PROP_SEG;
+        tqSegCnt = 0;
+    } else if (resyncBool) {
+        resync();
+    }
+    switch(currentSegment) {
+        case SYNC_SEG:
+            if(tqSegCnt == SYNC_SEG_LEN) {
+              tqSegCnt = 0;
+              writingPoint = false; // Disable writing point.
+              currentSegment = PROP_SEG;
+            }
+            break;
+        case PROP_SEG:
+            if(tqSegCnt == bitTiming.propSeg) {
+              tqSegCnt = 0;
+              currentSegment = PHASE_SEG1;
+            }
+            break;
+        case PHASE_SEG1:
+            if(tqSegCnt == phaseSeg1Len) {
+              samplePoint = true; // Enable sample point.
+              tqSegCnt = 0;
+              currentSegment = PHASE_SEG2;
+              restoreSegsDefaultLen();
+            }
+            break;
+        case PHASE_SEG2:
+            if(samplePoint) samplePoint = false; // Disable sample point.
+            if(tqSegCnt == phaseSeg2Len) {
+              writingPoint = true; // Enable writing point.
+              tqSegCnt = 0;
+              currentSegment = SYNC_SEG;
+              restoreSegsDefaultLen();
+            }
+            break;
+    }
+    hardSyncBool = false;
+    resyncBool = false;
+}
+
+static inline void incrementTq(void) {
+    tqSegCnt++;
+    bitTimingStateMachine();
+    advanceStateMachine = true;
+}
+
+// Power-up state: PROP_SEG of the first bit, no pending edge.
+static inline void resetBitTiming(void) {
+    samplePoint = writingPoint = hardSyncBool = resyncBool = advanceStateMachine = false;
+    currentSegment = PROP_SEG;
+    tqSegCnt = phaseError = 0;
+    restoreSegsDefaultLen();
+}
+
+#endif
@@ -0,0 +1,958 @@
+/*
+ * CAN controller context and the Deadline 4 decoder/encoder state machines.
+ *
+ * Every piece of decoder and encoder state lives in a struct Controller and
+ * every state action takes the context it works on, so one process can
+ * run any number of independent channels (one context per bus, or per
+ * thread) with no shared mutable state. controllerInit() resets a context
+ * to bus idle; controllerSampleBit() feeds it one bus bit.
+ */
+#ifndef CAN_CONTROLLER_H
+#define CAN_CONTROLLER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include "can_frame.h"
+#include "can_record.h"
+#include "can_log.h"
+
+/*
+ * Decoder states. Each field of the frame, or each sub-field of the fields
+ * that have some, is one state of a flat state machine: decoderStates[]
+ * maps every state to the action run on the bits sampled in it.
+ */
+
+/********** Interframe Space ***********/
+#define INTERFRAME_SPACE_INTERMISSION   0
+#define INTERFRAME_SPACE_BUS_IDLE       1
+/***************************************/
+
+/**** Start of Frame ***/
+#define START_OF_FRAME  2
+/***********************/
+
+/************* Arbitration *************/
+/*** Standard/Extended format fields ***/
+#define ARBITRATION_IDENTIFIER_11_BIT   3
+#define ARBITRATION_RTR                 4
+/**** Extended format extra fields *****/
+#define ARBITRATION_SRR                 5
+#define ARBITRATION_IDE                 6
+#define ARBITRATION_IDENTIFIER_18_BIT   7
+/***************************************/
+
+/************* Control *************/
+/* Standard/Extended format fields */
+#define CONTROL_IDE 8
+#define CONTROL_r0  9
+#define CONTROL_DLC 10
+/*** Extended format extra fields **/
+#define CONTROL_r1  11
+/***********************************/
+
+/*** Data ****/
+#define DATA 12
+/*************/
+
+/******* CRC check ******/
+#define CRC_SEQUENCE    13
+#define CRC_DELIMITER   14
+/************************/
+
+/********** ACK *********/
+#define ACK_SLOT        15
+#define ACK_DELIMITER   16
+/************************/
+
+/****** End of Frame ****/
+#define END_OF_FRAME    17
+/************************/
+
+/****** Bit Stuffing ****/
+#define BIT_STUFFING    18
+/************************/
+
+/****** Error frame *****/
+#define ERROR_FLAG      19
+#define ERROR_DELIMITER 20
+/************************/
+
+/***** Overload frame ******/
+#define OVERLOAD_FLAG      21
+#define OVERLOAD_DELIMITER 22
+/***************************/
+
+/*** Fault confinement ***/
+#define PASSIVE_ERROR_FLAG 23
+#define BUS_OFF            24
+/*************************/
+
+#define DECODER_STATE_CNT  25
+
+/*
+ * Fault confinement modes (CAN 2.0 part B, section 8). An error-active node
+ * signals errors with 6 dominant bits, an error-passive one with 6 recessive
+ * bits, and a bus-off node does not drive the bus until it has seen 128
+ * sequences of 11 recessive bits.
+ */
+#define ERROR_ACTIVE  0
+#define ERROR_PASSIVE 1
+#define ERROR_BUS_OFF 2
+
+#define ERROR_PASSIVE_LIMIT        128 // TEC or REC from which a node is error-passive.
+#define BUS_OFF_LIMIT              256 // TEC from which a node is bus-off.
+#define REC_AFTER_PASSIVE          119 // REC after a good frame received while error-passive.
+#define BUS_OFF_RECOVERY_BITS      11
+#define BUS_OFF_RECOVERY_SEQUENCES 128
+
+#define MAX_FRAME_SIZE 127
+
+// Fault confinement steps kept by a ChunkLog: an error increment (1 or 8),
+// a success or the bus-off recovery, by the transmitter or a receiver.
+#define CONFINEMENT_SUCCESS     0x10
+#define CONFINEMENT_RECOVERY    0x20
+#define CONFINEMENT_TRANSMITTER 0x80
+
+/*
+ * Split decoding (see decodeTraceSplit() in DecoderEncoder.c): a chunk of
+ * the trace is decoded from a fresh bus-idle context, with bit-times counted
+ * from its first bit. Its records and fault confinement steps are kept until
+ * the chunks before it are known, then fixed up and written out.
+ */
+struct ChunkLog {
+    struct FrameRecord *records;
+    long *logOffsets;           // Length of logFile when each record was emitted.
+    size_t recordCnt, recordCap;
+    unsigned char *steps;       // CONFINEMENT_* steps, in order.
+    size_t stepCnt, stepCap;
+    int failed;                 // Out of memory: some entries are missing.
+};
+
+struct Controller {
+    unsigned char state;     // Decoder state.
+    unsigned char prevState; // State to return to after a stuff bit.
+
+    unsigned char frameBuf[(MAX_FRAME_SIZE + 7) / 8]; // Destuffed frame bits, packed MSB-first.
+    unsigned char sampledBit;
+    unsigned char writingBit;
+    unsigned char previousBit;
+    unsigned char bitIndex;
+    unsigned char bitCnt;
+    unsigned char hasError;
+    unsigned char crcError;
+    unsigned char isTransmitter;
+    unsigned char bitFieldIndex;
+    unsigned char overloadFrameCnt;
+    unsigned char samePolarityBitCnt;
+    unsigned char loopback; // Feed the encoder's output back as the bus level (Deadline 4 echo test).
+    unsigned char crcChecked;
+
+    unsigned long long bitTime;           // Bus bits seen since the start of the trace.
+    unsigned long long frameStartBitTime; // Bit-time of the current frame's SOF.
+
+    // Decoded frame output (see can_record.h).
+    unsigned char outputFormat;
+    FILE *outputFile;
+    FILE *logFile; // Text output and log messages, NULL to discard them.
+    unsigned long bitrate; // Converts bit-times to candump timestamps.
+    const char *interfaceName;
+
+    unsigned char dlc;
+    uint16_t crc; // CRC-15 register, see can_crc.h.
+
+    struct Frame frame;
+    struct Frame receivedframe;
+
+    // Statistics.
+    unsigned long frameCnt;
+    unsigned long crcFailCnt;
+    unsigned long errorCnt[ERROR_TYPE_ACK + 1]; // Indexed by ERROR_TYPE_*.
+
+    // Fault confinement.
+    uint16_t tec;                     // Transmit error counter.
+    uint16_t rec;                     // Receive error counter.
+    unsigned char errorState;         // ERROR_ACTIVE, ERROR_PASSIVE or ERROR_BUS_OFF.
+    unsigned char wasTransmitter;     // Sent the last frame, or the one the error frame is about.
+    unsigned char recoveryCnt;        // 11-bit recessive sequences seen while bus-off.
+
+    struct ChunkLog *chunkLog;        // Split decoding only, NULL otherwise.
+};
+
+static inline void chunkLogRecord(struct ChunkLog *log, const struct FrameRecord *rec, FILE *logFile) {
+    void *records, *offsets;
+    if (log->recordCnt == log->recordCap) {
+        log->recordCap = log->recordCap ? 2 * log->recordCap : 64;
+        records = realloc(log->records, log->recordCap * sizeof(*log->records));
+        if (records != NULL) log->records = records;
+        offsets = realloc(log->logOffsets, log->recordCap * sizeof(*log->logOffsets));
+        if (offsets != NULL) log->logOffsets = offsets;
+        if (records == NULL || offsets == NULL) {
+            log->recordCap = log->recordCnt;
+            log->failed = 1;
+            return;
+        }
+    }
+    log->records[log->recordCnt] = *rec;
+    log->logOffsets[log->recordCnt++] = logFile != NULL ? ftell(logFile) : 0;
+}
+
+static inline void chunkLogStep(struct ChunkLog *log, unsigned char step) {
+    unsigned char *steps;
+    if (log->stepCnt == log->stepCap) {
+        steps = realloc(log->steps, (log->stepCap ? 2 * log->stepCap : 64) * sizeof(*log->steps));
+        if (steps == NULL) {
+            log->failed = 1;
+            return;
+        }
+        log->steps = steps;
+        log->stepCap = log->stepCap ? 2 * log->stepCap : 64;
+    }
+    log->steps[log->stepCnt++] = step;
+}
+
+static inline void chunkLogFree(struct ChunkLog *log) {
+    free(log->records);
+    free(log->logOffsets);
+    free(log->steps);
+    memset(log, 0, sizeof(*log));
+}
+
+static const unsigned char errorOverloadFrame[14] = {0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1};
+
+// Reset a context to bus idle with the default output settings.
+static void controllerInit(struct Controller *c) {
+    memset(c, 0, sizeof(*c));
+    c->state = INTERFRAME_SPACE_BUS_IDLE;
+    c->samePolarityBitCnt   = 1;
+    c->outputFormat  = FORMAT_TEXT;
+    c->outputFile    = stdout;
+    c->logFile       = stdout;
+    c->bitrate       = 500000;
+    c->interfaceName = "can0";
+}
+
+static void printBits(FILE *fp, uint32_t value, int len) {
+    int i;
+    char str[33];
+    for (i = 0; i < len; i++) {
+        str[i] = ((value >> (len - 1 - i)) & 1) + '0';
+    }
+    str[len] = '\0';
+    if (fp != NULL) fputs(str, fp);
+}
+
+static inline void printFrameInfo(const struct Controller *c, const struct Frame *f) {
+    int i;
+    FILE *fp = c->logFile;
+    if (fp == NULL) return;
+    fprintf(fp, "\n------- FRAME INFO -------\n");
+    fprintf(fp, "ID (11-bit): ");
+    printBits(fp, frameIsExtended(f) ? f->id >> 18 : f->id, 11);
+    fprintf(fp, "\n");
+
+    fprintf(fp, "RTR: %d\n", frameGetFlag(f, FRAME_FLAG_RTR));
+
+    fprintf(fp, "IDE: %d\n", frameGetFlag(f, FRAME_FLAG_IDE));
+
+    if (frameIsExtended(f)) {
+        fprintf(fp, "SRR: %d\n", frameGetFlag(f, FRAME_FLAG_SRR));
+        fprintf(fp, "ID (18-bit): ");
+        printBits(fp, f->id, 18);
+        fprintf(fp, "\n");
+        fprintf(fp, "r1: %d\n", frameGetFlag(f, FRAME_FLAG_R1));
+    }
+
+    fprintf(fp, "r0: %d\n", frameGetFlag(f, FRAME_FLAG_R0));
+
+    fprintf(fp, "DLC: ");
+    printBits(fp, f->dlc, 4);
+    fprintf(fp, "\n");
+
+
+    if (!frameIsRemote(f)) {
+        fprintf(fp, "Data: ");
+        for (i = 0; i < frameDataLength(f); i++) {
+            printBits(fp, f->data[i], 8);
+        }
+        fprintf(fp, "\n");
+    }
+
+    fprintf(fp, "CRC: ");
+    printBits(fp, f->crc, 15);
+    fprintf(fp, "\n");
+
+    fprintf(fp, "Frame (destuffed): ");
+    for (i = 0; i < c->bitIndex; i += 8) {
+        printBits(fp, c->frameBuf[i >> 3] >> (c->bitIndex - i < 8 ? 8 - (c->bitIndex - i) : 0), c->bitIndex - i < 8 ? c->bitIndex - i : 8);
+    }
+
+    fprintf(fp, "\n\n");
+}
+
+static void checkBitStuffing(struct Controller *c) {
+    c->sampledBit == c->previousBit ? c->samePolarityBitCnt++ : (c->samePolarityBitCnt = 1);
+    c->previousBit = c->sampledBit;
+    if (c->samePolarityBitCnt == 5) {
+        LOG_BIT(c->logFile, "Destuffing next bit at index %d.\n", c->bitIndex);
+        c->samePolarityBitCnt = 1;
+        c->prevState = c->state;
+        c->state = BIT_STUFFING;
+    }
+}
+
+static void decodeStuffBit(struct Controller *c) {
+    if (c->sampledBit == c->previousBit) {
+        LOG_FRAME(c->logFile, "Bit stuffing error at index %d.\n", c->bitIndex);
+        c->hasError = ERROR_TYPE_STUFF;
+    } else {
+        LOG_BIT(c->logFile, "Stuffed bit: %d\n", c->sampledBit);
+        c->samePolarityBitCnt = 1;
+        c->previousBit = c->sampledBit;
+        c->state = c->prevState;
+    }
+}
+
+static void computeCrcSequence(struct Controller *c) {
+    c->crc = crc15UpdateBit(c->crc, c->sampledBit);
+}
+
+static int validateCrcSequence(struct Controller *c) {
+    LOG_FIELD(c->logFile, "CRC calculated: ");
+#if LOG_LEVEL >= LOG_LEVEL_FIELD
+    printBits(c->logFile, c->crc, 15);
+#endif
+    LOG_FIELD(c->logFile, ", received: ");
+#if LOG_LEVEL >= LOG_LEVEL_FIELD
+    printBits(c->logFile, c->receivedframe.crc, 15);
+#endif
+    LOG_FIELD(c->logFile, "\n");
+    c->crcChecked = 1;
+    c->crcError = c->crc != c->receivedframe.crc;
+    return c->crcError;
+}
+
+// Count a finished (or aborted) frame and write it in the binary/candump
+// output format. The text format is printed by printFrameInfo() through the
+// log levels.
+static void emitFrame(struct Controller *c, unsigned char errorType) {
+    struct FrameRecord rec;
+    if (errorType == ERROR_TYPE_NONE) c->frameCnt++;
+    else c->errorCnt[errorType]++;
+    if (c->crcChecked && c->crcError) c->crcFailCnt++;
+    if (c->outputFormat != FORMAT_TEXT) {
+        recordFromFrame(&rec, &c->receivedframe, errorType ? c->bitTime : c->frameStartBitTime,
+                        c->crcChecked && !c->crcError, errorType);
+        if (c->chunkLog != NULL) chunkLogRecord(c->chunkLog, &rec, c->logFile);
+        else if (c->outputFormat == FORMAT_BINARY) recordWriteBinary(c->outputFile, &rec);
+        else recordWriteCandump(c->outputFile, &rec, c->bitrate, c->interfaceName);
+    }
+    c->crcChecked = 0; // Count each CRC check once, not again for the error frames that follow.
+}
+
+/********** Fault confinement **********/
+static void updateErrorState(struct Controller *c) {
+    unsigned char state;
+    if (c->errorState == ERROR_BUS_OFF) return; // Left only through the recovery sequence.
+    if (c->tec >= BUS_OFF_LIMIT) state = ERROR_BUS_OFF;
+    else if (c->tec >= ERROR_PASSIVE_LIMIT || c->rec >= ERROR_PASSIVE_LIMIT) state = ERROR_PASSIVE;
+    else state = ERROR_ACTIVE;
+    if (state == c->errorState) return;
+    c->errorState = state;
+    LOG_FRAME(c->logFile, "Fault confinement: %s (TEC %u, REC %u).\n",
+              state == ERROR_BUS_OFF ? "bus-off" : state == ERROR_PASSIVE ? "error-passive" : "error-active",
+              c->tec, c->rec);
+    if (state == ERROR_BUS_OFF) {
+        // Off the bus, wherever in the frame the last error was counted.
+        c->isTransmitter = 0;
+        c->bitCnt = 0;
+        c->recoveryCnt = 0;
+        c->state = BUS_OFF;
+    }
+}
+
+// Charge an error to the counter of the node's role in the frame.
+static void countError(struct Controller *c, unsigned char increment) {
+    if (c->chunkLog != NULL) chunkLogStep(c->chunkLog, increment | (c->wasTransmitter ? CONFINEMENT_TRANSMITTER : 0));
+    if (c->wasTransmitter) c->tec += increment;
+    else c->rec = c->rec + increment < 255 ? c->rec + increment : 255;
+    updateErrorState(c);
+}
+
+// A frame sent or received up to the end of EOF.
+static void countSuccess(struct Controller *c, unsigned char transmitter) {
+    if (c->chunkLog != NULL) chunkLogStep(c->chunkLog, CONFINEMENT_SUCCESS | (transmitter ? CONFINEMENT_TRANSMITTER : 0));
+    if (transmitter) {
+        if (c->tec > 0) c->tec--;
+    } else if (c->rec >= ERROR_PASSIVE_LIMIT) {
+        c->rec = REC_AFTER_PASSIVE;
+    } else if (c->rec > 0) {
+        c->rec--;
+    }
+    updateErrorState(c);
+}
+
+// Counter increments for the error just detected:
+//   - a receiver adds 1, a transmitter 8, except for an ACK error seen by
+//     an error-passive transmitter;
+//   - an error during the node's own error or overload flag (a recessive
+//     bit in it, or too long a run of dominant bits after it) adds 8.
+static void confineError(struct Controller *c) {
+    unsigned char flagging = c->state == ERROR_FLAG || c->state == OVERLOAD_FLAG;
+    if (c->state < ERROR_FLAG && c->state != INTERFRAME_SPACE_INTERMISSION) c->wasTransmitter = c->isTransmitter;
+    if (flagging) countError(c, 8);
+    else if (!c->wasTransmitter) countError(c, 1);
+    else if (!(c->errorState == ERROR_PASSIVE && c->hasError == ERROR_TYPE_ACK)) countError(c, 8);
+}
+
+// CRC and bit stuffing bookkeeping of a bit from SOF up to the data field.
+static inline void frameBitDone(struct Controller *c) {
+    if (!c->hasError) {
+        computeCrcSequence(c);
+        checkBitStuffing(c);
+    }
+}
+
+/******* Interframe space and SOF *******/
+static void decodeStartOfFrame(struct Controller *c) {
+    LOG_BIT(c->logFile, "Start of Frame\n");
+    c->dlc      = 0;
+    c->bitCnt   = 0;
+    c->bitIndex = 0;
+    c->crcError = 0;
+    c->crcChecked = 0;
+    c->hasError = 0;
+    c->frameStartBitTime = c->bitTime;
+    memset(&c->receivedframe, 0, sizeof(c->receivedframe));  // Assuming Standard format when in Receiver mode.
+    c->bitFieldIndex     = 0;
+    c->overloadFrameCnt   = 0;
+    c->samePolarityBitCnt = 1;
+    c->previousBit = c->sampledBit;
+    packBit(c->frameBuf, c->bitIndex++, c->sampledBit);
+    c->state = ARBITRATION_IDENTIFIER_11_BIT;
+    c->crc = 0; // Reset CRC sequence.
+    computeCrcSequence(c);
+}
+
+static void decodeIntermission(struct Controller *c) {
+    LOG_BIT(c->logFile, "Interframe space\n");
+    if (c->sampledBit == 0) {
+        if (c->bitCnt == 2) {
+            /*
+             * If a CAN node has a message waiting for transmission and it samples a
+             * dominant bit at the third bit of INTERMISSION, it will interpret this as
+             * a START OF FRAME bit, and, with the next bit, start transmitting its message
+             * with the first bit of its IDENTIFIER without first transmitting a START OF FRAME bit
+             * and without becoming receiver.
+             */
+            decodeStartOfFrame(c);
+        } else {
+            c->overloadFrameCnt++;
+            if (c->overloadFrameCnt <= 2) {
+                // Overload frame. A dominant first intermission bit is
+                // already the first bit of the overload flag.
+                c->state = OVERLOAD_FLAG;
+                c->bitCnt = c->bitCnt == 0 ? 6 - 1 : 6; // Overload flag length.
+            } else {
+                LOG_FRAME(c->logFile, "Overload error: ");
+                LOG_FRAME(c->logFile, "Maximum of 2 Overload frames allowed to delay Data/Remote frame.\n");
+                c->hasError = ERROR_TYPE_FORM;
+            }
+        }
+    } else {
+        c->bitCnt++;
+        if (c->bitCnt == 3) {
+            c->bitCnt = 0;
+            // TODO: Create logic to decide wheter or not to transmit a frame after receiving one.
+            if (c->loopback) { // Forcing transmission after receiving a frame.
+                c->isTransmitter = 1;
+                c->state = START_OF_FRAME;
+                c->frame = c->receivedframe;  // Send back the received frame.
+                computeFrameCrc(&c->frame);
+            } else {
+                c->state = INTERFRAME_SPACE_BUS_IDLE;
+            }
+        }
+    }
+}
+
+static void decodeBusIdle(struct Controller *c) {
+    LOG_BIT(c->logFile, "Interframe space\n");
+    if (c->sampledBit == 0) decodeStartOfFrame(c);
+}
+
+/************* Arbitration *************/
+static void decodeIdentifier11(struct Controller *c) {
+    LOG_BIT(c->logFile, "Arbitration\n");
+    packBit(c->frameBuf, c->bitIndex++, c->sampledBit);
+    frameShiftIdBit(&c->receivedframe, c->sampledBit);
+    if (++c->bitFieldIndex == 11) {
+        LOG_FIELD(c->logFile, "Identifier (11-bit): 0x%03X\n", (unsigned int)c->receivedframe.id);
+        c->bitFieldIndex = 0;
+        if (c->isTransmitter) {
+            c->state = frameIsExtended(&c->frame) ? ARBITRATION_SRR : ARBITRATION_RTR;
+        } else {
+            c->state = ARBITRATION_RTR; // Assuming Standard format.
+        }
+    }
+    frameBitDone(c);
+}
+
+static void decodeRtr(struct Controller *c) {
+    LOG_BIT(c->logFile, "Arbitration\n");
+    frameSetFlag(&c->receivedframe, FRAME_FLAG_RTR, c->sampledBit);
+    packBit(c->frameBuf, c->bitIndex++, c->sampledBit);
+    if (frameIsExtended(&c->receivedframe)) c->state = CONTROL_r1;  // Extended format.
+    else c->state = CONTROL_IDE;    // Standard format.
+    frameBitDone(c);
+}
+
+// A receiver takes the SRR bit for the RTR bit of a standard frame until
+// the IDE bit tells otherwise: the bit it just sampled as IDE is followed
+// by the 18-bit identifier.
+static void skipToIdentifier18(struct Controller *c) {
+    frameSetFlag(&c->receivedframe, FRAME_FLAG_SRR, frameIsRemote(&c->receivedframe));
+    c->bitFieldIndex = 0;
+    c->state = ARBITRATION_IDENTIFIER_18_BIT;
+}
+
+static void decodeSrr(struct Controller *c) {
+    LOG_BIT(c->logFile, "Arbitration\n");
+    if (c->isTransmitter) {
+        frameSetFlag(&c->receivedframe, FRAME_FLAG_SRR, c->sampledBit);
+        packBit(c->frameBuf, c->bitIndex++, c->sampledBit);
+        c->state = ARBITRATION_IDE;
+    } else {
+        skipToIdentifier18(c);
+    }
+    frameBitDone(c);
+}
+
+static void decodeIde(struct Controller *c) {
+    LOG_BIT(c->logFile, "Arbitration\n");
+    if (c->isTransmitter) {
+        frameSetFlag(&c->receivedframe, FRAME_FLAG_IDE, c->sampledBit);
+        packBit(c->frameBuf, c->bitIndex++, c->sampledBit);
+    }
+    c->bitFieldIndex = 0;
+    c->state = ARBITRATION_IDENTIFIER_18_BIT;
+    frameBitDone(c);
+}
+
+static void decodeIdentifier18(struct Controller *c) {
+    LOG_BIT(c->logFile, "Arbitration\n");
+    packBit(c->frameBuf, c->bitIndex++, c->sampledBit);
+    frameShiftIdBit(&c->receivedframe, c->sampledBit);
+    if (++c->bitFieldIndex == 18) {
+        LOG_FIELD(c->logFile, "Identifier (29-bit): 0x%08X\n", (unsigned int)c->receivedframe.id);
+        c->state = ARBITRATION_RTR; // Assuming Standard format.
+    }
+    frameBitDone(c);
+}
+
+/*************** Control ***************/
+static void decodeControlIde(struct Controller *c) {
+    LOG_BIT(c->logFile, "Control\n");
+    frameSetFlag(&c->receivedframe, FRAME_FLAG_IDE, c->sampledBit);
+    packBit(c->frameBuf, c->bitIndex++, c->sampledBit);
+    if (!frameIsExtended(&c->receivedframe)) c->state = CONTROL_r0; // Standard format.
+    else skipToIdentifier18(c); // Extended format.
+    frameBitDone(c);
+}
+
+static void decodeR1(struct Controller *c) {
+    LOG_BIT(c->logFile, "Control\n");
+    frameSetFlag(&c->receivedframe, FRAME_FLAG_R1, c->sampledBit);
+    packBit(c->frameBuf, c->bitIndex++, c->sampledBit);
+    c->state = CONTROL_r0;
+    frameBitDone(c);
+}
+
+static void decodeR0(struct Controller *c) {
+    LOG_BIT(c->logFile, "Control\n");
+    frameSetFlag(&c->receivedframe, FRAME_FLAG_R0, c->sampledBit);
+    packBit(c->frameBuf, c->bitIndex++, c->sampledBit);
+    c->state = CONTROL_DLC;
+    c->bitFieldIndex = 0;
+    c->bitCnt = 4;
+    frameBitDone(c);
+}
+
+static void decodeDlc(struct Controller *c) {
+    LOG_BIT(c->logFile, "Control\n");
+    packBit(c->frameBuf, c->bitIndex++, c->sampledBit);
+    frameShiftDlcBit(&c->receivedframe, c->sampledBit);
+    c->bitCnt--;
+    c->dlc += (c->sampledBit << c->bitCnt);
+    if (c->bitCnt == 0) {
+        c->dlc = fmin(c->dlc, 8); // Maximum number of data bytes: 8.
+        LOG_FIELD(c->logFile, "DLC: %d\n", c->dlc);
+        c->bitFieldIndex = 0;
+        if (!frameIsRemote(&c->receivedframe) && c->dlc != 0) c->state = DATA; // Data frame.
+        else {
+            // Remote frame. Transitioning to CRC sequence.
+            c->bitCnt = 15;
+            c->state = CRC_SEQUENCE;
+        }
+    }
+    frameBitDone(c);
+}
+
+/***************** Data ****************/
+static void decodeData(struct Controller *c) {
+    LOG_BIT(c->logFile, "Data\n");
+    packBit(c->frameBuf, c->bitIndex++, c->sampledBit);
+    frameSetDataBit(&c->receivedframe, c->bitFieldIndex++, c->sampledBit);
+    c->bitCnt++;
+    if (c->bitCnt == 8 * c->dlc) {
+        c->bitCnt = 15;
+        c->bitFieldIndex = 0;
+        c->state = CRC_SEQUENCE;
+    }
+    frameBitDone(c);
+}
+
+/************* CRC and ACK *************/
+static void decodeCrcSequence(struct Controller *c) {
+    LOG_BIT(c->logFile, "CRC\n");
+    packBit(c->frameBuf, c->bitIndex++, c->sampledBit);
+    frameShiftCrcBit(&c->receivedframe, c->sampledBit);
+    c->bitCnt--;
+    if (c->bitCnt == 0) {
+        validateCrcSequence(c);
+        c->state = CRC_DELIMITER;
+    }
+    // Check bit stuffing.
+    if (!c->hasError)
+        checkBitStuffing(c);
+}
+
+static void decodeCrcDelimiter(struct Controller *c) {
+    LOG_BIT(c->logFile, "CRC\n");
+    if (c->sampledBit != 1) {
+        LOG_FRAME(c->logFile, "CRC delimiter error: ");
+        LOG_FRAME(c->logFile, "Must be a recessive bit.\n");
+        c->hasError = ERROR_TYPE_FORM;
+    } else {
+        packBit(c->frameBuf, c->bitIndex++, c->sampledBit);
+        c->state = ACK_SLOT;
+    }
+}
+
+static void decodeAckSlot(struct Controller *c) {
+    LOG_BIT(c->logFile, "ACK\n");
+    if (c->sampledBit == 1) { // None of the stations has acknowledged the message.
+        LOG_FRAME(c->logFile, "Acknowledgment error: ");
+        LOG_FRAME(c->logFile, "Failed to validade the message correctly.\n");
+        c->hasError = ERROR_TYPE_ACK;
+    } else {
+        packBit(c->frameBuf, c->bitIndex++, c->sampledBit);
+        c->state = ACK_DELIMITER;
+    }
+}
+
+static void decodeAckDelimiter(struct Controller *c) {
+    LOG_BIT(c->logFile, "ACK\n");
+    if (c->crcError) {
+        LOG_FRAME(c->logFile, "CRC error: ");
+        LOG_FRAME(c->logFile, "The calculated result is not the same as that received in the CRC sequence.\n");
+        c->hasError = ERROR_TYPE_CRC;
+    } else if (c->sampledBit != 1) {
+        LOG_FRAME(c->logFile, "Acknowledgment delimiter error: ");
+        LOG_FRAME(c->logFile, "Must be a recessive bit.\n");
+        c->hasError = ERROR_TYPE_FORM;
+    } else {
+        c->bitCnt = 0;
+        packBit(c->frameBuf, c->bitIndex++, c->sampledBit);
+        c->state = END_OF_FRAME;
+    }
+}
+
+static void decodeEndOfFrame(struct Controller *c) {
+    LOG_BIT(c->logFile, "End of frame\n");
+    if (c->sampledBit == 1) {
+        packBit(c->frameBuf, c->bitIndex++, c->sampledBit);
+        c->bitCnt++;
+        if (c->bitCnt == 7) {
+            c->bitCnt = 0;
+#if LOG_LEVEL >= LOG_LEVEL_FRAME
+            printFrameInfo(c, &c->receivedframe);
+#endif
+            emitFrame(c, ERROR_TYPE_NONE);
+            c->wasTransmitter = c->isTransmitter;
+            countSuccess(c, c->isTransmitter);
+            c->state = INTERFRAME_SPACE_INTERMISSION;
+            c->isTransmitter = 0;  // Disabling transmission.
+        }
+    } else {
+        LOG_FRAME(c->logFile, "End of frame error: ");
+        LOG_FRAME(c->logFile, "Expecting a flag sequence consisting of 7 recessive bits.\n");
+        c->hasError = ERROR_TYPE_FORM;
+    }
+}
+
+/******** Error and overload frames ********/
+static void decodeErrorFlag(struct Controller *c) {
+    LOG_BIT(c->logFile, "Error frame\n");
+    if (c->sampledBit == 0) {
+        // A receiver that still sees dominant right after its own flag was
+        // the first to flag the error.
+        if (++c->bitCnt == 7 && !c->wasTransmitter) countError(c, 8);
+    } else if (c->bitCnt < 6) {
+        LOG_FRAME(c->logFile, "Error flag error: ");
+        LOG_FRAME(c->logFile, "Expecting at least 6 equal bits during error flag.\n");
+        c->hasError = ERROR_TYPE_FORM;
+    } else if (c->bitCnt <= 12) {
+        c->bitCnt = 7;
+        c->state = ERROR_DELIMITER;
+    }
+    if (c->bitCnt > 12) {
+        LOG_FRAME(c->logFile, "Error flag error: ");
+        LOG_FRAME(c->logFile, "Expecting maximum of 12 equal bits during error flag.\n");
+        c->hasError = ERROR_TYPE_FORM;
+    }
+}
+
+// Error-passive flag: the node sends 6 recessive bits, and the flag is over
+// once 6 equal bits, of either level, have been seen on the bus. The
+// delimiter starts with the first recessive bit after that.
+static void decodePassiveErrorFlag(struct Controller *c) {
+    LOG_BIT(c->logFile, "Passive error frame\n");
+    if (c->bitCnt < 6) {
+        c->bitCnt = c->bitCnt > 0 && c->sampledBit == c->previousBit ? c->bitCnt + 1 : 1;
+        c->previousBit = c->sampledBit;
+        if (c->bitCnt < 6 || c->sampledBit == 0) return;
+    } else if (c->sampledBit == 0) {
+        if (++c->bitCnt == 7 && !c->wasTransmitter) countError(c, 8);
+        if (c->bitCnt == 6 + 8) { // Every 8 further dominant bits.
+            countError(c, 8);
+            c->bitCnt = 6;
+        }
+        return;
+    }
+    c->bitCnt = 7;
+    c->state = ERROR_DELIMITER;
+}
+
+static void decodeErrorDelimiter(struct Controller *c) {
+    LOG_BIT(c->logFile, "Error frame\n");
+    if (c->sampledBit == 1) {
+        c->bitCnt--;
+        if (c->bitCnt == 0) c->state = INTERFRAME_SPACE_INTERMISSION;
+    } else {
+        LOG_FRAME(c->logFile, "Error delimiter error: ");
+        LOG_FRAME(c->logFile, "Expecting 8 recessive bits during error delimiter.\n");
+        c->hasError = ERROR_TYPE_FORM;
+    }
+}
+
+static void decodeOverloadFlag(struct Controller *c) {
+    LOG_BIT(c->logFile, "Overload frame\n");
+    if (c->sampledBit == 0) {
+        c->bitCnt--;
+        if (c->bitCnt == 0) {
+            c->bitCnt = 8;
+            c->state = OVERLOAD_DELIMITER;
+        }
+    } else {
+        LOG_FRAME(c->logFile, "Overload flag error: ");
+        LOG_FRAME(c->logFile, "Expecting 6 dominant bits during overload flag.\n");
+        c->hasError = ERROR_TYPE_FORM;
+    }
+}
+
+static void decodeOverloadDelimiter(struct Controller *c) {
+    LOG_BIT(c->logFile, "Overload frame\n");
+    if (c->sampledBit == 1) {
+        c->bitCnt--;
+        if (c->bitCnt == 0) c->state = INTERFRAME_SPACE_INTERMISSION;
+    } else {
+        LOG_FRAME(c->logFile, "Overload delimiter error: ");
+        LOG_FRAME(c->logFile, "Expecting 8 recessive bits during overload delimiter.\n");
+        c->hasError = ERROR_TYPE_FORM;
+    }
+}
+
+// Bus-off: stay off the bus until 128 sequences of 11 recessive bits have
+// gone by, then restart error-active with both counters cleared.
+static void decodeBusOff(struct Controller *c) {
+    LOG_BIT(c->logFile, "Bus off\n");
+    if (c->sampledBit == 0) {
+        c->bitCnt = 0;
+    } else if (++c->bitCnt == BUS_OFF_RECOVERY_BITS) {
+        c->bitCnt = 0;
+        if (++c->recoveryCnt == BUS_OFF_RECOVERY_SEQUENCES) {
+            if (c->chunkLog != NULL) chunkLogStep(c->chunkLog, CONFINEMENT_RECOVERY);
+            c->tec = 0;
+            c->rec = 0;
+            c->recoveryCnt = 0;
+            c->errorState = ERROR_ACTIVE;
+            c->state = INTERFRAME_SPACE_BUS_IDLE;
+            LOG_FRAME(c->logFile, "Fault confinement: bus-off recovery, error-active (TEC 0, REC 0).\n");
+        }
+    }
+}
+
+// Action of every decoder state, run once per sampled bit. Actions only set
+// the next state: the SOF sampled from the interframe space and the IDE bit
+// of an extended frame are handled in place, with no re-entry.
+static void (*const decoderStates[DECODER_STATE_CNT])(struct Controller *c) = {
+    [INTERFRAME_SPACE_INTERMISSION] = decodeIntermission,
+    [INTERFRAME_SPACE_BUS_IDLE]     = decodeBusIdle,
+    [START_OF_FRAME]                = decodeStartOfFrame,
+    [ARBITRATION_IDENTIFIER_11_BIT] = decodeIdentifier11,
+    [ARBITRATION_RTR]               = decodeRtr,
+    [ARBITRATION_SRR]               = decodeSrr,
+    [ARBITRATION_IDE]               = decodeIde,
+    [ARBITRATION_IDENTIFIER_18_BIT] = decodeIdentifier18,
+    [CONTROL_IDE]                   = decodeControlIde,
+    [CONTROL_r0]                    = decodeR0,
+    [CONTROL_DLC]                   = decodeDlc,
+    [CONTROL_r1]                    = decodeR1,
+    [DATA]                          = decodeData,
+    [CRC_SEQUENCE]                  = decodeCrcSequence,
+    [CRC_DELIMITER]                 = decodeCrcDelimiter,
+    [ACK_SLOT]                      = decodeAckSlot,
+    [ACK_DELIMITER]                 = decodeAckDelimiter,
+    [END_OF_FRAME]                  = decodeEndOfFrame,
+    [BIT_STUFFING]                  = decodeStuffBit,
+    [ERROR_FLAG]                    = decodeErrorFlag,
+    [ERROR_DELIMITER]               = decodeErrorDelimiter,
+    [OVERLOAD_FLAG]                 = decodeOverloadFlag,
+    [OVERLOAD_DELIMITER]            = decodeOverloadDelimiter,
+    [PASSIVE_ERROR_FLAG]            = decodePassiveErrorFlag,
+    [BUS_OFF]                       = decodeBusOff,
+};
+
+static void decoderStateMachine(struct Controller *c) {
+    decoderStates[c->state](c);
+    if (c->hasError) {
+#if LOG_LEVEL >= LOG_LEVEL_FRAME
+        printFrameInfo(c, &c->receivedframe);
+#endif
+        LOG_FRAME(c->logFile, "Start receiving error flag...\n");
+        emitFrame(c, c->hasError);
+        confineError(c);
+        c->bitCnt = 0;
+        c->hasError = 0;
+        c->bitFieldIndex = 0;
+        if (c->errorState != ERROR_BUS_OFF) {
+            c->isTransmitter = c->loopback; // A passive trace already carries the error flag.
+            c->state = c->errorState == ERROR_PASSIVE ? PASSIVE_ERROR_FLAG : ERROR_FLAG;
+        }
+    }
+}
+
+static void encoderStateMachine(struct Controller *c) {
+    switch (c->state) {
+        case START_OF_FRAME:
+#if LOG_LEVEL >= LOG_LEVEL_FRAME
+            printFrameInfo(c, &c->frame);
+#endif
+            c->writingBit = 0;
+            break;
+        case ARBITRATION_IDENTIFIER_11_BIT:
+            c->writingBit = frameIdABit(&c->frame, c->bitFieldIndex);
+            break;
+        case ARBITRATION_RTR:
+            c->writingBit = frameGetFlag(&c->frame, FRAME_FLAG_RTR);
+            break;
+        case ARBITRATION_SRR:
+            c->writingBit = frameGetFlag(&c->frame, FRAME_FLAG_SRR);
+            break;
+        case ARBITRATION_IDE:
+        case CONTROL_IDE:
+            c->writingBit = frameGetFlag(&c->frame, FRAME_FLAG_IDE);
+            break;
+        case ARBITRATION_IDENTIFIER_18_BIT:
+            c->writingBit = frameIdBBit(&c->frame, c->bitFieldIndex);
+            break;
+        case CONTROL_r1:
+            c->writingBit = frameGetFlag(&c->frame, FRAME_FLAG_R1);
+            break;
+        case CONTROL_r0:
+            c->writingBit = frameGetFlag(&c->frame, FRAME_FLAG_R0);
+            break;
+        case CONTROL_DLC:
+            c->writingBit = frameDlcBit(&c->frame, 4 - c->bitCnt);
+            break;
+        case DATA:
+            c->writingBit = frameDataBit(&c->frame, c->bitFieldIndex);
+            break;
+        case CRC_SEQUENCE:
+            c->writingBit = frameCrcBit(&c->frame, 15 - c->bitCnt);
+            break;
+        case ACK_SLOT:
+            // Forcing ACK for the sake of testing.
+            // This value should be set to '1' by the encoder.
+            c->writingBit = 0;
+            break;
+        case CRC_DELIMITER:
+        case ACK_DELIMITER:
+        case END_OF_FRAME:
+            c->writingBit = 1;
+            break;
+        case BIT_STUFFING:
+            c->writingBit = !c->previousBit; // The opposite polarity from the previous bit.
+            break;
+        case ERROR_FLAG:
+        case PASSIVE_ERROR_FLAG:
+        case ERROR_DELIMITER:
+        case OVERLOAD_FLAG:
+        case OVERLOAD_DELIMITER:
+            c->writingBit = c->state == PASSIVE_ERROR_FLAG ? 1 : errorOverloadFrame[c->bitFieldIndex];
+            c->bitFieldIndex++;
+            if (c->bitFieldIndex == 14) {
+                c->bitFieldIndex = 0;
+                c->isTransmitter = 0;
+            }
+            break;
+        default:
+            LOG_FRAME(c->logFile, "Encoder error: invalid state %d.\n", c->state);
+            break;
+    }
+}
+
+// True when the context waits for a SOF with no frame of its own to send:
+// a fresh controllerInit() context decodes the rest of the trace the same
+// from here, up to the fault confinement counters and mode it carries.
+static inline int controllerIsBusIdle(const struct Controller *c) {
+    return c->state == INTERFRAME_SPACE_BUS_IDLE && !c->isTransmitter;
+}
+
+// Replay one fault confinement step of a ChunkLog.
+static inline void controllerApplyStep(struct Controller *c, unsigned char step) {
+    c->wasTransmitter = (step & CONFINEMENT_TRANSMITTER) != 0;
+    if (step & CONFINEMENT_RECOVERY) {
+        c->tec = c->rec = 0;
+        c->recoveryCnt = 0;
+        c->errorState = ERROR_ACTIVE;
+        c->state = INTERFRAME_SPACE_BUS_IDLE;
+    } else if (step & CONFINEMENT_SUCCESS) {
+        countSuccess(c, c->wasTransmitter);
+    } else {
+        countError(c, step & 0x0F);
+    }
+}
+
+// Feed one bus bit (0/1) to the decoder.
+static void controllerSampleBit(struct Controller *c, unsigned char bit) {
+    c->sampledBit = bit;
+    LOG_BIT(c->logFile, "Sample point: bit %d\n", c->sampledBit);
+    decoderStateMachine(c);
+    c->bitTime++;
+}
+
+// Let the encoder drive the bus until it stops transmitting, writing the
+// bits to out if given.
+static inline void controllerTransmitBits(struct Controller *c, FILE *out) {
+    while (c->isTransmitter) {
+        encoderStateMachine(c);
+        LOG_BIT(c->logFile, "Writing point: bit %d\n", c->writingBit);
+        if (out != NULL) fputc(c->writingBit + '0', out);
+        controllerSampleBit(c, c->writingBit);
+    }
+}
+
+#endif
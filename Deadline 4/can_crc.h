@@ -0,0 +1,341 @@
+/*
+ * CRC-15 engine (generator polynomial 0x4599).
+ *
+ * The CRC register is kept right-aligned in a uint16_t. crc15UpdateBit() is
+ * the one-bit-per-call path used at the decoder's sample point, while
+ * crc15UpdateBits() walks a packed, MSB-first bit buffer a byte at a time
+ * through a 256-entry table (whole frames in the encoder / offline decoding).
+ */
+#ifndef CAN_CRC_H
+#define CAN_CRC_H
+
+#include <stdint.h>
+
+#define CRC15_POLYNOMIAL 0x4599
+#define CRC15_MASK       0x7FFF
+
+// Table entries hold the CRC left-aligned in 16 bits (polynomial << 1),
+// so a whole byte can be folded in with a single shift and lookup. The
+// table is precomputed, so worker threads can share it with no setup.
+static const uint16_t crc15Table[256] = {
+    0x0000, 0x8B32, 0x9D56, 0x1664, 0xB19E, 0x3AAC, 0x2CC8, 0xA7FA,
+    0xE80E, 0x633C, 0x7558, 0xFE6A, 0x5990, 0xD2A2, 0xC4C6, 0x4FF4,
+    0x5B2E, 0xD01C, 0xC678, 0x4D4A, 0xEAB0, 0x6182, 0x77E6, 0xFCD4,
+    0xB320, 0x3812, 0x2E76, 0xA544, 0x02BE, 0x898C, 0x9FE8, 0x14DA,
+    0xB65C, 0x3D6E, 0x2B0A, 0xA038, 0x07C2, 0x8CF0, 0x9A94, 0x11A6,
+    0x5E52, 0xD560, 0xC304, 0x4836, 0xEFCC, 0x64FE, 0x729A, 0xF9A8,
+    0xED72, 0x6640, 0x7024, 0xFB16, 0x5CEC, 0xD7DE, 0xC1BA, 0x4A88,
+    0x057C, 0x8E4E, 0x982A, 0x1318, 0xB4E2, 0x3FD0, 0x29B4, 0xA286,
+    0xE78A, 0x6CB8, 0x7ADC, 0xF1EE, 0x5614, 0xDD26, 0xCB42, 0x4070,
+    0x0F84, 0x84B6, 0x92D2, 0x19E0, 0xBE1A, 0x3528, 0x234C, 0xA87E,
+    0xBCA4, 0x3796, 0x21F2, 0xAAC0, 0x0D3A, 0x8608, 0x906C, 0x1B5E,
+    0x54AA, 0xDF98, 0xC9FC, 0x42CE, 0xE534, 0x6E06, 0x7862, 0xF350,
+    0x51D6, 0xDAE4, 0xCC80, 0x47B2, 0xE048, 0x6B7A, 0x7D1E, 0xF62C,
+    0xB9D8, 0x32EA, 0x248E, 0xAFBC, 0x0846, 0x8374, 0x9510, 0x1E22,
+    0x0AF8, 0x81CA, 0x97AE, 0x1C9C, 0xBB66, 0x3054, 0x2630, 0xAD02,
+    0xE2F6, 0x69C4, 0x7FA0, 0xF492, 0x5368, 0xD85A, 0xCE3E, 0x450C,
+    0x4426, 0xCF14, 0xD970, 0x5242, 0xF5B8, 0x7E8A, 0x68EE, 0xE3DC,
+    0xAC28, 0x271A, 0x317E, 0xBA4C, 0x1DB6, 0x9684, 0x80E0, 0x0BD2,
+    0x1F08, 0x943A, 0x825E, 0x096C, 0xAE96, 0x25A4, 0x33C0, 0xB8F2,
+    0xF706, 0x7C34, 0x6A50, 0xE162, 0x4698, 0xCDAA, 0xDBCE, 0x50FC,
+    0xF27A, 0x7948, 0x6F2C, 0xE41E, 0x43E4, 0xC8D6, 0xDEB2, 0x5580,
+    0x1A74, 0x9146, 0x8722, 0x0C10, 0xABEA, 0x20D8, 0x36BC, 0xBD8E,
+    0xA954, 0x2266, 0x3402, 0xBF30, 0x18CA, 0x93F8, 0x859C, 0x0EAE,
+    0x415A, 0xCA68, 0xDC0C, 0x573E, 0xF0C4, 0x7BF6, 0x6D92, 0xE6A0,
+    0xA3AC, 0x289E, 0x3EFA, 0xB5C8, 0x1232, 0x9900, 0x8F64, 0x0456,
+    0x4BA2, 0xC090, 0xD6F4, 0x5DC6, 0xFA3C, 0x710E, 0x676A, 0xEC58,
+    0xF882, 0x73B0, 0x65D4, 0xEEE6, 0x491C, 0xC22E, 0xD44A, 0x5F78,
+    0x108C, 0x9BBE, 0x8DDA, 0x06E8, 0xA112, 0x2A20, 0x3C44, 0xB776,
+    0x15F0, 0x9EC2, 0x88A6, 0x0394, 0xA46E, 0x2F5C, 0x3938, 0xB20A,
+    0xFDFE, 0x76CC, 0x60A8, 0xEB9A, 0x4C60, 0xC752, 0xD136, 0x5A04,
+    0x4EDE, 0xC5EC, 0xD388, 0x58BA, 0xFF40, 0x7472, 0x6216, 0xE924,
+    0xA6D0, 0x2DE2, 0x3B86, 0xB0B4, 0x174E, 0x9C7C, 0x8A18, 0x012A,
+};
+
+// Slicing-by-8 tables for crc15UpdateWord(): crc15SliceTable[k - 1][b] is
+// the register after byte b followed by k zero bytes, from 0.
+static const uint16_t crc15SliceTable[7][256] = {
+    {
+        0x0000, 0x884C, 0x9BAA, 0x13E6, 0xBC66, 0x342A, 0x27CC, 0xAF80,
+        0xF3FE, 0x7BB2, 0x6854, 0xE018, 0x4F98, 0xC7D4, 0xD432, 0x5C7E,
+        0x6CCE, 0xE482, 0xF764, 0x7F28, 0xD0A8, 0x58E4, 0x4B02, 0xC34E,
+        0x9F30, 0x177C, 0x049A, 0x8CD6, 0x2356, 0xAB1A, 0xB8FC, 0x30B0,
+        0xD99C, 0x51D0, 0x4236, 0xCA7A, 0x65FA, 0xEDB6, 0xFE50, 0x761C,
+        0x2A62, 0xA22E, 0xB1C8, 0x3984, 0x9604, 0x1E48, 0x0DAE, 0x85E2,
+        0xB552, 0x3D1E, 0x2EF8, 0xA6B4, 0x0934, 0x8178, 0x929E, 0x1AD2,
+        0x46AC, 0xCEE0, 0xDD06, 0x554A, 0xFACA, 0x7286, 0x6160, 0xE92C,
+        0x380A, 0xB046, 0xA3A0, 0x2BEC, 0x846C, 0x0C20, 0x1FC6, 0x978A,
+        0xCBF4, 0x43B8, 0x505E, 0xD812, 0x7792, 0xFFDE, 0xEC38, 0x6474,
+        0x54C4, 0xDC88, 0xCF6E, 0x4722, 0xE8A2, 0x60EE, 0x7308, 0xFB44,
+        0xA73A, 0x2F76, 0x3C90, 0xB4DC, 0x1B5C, 0x9310, 0x80F6, 0x08BA,
+        0xE196, 0x69DA, 0x7A3C, 0xF270, 0x5DF0, 0xD5BC, 0xC65A, 0x4E16,
+        0x1268, 0x9A24, 0x89C2, 0x018E, 0xAE0E, 0x2642, 0x35A4, 0xBDE8,
+        0x8D58, 0x0514, 0x16F2, 0x9EBE, 0x313E, 0xB972, 0xAA94, 0x22D8,
+        0x7EA6, 0xF6EA, 0xE50C, 0x6D40, 0xC2C0, 0x4A8C, 0x596A, 0xD126,
+        0x7014, 0xF858, 0xEBBE, 0x63F2, 0xCC72, 0x443E, 0x57D8, 0xDF94,
+        0x83EA, 0x0BA6, 0x1840, 0x900C, 0x3F8C, 0xB7C0, 0xA426, 0x2C6A,
+        0x1CDA, 0x9496, 0x8770, 0x0F3C, 0xA0BC, 0x28F0, 0x3B16, 0xB35A,
+        0xEF24, 0x6768, 0x748E, 0xFCC2, 0x5342, 0xDB0E, 0xC8E8, 0x40A4,
+        0xA988, 0x21C4, 0x3222, 0xBA6E, 0x15EE, 0x9DA2, 0x8E44, 0x0608,
+        0x5A76, 0xD23A, 0xC1DC, 0x4990, 0xE610, 0x6E5C, 0x7DBA, 0xF5F6,
+        0xC546, 0x4D0A, 0x5EEC, 0xD6A0, 0x7920, 0xF16C, 0xE28A, 0x6AC6,
+        0x36B8, 0xBEF4, 0xAD12, 0x255E, 0x8ADE, 0x0292, 0x1174, 0x9938,
+        0x481E, 0xC052, 0xD3B4, 0x5BF8, 0xF478, 0x7C34, 0x6FD2, 0xE79E,
+        0xBBE0, 0x33AC, 0x204A, 0xA806, 0x0786, 0x8FCA, 0x9C2C, 0x1460,
+        0x24D0, 0xAC9C, 0xBF7A, 0x3736, 0x98B6, 0x10FA, 0x031C, 0x8B50,
+        0xD72E, 0x5F62, 0x4C84, 0xC4C8, 0x6B48, 0xE304, 0xF0E2, 0x78AE,
+        0x9182, 0x19CE, 0x0A28, 0x8264, 0x2DE4, 0xA5A8, 0xB64E, 0x3E02,
+        0x627C, 0xEA30, 0xF9D6, 0x719A, 0xDE1A, 0x5656, 0x45B0, 0xCDFC,
+        0xFD4C, 0x7500, 0x66E6, 0xEEAA, 0x412A, 0xC966, 0xDA80, 0x52CC,
+        0x0EB2, 0x86FE, 0x9518, 0x1D54, 0xB2D4, 0x3A98, 0x297E, 0xA132,
+    },
+    {
+        0x0000, 0xE028, 0x4B62, 0xAB4A, 0x96C4, 0x76EC, 0xDDA6, 0x3D8E,
+        0xA6BA, 0x4692, 0xEDD8, 0x0DF0, 0x307E, 0xD056, 0x7B1C, 0x9B34,
+        0xC646, 0x266E, 0x8D24, 0x6D0C, 0x5082, 0xB0AA, 0x1BE0, 0xFBC8,
+        0x60FC, 0x80D4, 0x2B9E, 0xCBB6, 0xF638, 0x1610, 0xBD5A, 0x5D72,
+        0x07BE, 0xE796, 0x4CDC, 0xACF4, 0x917A, 0x7152, 0xDA18, 0x3A30,
+        0xA104, 0x412C, 0xEA66, 0x0A4E, 0x37C0, 0xD7E8, 0x7CA2, 0x9C8A,
+        0xC1F8, 0x21D0, 0x8A9A, 0x6AB2, 0x573C, 0xB714, 0x1C5E, 0xFC76,
+        0x6742, 0x876A, 0x2C20, 0xCC08, 0xF186, 0x11AE, 0xBAE4, 0x5ACC,
+        0x0F7C, 0xEF54, 0x441E, 0xA436, 0x99B8, 0x7990, 0xD2DA, 0x32F2,
+        0xA9C6, 0x49EE, 0xE2A4, 0x028C, 0x3F02, 0xDF2A, 0x7460, 0x9448,
+        0xC93A, 0x2912, 0x8258, 0x6270, 0x5FFE, 0xBFD6, 0x149C, 0xF4B4,
+        0x6F80, 0x8FA8, 0x24E2, 0xC4CA, 0xF944, 0x196C, 0xB226, 0x520E,
+        0x08C2, 0xE8EA, 0x43A0, 0xA388, 0x9E06, 0x7E2E, 0xD564, 0x354C,
+        0xAE78, 0x4E50, 0xE51A, 0x0532, 0x38BC, 0xD894, 0x73DE, 0x93F6,
+        0xCE84, 0x2EAC, 0x85E6, 0x65CE, 0x5840, 0xB868, 0x1322, 0xF30A,
+        0x683E, 0x8816, 0x235C, 0xC374, 0xFEFA, 0x1ED2, 0xB598, 0x55B0,
+        0x1EF8, 0xFED0, 0x559A, 0xB5B2, 0x883C, 0x6814, 0xC35E, 0x2376,
+        0xB842, 0x586A, 0xF320, 0x1308, 0x2E86, 0xCEAE, 0x65E4, 0x85CC,
+        0xD8BE, 0x3896, 0x93DC, 0x73F4, 0x4E7A, 0xAE52, 0x0518, 0xE530,
+        0x7E04, 0x9E2C, 0x3566, 0xD54E, 0xE8C0, 0x08E8, 0xA3A2, 0x438A,
+        0x1946, 0xF96E, 0x5224, 0xB20C, 0x8F82, 0x6FAA, 0xC4E0, 0x24C8,
+        0xBFFC, 0x5FD4, 0xF49E, 0x14B6, 0x2938, 0xC910, 0x625A, 0x8272,
+        0xDF00, 0x3F28, 0x9462, 0x744A, 0x49C4, 0xA9EC, 0x02A6, 0xE28E,
+        0x79BA, 0x9992, 0x32D8, 0xD2F0, 0xEF7E, 0x0F56, 0xA41C, 0x4434,
+        0x1184, 0xF1AC, 0x5AE6, 0xBACE, 0x8740, 0x6768, 0xCC22, 0x2C0A,
+        0xB73E, 0x5716, 0xFC5C, 0x1C74, 0x21FA, 0xC1D2, 0x6A98, 0x8AB0,
+        0xD7C2, 0x37EA, 0x9CA0, 0x7C88, 0x4106, 0xA12E, 0x0A64, 0xEA4C,
+        0x7178, 0x9150, 0x3A1A, 0xDA32, 0xE7BC, 0x0794, 0xACDE, 0x4CF6,
+        0x163A, 0xF612, 0x5D58, 0xBD70, 0x80FE, 0x60D6, 0xCB9C, 0x2BB4,
+        0xB080, 0x50A8, 0xFBE2, 0x1BCA, 0x2644, 0xC66C, 0x6D26, 0x8D0E,
+        0xD07C, 0x3054, 0x9B1E, 0x7B36, 0x46B8, 0xA690, 0x0DDA, 0xEDF2,
+        0x76C6, 0x96EE, 0x3DA4, 0xDD8C, 0xE002, 0x002A, 0xAB60, 0x4B48,
+    },
+    {
+        0x0000, 0x3DF0, 0x7BE0, 0x4610, 0xF7C0, 0xCA30, 0x8C20, 0xB1D0,
+        0x64B2, 0x5942, 0x1F52, 0x22A2, 0x9372, 0xAE82, 0xE892, 0xD562,
+        0xC964, 0xF494, 0xB284, 0x8F74, 0x3EA4, 0x0354, 0x4544, 0x78B4,
+        0xADD6, 0x9026, 0xD636, 0xEBC6, 0x5A16, 0x67E6, 0x21F6, 0x1C06,
+        0x19FA, 0x240A, 0x621A, 0x5FEA, 0xEE3A, 0xD3CA, 0x95DA, 0xA82A,
+        0x7D48, 0x40B8, 0x06A8, 0x3B58, 0x8A88, 0xB778, 0xF168, 0xCC98,
+        0xD09E, 0xED6E, 0xAB7E, 0x968E, 0x275E, 0x1AAE, 0x5CBE, 0x614E,
+        0xB42C, 0x89DC, 0xCFCC, 0xF23C, 0x43EC, 0x7E1C, 0x380C, 0x05FC,
+        0x33F4, 0x0E04, 0x4814, 0x75E4, 0xC434, 0xF9C4, 0xBFD4, 0x8224,
+        0x5746, 0x6AB6, 0x2CA6, 0x1156, 0xA086, 0x9D76, 0xDB66, 0xE696,
+        0xFA90, 0xC760, 0x8170, 0xBC80, 0x0D50, 0x30A0, 0x76B0, 0x4B40,
+        0x9E22, 0xA3D2, 0xE5C2, 0xD832, 0x69E2, 0x5412, 0x1202, 0x2FF2,
+        0x2A0E, 0x17FE, 0x51EE, 0x6C1E, 0xDDCE, 0xE03E, 0xA62E, 0x9BDE,
+        0x4EBC, 0x734C, 0x355C, 0x08AC, 0xB97C, 0x848C, 0xC29C, 0xFF6C,
+        0xE36A, 0xDE9A, 0x988A, 0xA57A, 0x14AA, 0x295A, 0x6F4A, 0x52BA,
+        0x87D8, 0xBA28, 0xFC38, 0xC1C8, 0x7018, 0x4DE8, 0x0BF8, 0x3608,
+        0x67E8, 0x5A18, 0x1C08, 0x21F8, 0x9028, 0xADD8, 0xEBC8, 0xD638,
+        0x035A, 0x3EAA, 0x78BA, 0x454A, 0xF49A, 0xC96A, 0x8F7A, 0xB28A,
+        0xAE8C, 0x937C, 0xD56C, 0xE89C, 0x594C, 0x64BC, 0x22AC, 0x1F5C,
+        0xCA3E, 0xF7CE, 0xB1DE, 0x8C2E, 0x3DFE, 0x000E, 0x461E, 0x7BEE,
+        0x7E12, 0x43E2, 0x05F2, 0x3802, 0x89D2, 0xB422, 0xF232, 0xCFC2,
+        0x1AA0, 0x2750, 0x6140, 0x5CB0, 0xED60, 0xD090, 0x9680, 0xAB70,
+        0xB776, 0x8A86, 0xCC96, 0xF166, 0x40B6, 0x7D46, 0x3B56, 0x06A6,
+        0xD3C4, 0xEE34, 0xA824, 0x95D4, 0x2404, 0x19F4, 0x5FE4, 0x6214,
+        0x541C, 0x69EC, 0x2FFC, 0x120C, 0xA3DC, 0x9E2C, 0xD83C, 0xE5CC,
+        0x30AE, 0x0D5E, 0x4B4E, 0x76BE, 0xC76E, 0xFA9E, 0xBC8E, 0x817E,
+        0x9D78, 0xA088, 0xE698, 0xDB68, 0x6AB8, 0x5748, 0x1158, 0x2CA8,
+        0xF9CA, 0xC43A, 0x822A, 0xBFDA, 0x0E0A, 0x33FA, 0x75EA, 0x481A,
+        0x4DE6, 0x7016, 0x3606, 0x0BF6, 0xBA26, 0x87D6, 0xC1C6, 0xFC36,
+        0x2954, 0x14A4, 0x52B4, 0x6F44, 0xDE94, 0xE364, 0xA574, 0x9884,
+        0x8482, 0xB972, 0xFF62, 0xC292, 0x7342, 0x4EB2, 0x08A2, 0x3552,
+        0xE030, 0xDDC0, 0x9BD0, 0xA620, 0x17F0, 0x2A00, 0x6C10, 0x51E0,
+    },
+    {
+        0x0000, 0xCFD0, 0x1492, 0xDB42, 0x2924, 0xE6F4, 0x3DB6, 0xF266,
+        0x5248, 0x9D98, 0x46DA, 0x890A, 0x7B6C, 0xB4BC, 0x6FFE, 0xA02E,
+        0xA490, 0x6B40, 0xB002, 0x7FD2, 0x8DB4, 0x4264, 0x9926, 0x56F6,
+        0xF6D8, 0x3908, 0xE24A, 0x2D9A, 0xDFFC, 0x102C, 0xCB6E, 0x04BE,
+        0xC212, 0x0DC2, 0xD680, 0x1950, 0xEB36, 0x24E6, 0xFFA4, 0x3074,
+        0x905A, 0x5F8A, 0x84C8, 0x4B18, 0xB97E, 0x76AE, 0xADEC, 0x623C,
+        0x6682, 0xA952, 0x7210, 0xBDC0, 0x4FA6, 0x8076, 0x5B34, 0x94E4,
+        0x34CA, 0xFB1A, 0x2058, 0xEF88, 0x1DEE, 0xD23E, 0x097C, 0xC6AC,
+        0x0F16, 0xC0C6, 0x1B84, 0xD454, 0x2632, 0xE9E2, 0x32A0, 0xFD70,
+        0x5D5E, 0x928E, 0x49CC, 0x861C, 0x747A, 0xBBAA, 0x60E8, 0xAF38,
+        0xAB86, 0x6456, 0xBF14, 0x70C4, 0x82A2, 0x4D72, 0x9630, 0x59E0,
+        0xF9CE, 0x361E, 0xED5C, 0x228C, 0xD0EA, 0x1F3A, 0xC478, 0x0BA8,
+        0xCD04, 0x02D4, 0xD996, 0x1646, 0xE420, 0x2BF0, 0xF0B2, 0x3F62,
+        0x9F4C, 0x509C, 0x8BDE, 0x440E, 0xB668, 0x79B8, 0xA2FA, 0x6D2A,
+        0x6994, 0xA644, 0x7D06, 0xB2D6, 0x40B0, 0x8F60, 0x5422, 0x9BF2,
+        0x3BDC, 0xF40C, 0x2F4E, 0xE09E, 0x12F8, 0xDD28, 0x066A, 0xC9BA,
+        0x1E2C, 0xD1FC, 0x0ABE, 0xC56E, 0x3708, 0xF8D8, 0x239A, 0xEC4A,
+        0x4C64, 0x83B4, 0x58F6, 0x9726, 0x6540, 0xAA90, 0x71D2, 0xBE02,
+        0xBABC, 0x756C, 0xAE2E, 0x61FE, 0x9398, 0x5C48, 0x870A, 0x48DA,
+        0xE8F4, 0x2724, 0xFC66, 0x33B6, 0xC1D0, 0x0E00, 0xD542, 0x1A92,
+        0xDC3E, 0x13EE, 0xC8AC, 0x077C, 0xF51A, 0x3ACA, 0xE188, 0x2E58,
+        0x8E76, 0x41A6, 0x9AE4, 0x5534, 0xA752, 0x6882, 0xB3C0, 0x7C10,
+        0x78AE, 0xB77E, 0x6C3C, 0xA3EC, 0x518A, 0x9E5A, 0x4518, 0x8AC8,
+        0x2AE6, 0xE536, 0x3E74, 0xF1A4, 0x03C2, 0xCC12, 0x1750, 0xD880,
+        0x113A, 0xDEEA, 0x05A8, 0xCA78, 0x381E, 0xF7CE, 0x2C8C, 0xE35C,
+        0x4372, 0x8CA2, 0x57E0, 0x9830, 0x6A56, 0xA586, 0x7EC4, 0xB114,
+        0xB5AA, 0x7A7A, 0xA138, 0x6EE8, 0x9C8E, 0x535E, 0x881C, 0x47CC,
+        0xE7E2, 0x2832, 0xF370, 0x3CA0, 0xCEC6, 0x0116, 0xDA54, 0x1584,
+        0xD328, 0x1CF8, 0xC7BA, 0x086A, 0xFA0C, 0x35DC, 0xEE9E, 0x214E,
+        0x8160, 0x4EB0, 0x95F2, 0x5A22, 0xA844, 0x6794, 0xBCD6, 0x7306,
+        0x77B8, 0xB868, 0x632A, 0xACFA, 0x5E9C, 0x914C, 0x4A0E, 0x85DE,
+        0x25F0, 0xEA20, 0x3162, 0xFEB2, 0x0CD4, 0xC304, 0x1846, 0xD796,
+    },
+    {
+        0x0000, 0x3C58, 0x78B0, 0x44E8, 0xF160, 0xCD38, 0x89D0, 0xB588,
+        0x69F2, 0x55AA, 0x1142, 0x2D1A, 0x9892, 0xA4CA, 0xE022, 0xDC7A,
+        0xD3E4, 0xEFBC, 0xAB54, 0x970C, 0x2284, 0x1EDC, 0x5A34, 0x666C,
+        0xBA16, 0x864E, 0xC2A6, 0xFEFE, 0x4B76, 0x772E, 0x33C6, 0x0F9E,
+        0x2CFA, 0x10A2, 0x544A, 0x6812, 0xDD9A, 0xE1C2, 0xA52A, 0x9972,
+        0x4508, 0x7950, 0x3DB8, 0x01E0, 0xB468, 0x8830, 0xCCD8, 0xF080,
+        0xFF1E, 0xC346, 0x87AE, 0xBBF6, 0x0E7E, 0x3226, 0x76CE, 0x4A96,
+        0x96EC, 0xAAB4, 0xEE5C, 0xD204, 0x678C, 0x5BD4, 0x1F3C, 0x2364,
+        0x59F4, 0x65AC, 0x2144, 0x1D1C, 0xA894, 0x94CC, 0xD024, 0xEC7C,
+        0x3006, 0x0C5E, 0x48B6, 0x74EE, 0xC166, 0xFD3E, 0xB9D6, 0x858E,
+        0x8A10, 0xB648, 0xF2A0, 0xCEF8, 0x7B70, 0x4728, 0x03C0, 0x3F98,
+        0xE3E2, 0xDFBA, 0x9B52, 0xA70A, 0x1282, 0x2EDA, 0x6A32, 0x566A,
+        0x750E, 0x4956, 0x0DBE, 0x31E6, 0x846E, 0xB836, 0xFCDE, 0xC086,
+        0x1CFC, 0x20A4, 0x644C, 0x5814, 0xED9C, 0xD1C4, 0x952C, 0xA974,
+        0xA6EA, 0x9AB2, 0xDE5A, 0xE202, 0x578A, 0x6BD2, 0x2F3A, 0x1362,
+        0xCF18, 0xF340, 0xB7A8, 0x8BF0, 0x3E78, 0x0220, 0x46C8, 0x7A90,
+        0xB3E8, 0x8FB0, 0xCB58, 0xF700, 0x4288, 0x7ED0, 0x3A38, 0x0660,
+        0xDA1A, 0xE642, 0xA2AA, 0x9EF2, 0x2B7A, 0x1722, 0x53CA, 0x6F92,
+        0x600C, 0x5C54, 0x18BC, 0x24E4, 0x916C, 0xAD34, 0xE9DC, 0xD584,
+        0x09FE, 0x35A6, 0x714E, 0x4D16, 0xF89E, 0xC4C6, 0x802E, 0xBC76,
+        0x9F12, 0xA34A, 0xE7A2, 0xDBFA, 0x6E72, 0x522A, 0x16C2, 0x2A9A,
+        0xF6E0, 0xCAB8, 0x8E50, 0xB208, 0x0780, 0x3BD8, 0x7F30, 0x4368,
+        0x4CF6, 0x70AE, 0x3446, 0x081E, 0xBD96, 0x81CE, 0xC526, 0xF97E,
+        0x2504, 0x195C, 0x5DB4, 0x61EC, 0xD464, 0xE83C, 0xACD4, 0x908C,
+        0xEA1C, 0xD644, 0x92AC, 0xAEF4, 0x1B7C, 0x2724, 0x63CC, 0x5F94,
+        0x83EE, 0xBFB6, 0xFB5E, 0xC706, 0x728E, 0x4ED6, 0x0A3E, 0x3666,
+        0x39F8, 0x05A0, 0x4148, 0x7D10, 0xC898, 0xF4C0, 0xB028, 0x8C70,
+        0x500A, 0x6C52, 0x28BA, 0x14E2, 0xA16A, 0x9D32, 0xD9DA, 0xE582,
+        0xC6E6, 0xFABE, 0xBE56, 0x820E, 0x3786, 0x0BDE, 0x4F36, 0x736E,
+        0xAF14, 0x934C, 0xD7A4, 0xEBFC, 0x5E74, 0x622C, 0x26C4, 0x1A9C,
+        0x1502, 0x295A, 0x6DB2, 0x51EA, 0xE462, 0xD83A, 0x9CD2, 0xA08A,
+        0x7CF0, 0x40A8, 0x0440, 0x3818, 0x8D90, 0xB1C8, 0xF520, 0xC978,
+    },
+    {
+        0x0000, 0xECE2, 0x52F6, 0xBE14, 0xA5EC, 0x490E, 0xF71A, 0x1BF8,
+        0xC0EA, 0x2C08, 0x921C, 0x7EFE, 0x6506, 0x89E4, 0x37F0, 0xDB12,
+        0x0AE6, 0xE604, 0x5810, 0xB4F2, 0xAF0A, 0x43E8, 0xFDFC, 0x111E,
+        0xCA0C, 0x26EE, 0x98FA, 0x7418, 0x6FE0, 0x8302, 0x3D16, 0xD1F4,
+        0x15CC, 0xF92E, 0x473A, 0xABD8, 0xB020, 0x5CC2, 0xE2D6, 0x0E34,
+        0xD526, 0x39C4, 0x87D0, 0x6B32, 0x70CA, 0x9C28, 0x223C, 0xCEDE,
+        0x1F2A, 0xF3C8, 0x4DDC, 0xA13E, 0xBAC6, 0x5624, 0xE830, 0x04D2,
+        0xDFC0, 0x3322, 0x8D36, 0x61D4, 0x7A2C, 0x96CE, 0x28DA, 0xC438,
+        0x2B98, 0xC77A, 0x796E, 0x958C, 0x8E74, 0x6296, 0xDC82, 0x3060,
+        0xEB72, 0x0790, 0xB984, 0x5566, 0x4E9E, 0xA27C, 0x1C68, 0xF08A,
+        0x217E, 0xCD9C, 0x7388, 0x9F6A, 0x8492, 0x6870, 0xD664, 0x3A86,
+        0xE194, 0x0D76, 0xB362, 0x5F80, 0x4478, 0xA89A, 0x168E, 0xFA6C,
+        0x3E54, 0xD2B6, 0x6CA2, 0x8040, 0x9BB8, 0x775A, 0xC94E, 0x25AC,
+        0xFEBE, 0x125C, 0xAC48, 0x40AA, 0x5B52, 0xB7B0, 0x09A4, 0xE546,
+        0x34B2, 0xD850, 0x6644, 0x8AA6, 0x915E, 0x7DBC, 0xC3A8, 0x2F4A,
+        0xF458, 0x18BA, 0xA6AE, 0x4A4C, 0x51B4, 0xBD56, 0x0342, 0xEFA0,
+        0x5730, 0xBBD2, 0x05C6, 0xE924, 0xF2DC, 0x1E3E, 0xA02A, 0x4CC8,
+        0x97DA, 0x7B38, 0xC52C, 0x29CE, 0x3236, 0xDED4, 0x60C0, 0x8C22,
+        0x5DD6, 0xB134, 0x0F20, 0xE3C2, 0xF83A, 0x14D8, 0xAACC, 0x462E,
+        0x9D3C, 0x71DE, 0xCFCA, 0x2328, 0x38D0, 0xD432, 0x6A26, 0x86C4,
+        0x42FC, 0xAE1E, 0x100A, 0xFCE8, 0xE710, 0x0BF2, 0xB5E6, 0x5904,
+        0x8216, 0x6EF4, 0xD0E0, 0x3C02, 0x27FA, 0xCB18, 0x750C, 0x99EE,
+        0x481A, 0xA4F8, 0x1AEC, 0xF60E, 0xEDF6, 0x0114, 0xBF00, 0x53E2,
+        0x88F0, 0x6412, 0xDA06, 0x36E4, 0x2D1C, 0xC1FE, 0x7FEA, 0x9308,
+        0x7CA8, 0x904A, 0x2E5E, 0xC2BC, 0xD944, 0x35A6, 0x8BB2, 0x6750,
+        0xBC42, 0x50A0, 0xEEB4, 0x0256, 0x19AE, 0xF54C, 0x4B58, 0xA7BA,
+        0x764E, 0x9AAC, 0x24B8, 0xC85A, 0xD3A2, 0x3F40, 0x8154, 0x6DB6,
+        0xB6A4, 0x5A46, 0xE452, 0x08B0, 0x1348, 0xFFAA, 0x41BE, 0xAD5C,
+        0x6964, 0x8586, 0x3B92, 0xD770, 0xCC88, 0x206A, 0x9E7E, 0x729C,
+        0xA98E, 0x456C, 0xFB78, 0x179A, 0x0C62, 0xE080, 0x5E94, 0xB276,
+        0x6382, 0x8F60, 0x3174, 0xDD96, 0xC66E, 0x2A8C, 0x9498, 0x787A,
+        0xA368, 0x4F8A, 0xF19E, 0x1D7C, 0x0684, 0xEA66, 0x5472, 0xB890,
+    },
+    {
+        0x0000, 0xAE60, 0xD7F2, 0x7992, 0x24D6, 0x8AB6, 0xF324, 0x5D44,
+        0x49AC, 0xE7CC, 0x9E5E, 0x303E, 0x6D7A, 0xC31A, 0xBA88, 0x14E8,
+        0x9358, 0x3D38, 0x44AA, 0xEACA, 0xB78E, 0x19EE, 0x607C, 0xCE1C,
+        0xDAF4, 0x7494, 0x0D06, 0xA366, 0xFE22, 0x5042, 0x29D0, 0x87B0,
+        0xAD82, 0x03E2, 0x7A70, 0xD410, 0x8954, 0x2734, 0x5EA6, 0xF0C6,
+        0xE42E, 0x4A4E, 0x33DC, 0x9DBC, 0xC0F8, 0x6E98, 0x170A, 0xB96A,
+        0x3EDA, 0x90BA, 0xE928, 0x4748, 0x1A0C, 0xB46C, 0xCDFE, 0x639E,
+        0x7776, 0xD916, 0xA084, 0x0EE4, 0x53A0, 0xFDC0, 0x8452, 0x2A32,
+        0xD036, 0x7E56, 0x07C4, 0xA9A4, 0xF4E0, 0x5A80, 0x2312, 0x8D72,
+        0x999A, 0x37FA, 0x4E68, 0xE008, 0xBD4C, 0x132C, 0x6ABE, 0xC4DE,
+        0x436E, 0xED0E, 0x949C, 0x3AFC, 0x67B8, 0xC9D8, 0xB04A, 0x1E2A,
+        0x0AC2, 0xA4A2, 0xDD30, 0x7350, 0x2E14, 0x8074, 0xF9E6, 0x5786,
+        0x7DB4, 0xD3D4, 0xAA46, 0x0426, 0x5962, 0xF702, 0x8E90, 0x20F0,
+        0x3418, 0x9A78, 0xE3EA, 0x4D8A, 0x10CE, 0xBEAE, 0xC73C, 0x695C,
+        0xEEEC, 0x408C, 0x391E, 0x977E, 0xCA3A, 0x645A, 0x1DC8, 0xB3A8,
+        0xA740, 0x0920, 0x70B2, 0xDED2, 0x8396, 0x2DF6, 0x5464, 0xFA04,
+        0x2B5E, 0x853E, 0xFCAC, 0x52CC, 0x0F88, 0xA1E8, 0xD87A, 0x761A,
+        0x62F2, 0xCC92, 0xB500, 0x1B60, 0x4624, 0xE844, 0x91D6, 0x3FB6,
+        0xB806, 0x1666, 0x6FF4, 0xC194, 0x9CD0, 0x32B0, 0x4B22, 0xE542,
+        0xF1AA, 0x5FCA, 0x2658, 0x8838, 0xD57C, 0x7B1C, 0x028E, 0xACEE,
+        0x86DC, 0x28BC, 0x512E, 0xFF4E, 0xA20A, 0x0C6A, 0x75F8, 0xDB98,
+        0xCF70, 0x6110, 0x1882, 0xB6E2, 0xEBA6, 0x45C6, 0x3C54, 0x9234,
+        0x1584, 0xBBE4, 0xC276, 0x6C16, 0x3152, 0x9F32, 0xE6A0, 0x48C0,
+        0x5C28, 0xF248, 0x8BDA, 0x25BA, 0x78FE, 0xD69E, 0xAF0C, 0x016C,
+        0xFB68, 0x5508, 0x2C9A, 0x82FA, 0xDFBE, 0x71DE, 0x084C, 0xA62C,
+        0xB2C4, 0x1CA4, 0x6536, 0xCB56, 0x9612, 0x3872, 0x41E0, 0xEF80,
+        0x6830, 0xC650, 0xBFC2, 0x11A2, 0x4CE6, 0xE286, 0x9B14, 0x3574,
+        0x219C, 0x8FFC, 0xF66E, 0x580E, 0x054A, 0xAB2A, 0xD2B8, 0x7CD8,
+        0x56EA, 0xF88A, 0x8118, 0x2F78, 0x723C, 0xDC5C, 0xA5CE, 0x0BAE,
+        0x1F46, 0xB126, 0xC8B4, 0x66D4, 0x3B90, 0x95F0, 0xEC62, 0x4202,
+        0xC5B2, 0x6BD2, 0x1240, 0xBC20, 0xE164, 0x4F04, 0x3696, 0x98F6,
+        0x8C1E, 0x227E, 0x5BEC, 0xF58C, 0xA8C8, 0x06A8, 0x7F3A, 0xD15A,
+    },
+};
+
+// Shift one bit (0 or 1) into the CRC register.
+static inline uint16_t crc15UpdateBit(uint16_t crc, unsigned char bit) {
+    unsigned char crcNxt = (bit ^ (crc >> 14)) & 1;
+    crc = (crc << 1) & CRC15_MASK;
+    return crcNxt ? (crc ^ CRC15_POLYNOMIAL) : crc;
+}
+
+// Shift nbits bits of a packed, MSB-first buffer into the CRC register.
+// Whole bytes go through the table; a trailing partial byte is done bitwise.
+static uint16_t crc15UpdateBits(uint16_t crc, const uint8_t *buf, unsigned int nbits) {
+    unsigned int i;
+    uint16_t reg;
+    reg = (uint16_t)(crc << 1);
+    for (i = 0; i < nbits / 8; i++) {
+        reg = (uint16_t)((reg << 8) ^ crc15Table[(reg >> 8) ^ buf[i]]);
+    }
+    crc = reg >> 1;
+    for (i = (nbits / 8) * 8; i < nbits; i++) {
+        crc = crc15UpdateBit(crc, (buf[i >> 3] >> (7 - (i & 7))) & 1);
+    }
+    return crc;
+}
+
+// Shift 64 bits, MSB first, into the CRC register: the register is folded
+// into the top of the word and the eight bytes go through the slicing
+// tables at once. Leading zero bits leave a zero register unchanged, so a
+// message can be right-aligned in whole words.
+static inline uint16_t crc15UpdateWord(uint16_t crc, uint64_t bits) {
+    uint16_t reg;
+    bits ^= (uint64_t)(uint16_t)(crc << 1) << 48;
+    reg = crc15SliceTable[6][bits >> 56] ^ crc15SliceTable[5][(bits >> 48) & 0xFF] ^
+          crc15SliceTable[4][(bits >> 40) & 0xFF] ^ crc15SliceTable[3][(bits >> 32) & 0xFF] ^
+          crc15SliceTable[2][(bits >> 24) & 0xFF] ^ crc15SliceTable[1][(bits >> 16) & 0xFF] ^
+          crc15SliceTable[0][(bits >> 8) & 0xFF] ^ crc15Table[bits & 0xFF];
+    return reg >> 1;
+}
+
+// Append one bit to a packed, MSB-first bit buffer.
+static inline void packBit(uint8_t *buf, unsigned int index, unsigned char bit) {
+    if (bit) buf[index >> 3] |= (uint8_t)(0x80 >> (index & 7));
+    else     buf[index >> 3] &= (uint8_t)~(0x80 >> (index & 7));
+}
+
+#endif
@@ -0,0 +1,362 @@
+/*
+ * Word-at-a-time offline decoder.
+ *
+ * Decodes a trace packed by tracePack() a frame at a time instead of a bit
+ * at a time:
+ *   - bus idle is skipped by counting leading recessive bits;
+ *   - the stuff bits of FAST_WINDOW_BITS bus bits are found at once with
+ *     word masks (a bit that follows five equal ones, see fastStuffBits())
+ *     and squeezed out of the window (fastSqueeze()), so a frame takes two
+ *     or three windows;
+ *   - the fields are pulled out of the destuffed words with shifts and
+ *     masks, and the CRC takes 64 bits at a time (crc15UpdateWord());
+ *   - the binary and candump records are formatted into a buffer that goes
+ *     out in large writes.
+ * Only frames that the state machine would accept as they are, followed by
+ * a plain intermission, are decoded here. Anything else (stuff, CRC, form
+ * or ACK errors, overload frames, the end of the trace) is handed to
+ * decoderStateMachine() from its SOF, bit by bit, until it is back at bus
+ * idle. The controller is left in the same state and the same frames, log
+ * lines and records come out as with controllerSampleBit() on every bit.
+ *
+ * The LOG_LEVEL_FIELD and LOG_LEVEL_BIT messages are not reproduced: use
+ * the bit-by-bit path in those builds.
+ */
+#ifndef CAN_FASTPATH_H
+#define CAN_FASTPATH_H
+
+#include <stdint.h>
+#include "can_controller.h"
+
+// SOF up to the intermission of the longest frame.
+#define FAST_FRAME_LOOKAHEAD (MAX_STUFFED_FRAME_SIZE + 3)
+// CRC delimiter, ACK slot, ACK delimiter and EOF of a valid frame.
+#define FAST_FRAME_TRAILER      0x2FF
+#define FAST_FRAME_TRAILER_BITS 10
+// Bus bits destuffed at once: a 64-bit window also holds the five bits
+// before them.
+#define FAST_WINDOW_BITS 59
+#define FAST_WINDOW_MASK ((UINT64_C(1) << FAST_WINDOW_BITS) - 1)
+// Records are written out of fastDecode() in blocks of this size.
+#define FAST_OUTPUT_SIZE 16384
+
+// State of one fastDecode() call: the CPU features in use and the record
+// buffer. The buffer is not used when the frames go through emitFrame():
+// split chunks, or a frame log on the output stream.
+struct FastDecoder {
+    unsigned char bmi2;
+    unsigned char buffered;
+    size_t len;
+    size_t ifaceLen;
+    char buf[FAST_OUTPUT_SIZE];
+};
+
+// 64 bus bits from pos, MSB first.
+static inline uint64_t fastPeek(const uint64_t *words, unsigned long long pos) {
+    unsigned long long i = pos >> 6;
+    unsigned int s = pos & 63;
+    return (words[i] << s) | ((words[i + 1] >> 1) >> (63 - s));
+}
+
+// Stuff bits of a window: w holds the five bus bits before it and then its
+// FAST_WINDOW_BITS bits, MSB first. A bit is a stuff bit when the five
+// before it are equal (a stuff bit starts the next run, so this also holds
+// for the bits after one). *errors gets the stuff bits that are equal to
+// the bit before them.
+static inline uint64_t fastStuffBits(uint64_t w, uint64_t *errors) {
+    uint64_t e = ~(w ^ (w >> 1)); // Bit equal to the one before it.
+    uint64_t stuff = (e >> 1) & (e >> 2) & (e >> 3) & (e >> 4) & FAST_WINDOW_MASK;
+    *errors = stuff & e;
+    return stuff;
+}
+
+// With BMI2, pext squeezes a window and pdep finds a kept bit in one
+// instruction each. x86-64 GCC and clang builds check for it (and POPCNT)
+// at run time and use inline assembly, as the intrinsics need -mbmi2;
+// other builds take the loops below.
+#if defined(__GNUC__) && defined(__x86_64__)
+#define FAST_HAVE_BMI2 (__builtin_cpu_supports("bmi2") && __builtin_cpu_supports("popcnt"))
+#define FAST_ASM(insn, r, ...) __asm__(insn : "=r"(r) : __VA_ARGS__)
+#else
+#define FAST_HAVE_BMI2 0
+#define FAST_ASM(insn, r, ...) ((r) = 0)
+#endif
+
+static inline unsigned int fastPopcount(const struct FastDecoder *fd, uint64_t x) {
+    uint64_t r;
+    if (!fd->bmi2) return __builtin_popcountll(x);
+    FAST_ASM("popcnt %1, %0", r, "r"(x));
+    return (unsigned int)r;
+}
+
+// The bits of the window w that are not stuff bits, in order, in the low
+// bits of the result.
+static inline uint64_t fastSqueeze(const struct FastDecoder *fd, uint64_t w, uint64_t stuff) {
+    unsigned int b;
+    uint64_t r;
+    w &= FAST_WINDOW_MASK;
+    if (fd->bmi2) {
+        FAST_ASM("pext %2, %1, %0", r, "r"(w), "r"(~stuff & FAST_WINDOW_MASK));
+        return r;
+    }
+    while (stuff != 0) {
+        // Highest first, so the lower positions still hold.
+        b = 63 - __builtin_clzll(stuff);
+        w = ((w >> (b + 1)) << b) | (w & ((UINT64_C(1) << b) - 1));
+        stuff &= ~(UINT64_C(1) << b);
+    }
+    return w;
+}
+
+// Window position (0 = first bus bit) of the k-th (1..kept) bit that is
+// not a stuff bit.
+static inline unsigned int fastKeptBit(const struct FastDecoder *fd, uint64_t stuff, unsigned int kept,
+                                       unsigned int k) {
+    unsigned int t = k - 1, s;
+    uint64_t r;
+    if (fd->bmi2) {
+        FAST_ASM("pdep %2, %1, %0", r, "r"(UINT64_C(1) << (kept - k)), "r"(~stuff & FAST_WINDOW_MASK));
+        return FAST_WINDOW_BITS - 1 - __builtin_ctzll(r);
+    }
+    // The smallest t with t - k + 1 stuff bits up to it.
+    while ((s = k - 1 + __builtin_popcountll(stuff >> (FAST_WINDOW_BITS - 1 - t))) != t) t = s;
+    return t;
+}
+
+// Destuff the window w into d at bit count. Returns the bits kept.
+static inline unsigned int fastWindow(const struct FastDecoder *fd, uint64_t *d, unsigned int count, uint64_t w,
+                                      uint64_t *stuff, uint64_t *errors) {
+    unsigned int kept, i, s;
+    uint64_t bits;
+    *stuff = fastStuffBits(w, errors);
+    kept = FAST_WINDOW_BITS - fastPopcount(fd, *stuff);
+    bits = fastSqueeze(fd, w, *stuff) << (63 - kept) << 1; // kept is 0 in a run of equal bits.
+    i = count >> 6;
+    s = count & 63;
+    d[i] |= bits >> s;
+    d[i + 1] |= (bits << 1) << (63 - s);
+    return kept;
+}
+
+// 64 destuffed bits from off, MSB first.
+static inline uint64_t fastBits(const uint64_t *d, unsigned int off) {
+    unsigned int i = off >> 6, s = off & 63;
+    return (d[i] << s) | ((d[i + 1] >> 1) >> (63 - s));
+}
+
+// Store x at p, MSB first.
+static inline void fastStore(unsigned char *p, uint64_t x) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    x = __builtin_bswap64(x);
+    memcpy(p, &x, sizeof(x));
+#else
+    int i;
+    for (i = 0; i < 8; i++) p[i] = (unsigned char)(x >> (56 - 8 * i));
+#endif
+}
+
+static void fastFlush(struct Controller *c, struct FastDecoder *fd) {
+    if (fd->len > 0) fwrite(fd->buf, 1, fd->len, c->outputFile);
+    fd->len = 0;
+}
+
+// emitFrame() for a valid frame, into the record buffer.
+static void fastEmitFrame(struct Controller *c, struct FastDecoder *fd) {
+    struct FrameRecord rec;
+    char *p;
+
+    if (!fd->buffered) {
+        emitFrame(c, ERROR_TYPE_NONE);
+        return;
+    }
+    c->frameCnt++;
+    c->crcChecked = 0;
+    if (c->outputFormat == FORMAT_TEXT) return;
+    if (fd->len + RECORD_CANDUMP_TIME_MAX + fd->ifaceLen + 1 + RECORD_CANDUMP_BODY_MAX > FAST_OUTPUT_SIZE) {
+        fastFlush(c, fd);
+    }
+    recordFromFrame(&rec, &c->receivedframe, c->frameStartBitTime, 1, ERROR_TYPE_NONE);
+    p = fd->buf + fd->len;
+    if (c->outputFormat == FORMAT_BINARY) {
+        recordFormatBinary((unsigned char *)p, &rec);
+        p += RECORD_SIZE;
+    } else {
+        p += recordFormatCandumpTime(p, &rec, c->bitrate);
+        memcpy(p, c->interfaceName, fd->ifaceLen);
+        p += fd->ifaceLen;
+        *p++ = ' ';
+        p += recordFormatCandumpBody(p, &rec);
+    }
+    fd->len = p - fd->buf;
+}
+
+// Decode the frame whose SOF is at bus bit sof. Returns the bus bit after
+// its EOF, or 0 when the frame is not a valid one and has to go through
+// the state machine. c is only changed for a valid frame. The stuff,
+// trailer and CRC checks are folded into one test at the end.
+static unsigned long long fastDecodeFrame(struct Controller *c, const uint64_t *words, unsigned long long sof,
+                                          struct FastDecoder *fd) {
+    // Destuffed frame bits from d[2] on, after two zero words that
+    // right-align the CRC input.
+    uint64_t d[6] = {0, 0, 0, 0, 0, 0}, stuff[3] = {0, 0, 0}, errors[3] = {0, 0, 0}, w, bad, data, a, b;
+    unsigned long long end;
+    unsigned int count[3], kept[3], ext, rtr, dlc, header, dataBits, len, j, t;
+    unsigned char prev, run, five;
+    struct Frame f;
+    uint16_t crc;
+
+    // The first window holds the arbitration and control fields. The SOF
+    // is already in d (dominant); the bus is recessive before it.
+    w = sof >= 4 ? fastPeek(words, sof - 4) : fastPeek(words, 0) >> (4 - sof);
+    count[0] = 128 + 1;
+    kept[0] = fastWindow(fd, d, count[0], w | ~(uint64_t)0 << 60, &stuff[0], &errors[0]);
+    w = d[2];
+    ext = (w >> 50) & 1;
+    memset(&f, 0, sizeof(f));
+    f.id = (uint32_t)((w >> 52) & 0x7FF);
+    f.id = ext ? f.id << 18 | (uint32_t)((w >> 32) & 0x3FFFF) : f.id;
+    f.flags = ext ? FRAME_FLAG_IDE | ((w >> 50) & FRAME_FLAG_SRR) | ((w >> 31) & FRAME_FLAG_RTR)
+                    | ((w >> 27) & FRAME_FLAG_R1) | ((w >> 25) & FRAME_FLAG_R0)
+                  : ((w >> 51) & FRAME_FLAG_RTR) | ((w >> 45) & FRAME_FLAG_R0);
+    f.dlc = (w >> (ext ? 25 : 45)) & 0xF;
+    rtr = f.flags & FRAME_FLAG_RTR;
+    dlc = f.dlc < FRAME_MAX_DLC ? f.dlc : FRAME_MAX_DLC;
+    header = ext ? 39 : 19;
+    dataBits = rtr ? 0 : 8 * dlc;
+    len = header + dataBits + 15;
+
+    // The rest of the frame, up to two more windows.
+    count[1] = count[0] + kept[0];
+    kept[1] = count[1] < 128 + len ? fastWindow(fd, d, count[1], fastPeek(words, sof + FAST_WINDOW_BITS - 4),
+                                                &stuff[1], &errors[1]) : 0;
+    count[2] = count[1] + kept[1];
+    kept[2] = count[2] < 128 + len ? fastWindow(fd, d, count[2], fastPeek(words, sof + 2 * FAST_WINDOW_BITS - 4),
+                                                &stuff[2], &errors[2]) : 0;
+
+    // Window j and position t of the last CRC bit; stuff errors up to it.
+    if (count[2] + kept[2] < 128 + len) return 0; // Runs of equal bits left too few.
+    j = (128 + len > count[1]) + (128 + len > count[2]);
+    t = fastKeptBit(fd, stuff[j], kept[j], 128 + len - count[j]);
+    bad = (j > 0 ? errors[0] : 0) | (j > 1 ? errors[1] : 0)
+        | (errors[j] & ~(FAST_WINDOW_MASK >> (t + 1)));
+    end = sof + 1 + j * FAST_WINDOW_BITS + t + 1;
+
+    // Stuff bit after the CRC when its last five bits are equal.
+    w = fastPeek(words, end - 5) >> 58;
+    five = (w >> 1) == 0 || (w >> 1) == 0x1F;
+    bad |= five & !((w ^ (w >> 1)) & 1);
+    prev = five ? w & 1 : (w >> 1) & 1;
+    run = five ? 1 : __builtin_ctzll((w >> 1) ^ (prev ? 0x1F : 0));
+    end += five;
+    bad |= (fastPeek(words, end) >> (64 - FAST_FRAME_TRAILER_BITS)) != FAST_FRAME_TRAILER;
+
+    // CRC of SOF to data: the two words that end at the CRC field.
+    crc = crc15UpdateWord(crc15UpdateWord(0, fastBits(d, header + dataBits)), fastBits(d, 64 + header + dataBits));
+    f.crc = fastBits(d, 128 + header + dataBits) >> 49;
+    bad |= crc != f.crc;
+    if (bad) return 0;
+    data = dataBits != 0 ? fastBits(d, 128 + header) & ~(~(uint64_t)0 >> 1 >> (dataBits - 1)) : 0;
+    fastStore(f.data, data);
+
+    // Same context as after the state machine's EOF: the frame bits and
+    // the trailer, packed MSB-first.
+    w = (uint64_t)FAST_FRAME_TRAILER << (64 - FAST_FRAME_TRAILER_BITS);
+    if (len >= 64) {
+        a = d[2];
+        b = (d[3] & ~(~(uint64_t)0 >> (len - 64))) | w >> (len - 64);
+    } else {
+        a = (d[2] & ~(~(uint64_t)0 >> len)) | w >> len;
+        b = len + FAST_FRAME_TRAILER_BITS > 64 ? w << (64 - len) : 0;
+    }
+    fastStore(c->frameBuf, a);
+    fastStore(c->frameBuf + 8, b);
+    c->bitIndex = len + FAST_FRAME_TRAILER_BITS;
+    c->receivedframe = f;
+    c->dlc = dlc;
+    c->crc = crc;
+    c->crcError = 0;
+    c->crcChecked = 1;
+    c->hasError = 0;
+    c->bitCnt = 0;
+    c->bitFieldIndex = 0;
+    c->overloadFrameCnt = 0;
+    c->previousBit = prev;
+    c->samePolarityBitCnt = run;
+    c->frameStartBitTime = sof;
+    c->bitTime = end + FAST_FRAME_TRAILER_BITS;
+    c->state = INTERFRAME_SPACE_INTERMISSION;
+#if LOG_LEVEL >= LOG_LEVEL_FRAME
+    printFrameInfo(c, &c->receivedframe);
+#endif
+    fastEmitFrame(c, fd);
+    c->wasTransmitter = 0;
+    countSuccess(c, 0);
+    return c->bitTime;
+}
+
+// Run the state machine bit by bit from pos until it is back at bus idle
+// (the error counters are carried on).
+static unsigned long long fastSlowPath(struct Controller *c, const uint64_t *words, unsigned long long pos,
+                                       unsigned long long bits, struct FastDecoder *fd) {
+    fastFlush(c, fd);
+    while (pos < bits) {
+        controllerSampleBit(c, (words[pos >> 6] >> (63 - (pos & 63))) & 1);
+        pos++;
+        if (c->state == INTERFRAME_SPACE_BUS_IDLE) break;
+    }
+    return pos;
+}
+
+// Decode bits bus bits of a packed trace with c at bus idle, as
+// controllerSampleBit() on every bit would. Not for loopback contexts.
+static void fastDecode(struct Controller *c, const uint64_t *words, unsigned long long bits) {
+    struct FastDecoder fd;
+    unsigned long long pos = c->bitTime, next;
+    uint64_t w;
+
+    fd.bmi2 = FAST_HAVE_BMI2;
+    fd.len = 0;
+    fd.ifaceLen = strlen(c->interfaceName);
+    fd.buffered = c->chunkLog == NULL && fd.ifaceLen <= FAST_OUTPUT_SIZE / 2
+                  && !(LOG_LEVEL >= LOG_LEVEL_FRAME && c->logFile == c->outputFile);
+    while (pos < bits) {
+        // Bus idle: skip to the next dominant bit, the SOF.
+        w = ~fastPeek(words, pos);
+        if (w == 0) {
+            pos += 64;
+            continue;
+        }
+        pos += __builtin_clzll(w);
+        if (pos >= bits) break;
+
+        for (;;) {
+            c->bitTime = pos;
+            next = pos + FAST_FRAME_LOOKAHEAD <= bits ? fastDecodeFrame(c, words, pos, &fd) : 0;
+            if (next == 0) {
+                c->state = INTERFRAME_SPACE_BUS_IDLE;
+                pos = fastSlowPath(c, words, pos, bits, &fd);
+                break;
+            }
+            // Intermission: three recessive bits, or a SOF on the third.
+            w = fastPeek(words, next) >> 61;
+            if (w == 7) {
+                c->state = INTERFRAME_SPACE_BUS_IDLE;
+                pos = next + 3;
+                break;
+            }
+            if (w == 6) {
+                pos = next + 2;
+                continue;
+            }
+            // Overload frame.
+            c->bitCnt = w >> 2;
+            c->bitTime = next + c->bitCnt;
+            pos = fastSlowPath(c, words, c->bitTime, bits, &fd);
+            break;
+        }
+    }
+    fastFlush(c, &fd);
+    c->bitTime = bits;
+}
+
+#endif
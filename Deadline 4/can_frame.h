@@ -0,0 +1,180 @@
+/*
+ * Bit-packed CAN frame.
+ *
+ * Replaces the one-ASCII-char-per-bit representation: the identifier is a
+ * single 29-bit word (11-bit base ID in the low bits of a standard frame,
+ * base ID << 18 | extension for an extended one), control bits are flags and
+ * the payload is plain bytes. Bits are 0/1 everywhere; '0'/'1' characters
+ * only appear at the print/file edges.
+ */
+#ifndef CAN_FRAME_H
+#define CAN_FRAME_H
+
+#include <stdint.h>
+#include <string.h>
+#include "can_crc.h"
+
+#define FRAME_FLAG_RTR 0x01
+#define FRAME_FLAG_SRR 0x02
+#define FRAME_FLAG_IDE 0x04
+#define FRAME_FLAG_R1  0x08
+#define FRAME_FLAG_R0  0x10
+
+#define FRAME_ID_MASK  0x1FFFFFFF
+#define FRAME_MAX_DLC  8
+
+// Bits from SOF up to the end of the data field of the longest frame.
+#define FRAME_CRC_FIELD_MAX_BITS (1 + 32 + 6 + 64)
+// Extended frame, 8 data bytes, worst-case stuffing, up to the end of EOF.
+#define MAX_STUFFED_FRAME_SIZE 160
+
+struct Frame {
+    uint32_t id;        // 11-bit (standard) or 29-bit (extended) identifier.
+    uint8_t  flags;     // FRAME_FLAG_*.
+    uint8_t  dlc;       // Data length code as received (0..15).
+    uint8_t  data[8];
+    uint16_t crc;       // Received or computed CRC-15.
+};
+
+static inline unsigned char frameGetFlag(const struct Frame *f, uint8_t flag) {
+    return (f->flags & flag) != 0;
+}
+
+static inline void frameSetFlag(struct Frame *f, uint8_t flag, unsigned char bit) {
+    if (bit) f->flags |= flag;
+    else     f->flags &= (uint8_t)~flag;
+}
+
+static inline unsigned char frameIsExtended(const struct Frame *f) {
+    return frameGetFlag(f, FRAME_FLAG_IDE);
+}
+
+static inline unsigned char frameIsRemote(const struct Frame *f) {
+    return frameGetFlag(f, FRAME_FLAG_RTR);
+}
+
+// Number of data bytes carried by the frame (DLC values above 8 mean 8).
+static inline unsigned char frameDataLength(const struct Frame *f) {
+    return frameIsRemote(f) ? 0 : (f->dlc < FRAME_MAX_DLC ? f->dlc : FRAME_MAX_DLC);
+}
+
+// Bit i (0 = first on the bus) of the 11-bit base identifier.
+static inline unsigned char frameIdABit(const struct Frame *f, unsigned char i) {
+    return (f->id >> ((frameIsExtended(f) ? 28 : 10) - i)) & 1;
+}
+
+// Bit i (0 = first on the bus) of the 18-bit identifier extension.
+static inline unsigned char frameIdBBit(const struct Frame *f, unsigned char i) {
+    return (f->id >> (17 - i)) & 1;
+}
+
+static inline unsigned char frameDlcBit(const struct Frame *f, unsigned char i) {
+    return (f->dlc >> (3 - i)) & 1;
+}
+
+static inline unsigned char frameDataBit(const struct Frame *f, unsigned char i) {
+    return (f->data[i >> 3] >> (7 - (i & 7))) & 1;
+}
+
+static inline unsigned char frameCrcBit(const struct Frame *f, unsigned char i) {
+    return (f->crc >> (14 - i)) & 1;
+}
+
+// Shift one received bit into the identifier / DLC / data / CRC fields.
+static inline void frameShiftIdBit(struct Frame *f, unsigned char bit) {
+    f->id = ((f->id << 1) | bit) & FRAME_ID_MASK;
+}
+
+static inline void frameShiftDlcBit(struct Frame *f, unsigned char bit) {
+    f->dlc = ((f->dlc << 1) | bit) & 0x0F;
+}
+
+static inline void frameSetDataBit(struct Frame *f, unsigned char i, unsigned char bit) {
+    packBit(f->data, i, bit);
+}
+
+static inline void frameShiftCrcBit(struct Frame *f, unsigned char bit) {
+    f->crc = ((f->crc << 1) | bit) & CRC15_MASK;
+}
+
+// Pack the CRC-protected part of a frame (SOF up to the end of the data
+// field, unstuffed) MSB-first into bits. Returns the number of bits written.
+static unsigned int framePackBits(const struct Frame *f, uint8_t *bits) {
+    unsigned int i, n = 0;
+    packBit(bits, n++, 0); // SOF.
+    for (i = 0; i < 11; i++) packBit(bits, n++, frameIdABit(f, i));
+    if (frameIsExtended(f)) {
+        packBit(bits, n++, frameGetFlag(f, FRAME_FLAG_SRR));
+        packBit(bits, n++, 1); // IDE.
+        for (i = 0; i < 18; i++) packBit(bits, n++, frameIdBBit(f, i));
+        packBit(bits, n++, frameGetFlag(f, FRAME_FLAG_RTR));
+        packBit(bits, n++, frameGetFlag(f, FRAME_FLAG_R1));
+    } else {
+        packBit(bits, n++, frameGetFlag(f, FRAME_FLAG_RTR));
+        packBit(bits, n++, 0); // IDE.
+    }
+    packBit(bits, n++, frameGetFlag(f, FRAME_FLAG_R0));
+    for (i = 0; i < 4; i++) packBit(bits, n++, frameDlcBit(f, i));
+    for (i = 0; i < 8u * frameDataLength(f); i++) packBit(bits, n++, frameDataBit(f, i));
+    return n;
+}
+
+// Compute the CRC of a whole frame through the table-driven path.
+static void computeFrameCrc(struct Frame *f) {
+    uint8_t bits[(FRAME_CRC_FIELD_MAX_BITS + 7) / 8] = {0};
+    f->crc = crc15UpdateBits(0, bits, framePackBits(f, bits));
+}
+
+// Pre-stuffed bitstream of a frame, ready to be shifted out bit by bit.
+struct TxStream {
+    uint8_t bits[(MAX_STUFFED_FRAME_SIZE + 7) / 8];
+    unsigned char len;
+    unsigned char arbitrationEnd;   // Index one past the last arbitration bit.
+    unsigned char ackSlot;          // Index of the ACK slot.
+};
+
+static inline unsigned char txStreamBit(const struct TxStream *tx, unsigned char i) {
+    return (tx->bits[i >> 3] >> (7 - (i & 7))) & 1;
+}
+
+// Insert the stuff bits into the n packed bits of a frame (SOF up to the end
+// of the CRC) and append the CRC delimiter, recessive ACK slot, ACK
+// delimiter and EOF. extended only locates the end of the arbitration field.
+static void frameStuff(const uint8_t *bits, unsigned int n, unsigned char extended, struct TxStream *tx) {
+    unsigned int i, arbitrationBits;
+    unsigned char bit, previous = 2, run = 0;
+
+    arbitrationBits = extended ? 1 + 11 + 2 + 18 + 1 : 1 + 11 + 1;
+    tx->len = 0;
+    for (i = 0; i < n; i++) {
+        bit = (bits[i >> 3] >> (7 - (i & 7))) & 1;
+        packBit(tx->bits, tx->len++, bit);
+        if (i + 1 == arbitrationBits) tx->arbitrationEnd = tx->len;
+        run = (bit == previous) ? run + 1 : 1;
+        previous = bit;
+        if (run == 5) {
+            packBit(tx->bits, tx->len++, !bit);
+            previous = !bit;
+            run = 1;
+        }
+    }
+    packBit(tx->bits, tx->len++, 1); // CRC delimiter.
+    tx->ackSlot = tx->len;
+    packBit(tx->bits, tx->len++, 1); // ACK slot.
+    packBit(tx->bits, tx->len++, 1); // ACK delimiter.
+    for (i = 0; i < 7; i++) packBit(tx->bits, tx->len++, 1); // End of frame.
+}
+
+// Compute the CRC and build the stuffed bitstream of a frame (same as the
+// firmware's compileFrame()).
+static inline void frameCompile(struct Frame *f, struct TxStream *tx) {
+    uint8_t bits[(FRAME_CRC_FIELD_MAX_BITS + 15 + 7) / 8] = {0};
+    unsigned int i, n;
+
+    n = framePackBits(f, bits);
+    f->crc = crc15UpdateBits(0, bits, n);
+    for (i = 0; i < 15; i++) packBit(bits, n++, (f->crc >> (14 - i)) & 1);
+    frameStuff(bits, n, frameIsExtended(f), tx);
+}
+
+#endif
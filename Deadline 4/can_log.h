@@ -0,0 +1,47 @@
+/*
+ * Compile-time log levels for the PC decoder/encoder.
+ *
+ * Build with -DLOG_LEVEL=<n> to pick how much is printed:
+ *   LOG_LEVEL_OFF   (0) nothing,
+ *   LOG_LEVEL_FRAME (1) frame summaries and errors (default),
+ *   LOG_LEVEL_FIELD (2) decoded field values and the CRC check,
+ *   LOG_LEVEL_BIT   (3) the Deadline 4 per-bit trace (state, sample/writing
+ *                       point, bit read/written, stuffing).
+ * Statements above the selected level expand to nothing, so the per-bit
+ * trace costs no code at all in the OFF and FRAME builds. Each statement
+ * names the stream it writes to (a controller's logFile); a NULL stream
+ * discards the message.
+ */
+#ifndef CAN_LOG_H
+#define CAN_LOG_H
+
+#include <stdio.h>
+
+#define LOG_LEVEL_OFF   0
+#define LOG_LEVEL_FRAME 1
+#define LOG_LEVEL_FIELD 2
+#define LOG_LEVEL_BIT   3
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_FRAME
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_FRAME
+#define LOG_FRAME(fp, ...) ((fp) ? (void)fprintf((fp), __VA_ARGS__) : (void)0)
+#else
+#define LOG_FRAME(fp, ...) ((void)0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_FIELD
+#define LOG_FIELD(fp, ...) ((fp) ? (void)fprintf((fp), __VA_ARGS__) : (void)0)
+#else
+#define LOG_FIELD(fp, ...) ((void)0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_BIT
+#define LOG_BIT(fp, ...) ((fp) ? (void)fprintf((fp), __VA_ARGS__) : (void)0)
+#else
+#define LOG_BIT(fp, ...) ((void)0)
+#endif
+
+#endif
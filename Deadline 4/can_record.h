@@ -0,0 +1,303 @@
+/*
+ * Decoded frame records: compact binary format and candump -L text logs.
+ *
+ * Binary file layout (little-endian):
+ *   header  8 bytes  "CANREC" 0x01 RECORD_SIZE
+ *   record 24 bytes  u64 timestamp (bit-times), u32 id, u8 flags, u8 dlc,
+ *                    u8 crcOk, u8 errorType, u8 data[8]
+ * The timestamp is the bit-time of the SOF for frames and of the detection
+ * for errors, counted from the first bit of the trace.
+ *
+ * candump -L lines are "(sec.usec) iface ID#DATA" as written by SocketCAN's
+ * can-utils, with "ID#R[len]" for remote frames and CAN_ERR_FLAG ids for
+ * error frames, so the output can be replayed with canplayer or log2asc.
+ */
+#ifndef CAN_RECORD_H
+#define CAN_RECORD_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "can_frame.h"
+
+/******* Error types *******/
+#define ERROR_TYPE_NONE  0
+#define ERROR_TYPE_BIT   1
+#define ERROR_TYPE_STUFF 2
+#define ERROR_TYPE_CRC   3
+#define ERROR_TYPE_FORM  4
+#define ERROR_TYPE_ACK   5
+/***************************/
+
+/***** Output formats ******/
+#define FORMAT_TEXT    0
+#define FORMAT_BINARY  1
+#define FORMAT_CANDUMP 2
+/***************************/
+
+#define RECORD_MAGIC   "CANREC\x01"
+#define RECORD_SIZE    24
+
+// SocketCAN flags used in candump logs.
+#define CAN_ERR_FLAG   0x20000000U
+#define CAN_ERR_PROT   0x00000008U
+#define CAN_ERR_ACK    0x00000020U
+#define CAN_ERR_PROT_BIT          0x01
+#define CAN_ERR_PROT_FORM         0x02
+#define CAN_ERR_PROT_STUFF        0x04
+#define CAN_ERR_PROT_LOC_CRC_SEQ  0x08
+
+struct FrameRecord {
+    uint64_t timestamp;
+    uint32_t id;
+    uint8_t  flags;
+    uint8_t  dlc;
+    uint8_t  crcOk;
+    uint8_t  errorType;
+    uint8_t  data[8];
+};
+
+static inline void recordFromFrame(struct FrameRecord *rec, const struct Frame *f, uint64_t timestamp,
+                            unsigned char crcOk, unsigned char errorType) {
+    rec->timestamp = timestamp;
+    rec->id = f->id;
+    rec->flags = f->flags;
+    rec->dlc = f->dlc;
+    rec->crcOk = crcOk;
+    rec->errorType = errorType;
+    memcpy(rec->data, f->data, sizeof(rec->data));
+}
+
+static inline void recordToFrame(const struct FrameRecord *rec, struct Frame *f) {
+    memset(f, 0, sizeof(*f));
+    f->id = rec->id & FRAME_ID_MASK;
+    f->flags = rec->flags;
+    f->dlc = rec->dlc & 0x0F;
+    memcpy(f->data, rec->data, sizeof(f->data));
+    if (frameIsExtended(f)) frameSetFlag(f, FRAME_FLAG_SRR, 1);
+    computeFrameCrc(f);
+}
+
+/********** Binary *********/
+static inline void recordWriteHeader(FILE *fp) {
+    unsigned char header[8];
+    memcpy(header, RECORD_MAGIC, 7);
+    header[7] = RECORD_SIZE;
+    fwrite(header, 1, sizeof(header), fp);
+}
+
+static inline void recordFormatBinary(unsigned char *buf, const struct FrameRecord *rec) {
+    int i;
+    for (i = 0; i < 8; i++) buf[i] = (unsigned char)(rec->timestamp >> (8 * i));
+    for (i = 0; i < 4; i++) buf[8 + i] = (unsigned char)(rec->id >> (8 * i));
+    buf[12] = rec->flags;
+    buf[13] = rec->dlc;
+    buf[14] = rec->crcOk;
+    buf[15] = rec->errorType;
+    memcpy(buf + 16, rec->data, 8);
+}
+
+static inline void recordWriteBinary(FILE *fp, const struct FrameRecord *rec) {
+    unsigned char buf[RECORD_SIZE];
+    recordFormatBinary(buf, rec);
+    fwrite(buf, 1, sizeof(buf), fp);
+}
+
+// Returns 1 when a record was read, 0 at the end of the file.
+static inline int recordReadBinary(FILE *fp, struct FrameRecord *rec) {
+    unsigned char buf[RECORD_SIZE];
+    int i;
+    if (fread(buf, 1, sizeof(buf), fp) != sizeof(buf)) return 0;
+    rec->timestamp = 0;
+    rec->id = 0;
+    for (i = 7; i >= 0; i--) rec->timestamp = (rec->timestamp << 8) | buf[i];
+    for (i = 3; i >= 0; i--) rec->id = (rec->id << 8) | buf[8 + i];
+    rec->flags = buf[12];
+    rec->dlc = buf[13];
+    rec->crcOk = buf[14];
+    rec->errorType = buf[15];
+    memcpy(rec->data, buf + 16, 8);
+    return 1;
+}
+
+/********* candump *********/
+// Longest "(sec.usec) " and "ID#DATA\n" parts of a candump line, around
+// the interface name.
+#define RECORD_CANDUMP_TIME_MAX 32
+#define RECORD_CANDUMP_BODY_MAX 32
+
+// v in decimal with at least width (<= 20) digits. Returns the length.
+static inline int recordFormatDecimal(char *buf, unsigned long long v, int width) {
+    char digits[20];
+    int n = 0, len = 0;
+    do {
+        digits[n++] = (char)('0' + v % 10);
+        v /= 10;
+    } while (v != 0);
+    while (n < width) digits[n++] = '0';
+    while (n > 0) buf[len++] = digits[--n];
+    return len;
+}
+
+// v in upper-case hex, digits digits wide.
+static inline int recordFormatHex(char *buf, uint32_t v, int digits) {
+    int i;
+    for (i = 0; i < digits; i++) buf[i] = "0123456789ABCDEF"[(v >> (4 * (digits - 1 - i))) & 0xF];
+    return digits;
+}
+
+// "(%010llu.%06llu) " of the record's timestamp.
+static inline int recordFormatCandumpTime(char *buf, const struct FrameRecord *rec, unsigned long bitrate) {
+    uint64_t usec = rec->timestamp * 1000000ULL / bitrate;
+    int len = 0;
+    buf[len++] = '(';
+    len += recordFormatDecimal(buf + len, usec / 1000000, 10);
+    buf[len++] = '.';
+    len += recordFormatDecimal(buf + len, usec % 1000000, 6);
+    buf[len++] = ')';
+    buf[len++] = ' ';
+    return len;
+}
+
+// "ID#DATA\n" of the record.
+static inline int recordFormatCandumpBody(char *buf, const struct FrameRecord *rec) {
+    int i, len = 0;
+    unsigned char dlc;
+    uint8_t errData[8] = {0};
+    uint32_t errId = CAN_ERR_FLAG;
+
+    if (rec->errorType != ERROR_TYPE_NONE) {
+        switch (rec->errorType) {
+            case ERROR_TYPE_ACK:   errId |= CAN_ERR_ACK; break;
+            case ERROR_TYPE_BIT:   errId |= CAN_ERR_PROT; errData[2] = CAN_ERR_PROT_BIT; break;
+            case ERROR_TYPE_STUFF: errId |= CAN_ERR_PROT; errData[2] = CAN_ERR_PROT_STUFF; break;
+            case ERROR_TYPE_CRC:   errId |= CAN_ERR_PROT; errData[3] = CAN_ERR_PROT_LOC_CRC_SEQ; break;
+            default:               errId |= CAN_ERR_PROT; errData[2] = CAN_ERR_PROT_FORM; break;
+        }
+        len += recordFormatHex(buf + len, errId, 8);
+        buf[len++] = '#';
+        for (i = 0; i < 8; i++) len += recordFormatHex(buf + len, errData[i], 2);
+        buf[len++] = '\n';
+        return len;
+    }
+
+    if (rec->flags & FRAME_FLAG_IDE) len += recordFormatHex(buf + len, rec->id & FRAME_ID_MASK, 8);
+    else                             len += recordFormatHex(buf + len, rec->id & 0x7FF, 3);
+    buf[len++] = '#';
+
+    dlc = rec->dlc < FRAME_MAX_DLC ? rec->dlc : FRAME_MAX_DLC;
+    if (rec->flags & FRAME_FLAG_RTR) {
+        buf[len++] = 'R';
+        if (dlc > 0) len += recordFormatHex(buf + len, dlc, 1);
+    } else {
+        for (i = 0; i < dlc; i++) len += recordFormatHex(buf + len, rec->data[i], 2);
+    }
+    buf[len++] = '\n';
+    return len;
+}
+
+static inline void recordWriteCandump(FILE *fp, const struct FrameRecord *rec, unsigned long bitrate, const char *iface) {
+    char time[RECORD_CANDUMP_TIME_MAX], body[RECORD_CANDUMP_BODY_MAX];
+    fwrite(time, 1, recordFormatCandumpTime(time, rec, bitrate), fp);
+    fputs(iface, fp);
+    putc(' ', fp);
+    fwrite(body, 1, recordFormatCandumpBody(body, rec), fp);
+}
+
+static inline int recordHexDigit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+// Parse one candump -L line. Returns 1 for a frame, 0 for lines to skip
+// (comments, error frames, malformed input).
+static inline int recordParseCandump(const char *line, unsigned long bitrate, struct FrameRecord *rec) {
+    unsigned long long sec = 0, usec = 0;
+    char iface[32];
+    const char *p, *hash;
+    int idDigits, hi, lo;
+
+    memset(rec, 0, sizeof(*rec));
+    if (sscanf(line, " (%llu.%llu) %31s", &sec, &usec, iface) != 3) return 0;
+    p = strchr(line, ')');
+    p = strstr(p, iface) + strlen(iface);
+    while (*p == ' ') p++;
+    hash = strchr(p, '#');
+    if (hash == NULL) return 0;
+
+    idDigits = (int)(hash - p);
+    rec->id = (uint32_t)strtoul(p, NULL, 16);
+    if ((rec->id & CAN_ERR_FLAG) && idDigits == 8) return 0;
+    if (idDigits == 8) rec->flags |= FRAME_FLAG_IDE | FRAME_FLAG_SRR;
+    rec->id &= idDigits == 8 ? FRAME_ID_MASK : 0x7FF;
+    rec->timestamp = (sec * 1000000ULL + usec) * bitrate / 1000000ULL;
+    rec->crcOk = 1;
+
+    p = hash + 1;
+    if (*p == 'R' || *p == 'r') {
+        rec->flags |= FRAME_FLAG_RTR;
+        hi = recordHexDigit(p[1]);
+        rec->dlc = hi > 0 && hi <= FRAME_MAX_DLC ? hi : 0;
+        return 1;
+    }
+    while ((hi = recordHexDigit(p[0])) >= 0 && (lo = recordHexDigit(p[1])) >= 0 && rec->dlc < FRAME_MAX_DLC) {
+        rec->data[rec->dlc++] = (uint8_t)(hi << 4 | lo);
+        p += 2;
+    }
+    return 1;
+}
+
+/********* Reader **********/
+struct RecordReader {
+    FILE *fp;
+    unsigned char binary;
+    unsigned long bitrate;
+};
+
+// Open a binary or candump file ("-" for stdin). Binary files start with
+// the "CANREC" header while candump lines start with '('.
+static inline int recordReaderOpen(struct RecordReader *reader, const char *path, unsigned long bitrate) {
+    unsigned char header[8];
+    int c;
+    reader->fp = (path == NULL || strcmp(path, "-") == 0) ? stdin : fopen(path, "rb");
+    reader->bitrate = bitrate;
+    reader->binary = 0;
+    if (reader->fp == NULL) return -1;
+    c = getc(reader->fp);
+    if (c == RECORD_MAGIC[0]) {
+        header[0] = (unsigned char)c;
+        if (fread(header + 1, 1, sizeof(header) - 1, reader->fp) != sizeof(header) - 1
+            || memcmp(header, RECORD_MAGIC, 7) != 0 || header[7] != RECORD_SIZE) {
+            return -1;
+        }
+        reader->binary = 1;
+    } else if (c != EOF) {
+        ungetc(c, reader->fp);
+    }
+    return 0;
+}
+
+// Read the next error-free frame record. Returns 0 at the end of the input.
+static inline int recordReaderNext(struct RecordReader *reader, struct FrameRecord *rec) {
+    char line[256];
+    if (reader->binary) {
+        while (recordReadBinary(reader->fp, rec)) {
+            if (rec->errorType == ERROR_TYPE_NONE) return 1;
+        }
+        return 0;
+    }
+    while (fgets(line, sizeof(line), reader->fp) != NULL) {
+        if (recordParseCandump(line, reader->bitrate, rec)) return 1;
+    }
+    return 0;
+}
+
+static inline void recordReaderClose(struct RecordReader *reader) {
+    if (reader->fp != NULL && reader->fp != stdin) fclose(reader->fp);
+    reader->fp = NULL;
+}
+
+#endif
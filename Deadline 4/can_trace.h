@@ -0,0 +1,166 @@
+/*
+ * Bitstream trace ingestion.
+ *
+ * A trace is a text file of '0'/'1' characters (one per bus bit), possibly
+ * split into lines or separated by whitespace between frames. Regular files
+ * are memory-mapped and handed out as a single block; stdin, pipes and
+ * platforms without mmap are read in TRACE_BLOCK_SIZE blocks.
+ */
+#ifndef CAN_TRACE_H
+#define CAN_TRACE_H
+
+// madvise() is not in strict ISO C: the includer defines _GNU_SOURCE before
+// its first system header, or this does when it comes first.
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#define TRACE_BLOCK_SIZE (1 << 20)
+
+struct Trace {
+    FILE *fp;
+    unsigned char *buf;         // Mapped file or block buffer.
+    size_t size;                // Bytes in buf.
+    unsigned char mapped;
+    unsigned char done;
+    unsigned long long bits;    // Trace bits handed to the decoder so far.
+    unsigned long long invalid; // Characters that are neither bits nor whitespace.
+};
+
+// Open path ("-" or NULL for stdin). Returns 0 on success.
+static int traceOpen(struct Trace *t, const char *path) {
+    memset(t, 0, sizeof(*t));
+    if (path == NULL || strcmp(path, "-") == 0) {
+        t->fp = stdin;
+    } else {
+#ifndef _WIN32
+        struct stat st;
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) return -1;
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+            void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (map != MAP_FAILED) {
+                close(fd);
+                madvise(map, st.st_size, MADV_SEQUENTIAL);
+                t->buf = map;
+                t->size = st.st_size;
+                t->mapped = 1;
+                return 0;
+            }
+        }
+        close(fd);
+#endif
+        t->fp = fopen(path, "rb");
+        if (t->fp == NULL) return -1;
+    }
+    t->buf = malloc(TRACE_BLOCK_SIZE);
+    return t->buf == NULL ? -1 : 0;
+}
+
+// Hand out the next block of raw trace characters. Returns 0 at the end.
+static int traceNextBlock(struct Trace *t, const unsigned char **begin, const unsigned char **end) {
+    if (t->done) return 0;
+    if (t->mapped) {
+        t->done = 1;
+    } else {
+        t->size = fread(t->buf, 1, TRACE_BLOCK_SIZE, t->fp);
+        if (t->size == 0) {
+            t->done = 1;
+            return 0;
+        }
+    }
+    *begin = t->buf;
+    *end = t->buf + t->size;
+    return 1;
+}
+
+static inline int traceIsSpace(unsigned char c) {
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+// Append the low n bits of value (n <= 8) to a packed, MSB-first word buffer.
+static inline void tracePutBits(uint64_t *words, unsigned long long *bits, uint64_t value, unsigned int n) {
+    unsigned long long i = *bits >> 6;
+    unsigned int used = *bits & 63;
+    if (used == 0) words[i] = 0;
+    if (used + n <= 64) {
+        words[i] |= value << (64 - used - n);
+    } else {
+        words[i] |= value >> (used + n - 64);
+        words[i + 1] = value << (128 - used - n);
+    }
+    *bits += n;
+}
+
+// Read the whole trace into 64-bit words, one bit per '0'/'1' character,
+// MSB first. Whitespace is skipped and invalid characters are counted, as
+// the bit-by-bit decoder does; t->bits ends up as the number of bits. Runs
+// of 8 bit characters are packed with a single multiply. Two zero words
+// follow the last bit so 64-bit windows can be read past the end. Returns
+// NULL when out of memory.
+static uint64_t *tracePack(struct Trace *t) {
+    const unsigned char *p, *end;
+    uint64_t *words, *grown, x, d;
+    size_t cap = t->mapped ? t->size / 64 + 3 : TRACE_BLOCK_SIZE / 64 + 3;
+
+    words = malloc(cap * sizeof(*words));
+    if (words == NULL) return NULL;
+    t->bits = 0;
+    while (traceNextBlock(t, &p, &end)) {
+        if ((t->bits + (end - p)) / 64 + 3 > cap) {
+            cap = (t->bits + (end - p)) / 64 + 3 + cap;
+            grown = realloc(words, cap * sizeof(*words));
+            if (grown == NULL) {
+                free(words);
+                return NULL;
+            }
+            words = grown;
+        }
+        while (p < end) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            if (end - p >= 8) {
+                memcpy(&x, p, 8);
+                d = x ^ 0x3030303030303030ULL; // '0'/'1' to 0/1 bytes.
+                if ((d & 0xFEFEFEFEFEFEFEFEULL) == 0) {
+                    // Byte i lands on bit 7 - i of the top byte.
+                    tracePutBits(words, &t->bits, (d * 0x8040201008040201ULL) >> 56, 8);
+                    p += 8;
+                    continue;
+                }
+            }
+#endif
+            if (*p == '0' || *p == '1') tracePutBits(words, &t->bits, *p - '0', 1);
+            else if (!traceIsSpace(*p)) t->invalid++;
+            p++;
+        }
+    }
+    if ((t->bits & 63) == 0) words[t->bits >> 6] = 0;
+    words[(t->bits >> 6) + 1] = 0;
+    words[(t->bits >> 6) + 2] = 0;
+    return words;
+}
+
+static void traceClose(struct Trace *t) {
+#ifndef _WIN32
+    if (t->mapped) munmap(t->buf, t->size);
+    else
+#endif
+    free(t->buf);
+    if (t->fp != NULL && t->fp != stdin) fclose(t->fp);
+    t->buf = NULL;
+    t->fp = NULL;
+}
+
+#endif
@@ -9,7 +9,7 @@
 #define PHASE_SEG1 2
 #define PHASE_SEG2 3
 
-// Bit and segments lengths (time quanta).
+// Bit and segments lengths (time quanta) at power-up, see setBitTiming().
 #define SYNC_SEG_LEN 1
 #define PROP_SEG_LEN 1
 #define PHASE_SEG1_LEN 7
@@ -23,6 +23,55 @@
 // For a 10bps baud rate and 16 TQ bit length, time quantum must be 6250 microseconds.
 #define TQ 1000000.0/(BAUD_RATE*BIT_LEN)
 
+// 1: Timer1 compare interrupts only at the sample and writing points, with
+// flagSync() moving those deadlines (2 interrupts per bit plus edges).
+// 0: Timer1 interrupts every TQ and steps bitTimingStateMachine().
+#define EVENT_DRIVEN_BIT_TIMING 1
+
+// Free-running Timer1 clock for the event-driven engine. The longest gap
+// between two events (SYNC + PROP + PHASE_SEG1 + SJW) must stay below
+// 65536 timer ticks.
+#define TIMER1_PRESCALER 1024
+#define TIMER1_CLOCK_SELECT ((1 << CS12) | (1 << CS10))
+#define TQ_TICKS ((uint16_t)((TQ) * (F_CPU / TIMER1_PRESCALER) / 1000000.0 + 0.5))
+
+#define SAMPLE_POINT_EVENT  0
+#define WRITING_POINT_EVENT 1
+
+// Event-driven engine: how an edge gets its Timer1 timestamp.
+// 1: Timer1 input capture, latched by the hardware on the edge itself. The
+//    bus receive line must also be wired to ICP1 (pin 8 on the ATmega328P).
+// 0: TCNT1 read first thing in flagSync(), late by the interrupt latency.
+#define EDGE_INPUT_CAPTURE 0
+#define MIN_EVENT_LEAD_TICKS 2 // A deadline moved into the past is set this far ahead instead.
+
+// 1: log binary records to a RAM ring that is sent to serial only while the
+// bus is idle or in intermission (decode them with Deadline 4/SerialLog.c).
+// 0: print the messages inline with Serial, which blocks inside frames.
+#define DEFERRED_LOG  1
+#define LOG_RING_SIZE 256 // Bytes, power of two.
+#define LOG_FIELDS    1   // Deferred: record every frame field change.
+#define LOG_BITS      0   // Deferred: record every sample and writing point.
+#define LOG_PLOT      0   // Deferred: record the plotValues() values of every TQ.
+#define LOG_EDGES     0   // Deferred: record every edge timestamp (replay them with EdgeReplayHarness).
+
+// 1: listen-only bus monitor. The node never drives TX (no frames, ACK,
+// error or overload flags, and no error counting) and decodes every frame,
+// error and overload frame on the bus into a capture ring, exported in
+// bulk while the bus is idle or in intermission.
+#define LISTEN_ONLY        0
+#define CAPTURE_RING_DEPTH 16 // Power of two, at most 128.
+
+/********* Bit timing limits (CAN 2.0) *********/
+#define MIN_BIT_LEN        8
+#define MAX_BIT_LEN        25
+#define MAX_PROP_SEG_LEN   8
+#define MAX_PHASE_SEG1_LEN 8
+#define MIN_PHASE_SEG2_LEN 2 // Information processing time.
+#define MAX_PHASE_SEG2_LEN 8
+#define MAX_SJW            4
+/***********************************************/
+
 // Another way to define TQ:
 //#define BRP 50000 // Baud rate prescaler (default: 50000).
 //#define OSC_FRQ 16000000 // Oscillator frequency (default: 16 MHz).
@@ -98,7 +147,106 @@
 #define OVERLOAD_DELIMITER 29
 /***************************/
 
+/*** Fault confinement ***/
+#define PASSIVE_ERROR_FLAG 30 // Sub-field of ERROR.
+#define BUS_OFF            31
+/*************************/
+
+// Decoder states: the sub-fields, and the fields that have none.
+#define DECODER_STATE_CNT  32
+
+/******* Log records *******/
+// A record is LOG_SYNC, its type and a little-endian payload:
+//   MESSAGE: message id, two uint16 values;
+//   FIELD, SAMPLE, WRITE: bit, frame field, sub-field;
+//   PLOT: tqSegCnt, currentSegment, LOG_PLOT_* flags;
+//   FRAME: id (4), flags, dlc, crc (2), bitIndex, data bytes, frameBuf bytes;
+//   DROPPED: records lost before this one (uint16);
+//   EDGE: hard sync, edge time in Timer1 ticks (uint32);
+//   CAPTURE: CAPTURE_* type, bit time (4), id (4), then flags, dlc and data
+//            bytes for a frame, or the field and sub-field for an error or
+//            overload flag; a DROPPED record stands for entries lost in the ring.
+#define LOG_SYNC           0xA5 // Not a text character, so plain prints can be told apart.
+#define LOG_RECORD_MESSAGE 1
+#define LOG_RECORD_FIELD   2
+#define LOG_RECORD_SAMPLE  3
+#define LOG_RECORD_WRITE   4
+#define LOG_RECORD_PLOT    5
+#define LOG_RECORD_FRAME   6
+#define LOG_RECORD_DROPPED 7
+#define LOG_RECORD_EDGE    8
+#define LOG_RECORD_CAPTURE 9
+
+#define CAPTURE_FRAME    1 // Data or remote frame, up to the end of EOF.
+#define CAPTURE_ERROR    2 // Error detected: field and sub-field where it was.
+#define CAPTURE_OVERLOAD 3 // Overload flag.
+#define CAPTURE_RECORD_MAX_LEN (13 + 8)
+
+#define LOG_PLOT_WRITING_POINT 0x01
+#define LOG_PLOT_SAMPLE_POINT  0x02
+#define LOG_PLOT_HARD_SYNC     0x04
+#define LOG_PLOT_RESYNC        0x08
+
+/*** Log messages (same numbers in SerialLog.c) ***/
+#define MSG_LOST_ARBITRATION         1
+#define MSG_ACKNOWLEDGED             2
+#define MSG_BIT_ERROR                3
+#define MSG_STUFF_ERROR              4
+#define MSG_RETRANSMITTING           5
+#define MSG_TX_DROPPED               6
+#define MSG_BUS_OFF                  7
+#define MSG_ERROR_PASSIVE            8
+#define MSG_ERROR_ACTIVE             9
+#define MSG_BUS_OFF_RECOVERY         10
+#define MSG_OVERLOAD_LIMIT           11
+#define MSG_INTERMISSION_ERROR       12
+#define MSG_CRC_DELIMITER_ERROR      13
+#define MSG_ACK_ERROR                14
+#define MSG_CRC_ERROR                15
+#define MSG_ACK_DELIMITER_ERROR      16
+#define MSG_END_OF_FRAME_ERROR       17
+#define MSG_ERROR_FLAG_SHORT         18
+#define MSG_ERROR_FLAG_LONG          19
+#define MSG_ERROR_DELIMITER_ERROR    20
+#define MSG_OVERLOAD_FLAG_ERROR      21
+#define MSG_OVERLOAD_DELIMITER_ERROR 22
+#define MSG_DECODER_INVALID          23
+#define MSG_ERROR_FLAG_START         24
+#define MSG_UNKNOWN_SEGMENT          25
+#define MSG_WORST_TX_WAIT            26
+#define MSG_BACKPRESSURE             27
+/***************************/
+
+// The format stays at the call site for the inline build; "%u" takes the
+// values in order. Deferred, only the id and the values are recorded.
+#if DEFERRED_LOG
+#define LOG_MESSAGE(id, format, a, b) logMessage(id, a, b)
+#else
+#define LOG_MESSAGE(id, format, a, b) logPrint(F(format), a, b)
+#endif
+#define LOG_TEXT(id, text) LOG_MESSAGE(id, text, 0, 0)
+
+/**
+/* Fault confinement modes (CAN 2.0 part B, section 8). An error-active node
+/* signals errors with 6 dominant bits, an error-passive one with 6 recessive
+/* bits and waits 8 more bits before sending again, and a bus-off node does
+/* not drive the bus until it has seen 128 sequences of 11 recessive bits.
+/**/
+#define ERROR_ACTIVE  0
+#define ERROR_PASSIVE 1
+#define ERROR_BUS_OFF 2
+
+#define ERROR_PASSIVE_LIMIT        128 // TEC or REC from which a node is error-passive.
+#define BUS_OFF_LIMIT              256 // TEC from which a node is bus-off.
+#define REC_AFTER_PASSIVE          119 // REC after a good frame received while error-passive.
+#define SUSPEND_TRANSMISSION_BITS  8
+#define BUS_OFF_RECOVERY_BITS      11
+#define BUS_OFF_RECOVERY_SEQUENCES 128
+
 #define MAX_FRAME_SIZE 127
+#define LOG_FRAME_MAX_LEN (11 + 8 + (MAX_FRAME_SIZE + 7) / 8)
+#define LOG_DROPPED_LEN   4
+#define MAX_STUFFED_FRAME_SIZE 160 // Extended frame, 8 data bytes, worst-case stuffing, up to EOF.
 
 #define RECEIVE_PID 0x0449
 #define SEND_PID    0x0672
@@ -106,49 +254,228 @@
 #define TX 4
 #define RX 3
 
-unsigned char currentFrameField    = INTERFRAME_SPACE;
-unsigned char currentFrameSubField = INTERFRAME_SPACE_BUS_IDLE;
-unsigned char prevFrameField;
-
-unsigned char frameBuf[MAX_FRAME_SIZE];
-unsigned char sampledBit;
-unsigned char writingBit = '1';
-unsigned char previousBit;
-unsigned char bitIndex = 0;
-unsigned char bitCnt   = 0;
-unsigned char hasError = 0;
-unsigned char crcError = 0;
-unsigned char isTransmitter      = 0;
-unsigned char bitFieldIndex      = 0;
-unsigned char overloadFrameCnt   = 0;
-unsigned char samePolarityBitCnt = 1;
-
-unsigned char dlc;
-unsigned char crc[] = "000000000000000";
-const unsigned char generatorPolynomial[] = "100010110011001"; // 0x4599
-const unsigned char errorOverloadFrame[] = "00000011111111";
-
-typedef struct{
-    unsigned char idA[11];
-    unsigned char rtr;
-    unsigned char srr;
-    unsigned char ide;
-    unsigned char idB[18];
-    unsigned char r1;
-    unsigned char r0;
-    unsigned char dlc[4];
-    unsigned char data[64];
-    unsigned char crc[15];
+const unsigned char errorOverloadFrame[] = {0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1};
+
+#define CRC15_POLYNOMIAL 0x4599
+#define CRC15_MASK       0x7FFF
+
+// Nibble table for the frame-at-a-time CRC path (CRC left-aligned in 16 bits).
+const uint16_t crc15NibbleTable[16] PROGMEM = {
+    0x0000, 0x8B32, 0x9D56, 0x1664, 0xB19E, 0x3AAC, 0x2CC8, 0xA7FA,
+    0xE80E, 0x633C, 0x7558, 0xFE6A, 0x5990, 0xD2A2, 0xC4C6, 0x4FF4
+};
+
+#define FRAME_FLAG_RTR 0x01
+#define FRAME_FLAG_SRR 0x02
+#define FRAME_FLAG_IDE 0x04
+#define FRAME_FLAG_R1  0x08
+#define FRAME_FLAG_R0  0x10
+
+#define FRAME_ID_MASK  0x1FFFFFFF
+
+// Bits from SOF up to the end of the data field of the longest frame.
+#define FRAME_CRC_FIELD_MAX_BITS (1 + 32 + 6 + 64)
+
+// Bit-packed frame (16 bytes). The identifier holds the 11-bit base ID of a
+// standard frame, or base ID << 18 | extension for an extended frame.
+typedef struct {
+    uint32_t id;
+    uint8_t  flags;     // FRAME_FLAG_*.
+    uint8_t  dlc;       // Data length code as received (0..15).
+    uint8_t  data[8];
+    uint16_t crc;
 } Frame;
 
-Frame frame;
-Frame receivedframe;
+// Bit timing in use. SYNC_SEG is always 1 TQ.
+typedef struct {
+    uint32_t fosc;              // Clock the time quantum is derived from (Hz).
+    uint32_t brp;               // Baud rate prescaler: fosc cycles per TQ.
+    unsigned char propSeg;
+    unsigned char phaseSeg1;
+    unsigned char phaseSeg2;
+    unsigned char sjw;
+    uint16_t tqTicks;           // Timer1 ticks per TQ.
+    unsigned char clockSelect;  // Timer1 CS1x bits giving those ticks.
+    uint32_t bitrate;           // Resulting bit rate (bps).
+    long rateErrorPpm;          // Against the requested bit rate.
+    long tolerancePpm;          // Oscillator tolerance allowed by the segments and SJW.
+} BitTiming;
+
+/********** Acceptance filters *********/
+#define MAX_FILTERS       32 // Acceptance filters per controller.
+#define MAX_FILTER_MASKS  4  // Distinct masks (per format) in use at once.
+#define STANDARD_ID_MASK  0x7FF
+#define EXTENDED_ID_MASK  FRAME_ID_MASK
+/***************************************/
+
+// Filters sharing a mask and a format. Their ids (already masked) are kept
+// sorted, so a lookup is one binary search per group.
+typedef struct {
+    uint32_t mask;
+    uint8_t  extended;
+    uint8_t  first;     // Index of the group's first id in FilterBank.ids.
+    uint8_t  count;
+} FilterGroup;
+
+// A frame passes when (id & mask) matches any filter of its format. An empty
+// bank accepts every frame.
+typedef struct {
+    uint32_t ids[MAX_FILTERS];
+    FilterGroup groups[MAX_FILTER_MASKS];
+    uint8_t idCnt;
+    uint8_t groupCnt;
+} FilterBank;
+
+/************ Frame FIFOs *************/
+#define RX_FIFO_DEPTH   4 // Power of two, at most 128.
+#define TX_QUEUE_DEPTH  4
+#define TX_REPORT_DEPTH 4 // Power of two, at most 128.
+#define TX_MAX_ATTEMPTS 0 // Attempts per frame before it is dropped: 0 for no limit, 1 for one-shot.
+#define TX_MAILBOXES    2 // Data frames sent by the controller itself in answer to a remote frame.
+#define MAX_OVERLOAD_FRAMES 2 // Overload frames that may delay the next data or remote frame.
+/***************************************/
+
+// Bus monitor capture entry, see captureExport().
+typedef struct {
+    uint32_t bitTime;   // Bit time of the SOF, or of the bit the error or overload flag was seen at.
+    uint32_t id;
+    uint8_t  type;      // CAPTURE_*.
+    uint8_t  flags;     // FRAME_FLAG_*, or the frame field of an error.
+    uint8_t  dlc;       // Or the frame sub-field of an error.
+    uint8_t  data[8];
+} CaptureEntry;
+
+// Captured entries, from the bit engine to captureExport(), as RxFifo.
+typedef struct {
+    CaptureEntry entries[CAPTURE_RING_DEPTH];
+    uint8_t head;
+    uint8_t tail;
+    uint16_t overflowCnt;           // Entries dropped because the ring was full.
+    uint16_t reportedOverflowCnt;   // Already sent as DROPPED records.
+} CaptureRing;
+
+// Received frames, from the bit engine (producer) to the application code
+// (consumer). Both run in loop(), one after the other: the timer ISRs only
+// flag the sample and writing points, so a push never interleaves with a
+// pop and the FIFO needs no locking.
+typedef struct {
+    Frame frames[RX_FIFO_DEPTH];
+    uint8_t head;                   // Free-running write index (bit engine).
+    uint8_t tail;                   // Free-running read index (application).
+    uint16_t overflowCnt;           // Frames dropped because the FIFO was full.
+    uint8_t busy;                   // Set by the application to hold off the next frames.
+    uint16_t backpressureCnt;       // Overload frames sent because the FIFO was full or busy.
+} RxFifo;
+
+// Queued frame with its pre-stuffed bitstream, compiled once by compileFrame().
+typedef struct {
+    Frame frame;
+    uint32_t priority;              // Arbitration field as a number, see arbitrationPriority().
+    uint8_t bits[(MAX_STUFFED_FRAME_SIZE + 7) / 8];
+    unsigned char len;
+    unsigned char arbitrationEnd;   // Stream index one past the last arbitration bit.
+    unsigned char ackSlot;          // Stream index of the ACK slot.
+    unsigned char attempts;         // SOFs sent, or joined at the third intermission bit.
+    uint32_t queuedAt;              // TxQueue bitTime when pushed.
+    uint32_t waitBits;              // Bit times from the push to the SOF of the last attempt.
+} TxFrame;
+
+// What became of a queued frame, see txReportPop().
+typedef struct {
+    uint32_t id;
+    uint32_t waitBits;
+    unsigned char attempts;
+    unsigned char sent;             // 0 when dropped by the retry limit.
+} TxReport;
+
+// Frames to send, from the application (producer) to the bit engine
+// (consumer). A slot belongs to the application while its pending flag is
+// clear and to the bit engine while it is set. At bus idle the engine picks
+// the pending frame that would win arbitration, and frees it once sent.
+// A frame that loses arbitration or hits an error stays pending and
+// contends again at the next intermission, up to maxAttempts.
+//
+// The last TX_MAILBOXES slots are mailboxes: the engine itself makes one
+// pending when it receives a remote frame for its ID, see txMailboxSet().
+typedef struct {
+    TxFrame slots[TX_QUEUE_DEPTH + TX_MAILBOXES];
+    uint8_t pending[TX_QUEUE_DEPTH + TX_MAILBOXES];
+    uint8_t mailboxValid[TX_MAILBOXES]; // Set once the application has filled the mailbox.
+    uint16_t overflowCnt;           // Frames refused because every slot was pending.
+    unsigned char maxAttempts;      // See TX_MAX_ATTEMPTS.
+    uint32_t bitTime;               // Bits sampled so far, the clock of queuedAt.
+
+    // Sent and dropped frames, from the bit engine to the application, as RxFifo.
+    TxReport reports[TX_REPORT_DEPTH];
+    uint8_t reportHead;
+    uint8_t reportTail;
+    uint16_t reportOverflowCnt;
+} TxQueue;
+
+// Decoder/encoder state. Every decoder state action and the encoder work on
+// the context they are given; the bit timing ISRs stay global as they drive
+// the one bus pin pair.
+typedef struct {
+    unsigned char currentFrameField;
+    unsigned char currentFrameSubField; // Decoder state, see decoderStates[].
+    unsigned char prevFrameField;
+    unsigned char prevFrameSubField;
+
+    unsigned char frameBuf[(MAX_FRAME_SIZE + 7) / 8]; // Destuffed frame bits, packed MSB-first.
+    unsigned char sampledBit;
+    unsigned char writingBit;
+    unsigned char previousBit;
+    unsigned char bitIndex;
+    unsigned char bitCnt;
+    unsigned char hasError;
+    unsigned char crcError;
+    unsigned char isTransmitter;
+    unsigned char bitFieldIndex;
+    unsigned char overloadFrameCnt;
+    unsigned char samePolarityBitCnt;
+    unsigned char standardMatch; // Standard acceptance result, known after the 11-bit identifier.
+    unsigned char accepted;      // Store the frame and hand it to the application.
+    unsigned char listenOnly;    // Never drive the bus, see LISTEN_ONLY.
+    uint32_t frameStartBitTime;  // txQueue.bitTime of the SOF.
+
+    unsigned char dlc;
+    uint16_t crc; // CRC-15 register (right-aligned).
+
+    Frame receivedframe;
+
+    TxFrame *tx;              // Frame being sent, a pending slot of txQueue.
+    unsigned char txBitIndex; // Next bit of tx to shift out.
+
+    FilterBank filters;
+    RxFifo rxFifo;
+    TxQueue txQueue;
+#if LISTEN_ONLY
+    CaptureRing capture;
+#endif
+
+    // Fault confinement, see readErrorCounters().
+    volatile uint16_t tec;          // Transmit error counter.
+    volatile uint16_t rec;          // Receive error counter.
+    volatile unsigned char errorState;
+    unsigned char wasTransmitter;   // Sent the last frame, or the one the error frame is about.
+    unsigned char suspendCnt;       // Bus idle bits to wait before sending (error-passive).
+    unsigned char recoveryCnt;      // 11-bit recessive sequences seen while bus-off.
+} Controller;
+
+typedef void (*DecoderAction)(Controller *c);
+
+Controller controller;
+
+// Deferred log ring. Records go in whole with interrupts off, so an ISR may
+// log too; logDrain() is the only reader.
+uint8_t logRing[LOG_RING_SIZE];
+volatile uint16_t logHead    = 0; // Free-running write index.
+volatile uint16_t logTail    = 0; // Free-running read index.
+volatile uint16_t logDropCnt = 0; // Records lost since the last DROPPED record.
 
 int bitLevel;
-bool sendMessage  = false;
-bool samplePoint  = false;
-bool writingPoint = false;
-bool hasReceivedMessage     = false;
+volatile bool samplePoint  = false;
+volatile bool writingPoint = false;
 volatile bool hardSyncBool  = false;
 volatile bool resyncBool    = false;
 volatile bool advanceStateMachine = false;
@@ -158,25 +485,138 @@ volatile unsigned char phaseError     = 0;
 volatile unsigned char phaseSeg1Len   = PHASE_SEG1_LEN;
 volatile unsigned char phaseSeg2Len   = PHASE_SEG2_LEN;
 
+// Event-driven bit timing, in Timer1 ticks counted from the timer start.
+volatile uint32_t lastEventTick = 0; // Last compare event, the reference for TCNT1.
+volatile uint32_t bitStartTick  = 0; // Start of SYNC_SEG of the current bit.
+volatile uint32_t sampleTick    = 0; // Sample point (next one, or the last one while in PHASE_SEG2).
+volatile uint32_t writeTick     = 0; // Next writing point.
+volatile unsigned char nextEvent = SAMPLE_POINT_EVENT;
+
+const uint16_t timer1Prescalers[5] = {1, 8, 64, 256, 1024};
+const unsigned char timer1ClockSelects[5] = {
+    1 << CS10, 1 << CS11, (1 << CS11) | (1 << CS10), 1 << CS12, (1 << CS12) | (1 << CS10)
+};
+
+BitTiming bitTiming = {
+    F_CPU, (uint32_t)TQ_TICKS * TIMER1_PRESCALER, PROP_SEG_LEN, PHASE_SEG1_LEN, PHASE_SEG2_LEN, SJW,
+    TQ_TICKS, TIMER1_CLOCK_SELECT, BAUD_RATE, 0, 0
+};
+BitTiming pendingBitTiming;
+volatile bool bitTimingPending = false; // pendingBitTiming takes over at the next writing point.
+
 void setup() {
     Serial.begin(4800);
     pinMode(TX, OUTPUT);
     pinMode(RX, INPUT);
     
     // Configuração do TIMER1 
-    Timer1.initialize(TQ);         // initialize timer1, and set a TQ second period
+#if EVENT_DRIVEN_BIT_TIMING
+    startBitTimer();
+#else
+    Timer1.initialize(tqMicroseconds(&bitTiming)); // initialize timer1, and set a TQ second period
     Timer1.attachInterrupt(incrementTq);  // attaches incrementTq() as a timer overflow interrupt
+#endif
+#if EVENT_DRIVEN_BIT_TIMING && EDGE_INPUT_CAPTURE
+    // Capture on the rising edge of ICP1 (recessive to dominant), with the
+    // noise canceler: a fixed 4 clock delay, well within one tick.
+    TCCR1B |= (1 << ICES1) | (1 << ICNC1);
+    TIFR1 = 1 << ICF1;
+    TIMSK1 |= 1 << ICIE1;
+#else
     attachInterrupt(digitalPinToInterrupt(RX), flagSync, RISING);
+#endif
 
-    setupFrameToEncode();    // Initialize the frame to be sent by the encoder.
+    controllerInit(&controller);
+    addAcceptanceFilter(&controller.filters, RECEIVE_PID, STANDARD_ID_MASK, false);
+    setupFrameToEncode(&controller);    // Queue the frame to be sent by the encoder.
+    setupMailboxes(&controller);
+}
+
+// Reset a controller context to bus idle.
+void controllerInit(Controller *c) {
+    memset(c, 0, sizeof(*c));
+    c->currentFrameField    = INTERFRAME_SPACE;
+    c->currentFrameSubField = INTERFRAME_SPACE_BUS_IDLE;
+    c->writingBit         = 1;
+    c->samePolarityBitCnt = 1;
+    c->txQueue.maxAttempts = TX_MAX_ATTEMPTS;
+    c->listenOnly = LISTEN_ONLY;
+}
+
+// Add an ID/mask filter to the bank. Returns false when the bank is full.
+bool addAcceptanceFilter(FilterBank *bank, uint32_t id, uint32_t mask, bool extended) {
+    FilterGroup *g = NULL;
+    unsigned char i, k, pos;
+
+    mask &= extended ? EXTENDED_ID_MASK : STANDARD_ID_MASK;
+    id &= mask;
+    for (k = 0; k < bank->groupCnt && g == NULL; k++) {
+        if (bank->groups[k].mask == mask && bank->groups[k].extended == extended) g = &bank->groups[k];
+    }
+    if (bank->idCnt == MAX_FILTERS || (g == NULL && bank->groupCnt == MAX_FILTER_MASKS)) return false;
+    if (g == NULL) {
+        g = &bank->groups[bank->groupCnt++];
+        g->mask = mask;
+        g->extended = extended;
+        g->first = bank->idCnt;
+        g->count = 0;
+    }
+
+    // Insert in order, moving the ids of the groups stored after this one.
+    pos = g->first;
+    while (pos < g->first + g->count && bank->ids[pos] < id) pos++;
+    if (pos < g->first + g->count && bank->ids[pos] == id) return true;
+    for (i = bank->idCnt; i > pos; i--) bank->ids[i] = bank->ids[i - 1];
+    bank->ids[pos] = id;
+    bank->idCnt++;
+    g->count++;
+    for (k = 0; k < bank->groupCnt; k++) {
+        if (&bank->groups[k] != g && bank->groups[k].first >= pos) bank->groups[k].first++;
+    }
+    return true;
+}
+
+bool acceptanceFilterMatch(const FilterBank *bank, uint32_t id, bool extended) {
+    const FilterGroup *g;
+    uint32_t key;
+    unsigned char k, lo, hi, mid;
+
+    if (bank->idCnt == 0) return true;
+    for (k = 0; k < bank->groupCnt; k++) {
+        g = &bank->groups[k];
+        if (g->extended != extended) continue;
+        key = id & g->mask;
+        lo = g->first;
+        hi = g->first + g->count;
+        while (lo < hi) {
+            mid = (lo + hi) >> 1;
+            if (bank->ids[mid] == key) return true;
+            if (bank->ids[mid] < key) lo = mid + 1;
+            else hi = mid;
+        }
+    }
+    return false;
+}
+
+// A recessive to dominant edge hard syncs at bus idle and on a SOF, and
+// resynchronises everywhere else.
+bool hardSyncEdge(const Controller *c) {
+    if (c->currentFrameField == START_OF_FRAME) return true;
+    return c->currentFrameField == INTERFRAME_SPACE &&
+           (c->currentFrameSubField == INTERFRAME_SPACE_BUS_IDLE ||
+            (c->currentFrameSubField == INTERFRAME_SPACE_INTERMISSION && c->bitCnt == 2));
 }
 
 void flagSync() {
-    if (currentFrameField == START_OF_FRAME) { 
+#if EVENT_DRIVEN_BIT_TIMING
+    bitTimingCapture(TCNT1);
+#else
+    if (hardSyncEdge(&controller)) { 
         hardSyncBool = true;
     } else {
         resyncBool = true;
     }
+#endif
 }
 
 void incrementTq() {
@@ -186,626 +626,1100 @@ void incrementTq() {
 }
 
 void loop() {
+    Controller *c = &controller;
     if (advanceStateMachine) {
         advanceStateMachine = false;
         // If in sample point, sample bit and updade Decoder state machine.
         if (samplePoint) {
             bitLevel = digitalRead(RX);
-            sampledBit = bitLevel == HIGH ? '0' : '1';
+            c->sampledBit = bitLevel == HIGH ? 0 : 1;
+            c->txQueue.bitTime++;
             // Check if bit sampled is different from the bit written by the encoder.
-            if (isTransmitter && (sampledBit != writingBit)) {
+            bool inFrame = c->currentFrameField != ERROR && c->currentFrameField != OVERLOAD;
+            // Recessive flag and delimiter bits may be overwritten by the
+            // other nodes' flags: only a dominant one can be a bit error.
+            if (c->isTransmitter && (c->sampledBit != c->writingBit) && (inFrame || c->writingBit == 0)) {
                 // Check if it's in arbitration process or ACK. Otherwise, it is a bit error.
-                if (currentFrameField == ARBITRATION && (currentFrameSubField == ARBITRATION_IDENTIFIER_11_BIT
-                    || currentFrameSubField == ARBITRATION_IDENTIFIER_18_BIT)) {
-                    if (writingBit = '0') {
-                        Serial.print(F("Won arbitration. Continuing transmission."));
-                    } else if(writingBit = '1') {
-                        Serial.print(F("Lost arbitration. Aborting transmission."));
-                        isTransmitter = 0;
-                    }
-                } else if (currentFrameField == ACK && currentFrameSubField == ACK_SLOT) {
-                    Serial.println(F("Acknowledged!"));
+                // Only a recessive bit overwritten during arbitration loses it: a
+                // dominant bit read back recessive is a bit error there too.
+                if (inFrame && c->writingBit == 1 && c->txBitIndex > 1 && c->txBitIndex <= c->tx->arbitrationEnd) {
+                    LOG_TEXT(MSG_LOST_ARBITRATION, "Lost arbitration. ");
+                    c->isTransmitter = 0;
+                    txFinish(c, false);
+                } else if (inFrame && c->txBitIndex == c->tx->ackSlot + 1) {
+                    LOG_TEXT(MSG_ACKNOWLEDGED, "Acknowledged!\n");
                 } else {
-                    Serial.print(F("Bit error: "));
-                    Serial.println(F("Sampled bit level is different from the bit level written by the encoder."));
-                    Serial.print(F("Written bit: "));
-                    Serial.print(writingBit - '0');
-                    Serial.print(" ");
-                    Serial.print(F("Sampled bit: "));
-                    Serial.println(sampledBit - '0');
-                    hasError = 1;
+                    LOG_MESSAGE(MSG_BIT_ERROR, "Bit error: Sampled bit level is different from the bit level written by the encoder.\n"
+                                "Written bit: %u Sampled bit: %u\n", c->writingBit, c->sampledBit);
+                    c->hasError = 1;
                 }
             }
-            decoderStateMachine();
+#if DEFERRED_LOG
+            unsigned char field = c->currentFrameField, subField = c->currentFrameSubField;
+            if (LOG_BITS) logEvent(LOG_RECORD_SAMPLE, c->sampledBit, field, subField);
+            decoderStateMachine(c);
+            if (LOG_FIELDS && (c->currentFrameField != field || c->currentFrameSubField != subField)) {
+                logEvent(LOG_RECORD_FIELD, c->sampledBit, c->currentFrameField, c->currentFrameSubField);
+            }
+#else
+            decoderStateMachine(c);
+#endif
         } else if (writingPoint) {
-            // Write bit to bus if the unit is transmitting or if the frame is in ACK slot field.
-            if (isTransmitter || (currentFrameField == ACK && currentFrameSubField == ACK_SLOT)) {
-                encoderStateMachine();
-                bitLevel = writingBit == '0' ? HIGH : LOW;
+            // Write bit to bus if the unit is transmitting or if the frame is in ACK slot field,
+            // and keep the bus recessive while bus-off. A listen-only node never writes.
+            if (!c->listenOnly && (c->isTransmitter || (c->currentFrameField == ACK && c->currentFrameSubField == ACK_SLOT) ||
+                                   c->currentFrameField == BUS_OFF)) {
+                encoderStateMachine(c);
+                bitLevel = c->writingBit == 0 ? HIGH : LOW;
                 digitalWrite(TX, bitLevel);
+#if DEFERRED_LOG
+                if (LOG_BITS) logEvent(LOG_RECORD_WRITE, c->writingBit, c->currentFrameField, c->currentFrameSubField);
+#endif
+            } else if (c->writingBit == 0) {
+                // Release the bus after the ACK slot.
+                c->writingBit = 1;
+                digitalWrite(TX, LOW);
             }
         }
         plotValues();
     }
+    serviceApplication(c);
+    // Off the frames only, where a full serial buffer cannot hold up a sample point.
+    if (c->currentFrameField == INTERFRAME_SPACE || c->currentFrameField == BUS_OFF) {
+#if DEFERRED_LOG
+        logDrain();
+#endif
+#if LISTEN_ONLY
+        captureExport(c);
+#endif
+    }
 }
 
-void checkBitStuffing() {
-    sampledBit == previousBit ? samePolarityBitCnt++ : (samePolarityBitCnt = 1);
-    previousBit = sampledBit;
-    if (samePolarityBitCnt == 5) {
+void checkBitStuffing(Controller *c) {
+    c->sampledBit == c->previousBit ? c->samePolarityBitCnt++ : (c->samePolarityBitCnt = 1);
+    c->previousBit = c->sampledBit;
+    if (c->samePolarityBitCnt == 5) {
 //        Serial.print(F("Destuffing next bit at index "));
 //        Serial.println(bitIndex);
-        samePolarityBitCnt = 1;
-        prevFrameField = currentFrameField;
-        currentFrameField = BIT_STUFFING;
+        c->samePolarityBitCnt = 1;
+        c->prevFrameField = c->currentFrameField;
+        c->prevFrameSubField = c->currentFrameSubField;
+        c->currentFrameField = BIT_STUFFING;
+        c->currentFrameSubField = BIT_STUFFING;
     }
 }
 
-void bitStuffingStateMachine() {
-    if (sampledBit == previousBit) {
-        Serial.print(F("Bit stuffing error at index "));
-        Serial.println(bitIndex);
-        hasError = 1;
+void decodeStuffBit(Controller *c) {
+    if (c->sampledBit == c->previousBit) {
+        LOG_MESSAGE(MSG_STUFF_ERROR, "Bit stuffing error at index %u\n", c->bitIndex, 0);
+        c->hasError = 1;
     } else {
 //        Serial.print(F("Stuffed bit: "));
-//        Serial.println(sampledBit - '0');
-        samePolarityBitCnt = 1;
-        previousBit = sampledBit;
-        currentFrameField = prevFrameField;
+//        Serial.println(sampledBit);
+        c->samePolarityBitCnt = 1;
+        c->previousBit = c->sampledBit;
+        c->currentFrameField = c->prevFrameField;
+        c->currentFrameSubField = c->prevFrameSubField;
     }
 }
 
-void computeCrcSequence() {
-    int i, j;
-    unsigned char nxtBit, crcNxt;
-    
-    nxtBit = sampledBit;
-    crcNxt = nxtBit ^ crc[0];
+uint16_t crc15UpdateBit(uint16_t crc, unsigned char bit) {
+    unsigned char crcNxt = (bit ^ (crc >> 14)) & 1;
+    crc = (crc << 1) & CRC15_MASK;
+    return crcNxt ? (crc ^ CRC15_POLYNOMIAL) : crc;
+}
+
+// Shift nbits bits of a packed, MSB-first buffer into the CRC register,
+// four bits per table lookup. A trailing partial nibble is done bitwise.
+uint16_t crc15UpdateBits(uint16_t crc, const uint8_t *buf, unsigned int nbits) {
+    unsigned int i;
+    unsigned char nibble;
+    uint16_t reg = crc << 1;
+    for (i = 0; i + 4 <= nbits; i += 4) {
+        nibble = (i & 4) ? (buf[i >> 3] & 0x0F) : (buf[i >> 3] >> 4);
+        reg = (reg << 4) ^ pgm_read_word(&crc15NibbleTable[(reg >> 12) ^ nibble]);
+    }
+    crc = reg >> 1;
+    for (; i < nbits; i++) {
+        crc = crc15UpdateBit(crc, (buf[i >> 3] >> (7 - (i & 7))) & 1);
+    }
+    return crc;
+}
+
+void packBit(uint8_t *buf, unsigned int index, unsigned char bit) {
+    if (bit) buf[index >> 3] |= (0x80 >> (index & 7));
+    else     buf[index >> 3] &= ~(0x80 >> (index & 7));
+}
+
+// Keep the destuffed bit for printFrameInfo(), unless the acceptance filters
+// rejected the frame. The index still advances for the error messages.
+void storeFrameBit(Controller *c) {
+    if (c->accepted) packBit(c->frameBuf, c->bitIndex, c->sampledBit);
+    c->bitIndex++;
+}
+
+void computeCrcSequence(Controller *c) {
+    c->crc = crc15UpdateBit(c->crc, c->sampledBit);
+}
+
+int validateCrcSequence(Controller *c) {
+//    Serial.println(crc, BIN);
+    c->crcError = c->crc != c->receivedframe.crc;
+    return c->crcError;
+}
+
+unsigned char frameGetFlag(const Frame *f, uint8_t flag) {
+    return (f->flags & flag) != 0;
+}
+
+void frameSetFlag(Frame *f, uint8_t flag, unsigned char bit) {
+    if (bit) f->flags |= flag;
+    else     f->flags &= ~flag;
+}
+
+unsigned char frameIsExtended(const Frame *f) {
+    return frameGetFlag(f, FRAME_FLAG_IDE);
+}
+
+unsigned char frameIsRemote(const Frame *f) {
+    return frameGetFlag(f, FRAME_FLAG_RTR);
+}
+
+// Number of data bytes carried by the frame (DLC values above 8 mean 8).
+unsigned char frameDataLength(const Frame *f) {
+    return frameIsRemote(f) ? 0 : min(f->dlc, 8);
+}
+
+// Bit i (0 = first on the bus) of the 11-bit base identifier.
+unsigned char frameIdABit(const Frame *f, unsigned char i) {
+    return (f->id >> ((frameIsExtended(f) ? 28 : 10) - i)) & 1;
+}
+
+// Bit i (0 = first on the bus) of the 18-bit identifier extension.
+unsigned char frameIdBBit(const Frame *f, unsigned char i) {
+    return (f->id >> (17 - i)) & 1;
+}
+
+unsigned char frameDlcBit(const Frame *f, unsigned char i) {
+    return (f->dlc >> (3 - i)) & 1;
+}
+
+unsigned char frameDataBit(const Frame *f, unsigned char i) {
+    return (f->data[i >> 3] >> (7 - (i & 7))) & 1;
+}
+
+unsigned char frameCrcBit(const Frame *f, unsigned char i) {
+    return (f->crc >> (14 - i)) & 1;
+}
+
+// Pack the CRC-protected part of a frame (SOF up to the end of the data
+// field, unstuffed) MSB-first into bits. Returns the number of bits written.
+unsigned int framePackBits(const Frame *f, uint8_t *bits) {
+    unsigned int i, n = 0;
+    packBit(bits, n++, 0); // SOF.
+    for (i = 0; i < 11; i++) packBit(bits, n++, frameIdABit(f, i));
+    if (frameIsExtended(f)) {
+        packBit(bits, n++, frameGetFlag(f, FRAME_FLAG_SRR));
+        packBit(bits, n++, 1); // IDE.
+        for (i = 0; i < 18; i++) packBit(bits, n++, frameIdBBit(f, i));
+        packBit(bits, n++, frameGetFlag(f, FRAME_FLAG_RTR));
+        packBit(bits, n++, frameGetFlag(f, FRAME_FLAG_R1));
+    } else {
+        packBit(bits, n++, frameGetFlag(f, FRAME_FLAG_RTR));
+        packBit(bits, n++, 0); // IDE.
+    }
+    packBit(bits, n++, frameGetFlag(f, FRAME_FLAG_R0));
+    for (i = 0; i < 4; i++) packBit(bits, n++, frameDlcBit(f, i));
+    for (i = 0; i < 8u * frameDataLength(f); i++) packBit(bits, n++, frameDataBit(f, i));
+    return n;
+}
+
+// Arbitration field as a number, first bus bit most significant: of two
+// frames, the one with the lower value wins arbitration.
+uint32_t arbitrationPriority(const Frame *f) {
+    uint32_t base = frameIsExtended(f) ? f->id >> 18 : f->id & STANDARD_ID_MASK;
+    if (!frameIsExtended(f)) return base << 21 | (uint32_t)frameIsRemote(f) << 20;
+    return base << 21 | (uint32_t)frameGetFlag(f, FRAME_FLAG_SRR) << 20 | 1UL << 19
+           | (f->id & 0x3FFFF) << 1 | frameIsRemote(f);
+}
+
+// Compile a frame once when it is queued: compute its CRC, insert the stuff
+// bits and append the delimiters, ACK slot and EOF, so that the writing point
+// only has to shift out tx->bits. Also notes where arbitration ends and where
+// the ACK slot is in the stuffed stream.
+void compileFrame(TxFrame *tx) {
+    uint8_t bits[(FRAME_CRC_FIELD_MAX_BITS + 15 + 7) / 8] = {0};
+    unsigned int i, n, arbitrationBits;
+    unsigned char bit, previous = 2, run = 0;
+    Frame *f = &tx->frame;
+
+    tx->priority = arbitrationPriority(f);
+    n = framePackBits(f, bits);
+    f->crc = crc15UpdateBits(0, bits, n);
+    for (i = 0; i < 15; i++) packBit(bits, n++, (f->crc >> (14 - i)) & 1);
+    arbitrationBits = frameIsExtended(f) ? 1 + 11 + 2 + 18 + 1 : 1 + 11 + 1;
+
+    // SOF up to the CRC sequence is stuffed.
+    tx->len = 0;
+    for (i = 0; i < n; i++) {
+        bit = (bits[i >> 3] >> (7 - (i & 7))) & 1;
+        packBit(tx->bits, tx->len++, bit);
+        if (i + 1 == arbitrationBits) tx->arbitrationEnd = tx->len;
+        run = (bit == previous) ? run + 1 : 1;
+        previous = bit;
+        if (run == 5) {
+            packBit(tx->bits, tx->len++, !bit);
+            previous = !bit;
+            run = 1;
+        }
+    }
+    packBit(tx->bits, tx->len++, 1); // CRC delimiter.
+    tx->ackSlot = tx->len;
+    packBit(tx->bits, tx->len++, 1); // ACK slot (recessive, receivers drive it dominant).
+    packBit(tx->bits, tx->len++, 1); // ACK delimiter.
+    for (i = 0; i < 7; i++) packBit(tx->bits, tx->len++, 1); // End of frame.
+}
+
+/*********** RX FIFO (bit engine -> application) ***********/
+// Returns false, and counts the overflow, when the application has not
+// read the older frames yet. The newest frame is the one dropped.
+bool rxFifoPush(RxFifo *q, const Frame *f) {
+    uint8_t head = q->head;
+    if ((uint8_t)(head - q->tail) == RX_FIFO_DEPTH) {
+        q->overflowCnt++;
+        return false;
+    }
+    q->frames[head & (RX_FIFO_DEPTH - 1)] = *f;
+    q->head = head + 1;
+    return true;
+}
+
+bool rxFifoPop(RxFifo *q, Frame *f) {
+    uint8_t tail = q->tail;
+    if (tail == q->head) return false;
+    *f = q->frames[tail & (RX_FIFO_DEPTH - 1)];
+    q->tail = tail + 1;
+    return true;
+}
+
+/********** TX queue (application -> bit engine) **********/
+// Compile f into a free slot. Returns false, and counts the overflow, when
+// every slot is still waiting for the bus.
+bool txQueuePush(TxQueue *q, const Frame *f) {
+    unsigned char i;
+    for (i = 0; i < TX_QUEUE_DEPTH; i++) {
+        if (!q->pending[i]) {
+            q->slots[i].frame = *f;
+            compileFrame(&q->slots[i]);
+            q->slots[i].attempts = 0;
+            q->slots[i].queuedAt = q->bitTime;
+            q->pending[i] = 1;
+            return true;
+        }
+    }
+    q->overflowCnt++;
+    return false;
+}
+
+// Pending frame with the highest priority (lowest arbitration value), or
+// NULL when there is nothing to send.
+TxFrame *txQueueNext(TxQueue *q) {
+    TxFrame *best = NULL;
+    unsigned char i;
+    for (i = 0; i < TX_QUEUE_DEPTH + TX_MAILBOXES; i++) {
+        if (q->pending[i] && (best == NULL || q->slots[i].priority < best->priority)) best = &q->slots[i];
+    }
+    return best;
+}
+
+// Hand a sent frame's slot back to the application.
+void txQueueRelease(TxQueue *q, TxFrame *tx) {
+    q->pending[tx - q->slots] = 0;
+}
 
-    // Shift left by one position.
-    for (j = 0; j < 14; j++) {
-        crc[j] = crc[j+1];
+// Put tx on the bus, from stream bit bitIndex: 1 when another node's SOF
+// at the third intermission bit stands for this frame's own.
+void txStart(Controller *c, TxFrame *tx, unsigned char bitIndex) {
+    c->tx = tx;
+    c->isTransmitter = 1;
+    c->txBitIndex = bitIndex;
+    tx->attempts++;
+    tx->waitBits = c->txQueue.bitTime - tx->queuedAt;
+}
+
+// The attempt in flight is over. A frame that was not sent is tried again
+// at the next intermission until the retry limit; the slot of a frame that
+// is sent or dropped is freed and its report goes to the application.
+void txFinish(Controller *c, bool sent) {
+    TxQueue *q = &c->txQueue;
+    TxFrame *tx = c->tx;
+    uint8_t head = q->reportHead;
+
+    c->tx = NULL;
+    if (!sent) {
+        if (q->maxAttempts == 0 || tx->attempts < q->maxAttempts) {
+            LOG_TEXT(MSG_RETRANSMITTING, "Retransmitting at the next intermission.\n");
+            return;
+        }
+        LOG_TEXT(MSG_TX_DROPPED, "Retry limit reached. Dropping frame.\n");
+    }
+    if ((uint8_t)(head - q->reportTail) == TX_REPORT_DEPTH) {
+        q->reportOverflowCnt++;
+    } else {
+        TxReport *r = &q->reports[head & (TX_REPORT_DEPTH - 1)];
+        r->id = tx->frame.id;
+        r->waitBits = tx->waitBits;
+        r->attempts = tx->attempts;
+        r->sent = sent;
+        q->reportHead = head + 1;
     }
-    crc[14] = '0';
+    txQueueRelease(q, tx);
+}
+
+bool txReportPop(TxQueue *q, TxReport *r) {
+    uint8_t tail = q->reportTail;
+    if (tail == q->reportHead) return false;
+    *r = q->reports[tail & (TX_REPORT_DEPTH - 1)];
+    q->reportTail = tail + 1;
+    return true;
+}
 
-    if (crcNxt) {
-        for (j = 0; j < 15; j++) {
-          crc[j] = crc[j] ^ generatorPolynomial[j] ? '1' : '0';
+/*************** TX mailboxes ***************/
+// Fill mailbox i with the data frame f, pre-encoded so that it can go out
+// at the intermission right after the remote frame asking for it. Returns
+// false while the mailbox is waiting for the bus or on it: the previous
+// payload is sent as a whole, and the update can be tried again after it.
+// A remote frame received during the update is not answered.
+bool txMailboxSet(TxQueue *q, unsigned char i, const Frame *f) {
+    TxFrame *tx;
+    if (i >= TX_MAILBOXES || q->pending[TX_QUEUE_DEPTH + i]) return false;
+    tx = &q->slots[TX_QUEUE_DEPTH + i];
+    q->mailboxValid[i] = 0;
+    tx->frame = *f;
+    frameSetFlag(&tx->frame, FRAME_FLAG_RTR, 0);
+    compileFrame(tx);
+    q->mailboxValid[i] = 1;
+    return true;
+}
+
+// A remote frame f was received: queue the mailbox holding f's ID, if any.
+void txMailboxRespond(TxQueue *q, const Frame *f) {
+    unsigned char i;
+    TxFrame *tx;
+    for (i = 0; i < TX_MAILBOXES; i++) {
+        tx = &q->slots[TX_QUEUE_DEPTH + i];
+        if (!q->mailboxValid[i] || tx->frame.id != f->id || frameIsExtended(&tx->frame) != frameIsExtended(f)) continue;
+        if (!q->pending[TX_QUEUE_DEPTH + i]) {
+            tx->attempts = 0;
+            tx->queuedAt = q->bitTime;
+            q->pending[TX_QUEUE_DEPTH + i] = 1;
         }
+        return;
+    }
+}
+
+// No application frame waiting (answers in the mailboxes not counted).
+bool txQueueIsEmpty(const TxQueue *q) {
+    unsigned char i;
+    for (i = 0; i < TX_QUEUE_DEPTH; i++) {
+        if (q->pending[i]) return false;
     }
+    return true;
 }
 
-int validateCrcSequence() {
-    int j;
-//    for (j = 0; j < 15; j++) {
-//        Serial.print(crc[j] - '0');
-//    }
-//    Serial.println();
-    for (j = 0; j < 15 && !crcError; j++) {
-        crcError = crc[j] != receivedframe.crc[j];
+/********* Bus monitor capture ring *********/
+#if LISTEN_ONLY
+// Record the frame just received, or the error or overload flag just seen.
+// The newest entry is the one dropped when the ring is full.
+void capturePush(Controller *c, uint8_t type) {
+    CaptureRing *q = &c->capture;
+    uint8_t head = q->head;
+    CaptureEntry *e;
+
+    if ((uint8_t)(head - q->tail) == CAPTURE_RING_DEPTH) {
+        q->overflowCnt++;
+        return;
+    }
+    e = &q->entries[head & (CAPTURE_RING_DEPTH - 1)];
+    e->type = type;
+    e->id = c->receivedframe.id;
+    if (type == CAPTURE_FRAME) {
+        e->bitTime = c->frameStartBitTime;
+        e->flags = c->receivedframe.flags;
+        e->dlc = c->receivedframe.dlc;
+        memcpy(e->data, c->receivedframe.data, sizeof(e->data));
+    } else {
+        e->bitTime = c->txQueue.bitTime - 1;
+        e->flags = c->currentFrameField;
+        // The sub-field a stuff error interrupted.
+        e->dlc = c->currentFrameField == BIT_STUFFING ? c->prevFrameSubField : c->currentFrameSubField;
     }
+    q->head = head + 1;
 }
 
-void interframeSpaceStateMachine() {
+// Send the captured entries as CAPTURE records, as many whole records as
+// the serial TX buffer takes without blocking. Waits for the deferred log
+// to be drained, so that no record is split by another.
+void captureExport(Controller *c) {
+    CaptureRing *q = &c->capture;
+    uint8_t record[CAPTURE_RECORD_MAX_LEN];
+    uint8_t tail = q->tail, n, i;
+    uint16_t lost;
+    CaptureEntry *e;
+
+#if DEFERRED_LOG
+    if (logHead != logTail) return;
+#endif
+    lost = q->overflowCnt - q->reportedOverflowCnt;
+    if (lost > 0 && Serial.availableForWrite() >= LOG_DROPPED_LEN) {
+        uint8_t dropped[LOG_DROPPED_LEN] = {LOG_SYNC, LOG_RECORD_DROPPED, (uint8_t)lost, (uint8_t)(lost >> 8)};
+        Serial.write(dropped, LOG_DROPPED_LEN);
+        q->reportedOverflowCnt += lost;
+    }
+    while (tail != q->head) {
+        e = &q->entries[tail & (CAPTURE_RING_DEPTH - 1)];
+        n = 0;
+        record[n++] = LOG_SYNC;
+        record[n++] = LOG_RECORD_CAPTURE;
+        record[n++] = e->type;
+        for (i = 0; i < 4; i++) record[n++] = (uint8_t)(e->bitTime >> (8 * i));
+        for (i = 0; i < 4; i++) record[n++] = (uint8_t)(e->id >> (8 * i));
+        record[n++] = e->flags;
+        record[n++] = e->dlc;
+        if (e->type == CAPTURE_FRAME && !(e->flags & FRAME_FLAG_RTR)) {
+            for (i = 0; i < min(e->dlc, 8); i++) record[n++] = e->data[i];
+        }
+        if (Serial.availableForWrite() < n) break;
+        Serial.write(record, n);
+        q->tail = ++tail;
+    }
+}
+#endif
+
+/*********** Fault confinement ***********/
+void updateErrorState(Controller *c) {
+    unsigned char state;
+    if (c->errorState == ERROR_BUS_OFF) return; // Left only through the recovery sequence.
+    if (c->tec >= BUS_OFF_LIMIT) state = ERROR_BUS_OFF;
+    else if (c->tec >= ERROR_PASSIVE_LIMIT || c->rec >= ERROR_PASSIVE_LIMIT) state = ERROR_PASSIVE;
+    else state = ERROR_ACTIVE;
+    if (state == c->errorState) return;
+    c->errorState = state;
+    if (state == ERROR_BUS_OFF) LOG_MESSAGE(MSG_BUS_OFF, "Bus-off: TEC %u, REC %u\n", c->tec, c->rec);
+    else if (state == ERROR_PASSIVE) LOG_MESSAGE(MSG_ERROR_PASSIVE, "Error-passive: TEC %u, REC %u\n", c->tec, c->rec);
+    else LOG_MESSAGE(MSG_ERROR_ACTIVE, "Error-active: TEC %u, REC %u\n", c->tec, c->rec);
+    if (state == ERROR_BUS_OFF) {
+        // Off the bus, wherever in the frame the last error was counted. The
+        // frame being sent stays queued until the recovery.
+        c->isTransmitter = 0;
+        c->bitCnt = 0;
+        c->recoveryCnt = 0;
+        c->currentFrameField = BUS_OFF;
+        c->currentFrameSubField = BUS_OFF;
+    }
+}
+
+// Charge an error to the counter of the node's role in the frame. A
+// listen-only node keeps its counters, and stays error-active.
+void countError(Controller *c, unsigned char increment) {
+    if (c->listenOnly) return;
+    noInterrupts();
+    if (c->wasTransmitter) c->tec += increment;
+    else c->rec = min(c->rec + increment, 255);
+    interrupts();
+    updateErrorState(c);
+}
+
+// A frame sent or received up to the end of EOF.
+void countSuccess(Controller *c, bool transmitter) {
+    if (c->listenOnly) return;
+    noInterrupts();
+    if (transmitter) {
+        if (c->tec > 0) c->tec--;
+    } else if (c->rec >= ERROR_PASSIVE_LIMIT) {
+        c->rec = REC_AFTER_PASSIVE;
+    } else if (c->rec > 0) {
+        c->rec--;
+    }
+    interrupts();
+    updateErrorState(c);
+}
+
+// Counter increments for the error just detected:
+//   - a receiver adds 1, a transmitter 8, except for an ACK error seen by
+//     an error-passive transmitter;
+//   - an error during the node's own error or overload flag (a bit error
+//     in it, or too long a run of dominant bits after it) adds 8.
+void confineError(Controller *c) {
+    bool flagging = (c->currentFrameField == ERROR && c->currentFrameSubField == ERROR_FLAG) ||
+                    (c->currentFrameField == OVERLOAD && c->currentFrameSubField == OVERLOAD_FLAG);
+    bool ackError = c->currentFrameField == ACK && c->currentFrameSubField == ACK_SLOT;
+    if (c->currentFrameField != ERROR && c->currentFrameField != OVERLOAD && c->currentFrameField != INTERFRAME_SPACE) {
+        c->wasTransmitter = c->isTransmitter;
+    }
+    if (flagging) countError(c, 8);
+    else if (!c->wasTransmitter) countError(c, 1);
+    else if (!(c->errorState == ERROR_PASSIVE && ackError)) countError(c, 8);
+}
+
+// Counters and mode for the application: returns ERROR_ACTIVE,
+// ERROR_PASSIVE or ERROR_BUS_OFF.
+unsigned char readErrorCounters(const Controller *c, uint16_t *tec, uint16_t *rec) {
+    unsigned char state;
+    noInterrupts();
+    *tec = c->tec;
+    *rec = c->rec;
+    state = c->errorState;
+    interrupts();
+    return state;
+}
+
+/******* Interframe space and SOF *******/
+void decodeIntermission(Controller *c) {
 //    Serial.println(F("Interframe space"));
-    switch(currentFrameSubField) {
-        case INTERFRAME_SPACE_INTERMISSION:
-            if (sampledBit == '0') {
-                if (bitCnt == 2) {
-                    /***
-                    /* If a CAN node has a message waiting for transmission and it samples a
-                    /* dominant bit at the third bit of INTERMISSION, it will interpret this as
-                    /* a START OF FRAME bit, and, with the next bit, start transmitting its message
-                    /* with the first bit of its IDENTIFIER without first transmitting a START OF FRAME bit
-                    /* and without becoming receiver.
-                    /***/
-                    currentFrameField = START_OF_FRAME;
-                    decoderStateMachine();
-                } else {
-                    overloadFrameCnt++;
-                    if (overloadFrameCnt <= 2) {
-                        // Overload frame.
-                        currentFrameField = OVERLOAD;
-                        currentFrameSubField = OVERLOAD_FLAG;
-                        if (bitCnt == 0) {
-                            bitCnt = 6; // Overload flag length.
-                            decoderStateMachine();
-                        } else {
-                            bitCnt = 6; // Overload flag length.
-                        }
-                    } else {
-                        Serial.print(F("Overload error: "));
-                        Serial.println(F("Maximum of 2 Overload frames allowed to delay Data/Remote frame."));
-                        hasError = 1;
-                    }
-                }
-            } else if (sampledBit == '1') {
-                bitCnt++;
-                if (bitCnt == 3) {
-                    bitCnt = 0;
-                    currentFrameField = INTERFRAME_SPACE;
-                    currentFrameSubField = INTERFRAME_SPACE_BUS_IDLE;
-                }
-            } else {
-                Serial.print(F("Interframe space error: "));
-                Serial.println(F("Expecting 3 recessive bits during Intermission."));
-                hasError = 1;
-            }
-            break;
-        case INTERFRAME_SPACE_BUS_IDLE:
-            if (sampledBit == '0') {
-                currentFrameField = START_OF_FRAME;
-                decoderStateMachine();
+    if (c->sampledBit == 0) {
+        if (c->bitCnt == 2) {
+            /***
+            /* If a CAN node has a message waiting for transmission and it samples a
+            /* dominant bit at the third bit of INTERMISSION, it will interpret this as
+            /* a START OF FRAME bit, and, with the next bit, start transmitting its message
+            /* with the first bit of its IDENTIFIER without first transmitting a START OF FRAME bit
+            /* and without becoming receiver.
+            /***/
+            TxFrame *tx = c->listenOnly ? NULL : txQueueNext(&c->txQueue);
+            // An error-passive node that has just sent suspends its transmission.
+            if (tx != NULL && !(c->errorState == ERROR_PASSIVE && c->wasTransmitter)) txStart(c, tx, 1);
+            decodeStartOfFrame(c);
+        } else {
+            c->overloadFrameCnt++;
+            if (c->overloadFrameCnt <= MAX_OVERLOAD_FRAMES) {
+                // Overload frame: this dominant bit is the first of its flag.
+#if LISTEN_ONLY
+                capturePush(c, CAPTURE_OVERLOAD);
+#endif
+                c->currentFrameField = OVERLOAD;
+                c->currentFrameSubField = OVERLOAD_FLAG;
+                c->bitCnt = 1;
             } else {
-                isTransmitter = 1;
-                currentFrameField = START_OF_FRAME;
+                LOG_TEXT(MSG_OVERLOAD_LIMIT, "Overload error: Maximum of 2 Overload frames allowed to delay Data/Remote frame.\n");
+                c->hasError = 1;
             }
-            break;
-        default:
-            Serial.println(F("Interframe space error: invalid sub-frame field."));
-            return;
+        }
+    } else if (c->sampledBit == 1) {
+        c->bitCnt++;
+        if (c->bitCnt == 3) {
+            c->bitCnt = 0;
+            c->currentFrameField = INTERFRAME_SPACE;
+            c->currentFrameSubField = INTERFRAME_SPACE_BUS_IDLE;
+            // Suspend transmission: an error-passive node that has just
+            // sent lets the others have the bus first.
+            if (c->errorState == ERROR_PASSIVE && c->wasTransmitter) c->suspendCnt = SUSPEND_TRANSMISSION_BITS;
+            else txStartPending(c);
+        }
+    } else {
+        LOG_TEXT(MSG_INTERMISSION_ERROR, "Interframe space error: Expecting 3 recessive bits during Intermission.\n");
+        c->hasError = 1;
     }
-};
+}
+
+void decodeBusIdle(Controller *c) {
+    if (c->sampledBit == 0) {
+        c->suspendCnt = 0;
+        decodeStartOfFrame(c);
+    } else if (c->suspendCnt == 0 || --c->suspendCnt == 0) {
+        txStartPending(c);
+    }
+}
 
-void startOfFrameStateMachine() {
+// Pick the pending frame at the end of a bit, so that its SOF goes out in
+// the next one: the first bus idle bit after the intermission (or after a
+// suspended transmission), where the other nodes start theirs.
+void txStartPending(Controller *c) {
+    TxFrame *tx = c->listenOnly ? NULL : txQueueNext(&c->txQueue);
+    if (tx != NULL) {
+        txStart(c, tx, 0);
+        c->currentFrameField = START_OF_FRAME;
+        c->currentFrameSubField = START_OF_FRAME;
+    }
+}
+
+void decodeStartOfFrame(Controller *c) {
 //    Serial.println(F("Start of Frame"));
-    int j;
-    dlc      = 0;
-    bitCnt   = 0;
-    bitIndex = 0;
-    crcError = 0;
-    hasError = 0;
-    receivedframe.ide  = '0';  // Assuming Standard format when in Receiver mode.
-    bitFieldIndex      = 0;
-    overloadFrameCnt   = 0;
-    samePolarityBitCnt = 1;
-    previousBit = sampledBit;
-    frameBuf[bitIndex++] = sampledBit;
-    currentFrameField = ARBITRATION;
-    currentFrameSubField = ARBITRATION_IDENTIFIER_11_BIT;
-    // Reset CRC sequence.
-    for (j = 0; j < 15; j++) {
-        crc[j] = '0';
-    }
-    computeCrcSequence();
-};
+    c->dlc      = 0;
+    c->bitCnt   = 0;
+    c->bitIndex = 0;
+    c->crcError = 0;
+    c->hasError = 0;
+    memset(&c->receivedframe, 0, sizeof(c->receivedframe));  // Assuming Standard format when in Receiver mode.
+    c->bitFieldIndex      = 0;
+    c->overloadFrameCnt   = 0;
+    c->samePolarityBitCnt = 1;
+    c->previousBit = c->sampledBit;
+    c->accepted = 1; // Until the identifier is complete.
+    c->frameStartBitTime = c->txQueue.bitTime - 1;
+    storeFrameBit(c);
+    c->currentFrameField = ARBITRATION;
+    c->currentFrameSubField = ARBITRATION_IDENTIFIER_11_BIT;
+    c->crc = 0; // Reset CRC sequence.
+    computeCrcSequence(c);
+}
 
-void arbitrationStateMachine() {
+// CRC and bit stuffing bookkeeping of a bit from SOF up to the data field.
+void frameBitDone(Controller *c) {
+    if (!c->hasError) {
+        computeCrcSequence(c);
+        checkBitStuffing(c);
+    }
+}
+
+/************* Arbitration *************/
+void decodeIdentifier11(Controller *c) {
 //    Serial.println(F("Arbitration"));
-    int skipState = 0;
-    switch (currentFrameSubField) {
-        case ARBITRATION_IDENTIFIER_11_BIT:
-            frameBuf[bitIndex++] = sampledBit;
-            receivedframe.idA[bitFieldIndex++] = sampledBit;
-            if (bitFieldIndex == 11) {
-                bitFieldIndex = 0;
-                if (isTransmitter) {
-                    currentFrameSubField = (frame.ide == '0') ? ARBITRATION_RTR : ARBITRATION_SRR;
-                } else {
-                    currentFrameSubField = ARBITRATION_RTR; // Assuming Standard format.
-                }
-            }
-            break;
-        case ARBITRATION_RTR:
-            receivedframe.rtr = sampledBit;
-            frameBuf[bitIndex++] = sampledBit;
-            currentFrameField = CONTROL;
-            if (isTransmitter) {
-                currentFrameSubField = (frame.ide == '1') ? CONTROL_r1 : CONTROL_IDE;
-                break;
-            }
-            if (receivedframe.ide == '1') currentFrameSubField = CONTROL_r1;  // Extended format.
-            else currentFrameSubField = CONTROL_IDE;    // Standard format.
-            break;
-        case ARBITRATION_SRR: // Empty transition to IDE bit field.
-            currentFrameSubField = ARBITRATION_IDE;
-            if (isTransmitter) {
-                receivedframe.srr = sampledBit;
-            } else {
-                receivedframe.srr = receivedframe.rtr;
-                skipState = 1; // Prevent from doing further evaluation without having sampled a new bit.
-                arbitrationStateMachine();
-            }
-            break;
-        case ARBITRATION_IDE: // Empty transition to 18 bit identifier.
-            if (isTransmitter) receivedframe.ide = sampledBit;
-            bitFieldIndex = 0;
-            currentFrameSubField = ARBITRATION_IDENTIFIER_18_BIT;
-            break;
-        case ARBITRATION_IDENTIFIER_18_BIT:
-            frameBuf[bitIndex++] = sampledBit;
-            receivedframe.idB[bitFieldIndex++] = sampledBit;
-            if (bitFieldIndex == 18) currentFrameSubField = ARBITRATION_RTR; // Assuming Standard format.
-            break;
-        default:
-//            Serial.println(F("Arbitration error: invalid sub-frame field."));
-            return;
+    storeFrameBit(c);
+    frameShiftIdBit(&c->receivedframe, c->sampledBit);
+    if (++c->bitFieldIndex == 11) {
+        c->bitFieldIndex = 0;
+        // Applied at the IDE bit if the frame turns out to be standard.
+        c->standardMatch = acceptanceFilterMatch(&c->filters, c->receivedframe.id, false);
+        if (c->isTransmitter) {
+            c->currentFrameSubField = frameIsExtended(&c->tx->frame) ? ARBITRATION_SRR : ARBITRATION_RTR;
+        } else {
+            c->currentFrameSubField = ARBITRATION_RTR; // Assuming Standard format.
+        }
     }
-    // Compute CRC sequence and check bit stuffing.
-    if (!hasError && !skipState) {
-        computeCrcSequence();
-        checkBitStuffing();
+    frameBitDone(c);
+}
+
+void decodeRtr(Controller *c) {
+    frameSetFlag(&c->receivedframe, FRAME_FLAG_RTR, c->sampledBit);
+    storeFrameBit(c);
+    c->currentFrameField = CONTROL;
+    if (c->isTransmitter) {
+        c->currentFrameSubField = frameIsExtended(&c->tx->frame) ? CONTROL_r1 : CONTROL_IDE;
+    } else if (frameIsExtended(&c->receivedframe)) {
+        c->currentFrameSubField = CONTROL_r1;  // Extended format.
+    } else {
+        c->currentFrameSubField = CONTROL_IDE; // Standard format.
     }
+    frameBitDone(c);
 }
 
-void controlStateMachine() {
+// Only a transmitter of an extended frame samples the SRR and IDE bits as
+// such: a receiver reads them as RTR and CONTROL_IDE.
+void decodeSrr(Controller *c) {
+    storeFrameBit(c);
+    if (!c->isTransmitter && c->sampledBit == 0) {
+        // Lost arbitration here: the winner sent a dominant RTR, so it is
+        // a standard data frame.
+        frameSetFlag(&c->receivedframe, FRAME_FLAG_RTR, 0);
+        c->currentFrameField = CONTROL;
+        c->currentFrameSubField = CONTROL_IDE;
+    } else {
+        frameSetFlag(&c->receivedframe, FRAME_FLAG_SRR, c->sampledBit);
+        c->currentFrameSubField = ARBITRATION_IDE;
+    }
+    frameBitDone(c);
+}
+
+void decodeIde(Controller *c) {
+    frameSetFlag(&c->receivedframe, FRAME_FLAG_IDE, c->sampledBit);
+    storeFrameBit(c);
+    if (c->sampledBit == 0) {
+        // Lost arbitration here: the winner is a standard remote frame and
+        // the recessive bit read as SRR was its RTR.
+        frameSetFlag(&c->receivedframe, FRAME_FLAG_SRR, 0);
+        frameSetFlag(&c->receivedframe, FRAME_FLAG_RTR, 1);
+        c->accepted = c->standardMatch;
+        c->currentFrameField = CONTROL;
+        c->currentFrameSubField = CONTROL_r0;
+    } else {
+        c->bitFieldIndex = 0;
+        c->currentFrameSubField = ARBITRATION_IDENTIFIER_18_BIT;
+    }
+    frameBitDone(c);
+}
+
+void decodeIdentifier18(Controller *c) {
+    storeFrameBit(c);
+    frameShiftIdBit(&c->receivedframe, c->sampledBit);
+    if (++c->bitFieldIndex == 18) {
+        c->accepted = acceptanceFilterMatch(&c->filters, c->receivedframe.id, true);
+        c->currentFrameSubField = ARBITRATION_RTR; // Assuming Standard format.
+    }
+    frameBitDone(c);
+}
+
+/*************** Control ***************/
+void decodeControlIde(Controller *c) {
 //    Serial.println(F("Control"));
-    int skipState = 0;
-    switch (currentFrameSubField) {
-        case CONTROL_IDE:
-            receivedframe.ide = sampledBit;
-            frameBuf[bitIndex++] = sampledBit;
-            if (receivedframe.ide == '0') { // Standard format.
-                currentFrameSubField = CONTROL_r0;
-            } else { // Extended format.
-                currentFrameField = ARBITRATION;
-                currentFrameSubField = ARBITRATION_SRR;
-                skipState = 1; // Prevent from doing further evaluation without having sampled a new bit.
-                arbitrationStateMachine();
-            }
-            break;
-        case CONTROL_r1:
-            receivedframe.r1 = sampledBit;
-            frameBuf[bitIndex++] = sampledBit;
-            currentFrameSubField = CONTROL_r0;
-            break;
-        case CONTROL_r0:
-            receivedframe.r0 = sampledBit;
-            frameBuf[bitIndex++] = sampledBit;
-            currentFrameSubField = CONTROL_DLC;
-            bitFieldIndex = 0;
-            bitCnt = 4;
-            break;
-        case CONTROL_DLC:
-            frameBuf[bitIndex++] = sampledBit;
-            receivedframe.dlc[bitFieldIndex++] = sampledBit;
-            bitCnt--;
-            dlc += ((sampledBit - '0') << bitCnt);
-            if (bitCnt == 0) {
-                dlc = min(dlc, 8); // Maximum number of data bytes: 8.
-//                Serial.println(dlc);
-                bitFieldIndex = 0;
-                if (receivedframe.rtr == '0' && dlc != 0) currentFrameField = DATA; // Data frame.
-                else {
-                    // Remote frame. Transitioning to CRC sequence. 
-                    bitCnt = 15;
-                    currentFrameField = CRC;
-                    currentFrameSubField = CRC_SEQUENCE;
-                }
-            }
-            break;
-        default:
-            Serial.println(F("Control error: invalid sub-frame field."));
-            return;
+    frameSetFlag(&c->receivedframe, FRAME_FLAG_IDE, c->sampledBit);
+    storeFrameBit(c);
+    if (!frameIsExtended(&c->receivedframe)) { // Standard format.
+        c->accepted = c->standardMatch;
+        c->currentFrameSubField = CONTROL_r0;
+    } else {
+        // Extended format: the bit read as RTR was the SRR, and the 18-bit
+        // identifier follows.
+        frameSetFlag(&c->receivedframe, FRAME_FLAG_SRR, frameIsRemote(&c->receivedframe));
+        c->bitFieldIndex = 0;
+        c->currentFrameField = ARBITRATION;
+        c->currentFrameSubField = ARBITRATION_IDENTIFIER_18_BIT;
     }
-    // Compute CRC sequence and check bit stuffing.
-    if (!hasError && !skipState) {
-        computeCrcSequence();
-        checkBitStuffing();
+    frameBitDone(c);
+}
+
+void decodeR1(Controller *c) {
+    frameSetFlag(&c->receivedframe, FRAME_FLAG_R1, c->sampledBit);
+    storeFrameBit(c);
+    c->currentFrameSubField = CONTROL_r0;
+    frameBitDone(c);
+}
+
+void decodeR0(Controller *c) {
+    frameSetFlag(&c->receivedframe, FRAME_FLAG_R0, c->sampledBit);
+    storeFrameBit(c);
+    c->currentFrameSubField = CONTROL_DLC;
+    c->bitFieldIndex = 0;
+    c->bitCnt = 4;
+    frameBitDone(c);
+}
+
+void decodeDlc(Controller *c) {
+    storeFrameBit(c);
+    frameShiftDlcBit(&c->receivedframe, c->sampledBit);
+    c->bitCnt--;
+    c->dlc += (c->sampledBit << c->bitCnt);
+    if (c->bitCnt == 0) {
+        c->dlc = min(c->dlc, 8); // Maximum number of data bytes: 8.
+//        Serial.println(dlc);
+        c->bitFieldIndex = 0;
+        if (!frameIsRemote(&c->receivedframe) && c->dlc != 0) { // Data frame.
+            c->currentFrameField = DATA;
+            c->currentFrameSubField = DATA;
+        } else {
+            // Remote frame. Transitioning to CRC sequence.
+            c->bitCnt = 15;
+            c->currentFrameField = CRC;
+            c->currentFrameSubField = CRC_SEQUENCE;
+        }
     }
+    frameBitDone(c);
 }
 
-void dataStateMachine() {
+/***************** Data ****************/
+void decodeData(Controller *c) {
 //    Serial.println(F("Data"));
-    frameBuf[bitIndex++] = sampledBit;
-    receivedframe.data[bitFieldIndex++] = sampledBit;
-    bitCnt++;
-    if (bitCnt == 8 * dlc) {
-        bitCnt = 15;
-        bitFieldIndex = 0;
-        currentFrameField = CRC;
-        currentFrameSubField = CRC_SEQUENCE;
-    }
-    // Compute CRC sequence and check bit stuffing.
-    if (!hasError) {
-        computeCrcSequence();
-        checkBitStuffing();
+    storeFrameBit(c);
+    if (c->accepted || c->listenOnly) packBit(c->receivedframe.data, c->bitFieldIndex, c->sampledBit);
+    c->bitFieldIndex++;
+    c->bitCnt++;
+    if (c->bitCnt == 8 * c->dlc) {
+        c->bitCnt = 15;
+        c->bitFieldIndex = 0;
+        c->currentFrameField = CRC;
+        c->currentFrameSubField = CRC_SEQUENCE;
     }
+    frameBitDone(c);
 }
 
-void crcStateMachine() {
+/************* CRC and ACK *************/
+void decodeCrcSequence(Controller *c) {
 //    Serial.println(F("CRC"));
-    switch (currentFrameSubField) {
-        case CRC_SEQUENCE:
-            frameBuf[bitIndex++] = sampledBit;
-            receivedframe.crc[bitFieldIndex++] = sampledBit;
-            bitCnt--;
-            if (bitCnt == 0) {
-                validateCrcSequence();
-                currentFrameSubField = CRC_DELIMITER;
-            }
-            // Check bit stuffing.
-            if (!hasError)
-                checkBitStuffing();
-            break;
-        case CRC_DELIMITER:
-            if (sampledBit != '1') {
-                Serial.print(F("CRC delimiter error: "));
-                Serial.println(F("Must be a recessive bit."));
-                hasError = 1;
-            } else {
-                frameBuf[bitIndex++] = sampledBit;
-                currentFrameField = ACK;
-                currentFrameSubField = ACK_SLOT;
-            }
-            break;
-        default:
-            Serial.println(F("CRC error: invalid sub-frame field."));
-            return;
+    storeFrameBit(c);
+    frameShiftCrcBit(&c->receivedframe, c->sampledBit);
+    c->bitCnt--;
+    if (c->bitCnt == 0) {
+        validateCrcSequence(c);
+        c->currentFrameSubField = CRC_DELIMITER;
     }
+    // Check bit stuffing.
+    if (!c->hasError)
+        checkBitStuffing(c);
 }
 
-void ackStateMachine() {
+void decodeCrcDelimiter(Controller *c) {
+    if (c->sampledBit != 1) {
+        LOG_TEXT(MSG_CRC_DELIMITER_ERROR, "CRC delimiter error: Must be a recessive bit.\n");
+        c->hasError = 1;
+    } else {
+        storeFrameBit(c);
+        c->currentFrameField = ACK;
+        c->currentFrameSubField = ACK_SLOT;
+    }
+}
+
+void decodeAckSlot(Controller *c) {
 //    Serial.println(F("ACK"));
-    switch (currentFrameSubField) {
-        case ACK_SLOT:
-            if (sampledBit == '1') { // None of the stations has acknowledged the message.
-                Serial.print(F("Acknowledgment error: "));
-                Serial.println(F("Failed to validade the message correctly."));
-                hasError = 1;
-            } else {
-                frameBuf[bitIndex++] = sampledBit;
-                currentFrameSubField = ACK_DELIMITER;
-            }
-            break;
-        case ACK_DELIMITER:
-            if (crcError) {
-                Serial.print(F("CRC error: "));
-                Serial.println(F("The calculated result is not the same as that received in the CRC sequence."));
-                hasError = 1;
-            } else if (sampledBit != '1') {
-                Serial.print(F("Acknowledgment delimiter error: "));
-                Serial.println(F("Must be a recessive bit."));
-                hasError = 1;
-            } else {
-                bitCnt = 0;
-                frameBuf[bitIndex++] = sampledBit;
-                currentFrameField = END_OF_FRAME;
-            }
-            break;
-        default:
-            Serial.println(F("Ack error: invalid sub-frame field."));
-            return;
+    if (c->sampledBit == 1) { // None of the stations has acknowledged the message.
+        LOG_TEXT(MSG_ACK_ERROR, "Acknowledgment error: Failed to validade the message correctly.\n");
+        c->hasError = 1;
+    } else {
+        storeFrameBit(c);
+        c->currentFrameSubField = ACK_DELIMITER;
     }
 }
 
-void endOfFrameStateMachine() {
+void decodeAckDelimiter(Controller *c) {
+    if (c->crcError) {
+        LOG_TEXT(MSG_CRC_ERROR, "CRC error: The calculated result is not the same as that received in the CRC sequence.\n");
+        c->hasError = 1;
+    } else if (c->sampledBit != 1) {
+        LOG_TEXT(MSG_ACK_DELIMITER_ERROR, "Acknowledgment delimiter error: Must be a recessive bit.\n");
+        c->hasError = 1;
+    } else {
+        c->bitCnt = 0;
+        storeFrameBit(c);
+        c->currentFrameField = END_OF_FRAME;
+        c->currentFrameSubField = END_OF_FRAME;
+    }
+}
+
+void decodeEndOfFrame(Controller *c) {
 //    Serial.println(F("End of frame"));
-    if (sampledBit == '1') {
-        frameBuf[bitIndex++] = sampledBit;
-        bitCnt++;
-        if (bitCnt == 7) {
-            bitCnt = 0;
-//            printFrameInfo(receivedframe);
-            currentFrameField = INTERFRAME_SPACE;
-            currentFrameSubField = INTERFRAME_SPACE_INTERMISSION;
-            isTransmitter = 0;  // Disabling transmission.
-            hasReceivedMessage = convertArrayToNum(receivedframe.idA, 11) == RECEIVE_PID;
-//            Serial.print(F("hasReceivedMessage: "));
-//            Serial.println(hasReceivedMessage);
+    if (c->sampledBit == 1) {
+        storeFrameBit(c);
+        c->bitCnt++;
+        if (c->bitCnt == 7) {
+            c->bitCnt = 0;
+#if DEFERRED_LOG
+            printFrameInfo(c, &c->receivedframe); // Only a record to copy.
+#endif
+            c->currentFrameField = INTERFRAME_SPACE;
+            c->currentFrameSubField = INTERFRAME_SPACE_INTERMISSION;
+            if (c->isTransmitter) txFinish(c, true);
+            else if (c->accepted) rxFifoPush(&c->rxFifo, &c->receivedframe);
+            // Answer a remote frame from the mailboxes, at the next intermission.
+            if (!c->isTransmitter && !c->listenOnly && frameIsRemote(&c->receivedframe)) {
+                txMailboxRespond(&c->txQueue, &c->receivedframe);
+            }
+#if LISTEN_ONLY
+            capturePush(c, CAPTURE_FRAME);
+#endif
+            c->wasTransmitter = c->isTransmitter;
+            countSuccess(c, c->isTransmitter);
+            c->isTransmitter = 0;  // Disabling transmission.
+            applyBackpressure(c);
         }
     } else {
-        Serial.print(F("End of frame error: "));
-        Serial.println(F("Expecting a flag sequence consisting of 7 recessive bits."));
-        hasError = 1;
+        LOG_TEXT(MSG_END_OF_FRAME_ERROR, "End of frame error: Expecting a flag sequence consisting of 7 recessive bits.\n");
+        c->hasError = 1;
     }
 }
 
-void errorStateMachine() {
+/******** Error and overload frames ********/
+void decodeErrorFlag(Controller *c) {
 //    Serial.println(F("Error frame"));
-    switch(currentFrameSubField) {
-        case ERROR_FLAG:
-            if (sampledBit == '0') {
-                bitCnt++;
-            } else if (sampledBit == '1') {
-                if (bitCnt < 6) {
-                    Serial.print(F("Error flag error: "));
-                    Serial.println(F("Expecting at least 6 equal bits during error flag."));
-                    hasError = 1;
-                } else if (bitCnt >= 6 && bitCnt <= 12) {
-                    bitCnt = 7;
-                    currentFrameSubField = ERROR_DELIMITER;
-                }
-            }
-            if (bitCnt > 12) {
-                Serial.print(F("Error flag error: "));
-                Serial.println(F("Expecting maximum of 12 equal bits during error flag."));
-                hasError = 1;
-            }
-            break;
-        case ERROR_DELIMITER:
-            if (sampledBit == '1') {
-                bitCnt--;
-                if (bitCnt == 0) {
-                    currentFrameField = INTERFRAME_SPACE;
-                    currentFrameSubField = INTERFRAME_SPACE_INTERMISSION;
-                }
-            } else {
-                Serial.print(F("Error delimiter error: "));
-                Serial.println(F("Expecting 8 recessive bits during error delimiter."));
-                hasError = 1;
-            }
-            break;
-        default:
-            Serial.println(F("Error frame error: invalid sub-frame field."));
-            return;
+    if (c->sampledBit == 0) {
+        // A receiver that still sees dominant right after its own flag
+        // was the first to flag the error.
+        if (++c->bitCnt == 7 && !c->wasTransmitter) countError(c, 8);
+    } else if (c->bitCnt < 6) {
+        LOG_TEXT(MSG_ERROR_FLAG_SHORT, "Error flag error: Expecting at least 6 equal bits during error flag.\n");
+        c->hasError = 1;
+    } else if (c->bitCnt <= 12) {
+        c->bitCnt = 7;
+        c->currentFrameSubField = ERROR_DELIMITER;
+    }
+    if (c->bitCnt > 12) {
+        LOG_TEXT(MSG_ERROR_FLAG_LONG, "Error flag error: Expecting maximum of 12 equal bits during error flag.\n");
+        c->hasError = 1;
+    }
+}
+
+// Error-passive flag: the flag is over once 6 equal bits, of either level,
+// have been seen on the bus. The delimiter starts with the first recessive
+// bit after that, so with 8 bits to go when the 6 were recessive.
+void decodePassiveErrorFlag(Controller *c) {
+    if (c->bitCnt < 6) {
+        c->bitCnt = c->bitCnt > 0 && c->sampledBit == c->previousBit ? c->bitCnt + 1 : 1;
+        c->previousBit = c->sampledBit;
+        return;
+    } else if (c->sampledBit == 0) {
+        if (++c->bitCnt == 7 && !c->wasTransmitter) countError(c, 8);
+        if (c->bitCnt == 6 + 8) { // Every 8 further dominant bits.
+            countError(c, 8);
+            c->bitCnt = 6;
+        }
+        return;
     }
+    c->bitCnt = 7;
+    c->currentFrameSubField = ERROR_DELIMITER;
 }
 
-void overloadStateMachine() {
+void decodeErrorDelimiter(Controller *c) {
+    if (c->sampledBit == 1) {
+        c->bitCnt--;
+        if (c->bitCnt == 0) {
+            c->isTransmitter = 0; // Flag and delimiter are out, no frame is left to send.
+            c->currentFrameField = INTERFRAME_SPACE;
+            c->currentFrameSubField = INTERFRAME_SPACE_INTERMISSION;
+        }
+    } else {
+        LOG_TEXT(MSG_ERROR_DELIMITER_ERROR, "Error delimiter error: Expecting 8 recessive bits during error delimiter.\n");
+        c->hasError = 1;
+    }
+}
+
+void decodeOverloadFlag(Controller *c) {
 //    Serial.println(F("Overload frame"));
-    switch(currentFrameSubField) {
-        case OVERLOAD_FLAG:
-            if (sampledBit == '0') {
-                bitCnt--;
-                if (bitCnt == 0) {
-                    bitCnt = 8;
-                    currentFrameSubField = OVERLOAD_DELIMITER;
-                }
-            } else if (sampledBit == '1') {
-                Serial.print(F("Overload flag error: "));
-                Serial.println(F("Expecting 6 dominant bits during overload flag."));
-                hasError = 1;
-            }
-            break;
-        case OVERLOAD_DELIMITER:
-            if (sampledBit == '1') {
-                bitCnt--;
-                if (bitCnt == 0) {
-                    currentFrameField = INTERFRAME_SPACE;
-                    currentFrameSubField = INTERFRAME_SPACE_INTERMISSION;
-                }
-            } else {
-                Serial.print(F("Overload delimiter error: "));
-                Serial.println(F("Expecting 8 recessive bits during overload delimiter."));
-                hasError = 1;
-            }
-            break;
-        default:
-            Serial.println(F("Overload frame error: invalid sub-frame field."));
-            return;
+    // The other nodes answer a flag with their own one bit later: 6 to 12
+    // dominant bits, as for an error flag.
+    if (c->sampledBit == 0 && ++c->bitCnt <= 12) return;
+    if (c->sampledBit == 0 || c->bitCnt < 6) {
+        LOG_TEXT(MSG_OVERLOAD_FLAG_ERROR, "Overload flag error: Expecting 6 dominant bits during overload flag.\n");
+        c->hasError = 1;
+    } else {
+        c->bitCnt = 7; // First delimiter bit.
+        c->currentFrameSubField = OVERLOAD_DELIMITER;
     }
 }
 
-void decoderStateMachine() {
-    if (!hasError) { // Execute only if there is no bit error.
-        switch(currentFrameField) {
-            case INTERFRAME_SPACE:
-                interframeSpaceStateMachine();
-                break;
-            case START_OF_FRAME:
-                startOfFrameStateMachine();
-                break;
-            case ARBITRATION:
-                arbitrationStateMachine();
-                break;
-            case CONTROL:
-                controlStateMachine();
-                break;
-            case DATA:
-                dataStateMachine();
-                break;
-            case CRC:
-                crcStateMachine();
-                break;
-            case ACK:
-                ackStateMachine();
-                break;
-            case END_OF_FRAME:
-                endOfFrameStateMachine();
-                break;
-            case BIT_STUFFING:
-                bitStuffingStateMachine();
-                break;
-            case ERROR:
-                errorStateMachine();
-                break;
-            case OVERLOAD:
-                overloadStateMachine();
-                break;
-            default:
-                Serial.println(F("Decoder error: invalid frame field."));
-                break;
+void decodeOverloadDelimiter(Controller *c) {
+    if (c->sampledBit == 1) {
+        c->bitCnt--;
+        if (c->bitCnt == 0) {
+            c->isTransmitter = 0;
+            c->currentFrameField = INTERFRAME_SPACE;
+            c->currentFrameSubField = INTERFRAME_SPACE_INTERMISSION;
+            applyBackpressure(c);
         }
+    } else {
+        LOG_TEXT(MSG_OVERLOAD_DELIMITER_ERROR, "Overload delimiter error: Expecting 8 recessive bits during overload delimiter.\n");
+        c->hasError = 1;
     }
-    if (hasError) {
-//        printFrameInfo(receivedframe);
-        Serial.println(F("Start receiving error flag..."));
-        bitCnt = 0;
-        hasError = 0;
-        isTransmitter = 1;
-        bitFieldIndex = 0;
-        currentFrameField = ERROR;
-        currentFrameSubField = ERROR_FLAG;
+}
+
+// At the first bit of an intermission: when the RX FIFO is full or the
+// application is busy, delay the next frame with an overload frame of our
+// own (at most MAX_OVERLOAD_FRAMES in a row), instead of dropping it.
+void applyBackpressure(Controller *c) {
+    RxFifo *q = &c->rxFifo;
+    bool full = (uint8_t)(q->head - q->tail) == RX_FIFO_DEPTH;
+    if (c->listenOnly || c->overloadFrameCnt >= MAX_OVERLOAD_FRAMES || !(full || q->busy)) return;
+    c->overloadFrameCnt++;
+    q->backpressureCnt++;
+    LOG_MESSAGE(MSG_BACKPRESSURE, "Receive path busy: overload frame %u of %u.\n", c->overloadFrameCnt, MAX_OVERLOAD_FRAMES);
+    // The encoder sends errorOverloadFrame while isTransmitter is set.
+    c->isTransmitter = 1;
+    c->bitFieldIndex = 0;
+    c->bitCnt = 0;
+    c->currentFrameField = OVERLOAD;
+    c->currentFrameSubField = OVERLOAD_FLAG;
+}
+
+// Bus-off: stay off the bus until 128 sequences of 11 recessive bits have
+// gone by, then restart error-active with both counters cleared.
+void decodeBusOff(Controller *c) {
+    if (c->sampledBit == 0) {
+        c->bitCnt = 0;
+    } else if (++c->bitCnt == BUS_OFF_RECOVERY_BITS) {
+        c->bitCnt = 0;
+        if (++c->recoveryCnt == BUS_OFF_RECOVERY_SEQUENCES) {
+            noInterrupts();
+            c->tec = 0;
+            c->rec = 0;
+            c->errorState = ERROR_ACTIVE;
+            interrupts();
+            c->recoveryCnt = 0;
+            c->currentFrameField = INTERFRAME_SPACE;
+            c->currentFrameSubField = INTERFRAME_SPACE_BUS_IDLE;
+            LOG_TEXT(MSG_BUS_OFF_RECOVERY, "Bus-off recovery: error-active.\n");
+        }
     }
 }
 
-void encoderStateMachine() {
-    switch (currentFrameField) {
-        case START_OF_FRAME:
-//            printFrameInfo(frame);
-            writingBit = '0';
-            break;
-        case ARBITRATION:
-            switch (currentFrameSubField) {
-                case ARBITRATION_IDENTIFIER_11_BIT:
-                    writingBit = frame.idA[bitFieldIndex];
-                    break;
-                case ARBITRATION_RTR:
-                    writingBit = frame.rtr;
-                    break;
-                case ARBITRATION_SRR:
-                    writingBit = frame.srr;
-                    break;
-                case ARBITRATION_IDE:
-                    writingBit = frame.ide;
-                    break;
-                case ARBITRATION_IDENTIFIER_18_BIT:
-                    writingBit = frame.idB[bitFieldIndex];
-                    break;
-            }
-            break;
-        case CONTROL:
-            switch (currentFrameSubField) {
-                case CONTROL_IDE:
-                    writingBit = frame.ide;
-                    break;
-                case CONTROL_r1:
-                    writingBit = frame.r1;
-                    break;
-                case CONTROL_r0:
-                    writingBit = frame.r0;
-                    break;
-                case CONTROL_DLC:
-                    writingBit = frame.dlc[bitFieldIndex];
-                    break;
-            }
-            break;
-        case DATA:
-            writingBit = frame.data[bitFieldIndex];
-            break;
-        case CRC:
-            switch (currentFrameSubField) {
-                case CRC_SEQUENCE:
-                    writingBit = frame.crc[bitFieldIndex];
-                    break;
-                case CRC_DELIMITER:
-                    writingBit = '1';
-                    break;
-            }
-            break;
-        case ACK:
-            switch (currentFrameSubField) {
-                case ACK_SLOT:
-                    if (isTransmitter) {
-                        writingBit = '1';
-                    } else {
-                        writingBit = '0';
-                    }
-                    break;
-                case ACK_DELIMITER:
-                    writingBit = '1';
-                    break;
-            }
-            break;
-        case END_OF_FRAME:
-            writingBit = '1';
-            break;
-        case BIT_STUFFING:
-            writingBit = (!(previousBit - '0')) + '0'; // The opposite polarity from the previous bit.
-            break;
-        case ERROR:
-        case OVERLOAD:
-            writingBit = errorOverloadFrame[bitFieldIndex++];
-            if (bitFieldIndex == 14) {
-                bitFieldIndex = 0;
-                isTransmitter = 0;
-            }
-            break;
-        default:
-            Serial.print(F("Encoder error: invalid frame field "));
-            Serial.println(currentFrameField);
-            break;
+// Action of every decoder state, run once per sampled bit and indexed by
+// currentFrameSubField: the sub-field, or the field itself for the fields
+// that have none. Actions only set the next state; the SOF sampled from the
+// interframe space and the IDE bit of an extended frame are handled in
+// place, with no re-entry. Kept in flash, as crc15NibbleTable is.
+const DecoderAction decoderStates[DECODER_STATE_CNT] PROGMEM = {
+    NULL,                    // INTERFRAME_SPACE (field with sub-fields)
+    decodeIntermission,      // INTERFRAME_SPACE_INTERMISSION
+    decodeBusIdle,           // INTERFRAME_SPACE_BUS_IDLE
+    decodeStartOfFrame,      // START_OF_FRAME
+    NULL,                    // ARBITRATION (field with sub-fields)
+    decodeIdentifier11,      // ARBITRATION_IDENTIFIER_11_BIT
+    decodeRtr,               // ARBITRATION_RTR
+    decodeSrr,               // ARBITRATION_SRR
+    decodeIde,               // ARBITRATION_IDE
+    decodeIdentifier18,      // ARBITRATION_IDENTIFIER_18_BIT
+    NULL,                    // CONTROL (field with sub-fields)
+    decodeControlIde,        // CONTROL_IDE
+    decodeR0,                // CONTROL_r0
+    decodeDlc,               // CONTROL_DLC
+    decodeR1,                // CONTROL_r1
+    decodeData,              // DATA
+    NULL,                    // CRC (field with sub-fields)
+    decodeCrcSequence,       // CRC_SEQUENCE
+    decodeCrcDelimiter,      // CRC_DELIMITER
+    NULL,                    // ACK (field with sub-fields)
+    decodeAckSlot,           // ACK_SLOT
+    decodeAckDelimiter,      // ACK_DELIMITER
+    decodeEndOfFrame,        // END_OF_FRAME
+    decodeStuffBit,          // BIT_STUFFING
+    NULL,                    // ERROR (field with sub-fields)
+    decodeErrorFlag,         // ERROR_FLAG
+    decodeErrorDelimiter,    // ERROR_DELIMITER
+    NULL,                    // OVERLOAD (field with sub-fields)
+    decodeOverloadFlag,      // OVERLOAD_FLAG
+    decodeOverloadDelimiter, // OVERLOAD_DELIMITER
+    decodePassiveErrorFlag,  // PASSIVE_ERROR_FLAG
+    decodeBusOff,            // BUS_OFF
+};
+
+void decoderStateMachine(Controller *c) {
+    if (!c->hasError) { // Execute only if there is no bit error.
+        DecoderAction action = NULL;
+        if (c->currentFrameSubField < DECODER_STATE_CNT) {
+            action = (DecoderAction)pgm_read_ptr(&decoderStates[c->currentFrameSubField]);
+        }
+        if (action != NULL) action(c);
+        else LOG_TEXT(MSG_DECODER_INVALID, "Decoder error: invalid frame field.\n");
+    }
+    if (c->hasError) {
+//        printFrameInfo(c, &c->receivedframe);
+        LOG_TEXT(MSG_ERROR_FLAG_START, "Start receiving error flag...\n");
+#if LISTEN_ONLY
+        capturePush(c, CAPTURE_ERROR);
+#endif
+        confineError(c);
+        if (c->tx != NULL) txFinish(c, false); // The frame being sent is hit.
+        c->bitCnt = 0;
+        c->hasError = 0;
+        c->bitFieldIndex = 0;
+        c->suspendCnt = 0;
+        if (c->listenOnly) {
+            // Follow the other nodes' flags as an error-passive node would,
+            // without sending one.
+            c->currentFrameField = ERROR;
+            c->currentFrameSubField = PASSIVE_ERROR_FLAG;
+        } else if (c->errorState != ERROR_BUS_OFF) {
+            c->isTransmitter = 1;
+            c->currentFrameField = ERROR;
+            c->currentFrameSubField = c->errorState == ERROR_PASSIVE ? PASSIVE_ERROR_FLAG : ERROR_FLAG;
+        }
+    }
+}
+
+void encoderStateMachine(Controller *c) {
+    if (c->currentFrameField == ERROR || c->currentFrameField == OVERLOAD) {
+        // A passive error flag is recessive, and lasts at least 6 bits.
+        c->writingBit = c->currentFrameSubField == PASSIVE_ERROR_FLAG ? 1 : errorOverloadFrame[c->bitFieldIndex];
+        if (++c->bitFieldIndex == 14) {
+            c->bitFieldIndex = 0;
+            c->isTransmitter = 0;
+        }
+    } else if (c->currentFrameField == BUS_OFF) {
+        c->writingBit = 1;
+    } else if (!c->isTransmitter) {
+        c->writingBit = 0; // Acknowledge a frame sent by another node.
+    } else if (c->txBitIndex < c->tx->len) {
+        // Shift out the next bit of the pre-stuffed frame.
+        c->writingBit = (c->tx->bits[c->txBitIndex >> 3] >> (7 - (c->txBitIndex & 7))) & 1;
+        c->txBitIndex++;
+    } else {
+        c->writingBit = 1;
     }
 }
 
@@ -826,7 +1740,7 @@ void bitTimingStateMachine() {
             }
             break; 
         case PROP_SEG:
-            if(tqSegCnt == PROP_SEG_LEN) {
+            if(tqSegCnt == bitTiming.propSeg) {
               tqSegCnt = 0;
               currentSegment = PHASE_SEG1;
             }
@@ -845,20 +1759,261 @@ void bitTimingStateMachine() {
               writingPoint = true; // Enable writing point.
               tqSegCnt = 0;
               currentSegment = SYNC_SEG;
+              if (bitTimingPending) applyPendingBitTiming();
               restoreSegsDefaultLen(); // Restore PHASE_SEG2 default lenght.
             }
             break;
         default:
-            Serial.println(F("Unknown segment!"));
+            LOG_TEXT(MSG_UNKNOWN_SEGMENT, "Unknown segment!\n");
             break;
     }
     hardSyncBool = false;
     resyncBool = false;
 }
 
+/******** Event-driven bit timing ********/
+// Timer1's compare only fires at the sample and writing points. Edges are
+// timestamped in timer ticks, so the phase error of a resync is measured
+// to the tick instead of rounded to the next TQ, and the sample and
+// writing points move by exactly that much (max. SJW).
+void startBitTimer() {
+    noInterrupts();
+    TCCR1A = 0;                     // Normal mode, free-running.
+    TCCR1B = bitTiming.clockSelect;
+    TCNT1  = 0;
+    lastEventTick = 0;
+    bitStartTick  = 0 - (uint32_t)SYNC_SEG_LEN * bitTiming.tqTicks; // Starts in PROP_SEG.
+    sampleTick    = bitStartTick + (uint32_t)(SYNC_SEG_LEN + bitTiming.propSeg + bitTiming.phaseSeg1) * bitTiming.tqTicks;
+    currentSegment = PROP_SEG;
+    scheduleBitTimingEvent(SAMPLE_POINT_EVENT, sampleTick);
+    TIFR1  = 1 << OCF1A;
+    TIMSK1 |= 1 << OCIE1A;
+    interrupts();
+}
+
+void scheduleBitTimingEvent(unsigned char event, uint32_t tick) {
+    nextEvent = event;
+    OCR1A = (uint16_t)tick;
+}
+
+// Extend a TCNT1 value read now to the 32-bit time base: it is less than
+// 65536 ticks past the last event (see solveBitTiming()).
+uint32_t timerTick(uint16_t count) {
+    return lastEventTick + (uint16_t)(count - (uint16_t)lastEventTick);
+}
+
+// Edge with Timer1 timestamp stamp (TCNT1 in flagSync(), ICR1 with input
+// capture), handled now.
+void bitTimingCapture(uint16_t stamp) {
+    uint16_t count = TCNT1;
+    uint32_t now = timerTick(count);
+    uint32_t edge = now - (uint16_t)(count - stamp);
+    bool hard = hardSyncEdge(&controller);
+#if DEFERRED_LOG
+    if (LOG_EDGES) logEdge(hard, edge);
+#endif
+    bitTimingEdge(hard, edge, now);
+}
+
+ISR(TIMER1_COMPA_vect) {
+    bitTimingEvent();
+}
+
+#if EDGE_INPUT_CAPTURE
+ISR(TIMER1_CAPT_vect) {
+    bitTimingCapture(ICR1);
+}
+#endif
+
+void bitTimingEvent() {
+    if (nextEvent == WRITING_POINT_EVENT && bitTimingPending) applyPendingBitTiming();
+    restoreSegsDefaultLen();
+    tqSegCnt = 0;
+    if (nextEvent == SAMPLE_POINT_EVENT) {
+        lastEventTick = sampleTick;
+        samplePoint  = true;
+        writingPoint = false;
+        currentSegment = PHASE_SEG2;
+        writeTick = sampleTick + (uint32_t)bitTiming.phaseSeg2 * bitTiming.tqTicks;
+        scheduleBitTimingEvent(WRITING_POINT_EVENT, writeTick);
+    } else {
+        lastEventTick = writeTick;
+        samplePoint  = false;
+        writingPoint = true;
+        currentSegment = SYNC_SEG;
+        bitStartTick = writeTick;
+        sampleTick = bitStartTick + (uint32_t)(SYNC_SEG_LEN + bitTiming.propSeg + bitTiming.phaseSeg1) * bitTiming.tqTicks;
+        scheduleBitTimingEvent(SAMPLE_POINT_EVENT, sampleTick);
+    }
+    advanceStateMachine = true;
+}
+
+// Move the pending deadline for an edge at tick edge, handled at tick now.
+// The phase error is measured in ticks from where the edge should be, the
+// start of the bit (the end of PHASE_SEG2 once past the sample point).
+// phaseError keeps it rounded up to TQ.
+void bitTimingEdge(bool hard, uint32_t edge, uint32_t now) {
+    uint32_t tq = bitTiming.tqTicks, sjw = (uint32_t)bitTiming.sjw * tq, error, deadline;
+    unsigned char event = nextEvent;
+
+    // The pending event fell due while the edge waited for this interrupt
+    // and its compare waits behind it: run it first, on time as it was.
+    if ((int32_t)(now - (event == SAMPLE_POINT_EVENT ? sampleTick : writeTick)) >= 0) {
+        bitTimingEvent();
+        TIFR1 = 1 << OCF1A;
+        event = nextEvent;
+    }
+    if (hard) {
+        // The edge starts the bit: SYNC_SEG, then PROP_SEG.
+        writingPoint = false;
+        currentSegment = PROP_SEG;
+        bitStartTick = edge;
+        event = SAMPLE_POINT_EVENT;
+        deadline = sampleTick = edge + (uint32_t)(SYNC_SEG_LEN + bitTiming.propSeg + bitTiming.phaseSeg1) * tq;
+    } else if (event == SAMPLE_POINT_EVENT) {
+        if (edge == bitStartTick) return; // On time: no phase error.
+        if ((int32_t)(edge - bitStartTick) > 0) {
+            // Late edge: lengthen PHASE_SEG1 (max. SJW).
+            error = edge - bitStartTick;
+            deadline = bitStartTick + min(error, sjw);
+        } else {
+            // Early edge handled after the writing point: shorten the
+            // PHASE_SEG2 that has just ended (max. SJW).
+            error = bitStartTick - edge;
+            deadline = bitStartTick -= min(error, sjw);
+        }
+        phaseError = (error + tq - 1) / tq;
+        deadline = sampleTick = deadline + (uint32_t)(SYNC_SEG_LEN + bitTiming.propSeg + bitTiming.phaseSeg1) * tq;
+    } else {
+        // Early edge, in PHASE_SEG2: shorten it (max. SJW).
+        error = sampleTick + (uint32_t)bitTiming.phaseSeg2 * tq - edge;
+        phaseError = (error + tq - 1) / tq;
+        deadline = writeTick = sampleTick + (uint32_t)bitTiming.phaseSeg2 * tq - min(error, sjw);
+    }
+    // Already passed while the edge waited for its interrupt: run it next.
+    if ((int32_t)(deadline - now) < MIN_EVENT_LEAD_TICKS) {
+        deadline = now + MIN_EVENT_LEAD_TICKS;
+        if (event == SAMPLE_POINT_EVENT) sampleTick = deadline;
+        else writeTick = deadline;
+    }
+    scheduleBitTimingEvent(event, deadline);
+    // A compare that matched while the edge waited would run the new event
+    // right away: the deadline above replaces it.
+    TIFR1 = 1 << OCF1A;
+}
+/*****************************************/
+
+/******** Runtime bit timing ********/
+uint32_t tqMicroseconds(const BitTiming *bt) {
+    return (uint32_t)((float)bt->brp * 1000000.0 / bt->fosc + 0.5);
+}
+
+// Choose the prescaler and segment lengths for bitrate (bps) from fosc (Hz)
+// with the sample point closest to samplePoint (percent). Settings stay
+// within the CAN limits (8..25 TQ per bit, PROP_SEG and PHASE_SEG1 up to 8,
+// PHASE_SEG2 2..8, SJW up to 4), and the TQ must be a whole number of
+// Timer1 ticks with less than 65536 ticks between two bit timing events.
+// The smallest rate error wins, then the closest sample point, then the
+// most TQ per bit. Returns false when nothing fits.
+bool solveBitTiming(uint32_t fosc, uint32_t bitrate, float samplePoint, BitTiming *bt) {
+    BitTiming c;
+    float error, spError, bestError = 0, bestSpError = 0, df1, df2;
+    unsigned char n, k, tseg1;
+    uint32_t ticks;
+    bool found = false;
+
+    if (fosc == 0 || bitrate == 0 || samplePoint <= 0 || samplePoint >= 100) return false;
+    for (n = MAX_BIT_LEN; n >= MIN_BIT_LEN; n--) {
+        c.phaseSeg2 = n - (unsigned char)(n * samplePoint / 100.0 + 0.5);
+        c.phaseSeg2 = constrain(c.phaseSeg2, MIN_PHASE_SEG2_LEN, MAX_PHASE_SEG2_LEN);
+        tseg1 = n - SYNC_SEG_LEN - c.phaseSeg2;
+        if (tseg1 < 2 || tseg1 > MAX_PROP_SEG_LEN + MAX_PHASE_SEG1_LEN) continue;
+        c.phaseSeg1 = min(tseg1 - 1, MAX_PHASE_SEG1_LEN);
+        c.propSeg = tseg1 - c.phaseSeg1;
+        c.sjw = min(min(c.phaseSeg1, c.phaseSeg2), MAX_SJW);
+
+        for (k = 0; k < 5; k++) {
+            ticks = (uint32_t)((float)fosc / ((float)bitrate * n * timer1Prescalers[k]) + 0.5);
+            if (ticks == 0 || (uint32_t)(SYNC_SEG_LEN + c.propSeg + c.phaseSeg1 + c.sjw) * ticks > 65535) continue;
+            c.fosc = fosc;
+            c.brp = ticks * timer1Prescalers[k];
+            c.tqTicks = ticks;
+            c.clockSelect = timer1ClockSelects[k];
+            c.bitrate = (uint32_t)((float)fosc / ((float)c.brp * n) + 0.5);
+            error = ((float)fosc / ((float)c.brp * n) - bitrate) / bitrate;
+            spError = fabs(100.0 * (n - c.phaseSeg2) / n - samplePoint);
+            if (found && (fabs(error) > fabs(bestError) || (fabs(error) == fabs(bestError) && spError >= bestSpError))) continue;
+            // Oscillator tolerance: resynchronisation over 13 bits (stuffing
+            // and error flags) and the SJW over 10 bits.
+            df1 = (float)min(c.phaseSeg1, c.phaseSeg2) / (2.0 * (13.0 * n - c.phaseSeg2));
+            df2 = (float)c.sjw / (20.0 * n);
+            c.rateErrorPpm = (long)(error * 1e6);
+            c.tolerancePpm = (long)(min(df1, df2) * 1e6);
+            *bt = c;
+            bestError = error;
+            bestSpError = spError;
+            found = true;
+        }
+    }
+    return found;
+}
+
+// Switch to bt at the next writing point, without restarting the
+// controller. bt comes from solveBitTiming() and its clock must be the
+// one Timer1 runs on.
+bool setBitTiming(const BitTiming *bt) {
+    if (bt->fosc != F_CPU) return false;
+    noInterrupts();
+    pendingBitTiming = *bt;
+    bitTimingPending = true;
+    interrupts();
+    return true;
+}
+
+// Called at a writing point, where the new bit starts.
+void applyPendingBitTiming() {
+    bitTiming = pendingBitTiming;
+    bitTimingPending = false;
+#if EVENT_DRIVEN_BIT_TIMING
+    // Restart the time base on this writing point with the new timer clock.
+    TCCR1B = bitTiming.clockSelect;
+    TCNT1 = 0;
+    writeTick = 0;
+    lastEventTick = 0;
+#else
+    Timer1.setPeriod(tqMicroseconds(&bitTiming));
+#endif
+}
+
+void printBitTiming(const BitTiming *bt) {
+    unsigned char n = SYNC_SEG_LEN + bt->propSeg + bt->phaseSeg1 + bt->phaseSeg2;
+    Serial.print(F("Bit timing: "));
+    Serial.print(bt->bitrate);
+    Serial.print(F(" bps, BRP "));
+    Serial.print(bt->brp);
+    Serial.print(F(", "));
+    Serial.print(n);
+    Serial.print(F(" TQ (1/"));
+    Serial.print(bt->propSeg);
+    Serial.print('/');
+    Serial.print(bt->phaseSeg1);
+    Serial.print('/');
+    Serial.print(bt->phaseSeg2);
+    Serial.print(F("), SJW "));
+    Serial.print(bt->sjw);
+    Serial.print(F(", sample point "));
+    Serial.print(100.0 * (n - bt->phaseSeg2) / n);
+    Serial.print(F("%, rate error "));
+    Serial.print(bt->rateErrorPpm);
+    Serial.print(F(" ppm, oscillator tolerance "));
+    Serial.print(bt->tolerancePpm);
+    Serial.println(F(" ppm"));
+}
+/************************************/
+
 void restoreSegsDefaultLen() {
-    phaseSeg1Len = PHASE_SEG1_LEN;
-    phaseSeg2Len = PHASE_SEG2_LEN;
+    phaseSeg1Len = bitTiming.phaseSeg1;
+    phaseSeg2Len = bitTiming.phaseSeg2;
 }
 
 void hardSync() {
@@ -875,131 +2030,151 @@ void resync() {
         case PROP_SEG:
             resyncBool = true;
             // Lengthen PHASE_SEG1 to compensate phase error (max. SJW).
-            phaseError = min(tqSegCnt + SYNC_SEG_LEN, PROP_SEG_LEN);
-            phaseSeg1Len = PHASE_SEG1_LEN + ((phaseError <= SJW) ? phaseError : SJW);
+            phaseError = min(tqSegCnt + SYNC_SEG_LEN, bitTiming.propSeg);
+            phaseSeg1Len = bitTiming.phaseSeg1 + ((phaseError <= bitTiming.sjw) ? phaseError : bitTiming.sjw);
+            break;
         case PHASE_SEG1:
             resyncBool = true;
             // Lengthen segment to compensate phase error (max. SJW).
-            phaseError = tqSegCnt + PROP_SEG_LEN + SYNC_SEG_LEN;
-            phaseSeg1Len = PHASE_SEG1_LEN + ((phaseError <= SJW) ? phaseError : SJW);
+            phaseError = tqSegCnt + bitTiming.propSeg + SYNC_SEG_LEN;
+            phaseSeg1Len = bitTiming.phaseSeg1 + ((phaseError <= bitTiming.sjw) ? phaseError : bitTiming.sjw);
             break;
         case PHASE_SEG2:
             resyncBool = true;
             // Shorten segment to compensate phase error (max. SJW).
-            phaseError = min((PHASE_SEG2_LEN - tqSegCnt), PHASE_SEG2_LEN);
-            phaseSeg2Len = PHASE_SEG2_LEN - ((phaseError <= SJW) ? phaseError : SJW);
+            phaseError = min((bitTiming.phaseSeg2 - tqSegCnt), bitTiming.phaseSeg2);
+            phaseSeg2Len = bitTiming.phaseSeg2 - ((phaseError <= bitTiming.sjw) ? phaseError : bitTiming.sjw);
             break;
         default:
-            Serial.println(F("Unknown segment!"));
+            LOG_TEXT(MSG_UNKNOWN_SEGMENT, "Unknown segment!\n");
             break;
     }
 }
 
 
-void setupFrameToEncode() {
-    int i;
-    unsigned char idA[] = "11001110010";
-    unsigned char rtr = '0';
-    unsigned char srr = '1';
-    unsigned char ide = '0';
-    unsigned char idB[] = "110000000001111010";
-    unsigned char r1 = '0';
-    unsigned char r0 = '0';
-    unsigned char dlc2[] = "1000";
-    unsigned char data[] = "1010101010101010101010101010101010101010101010101010101010101010";
-    unsigned char crc2[] = "000000001010001";
-    
-    for(i = 0; i < 11; i++) {
-        frame.idA[i] = idA[i];
-    }
-    frame.rtr = rtr;
-    frame.srr = srr;
-    frame.ide = ide;
-    for(i = 0; i < 18; i++) {
-        frame.idB[i] = idB[i];
-    }
-    frame.r1 = r1;
-    frame.r0 = r0;
-    for(i = 0; i < 4; i++) {
-        frame.dlc[i] = dlc2[i];
-    }
-    for(i = 0; i < 64; i++) {
-        frame.data[i] = data[i];
+// Queue the test frame sent by this node.
+void setupFrameToEncode(Controller *c) {
+    Frame f;
+    memset(&f, 0, sizeof(f));
+    f.id = SEND_PID;
+    f.flags = FRAME_FLAG_SRR;
+    f.dlc = 8;
+    memset(f.data, 0xAA, sizeof(f.data));
+    txQueuePush(&c->txQueue, &f);
+}
+
+// Answer remote frames for SEND_PID with the test payload.
+void setupMailboxes(Controller *c) {
+    Frame f;
+    memset(&f, 0, sizeof(f));
+    f.id = SEND_PID;
+    f.dlc = 8;
+    memset(f.data, 0xAA, sizeof(f.data));
+    txMailboxSet(&c->txQueue, 0, &f);
+}
+
+// Application side of the FIFOs: consume the frames that passed the
+// acceptance filters and keep the test frame queued.
+void serviceApplication(Controller *c) {
+    static uint32_t worstWaitBits = 0;
+    Frame f;
+    TxReport r;
+    while (rxFifoPop(&c->rxFifo, &f)) {
+        // Frames addressed to this node (RECEIVE_PID) are handled here.
     }
-    for(i = 0; i < 15; i++) {
-        frame.crc[i] = crc2[i];
+    while (txReportPop(&c->txQueue, &r)) {
+        // Worst-case queueing delay of the frames sent so far.
+        if (r.sent && r.waitBits > worstWaitBits) {
+            worstWaitBits = r.waitBits;
+            LOG_MESSAGE(MSG_WORST_TX_WAIT, "Worst TX wait: %u bit times, %u attempt(s).\n",
+                        worstWaitBits < 0xFFFF ? worstWaitBits : 0xFFFF, r.attempts);
+        }
     }
+    if (txQueueIsEmpty(&c->txQueue)) setupFrameToEncode(c);
 }
 
-int convertArrayToNum(unsigned char arr[], int len) {
-    int num = 0;
-    for (int i = 0; i < len; i++) {
-        num += (arr[i] - '0') << (len - (i + 1));
+void frameShiftIdBit(Frame *f, unsigned char bit) {
+    f->id = ((f->id << 1) | bit) & FRAME_ID_MASK;
+}
+
+void frameShiftDlcBit(Frame *f, unsigned char bit) {
+    f->dlc = ((f->dlc << 1) | bit) & 0x0F;
+}
+
+void frameShiftCrcBit(Frame *f, unsigned char bit) {
+    f->crc = ((f->crc << 1) | bit) & CRC15_MASK;
+}
+
+void printBits(uint32_t value, int len) {
+    for (int i = len - 1; i >= 0; i--) {
+        Serial.print((value >> i) & 1);
     }
-    return num;
 }
 
-void printFrameInfo(Frame frame) {
+void printFrameInfo(const Controller *c, const Frame *f) {
+#if DEFERRED_LOG
+    logFrame(c, f);
+#else
     int i;
     Serial.println();
     Serial.println(F("------- FRAME INFO -------"));
     Serial.print(F("ID (11-bit): "));
-    for (i = 0; i < 11; i++) {
-        Serial.print(frame.idA[i] - '0');
-    }
+    printBits(frameIsExtended(f) ? f->id >> 18 : f->id, 11);
     Serial.println();
 
     Serial.print(F("RTR: "));
-    Serial.println(frame.rtr - '0');
+    Serial.println(frameGetFlag(f, FRAME_FLAG_RTR));
 
     Serial.print(F("IDE: "));
-    Serial.println(frame.ide - '0');
+    Serial.println(frameGetFlag(f, FRAME_FLAG_IDE));
 
-    if (frame.ide == '1') {
+    if (frameIsExtended(f)) {
         Serial.print(F("SRR: "));
-        Serial.println(frame.srr - '0');
+        Serial.println(frameGetFlag(f, FRAME_FLAG_SRR));
         Serial.print(F("ID (18-bit): "));
-        for (i = 0; i < 18; i++) {
-            Serial.print(frame.idB[i] - '0');
-        }
+        printBits(f->id, 18);
         Serial.println();
         Serial.print(F("r1: "));
-        Serial.println(frame.r1 - '0');
+        Serial.println(frameGetFlag(f, FRAME_FLAG_R1));
     }
 
     Serial.print(F("r0: "));
-    Serial.println(frame.r0 - '0');
+    Serial.println(frameGetFlag(f, FRAME_FLAG_R0));
 
     Serial.print(F("DLC: "));
-    for (i = 0; i < 4; i++) {
-        Serial.print(frame.dlc[i] - '0');
-    }
+    printBits(f->dlc, 4);
     Serial.println();
 
-    if (frame.rtr == '0') {
+    if (!frameIsRemote(f)) {
         Serial.print(F("Data: "));
-        for (i = 0; i < 8 * dlc; i++) {
-            Serial.print(frame.data[i] - '0');
+        for (i = 0; i < frameDataLength(f); i++) {
+            printBits(f->data[i], 8);
         }
         Serial.println();
     }
 
     Serial.print(F("CRC: "));
-    for (i = 0; i < 15; i++) {
-        Serial.print(frame.crc[i] - '0');
-    }
+    printBits(f->crc, 15);
     Serial.println();
 
     Serial.print(F("Frame (destuffed): "));
-    for (i = 0; i < bitIndex; i++) {
-        Serial.print(frameBuf[i] - '0');
+    for (i = 0; i < c->bitIndex; i++) {
+        Serial.print((c->frameBuf[i >> 3] >> (7 - (i & 7))) & 1);
     }
 
     Serial.println();
     Serial.println();
+#endif
 }
 
 void plotValues() {
+#if DEFERRED_LOG
+    if (LOG_PLOT) {
+        logEvent(LOG_RECORD_PLOT, tqSegCnt, currentSegment,
+                 (writingPoint ? LOG_PLOT_WRITING_POINT : 0) | (samplePoint ? LOG_PLOT_SAMPLE_POINT : 0) |
+                 (hardSyncBool ? LOG_PLOT_HARD_SYNC : 0) | (resyncBool ? LOG_PLOT_RESYNC : 0));
+    }
+#else
     for (int i = 0; i < 5; i++) {
         Serial.print(tqSegCnt + 6);
         Serial.print(' ');
@@ -1015,4 +2190,96 @@ void plotValues() {
         Serial.print(' ');
         Serial.print('\n');
     }
+#endif
+}
+
+/********** Deferred logging **********/
+// Append a record, or count it as dropped when the ring is full. A DROPPED
+// record goes in first once there is room for it again.
+void logPut(const uint8_t *record, uint8_t len) {
+    uint8_t sreg = SREG;
+    uint16_t head;
+    uint8_t i;
+
+    noInterrupts();
+    head = logHead;
+    if (logDropCnt > 0 && LOG_RING_SIZE - (uint16_t)(head - logTail) >= LOG_DROPPED_LEN + len) {
+        uint8_t dropped[LOG_DROPPED_LEN] = {LOG_SYNC, LOG_RECORD_DROPPED, (uint8_t)logDropCnt, (uint8_t)(logDropCnt >> 8)};
+        for (i = 0; i < LOG_DROPPED_LEN; i++) logRing[head++ & (LOG_RING_SIZE - 1)] = dropped[i];
+        logDropCnt = 0;
+    }
+    if (logDropCnt > 0 || LOG_RING_SIZE - (uint16_t)(head - logTail) < len) {
+        if (logDropCnt < 0xFFFF) logDropCnt++;
+    } else {
+        for (i = 0; i < len; i++) logRing[head++ & (LOG_RING_SIZE - 1)] = record[i];
+        logHead = head;
+    }
+    SREG = sreg;
+}
+
+void logMessage(uint8_t id, uint16_t a, uint16_t b) {
+    uint8_t record[7] = {LOG_SYNC, LOG_RECORD_MESSAGE, id, (uint8_t)a, (uint8_t)(a >> 8), (uint8_t)b, (uint8_t)(b >> 8)};
+    logPut(record, sizeof(record));
+}
+
+void logEdge(bool hard, uint32_t tick) {
+    uint8_t record[7] = {LOG_SYNC, LOG_RECORD_EDGE, hard, (uint8_t)tick, (uint8_t)(tick >> 8), (uint8_t)(tick >> 16),
+                         (uint8_t)(tick >> 24)};
+    logPut(record, sizeof(record));
+}
+
+// FIELD, SAMPLE, WRITE and PLOT records.
+void logEvent(uint8_t type, uint8_t x, uint8_t y, uint8_t z) {
+    uint8_t record[5] = {LOG_SYNC, type, x, y, z};
+    logPut(record, sizeof(record));
+}
+
+void logFrame(const Controller *c, const Frame *f) {
+    uint8_t record[LOG_FRAME_MAX_LEN];
+    uint8_t n = 0, i;
+
+    record[n++] = LOG_SYNC;
+    record[n++] = LOG_RECORD_FRAME;
+    for (i = 0; i < 4; i++) record[n++] = (uint8_t)(f->id >> (8 * i));
+    record[n++] = f->flags;
+    record[n++] = f->dlc;
+    record[n++] = (uint8_t)f->crc;
+    record[n++] = (uint8_t)(f->crc >> 8);
+    record[n++] = c->bitIndex;
+    if (!frameIsRemote(f)) {
+        for (i = 0; i < frameDataLength(f); i++) record[n++] = f->data[i];
+    }
+    for (i = 0; i < (c->bitIndex + 7) / 8; i++) record[n++] = c->frameBuf[i];
+    logPut(record, n);
+}
+
+// Send what the serial TX buffer takes without blocking.
+void logDrain() {
+    uint16_t head, tail = logTail;
+    int room = Serial.availableForWrite();
+
+    noInterrupts();
+    head = logHead;
+    interrupts();
+    while (tail != head && room-- > 0) Serial.write(logRing[tail++ & (LOG_RING_SIZE - 1)]);
+    noInterrupts();
+    logTail = tail;
+    interrupts();
+}
+
+// Inline build: print format with each "%u" replaced by a, then b.
+void logPrint(const __FlashStringHelper *format, uint16_t a, uint16_t b) {
+    const char *p = (const char *)format;
+    bool first = true;
+    char ch;
+
+    while ((ch = pgm_read_byte(p++)) != 0) {
+        if (ch == '%' && pgm_read_byte(p) == 'u') {
+            Serial.print(first ? a : b);
+            first = false;
+            p++;
+        } else {
+            Serial.print(ch);
+        }
+    }
 }